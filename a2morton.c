@@ -0,0 +1,186 @@
+/*
+ *      a2morton.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Implements the method suite for Morton-ordered 2D arrays
+ */
+
+#include <stdlib.h>
+
+#include "a2morton.h"
+#include "uarray2m.h"
+
+typedef A2Methods_UArray2 A2;
+
+/*---------------------------------------------------------------
+ |             Constructors / Destructors                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       new
+ * [Purpose]:    Allocates memory for a Morton-ordered 2D array with
+ *               user-specified dimensions
+ * [Parameters]: 3 ints (width, height, size of each data elem in bytes)
+ * [Return]:     Opaque representation of a 2D array
+ */
+static A2 new(int width, int height, int size)
+{
+        return UArray2m_new(width, height, size);
+}
+
+/* [Name]:       new_with_blocksize
+ * [Purpose]:    Allocates memory for a Morton-ordered 2D array with
+ *               user-specified dimensions, ignoring the blocksize (the
+ *               Z order is blocked at every power of two)
+ * [Parameters]: 4 ints (width, height, size of each data elem in bytes,
+ *               blocksize)
+ * [Return]:     Opaque representation of a 2D array
+ */
+static A2 new_with_blocksize(int width, int height, int size, int blocksize)
+{
+        (void)blocksize;
+        return UArray2m_new(width, height, size);
+}
+
+/* [Name]:       a2free
+ * [Purpose]:    Frees the heap allocated memory of 2D array
+ * [Parameters]: 1 A2* (array2p)
+ * [Return]:     void
+ */
+static void a2free(A2 *array2p)
+{
+        UArray2m_free((UArray2m_T *) array2p);
+}
+
+/*---------------------------------------------------------------
+ |                       Metadata Functions                     |
+ *--------------------------------------------------------------*/
+/* [Name]:       width
+ * [Purpose]:    Returns width of 2D array
+ * [Parameters]: 1 A2 (array2)
+ * [Return]:     Width of array2
+ */
+static int width(A2 array2)
+{
+        return UArray2m_width(array2);
+}
+
+/* [Name]:       height
+ * [Purpose]:    Returns height of 2D array
+ * [Parameters]: 1 A2 (array2)
+ * [Return]:     Height of array2
+ */
+static int height(A2 array2)
+{
+        return UArray2m_height(array2);
+}
+
+/* [Name]:       size
+ * [Purpose]:    Returns size of each data element within the 2D array
+ * [Parameters]: 1 A2 (array2)
+ * [Return]:     Size of array2
+ */
+static int size(A2 array2)
+{
+        return UArray2m_size(array2);
+}
+
+/* [Name]:       blocksize
+ * [Purpose]:    Returns default value, because there is no one blocksize
+ * [Parameters]: 1 A2 (array2)
+ * [Return]:     1
+ */
+static int blocksize(A2 array2)
+{
+        (void) array2;
+        return 1;
+}
+
+/*---------------------------------------------------------------
+ |                      Access Functions                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       at
+ * [Purpose]:    Returns the element at the given (i, j)
+ * [Parameters]: 1 A2 (array2), 2 ints (i and j)
+ * [Return]:     A2Methods_Object* pointing to element at given index
+ */
+static A2Methods_Object *at(A2 array2, int i, int j)
+{
+        return UArray2m_at(array2, i, j);
+}
+
+/* Private definition for apply function */
+typedef void applyfun(int i, int j, UArray2m_T array2, void *elem, void *cl);
+
+/* [Name]:       map_morton
+ * [Purpose]:    Map function for A2 that does Morton-order mapping
+ * [Parameters]: 1 A2 (array2), 1 apply function, 1 void* (closure)
+ * [Return]:     void
+ */
+static void map_morton(A2 array2, A2Methods_applyfun apply, void *cl)
+{
+        UArray2m_map_morton(array2, (applyfun *) apply, cl);
+}
+
+/* [Name]:       uarray2_map_hilbert
+ * [Purpose]:    Map function for A2 that does Hilbert-order mapping
+ * [Parameters]: 1 A2 (array2), 1 apply function, 1 void* (closure)
+ * [Return]:     void
+ */
+void uarray2_map_hilbert(A2 array2, A2Methods_applyfun apply, void *cl)
+{
+        UArray2m_map_hilbert(array2, (applyfun *) apply, cl);
+}
+
+/* Private struct definition for small map closure */
+struct small_closure {
+        A2Methods_smallapplyfun *apply;
+        void *cl;
+};
+
+/* [Name]:       apply_small
+ * [Purpose]:    Wrapper function for small map functions
+ * [Parameters]: 2 ints (i, j), 1 UArray2m_T (array2), 2 void* (elem & closure)
+ * [Return]:     void
+ */
+static void apply_small(int i, int j, UArray2m_T array2, void *elem,
+                        void *vcl)
+{
+        struct small_closure *cl = vcl;
+        (void)i;
+        (void)j;
+        (void)array2;
+        cl->apply(elem, cl->cl);
+}
+
+/* [Name]:       small_map_morton
+ * [Purpose]:    Small map function for A2 that does Morton-order mapping
+ * [Parameters]: 1 A2 (array2), 1 small apply function, 1 void* (closure)
+ * [Return]:     void
+ */
+static void small_map_morton(A2 a2, A2Methods_smallapplyfun apply, void *cl)
+{
+        struct small_closure mycl = { apply, cl };
+        UArray2m_map_morton(a2, apply_small, &mycl);
+}
+
+/* Private struct containing pointers to the functions */
+static struct A2Methods_T uarray2_methods_morton_struct = {
+        new,
+        new_with_blocksize,
+        a2free,
+        width,
+        height,
+        size,
+        blocksize,
+        at,
+        NULL,                   // map_row_major
+        NULL,                   // map_col_major
+        map_morton,             // map_block_major
+        map_morton,             // map_default
+        NULL,                   // small_map_row_major
+        NULL,                   // small_map_col_major
+        small_map_morton,       // small_map_block_major
+        small_map_morton,       // small_map_default
+};
+
+/* Payoff: exported pointer to the struct */
+A2Methods_T uarray2_methods_morton = &uarray2_methods_morton_struct;
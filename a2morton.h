@@ -0,0 +1,20 @@
+/*
+ *      a2morton.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - A2Methods for Morton-ordered arrays (-morton-major, -hilbert-major;
+ *        see UArray2m_new)
+ *      - The default map follows the storage (Z) order; uarray2_map_hilbert
+ *        is the Hilbert-order alternative. Neither row- nor column-major
+ *        mapping is supported, as with blocked arrays
+ */
+
+#ifndef A2MORTON_INCLUDED
+#define A2MORTON_INCLUDED
+
+#include "a2methods.h"
+
+extern A2Methods_T      uarray2_methods_morton;
+extern A2Methods_mapfun uarray2_map_hilbert;
+
+#endif
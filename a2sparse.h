@@ -0,0 +1,18 @@
+/*
+ *      a2sparse.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - A2Methods for sparse blocked arrays (-sparse): UArray2b tiles
+ *        that are allocated only when written, so flat regions of an image
+ *        cost one value per tile (see UArray2b_new_sparse)
+ *      - Only block-major mapping is supported, as with blocked arrays
+ */
+
+#ifndef A2SPARSE_INCLUDED
+#define A2SPARSE_INCLUDED
+
+#include "a2methods.h"
+
+extern A2Methods_T uarray2_methods_sparse;
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ *      bands.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Band 0 runs on the calling thread and the rest on threads of
+ *        their own; a band whose thread cannot be created runs inline, so
+ *        a band runner never fails
+ *      - Band edges can be kept on multiples of an alignment (a tile
+ *        height) so that no two bands share a tile
+ */
+
+#include <pthread.h>
+
+#include "bands.h"
+
+/* [Name]:       Bands_count
+ * [Purpose]:    Picks how many bands to split rows into: no more than
+ *               threads, no band under BANDS_MIN_ROWS rows, and no more
+ *               than there are align-row units
+ * [Parameters]: 3 ints (threads requested, rows, align)
+ * [Return]:     Number of bands, at least 1
+ */
+int Bands_count(int threads, int rows, int align)
+{
+        int units = align > 1 ? (rows + align - 1) / align : rows;
+        int count = rows / BANDS_MIN_ROWS;
+
+        count = threads < count ? threads : count;
+        count = count > units ? units : count;
+        return count < 1 ? 1 : count;
+}
+
+/* [Name]:       Bands_split
+ * [Purpose]:    Gives the rows of one band when rows are split into count
+ *               bands of near-equal size, edges on multiples of align
+ * [Parameters]: 4 ints (rows, align, count, index of the band), 2 int*
+ *               (first, end; the band is rows first..end-1)
+ * [Return]:     void
+ */
+void Bands_split(int rows, int align, int count, int index, int *first,
+                 int *end)
+{
+        long units = align > 1 ? (rows + align - 1) / align : rows;
+
+        align  = align > 1 ? align : 1;
+        *first = units * index / count * align;
+        *end   = units * (index + 1) / count * align;
+        *first = *first < rows ? *first : rows;
+        *end   = *end   < rows ? *end   : rows;
+}
+
+/* [Name]:       Bands_run
+ * [Purpose]:    Runs work on every band, one thread per band; band 0 runs
+ *               on the calling thread. A band whose thread cannot be
+ *               created is run inline instead.
+ * [Parameters]: 1 void* (bands, an array of count closures), 1 int
+ *               (count), 1 size_t (band_size; bytes per closure), 1 thread
+ *               body (work)
+ * [Return]:     void
+ */
+void Bands_run(void *bands, int count, size_t band_size, void *work(void *))
+{
+        char     *band = bands;
+        pthread_t threads[count];
+        int       started[count];
+
+        for (int i = 1; i < count; i++) {
+                started[i] = pthread_create(&threads[i], NULL, work,
+                                            band + i * band_size) == 0;
+                if (!started[i]) {
+                        work(band + i * band_size);
+                }
+        }
+        work(band);
+
+        for (int i = 1; i < count; i++) {
+                if (started[i]) {
+                        pthread_join(threads[i], NULL);
+                }
+        }
+}
@@ -0,0 +1,27 @@
+/*
+ *      bands.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Splits a run of rows (or columns, or tile rows) into bands and
+ *        runs a thread body on each band, one thread per band; shared by
+ *        every banded reader, writer and transform
+ *      - Band closures are the caller's own structs, laid out in an array;
+ *        Bands_run only needs their size
+ *      - Depends only on libc and pthreads, so libppmtrans links it too
+ */
+
+#ifndef BANDS_INCLUDED
+#define BANDS_INCLUDED
+
+#include <stddef.h>
+
+/* Bands smaller than this many rows are not worth a thread */
+#define BANDS_MIN_ROWS 16
+
+extern int  Bands_count(int threads, int rows, int align);
+extern void Bands_split(int rows, int align, int count, int index,
+                        int *first, int *end);
+extern void Bands_run  (void *bands, int count, size_t band_size,
+                        void *work(void *));
+
+#endif
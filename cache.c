@@ -0,0 +1,526 @@
+/*
+ *      cache.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Entries are files named <input hash>-<options hash>.out; the
+ *        input is hashed straight from a read-only mapping, 32 bytes at a
+ *        time in four independent multiply/rotate lanes, into 128 bits
+ *      - A miss points standard output at a temporary file in the cache
+ *        directory for the rest of the run; committing copies it to the
+ *        real output and renames it into place, so readers never see a
+ *        partial entry and concurrent writers of one entry are harmless
+ *      - Recency is the entry's modification time, refreshed on every hit
+ *      - One process at a time evicts, under an flock on the directory's
+ *        lock file; a reader whose entry is evicted keeps its open file
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "cache.h"
+#include "mem.h"
+
+#define T Cache_T
+
+#define PRIME1 0x9e3779b185ebca87ull
+#define PRIME2 0xc2b2ae3d27d4eb4full
+#define PRIME3 0x165667b19e3779f9ull
+
+#define STALE_SECONDS 3600      /* temporaries older than this are debris */
+#define DIR_MAX (PATH_MAX - NAME_MAX - 1)   /* room for any name inside */
+
+struct T {
+        char dir[DIR_MAX];
+        char entry[PATH_MAX];           /* this run's entry */
+        char temp[PATH_MAX];            /* capture file, while a miss runs */
+        long limit;                     /* bytes */
+        int  saved_fd;                  /* the real stdout while capturing */
+        int  hit, stored;
+        long evicted;
+};
+
+/* An entry seen while evicting */
+typedef struct entry {
+        char            name[NAME_MAX + 1];
+        off_t           size;
+        struct timespec used;   /* mtime, to the nanosecond */
+} entry;
+
+/* The capture to discard if the run exits before committing it */
+static T pending = NULL;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static int      hash_file (const char *path, uint64_t hash[2]);
+static void     hash_bytes(const unsigned char *bytes, long length,
+                           uint64_t hash[2]);
+static uint64_t lane      (uint64_t acc, uint64_t word);
+static uint64_t mix       (uint64_t h);
+static int      copy_out  (int in_fd, int out_fd, off_t length);
+static void     evict     (T cache);
+static int      by_use    (const void *a, const void *b);
+static void     discard   (void);
+
+/*---------------------------------------------------------------
+ |             Constructors / Destructors                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Cache_open
+ * [Purpose]:    Opens (creating if needed) a cache directory and names
+ *               the entry for this input and options
+ * [Parameters]: 1 const char* (dir), 1 long (limit, bytes), 2 const char*
+ *               (input, a regular file; options, the normalized options
+ *               that shape the output)
+ * [Return]:     The cache, or NULL if dir or input cannot be used
+ */
+T Cache_open(const char *dir, long limit, const char *input,
+             const char *options)
+{
+        uint64_t    input_hash[2], options_hash[2];
+        struct stat st;
+        T           cache;
+
+        assert(dir != NULL && input != NULL && options != NULL);
+
+        if (strlen(dir) >= DIR_MAX ||
+            (mkdir(dir, 0777) != 0 && errno != EEXIST) ||
+            stat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+            access(dir, R_OK | W_OK | X_OK) != 0 ||
+            hash_file(input, input_hash) != 0) {
+                return NULL;
+        }
+        hash_bytes((const unsigned char *)options, strlen(options),
+                   options_hash);
+
+        NEW(cache);
+        snprintf(cache->dir, DIR_MAX, "%s", dir);
+        snprintf(cache->entry, PATH_MAX, "%s/%016llx%016llx-%016llx.out",
+                 dir, (unsigned long long)input_hash[0],
+                 (unsigned long long)input_hash[1],
+                 (unsigned long long)options_hash[0]);
+        cache->temp[0]  = '\0';
+        cache->limit    = limit;
+        cache->saved_fd = -1;
+        cache->hit      = 0;
+        cache->stored   = 0;
+        cache->evicted  = 0;
+
+        return cache;
+}
+
+/* [Name]:       Cache_free
+ * [Purpose]:    Frees the cache handle (entries stay on disk)
+ * [Parameters]: 1 T* (cache)
+ * [Return]:     void
+ */
+void Cache_free(T *cache)
+{
+        assert(cache != NULL && *cache != NULL);
+
+        if (pending == *cache) {
+                discard();
+        }
+        FREE(*cache);
+}
+
+/*---------------------------------------------------------------
+ |                      Entry Functions                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       Cache_fetch
+ * [Purpose]:    On a hit, marks the entry used and copies it to fd
+ * [Parameters]: 1 T (cache), 1 int (fd, the output)
+ * [Return]:     1 on a hit, 0 on a miss, -1 if copying the hit failed
+ */
+int Cache_fetch(T cache, int fd)
+{
+        struct stat st;
+        int         in_fd, status;
+
+        assert(cache != NULL);
+
+        in_fd = open(cache->entry, O_RDONLY);
+        if (in_fd < 0) {
+                return 0;
+        }
+        if (fstat(in_fd, &st) != 0) {
+                close(in_fd);
+                return 0;
+        }
+        futimens(in_fd, NULL);          /* most recently used */
+        cache->hit = 1;
+        status = copy_out(in_fd, fd, st.st_size) == 0 ? 1 : -1;
+        close(in_fd);
+        return status;
+}
+
+/* [Name]:       Cache_capture
+ * [Purpose]:    Points standard output at a new temporary file in the
+ *               cache, to become the entry once the run commits it
+ * [Parameters]: 1 T (cache)
+ * [Return]:     0 on success, -1 if output cannot be captured
+ */
+int Cache_capture(T cache)
+{
+        static int registered = 0;
+        int fd;
+
+        assert(cache != NULL && pending == NULL);
+
+        snprintf(cache->temp, PATH_MAX, "%s/tmp.XXXXXX", cache->dir);
+        fd = mkstemp(cache->temp);
+        if (fd < 0) {
+                cache->temp[0] = '\0';
+                return -1;
+        }
+        fchmod(fd, 0644);
+        fflush(stdout);
+        cache->saved_fd = dup(STDOUT_FILENO);
+        if (cache->saved_fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+                close(fd);
+                unlink(cache->temp);
+                cache->temp[0] = '\0';
+                if (cache->saved_fd >= 0) {
+                        close(cache->saved_fd);
+                        cache->saved_fd = -1;
+                }
+                return -1;
+        }
+        close(fd);
+
+        pending = cache;
+        if (!registered) {
+                atexit(discard);
+                registered = 1;
+        }
+        return 0;
+}
+
+/* [Name]:       Cache_commit
+ * [Purpose]:    Ends a capture: restores standard output, copies the
+ *               captured result to it, publishes the entry and evicts
+ * [Parameters]: 1 T (cache)
+ * [Return]:     0 on success, -1 if the result could not be copied out
+ */
+int Cache_commit(T cache)
+{
+        struct stat st;
+        int         in_fd, ok;
+
+        assert(cache != NULL && pending == cache);
+
+        fflush(stdout);
+        dup2(cache->saved_fd, STDOUT_FILENO);   /* closes the capture */
+        close(cache->saved_fd);
+        cache->saved_fd = -1;
+        pending         = NULL;
+
+        in_fd = open(cache->temp, O_RDONLY);
+        ok = in_fd >= 0 && fstat(in_fd, &st) == 0 &&
+             copy_out(in_fd, STDOUT_FILENO, st.st_size) == 0;
+        if (in_fd >= 0) {
+                close(in_fd);
+        }
+        if (ok && rename(cache->temp, cache->entry) == 0) {
+                cache->stored = 1;
+        } else {
+                unlink(cache->temp);
+        }
+        cache->temp[0] = '\0';
+
+        evict(cache);
+        return ok ? 0 : -1;
+}
+
+/* [Name]:       Cache_log
+ * [Purpose]:    Prints what the cache did for this run
+ * [Parameters]: 1 T (cache), 1 FILE* (fp)
+ * [Return]:     void
+ */
+void Cache_log(T cache, FILE *fp)
+{
+        const char *name;
+
+        assert(cache != NULL && fp != NULL);
+
+        name = strrchr(cache->entry, '/');
+
+        fprintf(fp, "CACHE\nResult:\t\t%s\nEntry:\t\t%s\nEvicted:\t%ld\n",
+                cache->hit ? "hit" : cache->stored ? "miss, stored"
+                                                   : "miss",
+                name != NULL ? name + 1 : cache->entry, cache->evicted);
+}
+
+/* [Name]:       copy_out
+ * [Purpose]:    Copies length bytes from in_fd to out_fd, both at their
+ *               current offsets: copy_file_range between files,
+ *               sendfile to anything else, read/write as a last resort
+ * [Parameters]: 2 ints (in_fd, out_fd), 1 off_t (length)
+ * [Return]:     0 on success, -1 on an error
+ */
+static int copy_out(int in_fd, int out_fd, off_t length)
+{
+        off_t   done = 0;
+        ssize_t n    = 0;
+
+        while (done < length &&
+               (n = copy_file_range(in_fd, NULL, out_fd, NULL,
+                                    length - done, 0)) > 0) {
+                done += n;
+        }
+        while (done < length &&
+               (n = sendfile(out_fd, in_fd, NULL, length - done)) > 0) {
+                done += n;
+        }
+        while (done < length) {
+                char buffer[65536];
+                n = read(in_fd, buffer, sizeof(buffer));
+                if (n <= 0) {
+                        return -1;
+                }
+                for (ssize_t put = 0; put < n; ) {
+                        ssize_t m = write(out_fd, buffer + put, n - put);
+                        if (m < 0) {
+                                return -1;
+                        }
+                        put += m;
+                }
+                done += n;
+        }
+        return 0;
+}
+
+/* [Name]:       discard
+ * [Purpose]:    Removes a capture the run never committed (at exit)
+ * [Parameters]: none
+ * [Return]:     void
+ */
+static void discard(void)
+{
+        if (pending != NULL && pending->temp[0] != '\0') {
+                unlink(pending->temp);
+                pending->temp[0] = '\0';
+        }
+        pending = NULL;
+}
+
+/*---------------------------------------------------------------
+ |                      Eviction Functions                      |
+ *--------------------------------------------------------------*/
+/* [Name]:       evict
+ * [Purpose]:    Deletes least recently used entries until the cache holds
+ *               at most its limit, and temporaries left by runs that
+ *               died; skipped if another process is already evicting.
+ *               This run's own entry is never evicted.
+ * [Parameters]: 1 T (cache)
+ * [Return]:     void
+ */
+static void evict(T cache)
+{
+        char           path[PATH_MAX];
+        entry         *entries = NULL;
+        long           count = 0, capacity = 0;
+        long           total = 0;
+        time_t         now   = time(NULL);
+        const char    *own     = strrchr(cache->entry, '/') + 1;
+        struct dirent *dirent;
+        DIR           *dp;
+        int            lock;
+
+        snprintf(path, PATH_MAX, "%s/lock", cache->dir);
+        lock = open(path, O_RDWR | O_CREAT, 0666);
+        if (lock < 0 || flock(lock, LOCK_EX | LOCK_NB) != 0) {
+                if (lock >= 0) {
+                        close(lock);
+                }
+                return;
+        }
+        dp = opendir(cache->dir);
+        while (dp != NULL && (dirent = readdir(dp)) != NULL) {
+                struct stat st;
+                size_t len = strlen(dirent->d_name);
+                snprintf(path, PATH_MAX, "%s/%s", cache->dir,
+                         dirent->d_name);
+                if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+                        continue;
+                }
+                if (strncmp(dirent->d_name, "tmp.", 4) == 0) {
+                        if (now - st.st_mtime > STALE_SECONDS) {
+                                unlink(path);
+                        }
+                        continue;
+                }
+                if (len < 4 || strcmp(dirent->d_name + len - 4, ".out")) {
+                        continue;
+                }
+                if (count == capacity) {
+                        capacity = capacity ? 2 * capacity : 64;
+                        entry *grown = realloc(entries,
+                                               capacity * sizeof(entry));
+                        if (grown == NULL) {
+                                break;
+                        }
+                        entries = grown;
+                }
+                snprintf(entries[count].name, NAME_MAX + 1, "%s",
+                         dirent->d_name);
+                entries[count].size = st.st_size;
+                entries[count].used = st.st_mtim;
+                total += st.st_size;
+                count++;
+        }
+        if (dp != NULL) {
+                closedir(dp);
+        }
+
+        if (total > cache->limit) {
+                qsort(entries, count, sizeof(entry), by_use);
+                for (long i = 0; i < count && total > cache->limit; i++) {
+                        if (strcmp(entries[i].name, own) == 0) {
+                                continue;
+                        }
+                        snprintf(path, PATH_MAX, "%s/%s", cache->dir,
+                                 entries[i].name);
+                        if (unlink(path) == 0) {
+                                cache->evicted++;
+                        }
+                        total -= entries[i].size;
+                }
+        }
+        free(entries);
+        close(lock);                    /* releases the flock */
+}
+
+/* [Name]:       by_use
+ * [Purpose]:    qsort comparison: least recently used entry first, by
+ *               seconds and then nanoseconds, so entries written in the
+ *               same second keep their order
+ * [Parameters]: 2 const void* (entries)
+ * [Return]:     Negative, zero or positive
+ */
+static int by_use(const void *a, const void *b)
+{
+        const struct timespec *used_a = &((const entry *)a)->used;
+        const struct timespec *used_b = &((const entry *)b)->used;
+
+        if (used_a->tv_sec != used_b->tv_sec) {
+                return (used_a->tv_sec > used_b->tv_sec) -
+                       (used_a->tv_sec < used_b->tv_sec);
+        }
+        return (used_a->tv_nsec > used_b->tv_nsec) -
+               (used_a->tv_nsec < used_b->tv_nsec);
+}
+
+/*---------------------------------------------------------------
+ |                       Hash Functions                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       hash_file
+ * [Purpose]:    Hashes the bytes of a regular file through a read-only
+ *               mapping
+ * [Parameters]: 1 const char* (path), 1 uint64_t[2] (hash; set)
+ * [Return]:     0 on success, -1 if path is not a readable regular file
+ */
+static int hash_file(const char *path, uint64_t hash[2])
+{
+        struct stat st;
+        void       *base = NULL;
+        int         fd   = open(path, O_RDONLY);
+
+        if (fd < 0) {
+                return -1;
+        }
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                close(fd);
+                return -1;
+        }
+        if (st.st_size > 0) {
+                base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (base == MAP_FAILED) {
+                        close(fd);
+                        return -1;
+                }
+                madvise(base, st.st_size, MADV_SEQUENTIAL);
+        }
+        close(fd);
+
+        hash_bytes(base, st.st_size, hash);
+        if (base != NULL) {
+                munmap(base, st.st_size);
+        }
+        return 0;
+}
+
+/* [Name]:       hash_bytes
+ * [Purpose]:    Hashes length bytes into 128 bits: four lanes take a word
+ *               each of every 32 bytes, so their multiplies overlap, and
+ *               both halves of the result mix all four lanes
+ * [Parameters]: 1 const unsigned char* (bytes), 1 long (length),
+ *               1 uint64_t[2] (hash; set)
+ * [Return]:     void
+ */
+static void hash_bytes(const unsigned char *bytes, long length,
+                       uint64_t hash[2])
+{
+        uint64_t acc[4] = { PRIME1 + PRIME2, PRIME2, 0, -PRIME1 };
+        long     i = 0;
+
+        for (; i + 32 <= length; i += 32) {
+                uint64_t words[4];
+                memcpy(words, bytes + i, sizeof(words));
+                acc[0] = lane(acc[0], words[0]);
+                acc[1] = lane(acc[1], words[1]);
+                acc[2] = lane(acc[2], words[2]);
+                acc[3] = lane(acc[3], words[3]);
+        }
+        for (int k = 0; i < length; i++, k++) {
+                acc[k % 4] = lane(acc[k % 4], bytes[i]);
+        }
+
+        uint64_t h = ((acc[0] << 1  | acc[0] >> 63) +
+                      (acc[1] << 7  | acc[1] >> 57) +
+                      (acc[2] << 12 | acc[2] >> 52) +
+                      (acc[3] << 18 | acc[3] >> 46)) ^ (uint64_t)length;
+        hash[0] = mix(h);
+        hash[1] = mix((acc[0] ^ acc[2] * PRIME3) + (acc[1] ^ acc[3]) * PRIME1
+                      + hash[0]);
+}
+
+/* [Name]:       lane
+ * [Purpose]:    Folds one word into a lane: multiply, rotate, multiply
+ * [Parameters]: 2 uint64_ts (acc, word)
+ * [Return]:     The new lane value
+ */
+static uint64_t lane(uint64_t acc, uint64_t word)
+{
+        acc += word * PRIME2;
+        acc  = acc << 31 | acc >> 33;
+        return acc * PRIME1;
+}
+
+/* [Name]:       mix
+ * [Purpose]:    Final avalanche of a 64-bit value
+ * [Parameters]: 1 uint64_t (h)
+ * [Return]:     Mixed value
+ */
+static uint64_t mix(uint64_t h)
+{
+        h ^= h >> 33;
+        h *= PRIME2;
+        h ^= h >> 29;
+        h *= PRIME3;
+        h ^= h >> 32;
+        return h;
+}
@@ -0,0 +1,34 @@
+/*
+ *      cache.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Content-addressed cache of ppmtrans results (-cache), shared by
+ *        any number of processes
+ *      - An entry is named by a hash of the input file's bytes and a hash
+ *        of the normalized options that shape the output, so a hit is
+ *        exactly the output the run would have produced
+ *      - A hit is copied to the output in the kernel (copy_file_range or
+ *        sendfile) without decoding anything; a miss captures the run's
+ *        standard output into a new entry, which is published atomically
+ *      - Entries are evicted least recently used first once the cache
+ *        holds more than its limit; a hit counts as a use
+ */
+
+#ifndef CACHE_INCLUDED
+#define CACHE_INCLUDED
+
+#include <stdio.h>
+
+#define T Cache_T
+typedef struct T *T;
+
+extern T    Cache_open   (const char *dir, long limit, const char *input,
+                          const char *options);
+extern int  Cache_fetch  (T cache, int fd);
+extern int  Cache_capture(T cache);
+extern int  Cache_commit (T cache);
+extern void Cache_log    (T cache, FILE *fp);
+extern void Cache_free   (T *cache);
+
+#undef T
+#endif
@@ -0,0 +1,307 @@
+/*
+ *      cache_test.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Tests the -cache result cache (see cache.h): a miss captures
+ *        standard output into an entry named <32 hex digits of input
+ *        hash>-<16 hex digits of options hash>.out holding exactly the
+ *        output; a hit copies those bytes back; other options or other
+ *        input bytes miss; eviction removes the least recently used
+ *        entries, a hit counting as a use
+ *      - Standard output is pointed at a scratch file while results are
+ *        captured, and restored before the summary is printed
+ *      - Exits nonzero if any check fails
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+#define PATH_BYTES 256
+
+static int checks = 0;
+static int failed = 0;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void check      (int ok, const char *what);
+static void write_file (const char *path, const char *text);
+static int  file_is    (const char *path, const char *text);
+static int  store      (const char *dir, long limit, const char *input,
+                        const char *options, const char *result,
+                        const char *scratch);
+static int  fetch      (const char *dir, const char *input,
+                        const char *options, const char *scratch);
+static int  entries    (const char *dir, char *name);
+static int  entry_name (const char *name);
+static void pause_clock(void);
+
+int main(void)
+{
+        char dir[] = "/tmp/cache_test.XXXXXX";
+        char cache_dir[PATH_BYTES], input[PATH_BYTES], scratch[PATH_BYTES];
+        char name[PATH_BYTES], first[PATH_BYTES], path[2 * PATH_BYTES];
+        long big = 1L << 30;
+
+        if (mkdtemp(dir) == NULL) {
+                perror("mkdtemp");
+                return EXIT_FAILURE;
+        }
+        snprintf(cache_dir, PATH_BYTES, "%s/cache", dir);
+        snprintf(input,     PATH_BYTES, "%s/in.ppm", dir);
+        snprintf(scratch,   PATH_BYTES, "%s/out", dir);
+        write_file(input, "P6\n1 1\n255\nabc");
+
+        /* a miss stores exactly the run's output, under a hashed name */
+        check(fetch(cache_dir, input, "-rotate 90", scratch) == 0,
+              "empty cache misses");
+        check(store(cache_dir, big, input, "-rotate 90", "result A",
+                    scratch) == 0 && file_is(scratch, "result A"),
+              "miss passes the output through");
+        check(entries(cache_dir, first) == 1 && entry_name(first),
+              "one entry, named <input hash>-<options hash>.out");
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, first);
+        check(file_is(path, "result A"), "entry holds the output");
+
+        /* a hit gives the same bytes back */
+        check(fetch(cache_dir, input, "-rotate 90", scratch) == 1 &&
+              file_is(scratch, "result A"), "hit copies the entry");
+
+        /* other options and other input bytes are other entries */
+        check(fetch(cache_dir, input, "-rotate 180", scratch) == 0,
+              "other options miss");
+        pause_clock();
+        store(cache_dir, big, input, "-rotate 180", "result B", scratch);
+        check(entries(cache_dir, name) == 2 &&
+              strncmp(name, first, 32) == 0,
+              "same input, same input hash");
+        write_file(input, "P6\n1 1\n255\nabd");
+        check(fetch(cache_dir, input, "-rotate 90", scratch) == 0,
+              "other input misses");
+        write_file(input, "P6\n1 1\n255\nabc");
+
+        /* eviction: A is used again, so B is the least recently used and
+         * goes once a third entry would exceed room for two */
+        pause_clock();
+        check(fetch(cache_dir, input, "-rotate 90", scratch) == 1,
+              "hit before eviction");
+        pause_clock();
+        store(cache_dir, 16, input, "-transpose", "result C", scratch);
+        check(entries(cache_dir, NULL) == 2, "eviction keeps the limit");
+        check(fetch(cache_dir, input, "-rotate 90", scratch) == 1 &&
+              fetch(cache_dir, input, "-transpose", scratch) == 1 &&
+              fetch(cache_dir, input, "-rotate 180", scratch) == 0,
+              "least recently used entry evicted");
+
+        /* unusable directory or input */
+        check(Cache_open(input, big, input, "-rotate 90") == NULL,
+              "file as cache directory refused");
+        check(Cache_open(cache_dir, big, "/nonexistent", "-rotate 90") ==
+              NULL, "missing input refused");
+
+        DIR *dp = opendir(cache_dir);
+        struct dirent *dirent;
+        while (dp != NULL && (dirent = readdir(dp)) != NULL) {
+                snprintf(path, sizeof(path), "%s/%s", cache_dir,
+                         dirent->d_name);
+                unlink(path);
+        }
+        if (dp != NULL) {
+                closedir(dp);
+        }
+        rmdir(cache_dir);
+        unlink(input);
+        unlink(scratch);
+        rmdir(dir);
+
+        printf("cache_test: %d checks, %d failed\n", checks, failed);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* [Name]:       check
+ * [Purpose]:    Counts a check and reports it if it failed
+ * [Parameters]: 1 int (ok), 1 const char* (what was checked)
+ * [Return]:     void
+ */
+static void check(int ok, const char *what)
+{
+        checks++;
+        if (!ok) {
+                failed++;
+                fprintf(stderr, "FAIL %s\n", what);
+        }
+}
+
+/* [Name]:       write_file
+ * [Purpose]:    Replaces a file's contents with text
+ * [Parameters]: 2 const char* (path, text)
+ * [Return]:     void
+ */
+static void write_file(const char *path, const char *text)
+{
+        FILE *fp = fopen(path, "w");
+
+        if (fp == NULL) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+        fputs(text, fp);
+        fclose(fp);
+}
+
+/* [Name]:       file_is
+ * [Purpose]:    Compares a file's contents with text
+ * [Parameters]: 2 const char* (path, text)
+ * [Return]:     1 if they are equal, 0 otherwise
+ */
+static int file_is(const char *path, const char *text)
+{
+        char   buf[PATH_BYTES];
+        size_t got;
+        FILE  *fp = fopen(path, "r");
+
+        if (fp == NULL) {
+                return 0;
+        }
+        got = fread(buf, 1, sizeof(buf), fp);
+        fclose(fp);
+        return got == strlen(text) && memcmp(buf, text, got) == 0;
+}
+
+/* [Name]:       store
+ * [Purpose]:    Runs a miss the way ppmtrans does: captures standard
+ *               output, writes result to it and commits; standard output
+ *               is the scratch file meanwhile, so it receives the result
+ * [Parameters]: 1 const char* (dir), 1 long (limit, bytes),
+ *               4 const char* (input, options, result, scratch)
+ * [Return]:     0 on success, -1 on a failure
+ */
+static int store(const char *dir, long limit, const char *input,
+                 const char *options, const char *result,
+                 const char *scratch)
+{
+        int     saved  = dup(STDOUT_FILENO);
+        int     out    = open(scratch, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int     status = -1;
+        Cache_T cache  = Cache_open(dir, limit, input, options);
+
+        fflush(stdout);
+        if (cache != NULL && saved >= 0 && out >= 0 &&
+            dup2(out, STDOUT_FILENO) >= 0 && Cache_capture(cache) == 0) {
+                fputs(result, stdout);
+                status = Cache_commit(cache);
+        }
+        fflush(stdout);
+        if (saved >= 0) {
+                dup2(saved, STDOUT_FILENO);
+                close(saved);
+        }
+        if (out >= 0) {
+                close(out);
+        }
+        if (cache != NULL) {
+                Cache_free(&cache);
+        }
+        return status;
+}
+
+/* [Name]:       fetch
+ * [Purpose]:    Looks a result up, copying a hit into the scratch file
+ * [Parameters]: 4 const char* (dir, input, options, scratch)
+ * [Return]:     1 on a hit, 0 on a miss, -1 on a failure
+ */
+static int fetch(const char *dir, const char *input, const char *options,
+                 const char *scratch)
+{
+        int     out    = open(scratch, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int     status = -1;
+        Cache_T cache  = Cache_open(dir, 1L << 30, input, options);
+
+        if (cache != NULL && out >= 0) {
+                status = Cache_fetch(cache, out);
+        }
+        if (out >= 0) {
+                close(out);
+        }
+        if (cache != NULL) {
+                Cache_free(&cache);
+        }
+        return status;
+}
+
+/* [Name]:       entries
+ * [Purpose]:    Counts the entries (.out files) in a cache directory; no
+ *               other files may be left behind but the lock
+ * [Parameters]: 1 const char* (dir), 1 char* (name, PATH_BYTES; the last
+ *               entry seen, or NULL)
+ * [Return]:     Number of entries, or -1 if a stray file is present
+ */
+static int entries(const char *dir, char *name)
+{
+        DIR           *dp = opendir(dir);
+        struct dirent *dirent;
+        int            count = 0;
+
+        while (dp != NULL && (dirent = readdir(dp)) != NULL) {
+                const char *d_name = dirent->d_name;
+                size_t      len    = strlen(d_name);
+                if (strcmp(d_name, ".") == 0 || strcmp(d_name, "..") == 0 ||
+                    strcmp(d_name, "lock") == 0) {
+                        continue;
+                }
+                if (len < 4 || strcmp(d_name + len - 4, ".out") != 0) {
+                        count = -1;
+                        break;
+                }
+                if (name != NULL) {
+                        snprintf(name, PATH_BYTES, "%s", d_name);
+                }
+                count++;
+        }
+        if (dp != NULL) {
+                closedir(dp);
+        }
+        return count;
+}
+
+/* [Name]:       entry_name
+ * [Purpose]:    Checks an entry's name: 32 hex digits, '-', 16 hex
+ *               digits, ".out"
+ * [Parameters]: 1 const char* (name)
+ * [Return]:     1 if it is well formed, 0 otherwise
+ */
+static int entry_name(const char *name)
+{
+        if (strlen(name) != 32 + 1 + 16 + 4 || name[32] != '-' ||
+            strcmp(name + 49, ".out") != 0) {
+                return 0;
+        }
+        for (int i = 0; i < 49; i++) {
+                if (i != 32 && strchr("0123456789abcdef", name[i]) == NULL) {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/* [Name]:       pause_clock
+ * [Purpose]:    Waits long enough for file times to move on (they tick
+ *               with the kernel's coarse clock), so entries used one
+ *               after another are ordered by recency
+ * [Parameters]: None
+ * [Return]:     void
+ */
+static void pause_clock(void)
+{
+        struct timespec pause = { 0, 20 * 1000 * 1000 };
+
+        nanosleep(&pause, NULL);
+}
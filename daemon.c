@@ -0,0 +1,739 @@
+/*
+ *      daemon.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Long-running transform server on a Unix domain socket
+ *      - The main thread accepts connections and queues them; a fixed pool
+ *        of worker threads serves them, one connection at a time each
+ *      - Input and output may be passed as file descriptors (SCM_RIGHTS),
+ *        so clients hand over their open files instead of copying bytes
+ *      - Each worker keeps a small pool of freed pixel storage (see
+ *        pool.h, beneath the arrays' new and free, so the methods suite
+ *        passed in is used as is and keeps its fast paths); steady
+ *        traffic of same-sized images does not go back to the allocator
+ *      - A job reads, transforms and writes on its share of the threads:
+ *        all of them when it runs alone, fewer while other jobs are in
+ *        flight
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "daemon.h"
+#include "pool.h"
+#include "ppmio.h"
+#include "tilefile.h"
+#include "transform.h"
+
+/* Accepted connections waiting for a worker */
+#define QUEUE_SLOTS 128
+
+/* Freed pixel buffers each worker keeps for reuse */
+#define POOL_SLOTS 4
+
+/* Longest request line */
+#define LINE_BYTES 4096
+
+/* Most descriptors a connection may have passed but not yet used */
+#define MAX_FDS 16
+
+/* Most transformations in one job */
+#define MAX_STEPS 16
+
+/* Latencies of recent successful jobs kept for the STATS percentiles */
+#define LATENCY_SLOTS 4096
+
+/* Bounded queue of accepted sockets */
+typedef struct conn_queue {
+        int             socks[QUEUE_SLOTS];
+        int             head, count;
+        pthread_mutex_t lock;
+        pthread_cond_t  nonempty, nonfull;
+} conn_queue;
+
+/* Counters reported by STATS; updated atomically. total_ns and max_ns
+ * cover successful jobs only, as does the ring of recent latencies. */
+typedef struct stats {
+        long jobs, failed, connections;
+        long total_ns, max_ns;
+        long            recent[LATENCY_SLOTS];
+        long            recorded;       /* successful jobs so far */
+        pthread_mutex_t lock;           /* guards recent and recorded */
+} stats;
+
+/* One client connection, with bytes and descriptors not yet consumed */
+typedef struct connection {
+        int  sock;
+        char buf[LINE_BYTES];
+        int  len;
+        int  fds[MAX_FDS];
+        int  nfds;
+} connection;
+
+/* One transformation of a job */
+typedef struct step {
+        int transform_type;
+        int magnitude;
+} step;
+
+/* Shared server state */
+typedef struct server {
+        conn_queue  queue;
+        stats       stats;
+        A2Methods_T methods;
+        mapfun     *map;
+        int         threads;
+        int         busy;        /* jobs in flight; updated atomically */
+} server;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void    *worker_thread (void *cl);
+static void     serve         (server *s, int sock);
+static int      receive       (connection *c);
+static int      handle_line   (server *s, connection *c, char *line);
+static void     run_job       (server *s, connection *c, char **tokens,
+                               int count);
+static int      parse_steps   (char **tokens, int count, step *steps);
+static int      open_endpoint (connection *c, const char *name, int flags);
+static Pnm_ppm  read_image    (int fd, A2Methods_T methods, int threads);
+static int      write_image   (int fd, Pnm_ppm ppm, int threads);
+static void     reply         (connection *c, const char *fmt, ...);
+static void     record_job    (server *s, long ns, int ok);
+static void     percentiles   (server *s, double *p50_us, double *p99_us);
+static int      compare_longs (const void *a, const void *b);
+static long     now_ns        (void);
+
+static void     queue_init    (conn_queue *q);
+static void     queue_push    (conn_queue *q, int sock);
+static int      queue_pop     (conn_queue *q);
+
+/*---------------------------------------------------------------
+ |                         Server Loop                          |
+ *--------------------------------------------------------------*/
+/* [Name]:       Daemon_run
+ * [Purpose]:    Listens on a Unix domain socket at path and serves
+ *               transform jobs on 'threads' worker threads, forever. A
+ *               socket left at path by an earlier run is replaced;
+ *               anything else there is left alone.
+ * [Parameters]: 1 c-string (path), 1 A2Methods_T (methods), 1 mapfun*
+ *               (map), 1 int (threads)
+ * [Return]:     -1 if the socket could not be set up or accept failed
+ *               (errno is ENOTSOCK if path names something other than a
+ *               socket)
+ */
+int Daemon_run(const char *path, A2Methods_T methods, mapfun *map,
+               int threads)
+{
+        struct sockaddr_un addr;
+        struct stat        st;
+        server s;
+        int    listener, stale;
+
+        assert(path != NULL && methods != NULL && map != NULL);
+
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+        stale = lstat(path, &st) == 0;
+        if (stale && !S_ISSOCK(st.st_mode)) {
+                errno = ENOTSOCK;
+                return -1;
+        }
+
+        memset(&s.stats, 0, sizeof(s.stats));
+        pthread_mutex_init(&s.stats.lock, NULL);
+        s.methods = methods;
+        s.map     = map;
+        s.threads = threads < 1 ? 1 : threads;
+        s.busy    = 0;
+        queue_init(&s.queue);
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+                return -1;
+        }
+        if (stale) {
+                unlink(path);   /* socket from an earlier run */
+        }
+        if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(listener, QUEUE_SLOTS) != 0) {
+                close(listener);
+                return -1;
+        }
+
+        /* a client hanging up must not kill the server */
+        signal(SIGPIPE, SIG_IGN);
+
+        for (int i = 0; i < s.threads; i++) {
+                pthread_t worker;
+                if (pthread_create(&worker, NULL, worker_thread, &s) != 0) {
+                        close(listener);
+                        return -1;
+                }
+                pthread_detach(worker);
+        }
+
+        for (;;) {
+                int sock = accept(listener, NULL, NULL);
+                if (sock < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED) {
+                                continue;
+                        }
+                        close(listener);
+                        return -1;
+                }
+                queue_push(&s.queue, sock);
+        }
+}
+
+/* [Name]:       worker_thread
+ * [Purpose]:    Pool thread body: serves queued connections until the
+ *               process exits, recycling freed pixel storage
+ * [Parameters]: 1 void* (closure; the server)
+ * [Return]:     never returns
+ */
+static void *worker_thread(void *cl)
+{
+        server *s = cl;
+
+        Pool_enable(POOL_SLOTS);
+        for (;;) {
+                int sock = queue_pop(&s->queue);
+                __atomic_add_fetch(&s->stats.connections, 1,
+                                   __ATOMIC_RELAXED);
+                serve(s, sock);
+                close(sock);
+        }
+        return NULL;
+}
+
+/* [Name]:       serve
+ * [Purpose]:    Reads request lines from one connection and answers each,
+ *               until the client hangs up or sends QUIT
+ * [Parameters]: 1 server* (s), 1 int (sock)
+ * [Return]:     void
+ */
+static void serve(server *s, int sock)
+{
+        connection c;
+        int        open = 1;
+
+        c.sock = sock;
+        c.len  = 0;
+        c.nfds = 0;
+
+        while (open) {
+                char *newline = memchr(c.buf, '\n', c.len);
+                if (newline != NULL) {
+                        *newline = '\0';
+                        open = handle_line(s, &c, c.buf);
+                        c.len -= newline + 1 - c.buf;
+                        memmove(c.buf, newline + 1, c.len);
+                } else if (c.len == LINE_BYTES) {
+                        reply(&c, "ERR request line too long\n");
+                        open = 0;
+                } else if (receive(&c) <= 0) {
+                        open = 0;
+                }
+        }
+
+        for (int i = 0; i < c.nfds; i++) {
+                close(c.fds[i]);
+        }
+}
+
+/* [Name]:       receive
+ * [Purpose]:    Reads more request bytes, collecting any descriptors passed
+ *               along with them (extras beyond MAX_FDS are closed)
+ * [Parameters]: 1 connection* (c)
+ * [Return]:     Bytes read; 0 at end of stream, -1 on error
+ */
+static int receive(connection *c)
+{
+        union {
+                struct cmsghdr align;
+                char           buf[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+        } control;
+        struct iovec  iov;
+        struct msghdr msg;
+        ssize_t       got;
+
+        iov.iov_base = c->buf + c->len;
+        iov.iov_len  = LINE_BYTES - c->len;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        do {
+                got = recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC);
+        } while (got < 0 && errno == EINTR);
+        if (got <= 0) {
+                return got;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level != SOL_SOCKET ||
+                    cmsg->cmsg_type  != SCM_RIGHTS) {
+                        continue;
+                }
+                int  n   = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                int *fds = (int *)CMSG_DATA(cmsg);
+                for (int i = 0; i < n; i++) {
+                        if (c->nfds < MAX_FDS) {
+                                c->fds[c->nfds++] = fds[i];
+                        } else {
+                                close(fds[i]);
+                        }
+                }
+        }
+
+        c->len += got;
+        return got;
+}
+
+/* [Name]:       handle_line
+ * [Purpose]:    Dispatches one request line
+ * [Parameters]: 1 server* (s), 1 connection* (c), 1 c-string (line)
+ * [Return]:     0 if the connection should be closed, 1 otherwise
+ */
+static int handle_line(server *s, connection *c, char *line)
+{
+        char *tokens[2 * MAX_STEPS + 3];
+        char *save  = NULL;
+        int   count = 0;
+
+        for (char *tok = strtok_r(line, " \t\r", &save); tok != NULL;
+             tok = strtok_r(NULL, " \t\r", &save)) {
+                if (count == (int)(sizeof(tokens) / sizeof(tokens[0]))) {
+                        reply(c, "ERR too many arguments\n");
+                        return 1;
+                }
+                tokens[count++] = tok;
+        }
+
+        if (count == 0) {
+                return 1;
+        } else if (strcmp(tokens[0], "JOB") == 0) {
+                run_job(s, c, tokens + 1, count - 1);
+        } else if (strcmp(tokens[0], "STATS") == 0) {
+                long   jobs   = __atomic_load_n(&s->stats.jobs,
+                                                __ATOMIC_RELAXED);
+                long   failed = __atomic_load_n(&s->stats.failed,
+                                                __ATOMIC_RELAXED);
+                long   total  = __atomic_load_n(&s->stats.total_ns,
+                                                __ATOMIC_RELAXED);
+                long   ok     = jobs - failed;
+                double p50, p99;
+                percentiles(s, &p50, &p99);
+                reply(c, "STATS jobs=%ld failed=%ld connections=%ld "
+                         "mean_us=%.1f p50_us=%.1f p99_us=%.1f "
+                         "max_us=%.1f threads=%d\n", jobs, failed,
+                      __atomic_load_n(&s->stats.connections,
+                                      __ATOMIC_RELAXED),
+                      ok > 0 ? total / 1000.0 / ok : 0.0, p50, p99,
+                      __atomic_load_n(&s->stats.max_ns, __ATOMIC_RELAXED) /
+                      1000.0, s->threads);
+        } else if (strcmp(tokens[0], "QUIT") == 0) {
+                return 0;
+        } else {
+                reply(c, "ERR unknown command '%s'\n", tokens[0]);
+        }
+        return 1;
+}
+
+/*---------------------------------------------------------------
+ |                          Job Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       run_job
+ * [Purpose]:    Runs one JOB request: reads the input, applies each
+ *               transformation in order, writes the output and replies
+ * [Parameters]: 1 server* (s), 1 connection* (c), 1 c-string array
+ *               (tokens after "JOB"), 1 int (count)
+ * [Return]:     void
+ */
+static void run_job(server *s, connection *c, char **tokens, int count)
+{
+        step  steps[MAX_STEPS];
+        int   nsteps, in_fd, out_fd;
+        long  start = now_ns();
+
+        if (count < 2) {
+                reply(c, "ERR usage: JOB <input> <output> [transform ...]\n");
+                record_job(s, 0, 0);
+                return;
+        }
+        nsteps = parse_steps(tokens + 2, count - 2, steps);
+        if (nsteps < 0) {
+                reply(c, "ERR bad transformation\n");
+                record_job(s, 0, 0);
+                return;
+        }
+
+        in_fd  = open_endpoint(c, tokens[0], O_RDONLY);
+        out_fd = open_endpoint(c, tokens[1], O_WRONLY | O_CREAT | O_TRUNC);
+        if (in_fd < 0 || out_fd < 0) {
+                reply(c, "ERR cannot open %s\n", in_fd < 0 ? "input"
+                                                          : "output");
+                if (in_fd >= 0) {
+                        close(in_fd);
+                }
+                if (out_fd >= 0) {
+                        close(out_fd);
+                }
+                record_job(s, 0, 0);
+                return;
+        }
+
+        /* this job's share of the threads */
+        int busy    = __atomic_add_fetch(&s->busy, 1, __ATOMIC_RELAXED);
+        int threads = s->threads / busy > 1 ? s->threads / busy : 1;
+
+        Pnm_ppm ppm = read_image(in_fd, s->methods, threads);
+        close(in_fd);
+        if (ppm == NULL) {
+                __atomic_sub_fetch(&s->busy, 1, __ATOMIC_RELAXED);
+                close(out_fd);
+                reply(c, "ERR bad input image\n");
+                record_job(s, 0, 0);
+                return;
+        }
+
+        for (int i = 0; i < nsteps; i++) {
+                ppm = transform(ppm, s->methods, s->map,
+                                steps[i].transform_type, steps[i].magnitude,
+                                threads, NULL);
+        }
+
+        int ok = write_image(out_fd, ppm, threads) == 0;
+        close(out_fd);
+        __atomic_sub_fetch(&s->busy, 1, __ATOMIC_RELAXED);
+
+        long elapsed = now_ns() - start;
+        if (ok) {
+                reply(c, "OK %u %u %ld\n", ppm->width, ppm->height,
+                      elapsed / 1000);
+        } else {
+                reply(c, "ERR cannot write output\n");
+        }
+        Pnm_ppmfree(&ppm);
+        record_job(s, elapsed, ok);
+}
+
+/* [Name]:       parse_steps
+ * [Purpose]:    Parses a job's transformation list (same spelling as the
+ *               command line: -rotate <angle>, -flip <direction>,
+ *               -transpose)
+ * [Parameters]: 1 c-string array (tokens), 1 int (count), 1 step* (steps,
+ *               room for MAX_STEPS)
+ * [Return]:     Number of steps, or -1 on a malformed list
+ */
+static int parse_steps(char **tokens, int count, step *steps)
+{
+        int n = 0;
+
+        for (int i = 0; i < count; i++) {
+                if (n == MAX_STEPS) {
+                        return -1;
+                }
+                if (strcmp(tokens[i], "-rotate") == 0 && i + 1 < count) {
+                        char *endptr;
+                        long angle = strtol(tokens[++i], &endptr, 10);
+                        if (*endptr != '\0' || !(angle == 0 || angle == 90 ||
+                            angle == 180 || angle == 270)) {
+                                return -1;
+                        }
+                        steps[n].transform_type = ROTATE;
+                        steps[n].magnitude      = angle;
+                } else if (strcmp(tokens[i], "-flip") == 0 && i + 1 < count) {
+                        i++;
+                        if (strcmp(tokens[i], "horizontal") == 0) {
+                                steps[n].magnitude = HORIZ;
+                        } else if (strcmp(tokens[i], "vertical") == 0) {
+                                steps[n].magnitude = VERT;
+                        } else {
+                                return -1;
+                        }
+                        steps[n].transform_type = FLIP;
+                } else if (strcmp(tokens[i], "-transpose") == 0) {
+                        steps[n].transform_type = TRANSPOSE;
+                        steps[n].magnitude      = 0;
+                } else {
+                        return -1;
+                }
+                n++;
+        }
+        return n;
+}
+
+/* [Name]:       open_endpoint
+ * [Purpose]:    Resolves a job's input or output: '@' takes the oldest
+ *               descriptor passed on the connection, anything else is
+ *               opened as a path
+ * [Parameters]: 1 connection* (c), 1 c-string (name), 1 int (open flags)
+ * [Return]:     Open descriptor (owned by the caller), or -1
+ */
+static int open_endpoint(connection *c, const char *name, int flags)
+{
+        if (strcmp(name, "@") == 0) {
+                if (c->nfds == 0) {
+                        return -1;
+                }
+                int fd = c->fds[0];
+                c->nfds--;
+                memmove(c->fds, c->fds + 1, c->nfds * sizeof(int));
+                return fd;
+        }
+        return open(name, flags | O_CLOEXEC, 0644);
+}
+
+/* [Name]:       read_image
+ * [Purpose]:    Reads a tiled or P6 image from any kind of descriptor.
+ *               Only pipes and sockets fall back to the stream reader; a
+ *               regular file Ppmio_read refuses (short, or with sizes
+ *               that overflow) is a bad image.
+ * [Parameters]: 1 int (fd), 1 A2Methods_T (methods), 1 int (threads)
+ * [Return]:     Pnm_ppm, or NULL if fd does not hold a readable image
+ */
+static Pnm_ppm read_image(int fd, A2Methods_T methods, int threads)
+{
+        Pnm_ppm     ppm;
+        struct stat st;
+
+        if (Tilefile_probe(fd)) {
+                return Tilefile_read(fd, methods);
+        }
+        ppm = Ppmio_read(fd, methods, threads);
+        if (ppm == NULL) {
+                if (fstat(fd, &st) != 0 || S_ISREG(st.st_mode)) {
+                        return NULL;
+                }
+                int   copy = dup(fd);
+                FILE *fp   = copy < 0 ? NULL : fdopen(copy, "r");
+                if (fp == NULL) {
+                        if (copy >= 0) {
+                                close(copy);
+                        }
+                        return NULL;
+                }
+                ppm = Ppmio_read_stream(fp, methods);
+                fclose(fp);
+        }
+        return ppm;
+}
+
+/* [Name]:       write_image
+ * [Purpose]:    Writes ppm as P6 to any kind of descriptor
+ * [Parameters]: 1 int (fd), 1 Pnm_ppm (ppm), 1 int (threads)
+ * [Return]:     0 on success, -1 on a write error
+ */
+static int write_image(int fd, Pnm_ppm ppm, int threads)
+{
+        int status = Ppmio_write(fd, ppm, threads);
+
+        if (status == 0) {
+                int   copy = dup(fd);
+                FILE *fp   = copy < 0 ? NULL : fdopen(copy, "w");
+                if (fp == NULL) {
+                        if (copy >= 0) {
+                                close(copy);
+                        }
+                        return -1;
+                }
+                status = Ppmio_write_stream(fp, ppm) == 0 ? 1 : -1;
+                if (fclose(fp) != 0) {
+                        status = -1;
+                }
+        }
+        return status == 1 ? 0 : -1;
+}
+
+/* [Name]:       reply
+ * [Purpose]:    Sends one formatted reply line to the client
+ * [Parameters]: 1 connection* (c), 1 c-string (printf format), varargs
+ * [Return]:     void
+ */
+static void reply(connection *c, const char *fmt, ...)
+{
+        char    line[LINE_BYTES];
+        va_list args;
+        int     len;
+
+        va_start(args, fmt);
+        len = vsnprintf(line, sizeof(line), fmt, args);
+        va_end(args);
+        if (len < 0) {
+                return;
+        }
+        if (len >= (int)sizeof(line)) {
+                len = sizeof(line) - 1;
+        }
+        for (int sent = 0; sent < len; ) {
+                ssize_t n = send(c->sock, line + sent, len - sent,
+                                 MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (n <= 0) {
+                        return;
+                }
+                sent += n;
+        }
+}
+
+/* [Name]:       record_job
+ * [Purpose]:    Adds one finished job to the server's counters; a failed
+ *               job is only counted, so it does not skew the latencies
+ * [Parameters]: 1 server* (s), 1 long (ns, latency), 1 int (ok)
+ * [Return]:     void
+ */
+static void record_job(server *s, long ns, int ok)
+{
+        long max = __atomic_load_n(&s->stats.max_ns, __ATOMIC_RELAXED);
+
+        __atomic_add_fetch(&s->stats.jobs, 1, __ATOMIC_RELAXED);
+        if (!ok) {
+                __atomic_add_fetch(&s->stats.failed, 1, __ATOMIC_RELAXED);
+                return;
+        }
+        __atomic_add_fetch(&s->stats.total_ns, ns, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&s->stats.lock);
+        s->stats.recent[s->stats.recorded++ % LATENCY_SLOTS] = ns;
+        pthread_mutex_unlock(&s->stats.lock);
+        while (ns > max &&
+               !__atomic_compare_exchange_n(&s->stats.max_ns, &max, ns, 0,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+        }
+}
+
+/* [Name]:       percentiles
+ * [Purpose]:    Picks the median and 99th percentile latency (nearest
+ *               rank) of the last LATENCY_SLOTS successful jobs
+ * [Parameters]: 1 server* (s), 2 double* (p50_us, p99_us; set, 0 if no
+ *               job has succeeded yet)
+ * [Return]:     void
+ */
+static void percentiles(server *s, double *p50_us, double *p99_us)
+{
+        long sorted[LATENCY_SLOTS];
+        long n;
+
+        pthread_mutex_lock(&s->stats.lock);
+        n = s->stats.recorded < LATENCY_SLOTS ? s->stats.recorded
+                                              : LATENCY_SLOTS;
+        memcpy(sorted, s->stats.recent, n * sizeof(long));
+        pthread_mutex_unlock(&s->stats.lock);
+
+        if (n == 0) {
+                *p50_us = 0.0;
+                *p99_us = 0.0;
+                return;
+        }
+        qsort(sorted, n, sizeof(long), compare_longs);
+        *p50_us = sorted[(n * 50 + 99) / 100 - 1] / 1000.0;
+        *p99_us = sorted[(n * 99 + 99) / 100 - 1] / 1000.0;
+}
+
+/* [Name]:       compare_longs
+ * [Purpose]:    qsort comparator for ascending longs
+ * [Parameters]: 2 const void* (a, b)
+ * [Return]:     Negative, zero or positive
+ */
+static int compare_longs(const void *a, const void *b)
+{
+        long x = *(const long *)a, y = *(const long *)b;
+        return (x > y) - (x < y);
+}
+
+/* [Name]:       now_ns
+ * [Purpose]:    Reads the monotonic clock
+ * [Parameters]: none
+ * [Return]:     Nanoseconds since an arbitrary epoch
+ */
+static long now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*---------------------------------------------------------------
+ |                    Connection Queue Functions                |
+ *--------------------------------------------------------------*/
+/* [Name]:       queue_init
+ * [Purpose]:    Initializes an empty connection queue
+ * [Parameters]: 1 conn_queue* (q)
+ * [Return]:     void
+ */
+static void queue_init(conn_queue *q)
+{
+        q->head  = 0;
+        q->count = 0;
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_cond_init(&q->nonempty, NULL);
+        pthread_cond_init(&q->nonfull, NULL);
+}
+
+/* [Name]:       queue_push
+ * [Purpose]:    Queues an accepted socket, waiting while the queue is full
+ * [Parameters]: 1 conn_queue* (q), 1 int (sock)
+ * [Return]:     void
+ */
+static void queue_push(conn_queue *q, int sock)
+{
+        pthread_mutex_lock(&q->lock);
+        while (q->count == QUEUE_SLOTS) {
+                pthread_cond_wait(&q->nonfull, &q->lock);
+        }
+        q->socks[(q->head + q->count) % QUEUE_SLOTS] = sock;
+        q->count++;
+        pthread_cond_signal(&q->nonempty);
+        pthread_mutex_unlock(&q->lock);
+}
+
+/* [Name]:       queue_pop
+ * [Purpose]:    Takes the oldest queued socket, waiting while none is
+ *               queued
+ * [Parameters]: 1 conn_queue* (q)
+ * [Return]:     Socket of the connection to serve
+ */
+static int queue_pop(conn_queue *q)
+{
+        int sock;
+
+        pthread_mutex_lock(&q->lock);
+        while (q->count == 0) {
+                pthread_cond_wait(&q->nonempty, &q->lock);
+        }
+        sock    = q->socks[q->head];
+        q->head = (q->head + 1) % QUEUE_SLOTS;
+        q->count--;
+        pthread_cond_signal(&q->nonfull);
+        pthread_mutex_unlock(&q->lock);
+
+        return sock;
+}
@@ -0,0 +1,37 @@
+/*
+ *      daemon.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Long-running transform server on a Unix domain socket
+ *      - Jobs run on a warm pool of worker threads that recycle pixel
+ *        storage between jobs, so a small image costs no process startup
+ *      - Jobs use the storage given at startup (-row-major, -block-major,
+ *        ...) and split the threads among those in flight; other options
+ *        are per-run and not accepted with -daemon
+ *
+ *      Protocol (one request per line, one reply line per request):
+ *        JOB <input> <output> [-rotate <angle>] [-flip <direction>]
+ *            [-transpose] ...
+ *              input/output are paths, or '@' to use the next file
+ *              descriptor passed with SCM_RIGHTS on this connection;
+ *              transformations are applied left to right
+ *              reply: "OK <width> <height> <microseconds>" or "ERR <why>"
+ *        STATS
+ *              reply: "STATS jobs=<n> failed=<n> connections=<n>
+ *                      mean_us=<t> p50_us=<t> p99_us=<t> max_us=<t>
+ *                      threads=<n>"
+ *              latencies cover successful jobs only; the percentiles
+ *              are over the most recent 4096 of them
+ *        QUIT
+ *              closes the connection
+ */
+
+#ifndef DAEMON_INCLUDED
+#define DAEMON_INCLUDED
+
+#include "a2methods.h"
+
+extern int Daemon_run(const char *path, A2Methods_T methods,
+                      A2Methods_mapfun *map, int threads);
+
+#endif
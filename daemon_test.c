@@ -0,0 +1,344 @@
+/*
+ *      daemon_test.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Tests the -daemon protocol (see daemon.h) against a running
+ *        ppmtrans: JOB results are compared byte for byte with what
+ *        ppmtrans writes for the same transformations run directly,
+ *        by path and by passed descriptors; then the error replies,
+ *        STATS counters and QUIT
+ *      - Usage: daemon_test [ppmtrans] (default ./ppmtrans); exits
+ *        nonzero if any check fails
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Test image: odd sides, so no transformation is accidentally symmetric */
+#define WIDTH  37
+#define HEIGHT 23
+
+#define REPLY_BYTES 512
+
+/* One JOB case: the daemon's transformation list, the same run as
+ * direct ppmtrans commands (%s is ppmtrans), and the result's size */
+typedef struct job_case {
+        const char *steps;
+        const char *direct;
+        int         width, height;
+} job_case;
+
+static const job_case cases[] = {
+        { "-rotate 0",   "%s -rotate 0",   WIDTH,  HEIGHT },
+        { "-rotate 90",  "%s -rotate 90",  HEIGHT, WIDTH  },
+        { "-rotate 180", "%s -rotate 180", WIDTH,  HEIGHT },
+        { "-rotate 270", "%s -rotate 270", HEIGHT, WIDTH  },
+        { "-flip horizontal", "%s -flip horizontal", WIDTH, HEIGHT },
+        { "-flip vertical",   "%s -flip vertical",   WIDTH, HEIGHT },
+        { "-transpose",  "%s -transpose",  HEIGHT, WIDTH  },
+        { "-rotate 90 -flip vertical",
+          "%s -rotate 90 | %s -flip vertical", HEIGHT, WIDTH },
+};
+
+static int checks = 0;
+static int failed = 0;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void check      (int ok, const char *what, const char *detail);
+static void write_image(const char *path);
+static int  same_file  (const char *a, const char *b);
+static int  connect_to (const char *path);
+static void ask        (int sock, const char *line, const int *fds,
+                        int nfds, char *reply);
+static long stat_field (const char *reply, const char *name);
+
+int main(int argc, char *argv[])
+{
+        const char *ppmtrans = argc > 1 ? argv[1] : "./ppmtrans";
+        char dir[] = "/tmp/daemon_test.XXXXXX";
+        char sock_path[64], input[64], output[64], expected[64];
+        char command[512], reply[REPLY_BYTES];
+        int  jobs = 0, bad_jobs = 0;
+
+        if (mkdtemp(dir) == NULL) {
+                perror("mkdtemp");
+                return EXIT_FAILURE;
+        }
+        snprintf(sock_path, sizeof(sock_path), "%s/sock", dir);
+        snprintf(input,     sizeof(input),     "%s/in.ppm", dir);
+        snprintf(output,    sizeof(output),    "%s/out.ppm", dir);
+        snprintf(expected,  sizeof(expected),  "%s/expected.ppm", dir);
+        write_image(input);
+
+        pid_t daemon = fork();
+        if (daemon == 0) {
+                execl(ppmtrans, ppmtrans, "-threads", "2", "-daemon",
+                      sock_path, (char *)NULL);
+                _exit(127);
+        }
+        int sock = connect_to(sock_path);
+        check(sock >= 0, "daemon accepts connections", sock_path);
+        if (sock < 0) {
+                kill(daemon, SIGTERM);
+                waitpid(daemon, NULL, 0);
+                return EXIT_FAILURE;
+        }
+
+        /* every transformation, by path */
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+                char line[256], ok[64];
+                snprintf(line, sizeof(line), "JOB %s %s %s\n", input,
+                         output, cases[i].steps);
+                ask(sock, line, NULL, 0, reply);
+                jobs++;
+                snprintf(ok, sizeof(ok), "OK %d %d ", cases[i].width,
+                         cases[i].height);
+                check(strncmp(reply, ok, strlen(ok)) == 0, cases[i].steps,
+                      reply);
+
+                char direct[256];
+                snprintf(direct, sizeof(direct), cases[i].direct, ppmtrans,
+                         ppmtrans);
+                snprintf(command, sizeof(command), "(%s) < %s > %s", direct,
+                         input, expected);
+                check(system(command) == 0 && same_file(output, expected),
+                      cases[i].steps, "output differs from a direct run");
+        }
+
+        /* input and output passed as descriptors */
+        int fds[2] = { open(input, O_RDONLY),
+                       open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+        ask(sock, "JOB @ @ -rotate 270\n", fds, 2, reply);
+        jobs++;
+        close(fds[0]);
+        close(fds[1]);
+        snprintf(command, sizeof(command), "%s -rotate 270 < %s > %s",
+                 ppmtrans, input, expected);
+        check(strncmp(reply, "OK ", 3) == 0 && system(command) == 0 &&
+              same_file(output, expected), "JOB @ @", reply);
+
+        /* error replies; each one counts as a failed job */
+        ask(sock, "JOB /nonexistent/in.ppm out.ppm -rotate 90\n", NULL, 0,
+            reply);
+        jobs++, bad_jobs++;
+        check(strcmp(reply, "ERR cannot open input\n") == 0,
+              "missing input", reply);
+        ask(sock, "JOB in.ppm out.ppm -rotate 45\n", NULL, 0, reply);
+        jobs++, bad_jobs++;
+        check(strcmp(reply, "ERR bad transformation\n") == 0,
+              "free angle", reply);
+        FILE *junk = fopen(expected, "w");
+        if (junk != NULL) {
+                fputs("not an image\n", junk);
+                fclose(junk);
+        }
+        snprintf(command, sizeof(command), "JOB %s %s -rotate 90\n",
+                 expected, output);
+        ask(sock, command, NULL, 0, reply);
+        jobs++, bad_jobs++;
+        check(strcmp(reply, "ERR bad input image\n") == 0,
+              "input not an image", reply);
+        ask(sock, "JOB in.ppm\n", NULL, 0, reply);
+        jobs++, bad_jobs++;
+        check(strncmp(reply, "ERR usage", 9) == 0, "short JOB", reply);
+        ask(sock, "FROB\n", NULL, 0, reply);
+        check(strcmp(reply, "ERR unknown command 'FROB'\n") == 0,
+              "unknown command", reply);
+
+        ask(sock, "STATS\n", NULL, 0, reply);
+        check(stat_field(reply, "jobs") == jobs, "STATS jobs", reply);
+        check(stat_field(reply, "failed") == bad_jobs, "STATS failed",
+              reply);
+        check(stat_field(reply, "threads") == 2, "STATS threads", reply);
+
+        /* QUIT closes the connection */
+        ssize_t sent = send(sock, "QUIT\n", 5, MSG_NOSIGNAL);
+        check(sent == 5 && recv(sock, reply, 1, 0) == 0, "QUIT",
+              "connection still open");
+        close(sock);
+
+        kill(daemon, SIGTERM);
+        waitpid(daemon, NULL, 0);
+        unlink(sock_path);
+        unlink(input);
+        unlink(output);
+        unlink(expected);
+        rmdir(dir);
+
+        printf("daemon_test: %d checks, %d failed\n", checks, failed);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* [Name]:       check
+ * [Purpose]:    Counts a check and reports it if it failed
+ * [Parameters]: 1 int (ok), 2 const char* (what was checked, detail)
+ * [Return]:     void
+ */
+static void check(int ok, const char *what, const char *detail)
+{
+        checks++;
+        if (!ok) {
+                failed++;
+                fprintf(stderr, "FAIL %s: %s\n", what, detail);
+        }
+}
+
+/* [Name]:       write_image
+ * [Purpose]:    Writes the WIDTH x HEIGHT test image, every pixel
+ *               different, as a P6 file
+ * [Parameters]: 1 const char* (path)
+ * [Return]:     void
+ */
+static void write_image(const char *path)
+{
+        FILE *fp = fopen(path, "wb");
+
+        if (fp == NULL) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+        fprintf(fp, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+        for (int row = 0; row < HEIGHT; row++) {
+                for (int col = 0; col < WIDTH; col++) {
+                        putc(col * 7, fp);
+                        putc(row * 11, fp);
+                        putc(col ^ row, fp);
+                }
+        }
+        fclose(fp);
+}
+
+/* [Name]:       same_file
+ * [Purpose]:    Compares two files byte for byte
+ * [Parameters]: 2 const char* (paths)
+ * [Return]:     1 if both exist and are equal, 0 otherwise
+ */
+static int same_file(const char *a, const char *b)
+{
+        FILE *fa = fopen(a, "rb");
+        FILE *fb = fopen(b, "rb");
+        int   same = fa != NULL && fb != NULL;
+
+        while (same) {
+                int ca = getc(fa), cb = getc(fb);
+                same = ca == cb;
+                if (ca == EOF) {
+                        break;
+                }
+        }
+        if (fa != NULL) {
+                fclose(fa);
+        }
+        if (fb != NULL) {
+                fclose(fb);
+        }
+        return same;
+}
+
+/* [Name]:       connect_to
+ * [Purpose]:    Connects to the daemon's socket, retrying for up to five
+ *               seconds while it starts
+ * [Parameters]: 1 const char* (path)
+ * [Return]:     The connected socket, or -1
+ */
+static int connect_to(const char *path)
+{
+        struct sockaddr_un addr;
+        struct timespec    pause = { 0, 10 * 1000 * 1000 };
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+        for (int tries = 0; tries < 500; tries++) {
+                int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (sock < 0) {
+                        return -1;
+                }
+                if (connect(sock, (struct sockaddr *)&addr,
+                            sizeof(addr)) == 0) {
+                        return sock;
+                }
+                close(sock);
+                nanosleep(&pause, NULL);
+        }
+        return -1;
+}
+
+/* [Name]:       ask
+ * [Purpose]:    Sends one request line, passing fds along with it, and
+ *               reads the one reply line
+ * [Parameters]: 1 int (sock), 1 const char* (line), 1 const int* (fds),
+ *               1 int (nfds, up to 2), 1 char* (reply, REPLY_BYTES;
+ *               filled in, newline kept, "" if the connection closed)
+ * [Return]:     void
+ */
+static void ask(int sock, const char *line, const int *fds, int nfds,
+                char *reply)
+{
+        union {
+                struct cmsghdr align;
+                char           buf[CMSG_SPACE(2 * sizeof(int))];
+        } control;
+        struct iovec  iov = { (void *)line, strlen(line) };
+        struct msghdr msg;
+        size_t        used = 0;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = &iov;
+        msg.msg_iovlen = 1;
+        if (nfds > 0) {
+                msg.msg_control    = control.buf;
+                msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type  = SCM_RIGHTS;
+                cmsg->cmsg_len   = CMSG_LEN(nfds * sizeof(int));
+                memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+        }
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) {
+                reply[0] = '\0';
+                return;
+        }
+
+        while (used < REPLY_BYTES - 1 &&
+               (used == 0 || reply[used - 1] != '\n')) {
+                ssize_t got = recv(sock, reply + used, 1, 0);
+                if (got < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (got <= 0) {
+                        break;
+                }
+                used += got;
+        }
+        reply[used] = '\0';
+}
+
+/* [Name]:       stat_field
+ * [Purpose]:    Finds "<name>=<n>" in a STATS reply
+ * [Parameters]: 2 const char* (reply, name)
+ * [Return]:     n, or -1 if the field is missing
+ */
+static long stat_field(const char *reply, const char *name)
+{
+        char        key[32];
+        const char *at;
+
+        snprintf(key, sizeof(key), " %s=", name);
+        at = strstr(reply, key);
+        return at == NULL ? -1 : strtol(at + strlen(key), NULL, 10);
+}
@@ -0,0 +1,257 @@
+/*
+ *      encode.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Writes the P6 header, sizes the file with ftruncate and maps it
+ *        shared, then encodes every source pixel at its destination's
+ *        byte offset in the mapping
+ *      - Each source column lands in one destination column (or row) and
+ *        each source row in one destination row (or column), see
+ *        axis_positions, so the offset of source (col, row) is
+ *        col_part[col] + row_part[row], from two small tables
+ *      - Source rows are split into bands, one thread per band; every
+ *        pixel has its own bytes, so bands need no locking
+ *      - A band walks its rows in strips; when columns become rows, each
+ *        strip is walked column by column so that consecutive stores fill
+ *        a run of one output row instead of striding down a column
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "a2sparse.h"
+#include "bands.h"
+#include "cputiming.h"
+#include "encode.h"
+#include "mem.h"
+#include "ppmio.h"
+#include "trace.h"
+#include "transform.h"
+#include "uarray2b.h"
+
+/* Source rows walked together; their stores share output rows */
+#define STRIP_ROWS 16
+
+/* Work description for one band of source rows */
+typedef struct band {
+        A2Methods_T    methods;
+        A2             source;
+        int            width;
+        int            first_row, end_row;
+        int            swap;            /* columns become rows */
+        int            wide;            /* 2-byte samples      */
+        const long    *col_part, *row_part;
+        unsigned char *raster;
+        Pixelop_T      ops;
+} band;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void  axis_tables (int transform_type, int magnitude, int width,
+                          int height, long pixel_bytes, long row_bytes,
+                          long *col_part, long *row_part);
+static void  put_pixel   (const band *b, int col, int row);
+static void *encode_band (void *cl);
+
+/*---------------------------------------------------------------
+ |                       Encode Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Encode_transform
+ * [Purpose]:    Rotates, flips or transposes ppm into P6 written at fd's
+ *               current offset, encoding each pixel (after ops, if any)
+ *               directly into the mapped file. On success fd's offset is
+ *               left just past the image. Records the time taken in time,
+ *               if needed.
+ * [Parameters]: 1 int (fd, a regular file open for reading and writing),
+ *               1 Pnm_ppm (ppm), 2 ints (transform_type, magnitude),
+ *               1 Pixelop_T (ops, NULL for none), 1 int (threads),
+ *               1 float* (time)
+ * [Return]:     1 if written, 0 if fd cannot be mapped for writing
+ *               (nothing is written; caller should fall back), -1 on a
+ *               write error
+ */
+int Encode_transform(int fd, Pnm_ppm ppm, int transform_type, int magnitude,
+                     Pixelop_T ops, int threads, float *time)
+{
+        struct stat st;
+        char        header[64];
+        CPUTime_T   timer;
+
+        assert(ppm != NULL);
+
+        int  width  = ppm->width;
+        int  height = ppm->height;
+        int  swap   = swaps_axes(transform_type, magnitude);
+        int  flags  = fcntl(fd, F_GETFL);
+        long base   = lseek(fd, 0, SEEK_CUR);
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || flags < 0 ||
+            (flags & O_ACCMODE) != O_RDWR || (flags & O_APPEND) ||
+            base < 0 || ppm->denominator == 0 || ppm->denominator > 65535) {
+                return 0;
+        }
+
+        unsigned maxval = ops != NULL ? Pixelop_prepare(ops, ppm->denominator)
+                                      : ppm->denominator;
+        int  header_len  = snprintf(header, sizeof(header), "P6\n%d %d\n%u\n",
+                                    swap ? height : width,
+                                    swap ? width : height, maxval);
+        long pixel_bytes = Ppmio_row_bytes(1, maxval);
+        long row_bytes   = pixel_bytes * (swap ? height : width);
+        long total       = base + header_len + row_bytes * (swap ? width
+                                                                 : height);
+
+        if (ftruncate(fd, total) != 0) {
+                return -1;
+        }
+        /* not every filesystem supports fallocate; faults allocate anyway */
+        if (fallocate(fd, 0, base, total - base) != 0 &&
+            errno != EOPNOTSUPP && errno != ENOSYS) {
+                return -1;
+        }
+        unsigned char *map = mmap(NULL, total, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+                return -1;
+        }
+
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+        memcpy(map + base, header, header_len);
+
+        long *col_part = CALLOC(width, sizeof(long));
+        long *row_part = CALLOC(height, sizeof(long));
+        axis_tables(transform_type, magnitude, width, height, pixel_bytes,
+                    row_bytes, col_part, row_part);
+
+        int count = Bands_count(threads, height, 1);
+        band bands[count];
+        for (int i = 0; i < count; i++) {
+                bands[i].methods   = ppm->methods;
+                bands[i].source    = ppm->pixels;
+                bands[i].width     = width;
+                Bands_split(height, 1, count, i, &bands[i].first_row,
+                            &bands[i].end_row);
+                bands[i].swap      = swap;
+                bands[i].wide      = maxval > 255;
+                bands[i].col_part  = col_part;
+                bands[i].row_part  = row_part;
+                bands[i].raster    = map + base + header_len;
+                bands[i].ops       = ops;
+        }
+        Bands_run(bands, count, sizeof(band), encode_band);
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+
+        FREE(col_part);
+        FREE(row_part);
+        if (munmap(map, total) != 0 || lseek(fd, total, SEEK_SET) < 0) {
+                return -1;
+        }
+        return 1;
+}
+
+/* [Name]:       axis_tables
+ * [Purpose]:    Fills the tables that give each source column's and row's
+ *               share of its destination pixel's byte offset in the raster
+ * [Parameters]: 2 ints (transform_type, magnitude), 2 ints (source width,
+ *               height), 2 longs (pixel_bytes, row_bytes; of the output),
+ *               2 long* (col_part, row_part; width and height entries)
+ * [Return]:     void
+ */
+static void axis_tables(int transform_type, int magnitude, int width,
+                        int height, long pixel_bytes, long row_bytes,
+                        long *col_part, long *row_part)
+{
+        int swap = swaps_axes(transform_type, magnitude);
+
+        axis_positions(transform_type, magnitude, width, height, col_part,
+                       row_part);
+        for (int c = 0; c < width; c++) {
+                col_part[c] *= swap ? row_bytes : pixel_bytes;
+        }
+        for (int r = 0; r < height; r++) {
+                row_part[r] *= swap ? pixel_bytes : row_bytes;
+        }
+}
+
+/*---------------------------------------------------------------
+ |                       Thread Helpers                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       put_pixel
+ * [Purpose]:    Encodes one source pixel at its destination offset;
+ *               uniform tiles of a sparse image are read without being
+ *               expanded
+ * [Parameters]: 1 const band* (b), 2 ints (col, row; in the source)
+ * [Return]:     void
+ */
+static void put_pixel(const band *b, int col, int row)
+{
+        struct Pnm_rgb pixel = b->methods == uarray2_methods_sparse
+                               ? *(Pnm_rgb)UArray2b_get(b->source, col, row)
+                               : *(Pnm_rgb)b->methods->at(b->source, col,
+                                                          row);
+        unsigned char *out = b->raster + b->col_part[col] +
+                             b->row_part[row];
+
+        if (b->ops != NULL) {
+                Pixelop_apply(b->ops, &pixel);
+        }
+        if (b->wide) {
+                out[0] = pixel.red >> 8;
+                out[1] = pixel.red;
+                out[2] = pixel.green >> 8;
+                out[3] = pixel.green;
+                out[4] = pixel.blue >> 8;
+                out[5] = pixel.blue;
+        } else {
+                out[0] = pixel.red;
+                out[1] = pixel.green;
+                out[2] = pixel.blue;
+        }
+}
+
+/* [Name]:       encode_band
+ * [Purpose]:    Thread body: encodes every pixel of one band of source
+ *               rows, a strip of rows at a time
+ * [Parameters]: 1 void* (closure; the band)
+ * [Return]:     NULL
+ */
+static void *encode_band(void *cl)
+{
+        band *b     = cl;
+        long  start = Trace_now();
+
+        for (int top = b->first_row; top < b->end_row; top += STRIP_ROWS) {
+                int end = b->end_row - top < STRIP_ROWS ? b->end_row
+                                                        : top + STRIP_ROWS;
+                if (b->swap) {
+                        for (int col = 0; col < b->width; col++) {
+                                for (int row = top; row < end; row++) {
+                                        put_pixel(b, col, row);
+                                }
+                        }
+                } else {
+                        for (int row = top; row < end; row++) {
+                                for (int col = 0; col < b->width; col++) {
+                                        put_pixel(b, col, row);
+                                }
+                        }
+                }
+        }
+        Trace_span("encode band", start, b->first_row);
+        return NULL;
+}
@@ -0,0 +1,22 @@
+/*
+ *      encode.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Rotate, flip or transpose fused with P6 encoding (-o): the output
+ *        file is sized up front and mapped, and each source pixel is
+ *        encoded straight to its final byte offset, so neither a
+ *        destination array nor a separate encode pass is needed
+ */
+
+#ifndef ENCODE_INCLUDED
+#define ENCODE_INCLUDED
+
+#include "a2methods.h"
+#include "pixelop.h"
+#include "pnm.h"
+
+extern int Encode_transform(int fd, Pnm_ppm ppm, int transform_type,
+                            int magnitude, Pixelop_T ops, int threads,
+                            float *time);
+
+#endif
@@ -0,0 +1,479 @@
+/*
+ *      incremental.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - State directory layout:
+ *              hashes          header, then one 64-bit hash per source
+ *                              tile in block row-major order
+ *              destination     the previous result, as a tiled image
+ *      - A run hashes the source tile by tile (straight from the UArray2b
+ *        tiles, one band of block rows per thread), maps the kept
+ *        destination shared and writable, and re-applies the ordinary
+ *        rotate/flip/transpose apply function to the cells of the tiles
+ *        whose hash changed. Only those destination pages are dirtied, so
+ *        the transform and the write-back are proportional to the changed
+ *        area.
+ *      - The hashes are removed before the destination is touched and
+ *        written back (via rename) once it is consistent, so an interrupted
+ *        run leaves state that forces a rebuild rather than stale pixels
+ *      - Missing or mismatched state (other size, maxval, transformation or
+ *        tile grid) rebuilds everything
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "a2blocked.h"
+#include "bands.h"
+#include "cputiming.h"
+#include "incremental.h"
+#include "tilefile.h"
+#include "trace.h"
+#include "transform.h"
+#include "uarray2b.h"
+
+#define STATE_MAGIC "PPMINC2"
+
+/* Header of the hashes file; all fields in host byte order */
+typedef struct state_header {
+        char     magic[8];
+        uint32_t width, height;         /* source */
+        uint32_t maxval;
+        uint32_t tile_width;            /* source tile grid */
+        uint32_t tile_height;
+        int32_t  transform_type, magnitude;
+        uint64_t tile_count;
+} state_header;
+
+/* Everything the band workers share */
+typedef struct update {
+        UArray2b_T      source;
+        int             blocks_w;
+        uint64_t       *hashes;         /* this run's */
+        const uint64_t *previous;       /* NULL while only hashing */
+        applyfun       *apply;
+        result          info;
+} update;
+
+/* Block rows [first, end) of work for one thread */
+typedef struct band {
+        update *u;
+        int     first, end;
+        long    changed;
+} band;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void    *hash_band        (void *cl);
+static void    *update_band      (void *cl);
+static uint64_t hash_tile        (UArray2b_T source, int blk_col,
+                                  int blk_row);
+static void     transform_tile   (update *u, int blk_col, int blk_row);
+static int      load_hashes      (const char *dir, const state_header *want,
+                                  uint64_t *hashes);
+static int      save_hashes      (const char *dir, const state_header *header,
+                                  const uint64_t *hashes);
+static Pnm_ppm  open_destination (const char *dir, int width, int height,
+                                  unsigned maxval);
+static int      save_destination (const char *dir, Pnm_ppm ppm);
+static void     state_path       (char *path, const char *dir,
+                                  const char *name);
+static long     run_bands        (update *u, int rows, int threads,
+                                  void *work(void *));
+
+/*---------------------------------------------------------------
+ |                    Incremental Functions                     |
+ *--------------------------------------------------------------*/
+/* [Name]:       Incremental_transform
+ * [Purpose]:    Transforms ppm, reusing the destination kept in dir for
+ *               every source tile whose hash matches the previous run's,
+ *               and updates the state in dir for the next run. Records the
+ *               time taken in time, if needed.
+ * [Parameters]: 1 Pnm_ppm (ppm; blocked pixels), 1 const char* (dir; created
+ *               if missing), 3 ints (transform_type [see constants],
+ *               magnitude, threads), 1 Incremental_stats* (stats, filled
+ *               in), 1 float* (time)
+ * [Return]:     The transformed image (ppm itself, or a new Pnm_ppm over the
+ *               kept destination, in which case ppm is freed), or NULL if
+ *               the state directory cannot be written
+ */
+Pnm_ppm Incremental_transform(Pnm_ppm ppm, const char *dir,
+                              int transform_type, int magnitude, int threads,
+                              Incremental_stats *stats, float *time)
+{
+        update       u;
+        state_header header;
+        CPUTime_T    timer;
+        Pnm_ppm      destination = NULL;
+
+        assert(ppm != NULL && dir != NULL && stats != NULL);
+        assert(ppm->methods == uarray2_methods_blocked);
+
+        if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+                return NULL;
+        }
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+
+        u.source   = ppm->pixels;
+        u.blocks_w = UArray2b_blocks_width(u.source);
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+        header.width          = ppm->width;
+        header.height         = ppm->height;
+        header.maxval         = ppm->denominator;
+        header.tile_width     = UArray2b_tile_width(u.source);
+        header.tile_height    = UArray2b_tile_height(u.source);
+        header.transform_type = transform_type;
+        header.magnitude      = magnitude;
+        header.tile_count     = (uint64_t)u.blocks_w *
+                                UArray2b_blocks_height(u.source);
+
+        stats->tiles   = header.tile_count;
+        stats->changed = 0;
+        stats->rebuilt = 0;
+
+        u.hashes   = malloc(header.tile_count * sizeof(uint64_t));
+        u.previous = NULL;
+        malloc_check(u.hashes);
+        run_bands(&u, UArray2b_blocks_height(u.source), threads, hash_band);
+
+        uint64_t *previous = malloc(header.tile_count * sizeof(uint64_t));
+        malloc_check(previous);
+        if (load_hashes(dir, &header, previous)) {
+                int swap = swaps_axes(transform_type, magnitude);
+                destination = open_destination(dir,
+                        swap ? ppm->height : ppm->width,
+                        swap ? ppm->width  : ppm->height, ppm->denominator);
+        }
+
+        char path[PATH_MAX];
+        state_path(path, dir, "hashes");
+        unlink(path);           /* state is inconsistent until saved */
+
+        if (destination != NULL) {
+                u.previous = previous;
+                u.apply    = transform_init(NULL, transform_type);
+                u.info     = result_init(uarray2_methods_blocked, magnitude,
+                                         destination->pixels);
+                stats->changed = run_bands(&u,
+                                           UArray2b_blocks_height(u.source),
+                                           threads, update_band);
+                Pnm_ppmfree(&ppm);
+                ppm = destination;
+        } else {
+                ppm = transform(ppm, uarray2_methods_blocked,
+                                uarray2_methods_blocked->map_default,
+                                transform_type, magnitude, threads, NULL);
+                stats->changed = stats->tiles;
+                stats->rebuilt = 1;
+        }
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+
+        int saved = (stats->rebuilt ? save_destination(dir, ppm) : 0) == 0 &&
+                    save_hashes(dir, &header, u.hashes) == 0;
+        free(previous);
+        free(u.hashes);
+        if (!saved) {
+                Pnm_ppmfree(&ppm);
+                return NULL;
+        }
+        return ppm;
+}
+
+/* [Name]:       Incremental_log
+ * [Purpose]:    Prints what an incremental run did, for the timing file
+ * [Parameters]: 1 const Incremental_stats* (stats), 1 FILE* (fp)
+ * [Return]:     void
+ */
+void Incremental_log(const Incremental_stats *stats, FILE *fp)
+{
+        assert(stats != NULL && fp != NULL);
+
+        fprintf(fp, "INCREMENTAL\n");
+        fprintf(fp, "Tiles:\t\t%ld\n", stats->tiles);
+        fprintf(fp, "Changed:\t%ld (%.1f%%)%s\n", stats->changed,
+                stats->tiles > 0 ? 100.0 * stats->changed / stats->tiles
+                                 : 0.0,
+                stats->rebuilt ? ", rebuilt" : "");
+}
+
+/*---------------------------------------------------------------
+ |                        Tile Functions                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       hash_band
+ * [Purpose]:    Thread body: hashes every source tile in one band of block
+ *               rows
+ * [Parameters]: 1 void* (closure; the band)
+ * [Return]:     NULL
+ */
+static void *hash_band(void *cl)
+{
+        band   *b     = cl;
+        update *u     = b->u;
+        long    start = Trace_now();
+
+        for (int blk_row = b->first; blk_row < b->end; blk_row++) {
+                for (int blk_col = 0; blk_col < u->blocks_w; blk_col++) {
+                        u->hashes[(long)blk_row * u->blocks_w + blk_col] =
+                                hash_tile(u->source, blk_col, blk_row);
+                }
+        }
+        Trace_span("hash band", start, b->first);
+        return NULL;
+}
+
+/* [Name]:       update_band
+ * [Purpose]:    Thread body: re-transforms the changed tiles in one band of
+ *               block rows. Tiles of different bands land on disjoint
+ *               destination cells.
+ * [Parameters]: 1 void* (closure; the band, whose changed count is set)
+ * [Return]:     NULL
+ */
+static void *update_band(void *cl)
+{
+        band   *b = cl;
+        update *u = b->u;
+
+        for (int blk_row = b->first; blk_row < b->end; blk_row++) {
+                for (int blk_col = 0; blk_col < u->blocks_w; blk_col++) {
+                        long i = (long)blk_row * u->blocks_w + blk_col;
+                        if (u->hashes[i] != u->previous[i]) {
+                                long start = Trace_now();
+                                transform_tile(u, blk_col, blk_row);
+                                Trace_span("tile", start, i);
+                                b->changed++;
+                        }
+                }
+        }
+        return NULL;
+}
+
+/* [Name]:       hash_tile
+ * [Purpose]:    Hashes the cells of one source tile, a word at a time
+ *               with a multiply/xor-shift mix
+ * [Parameters]: 1 UArray2b_T (source), 2 ints (blk_col, blk_row)
+ * [Return]:     64-bit hash of the tile
+ */
+static uint64_t hash_tile(UArray2b_T source, int blk_col, int blk_row)
+{
+        const uint64_t prime = 0x9e3779b97f4a7c15ull;
+        int size   = UArray2b_size(source);
+        int cols, rows;
+        uint64_t h = prime;
+
+        UArray2b_block_shape(source, blk_col, blk_row, &cols, &rows);
+
+        const unsigned char *p = UArray2b_block(source, blk_col, blk_row);
+        long  bytes = (long)cols * rows * size;
+        long  i     = 0;
+        for (; i + 8 <= bytes; i += 8) {
+                uint64_t word;
+                memcpy(&word, p + i, sizeof(word));
+                h = (h ^ word) * prime;
+                h ^= h >> 29;
+        }
+        for (; i < bytes; i++) {
+                h = (h ^ p[i]) * prime;
+        }
+        return h ^ (h >> 32);
+}
+
+/* [Name]:       transform_tile
+ * [Purpose]:    Applies the transformation to the cells of one source tile,
+ *               writing into the kept destination
+ * [Parameters]: 1 update* (u), 2 ints (blk_col, blk_row)
+ * [Return]:     void
+ */
+static void transform_tile(update *u, int blk_col, int blk_row)
+{
+        int cols, rows;
+
+        UArray2b_block_shape(u->source, blk_col, blk_row, &cols, &rows);
+
+        int col0  = blk_col * UArray2b_tile_width(u->source);
+        int row0  = blk_row * UArray2b_tile_height(u->source);
+        int col1  = col0 + cols;
+        int row1  = row0 + rows;
+
+        for (int row = row0; row < row1; row++) {
+                for (int col = col0; col < col1; col++) {
+                        u->apply(col, row, u->source,
+                                 UArray2b_at(u->source, col, row), &u->info);
+                }
+        }
+}
+
+/*---------------------------------------------------------------
+ |                        State Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       load_hashes
+ * [Purpose]:    Reads the previous run's tile hashes, if they were made for
+ *               the same image shape, maxval, tile grid and transformation
+ * [Parameters]: 1 const char* (dir), 1 const state_header* (want),
+ *               1 uint64_t* (hashes; want->tile_count entries)
+ * [Return]:     1 if hashes were loaded, 0 otherwise
+ */
+static int load_hashes(const char *dir, const state_header *want,
+                       uint64_t *hashes)
+{
+        char         path[PATH_MAX];
+        state_header header;
+        FILE        *fp;
+        int          ok;
+
+        state_path(path, dir, "hashes");
+        fp = fopen(path, "rb");
+        if (fp == NULL) {
+                return 0;
+        }
+        ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+             memcmp(&header, want, sizeof(header)) == 0 &&
+             fread(hashes, sizeof(uint64_t), want->tile_count, fp) ==
+             want->tile_count;
+        fclose(fp);
+        return ok;
+}
+
+/* [Name]:       save_hashes
+ * [Purpose]:    Writes this run's tile hashes, replacing the file atomically
+ * [Parameters]: 1 const char* (dir), 1 const state_header* (header),
+ *               1 const uint64_t* (hashes)
+ * [Return]:     0 on success, -1 on a write error
+ */
+static int save_hashes(const char *dir, const state_header *header,
+                       const uint64_t *hashes)
+{
+        char  path[PATH_MAX], temp[PATH_MAX];
+        FILE *fp;
+        int   ok;
+
+        state_path(path, dir, "hashes");
+        state_path(temp, dir, "hashes.tmp");
+        fp = fopen(temp, "wb");
+        if (fp == NULL) {
+                return -1;
+        }
+        ok = fwrite(header, sizeof(*header), 1, fp) == 1 &&
+             fwrite(hashes, sizeof(uint64_t), header->tile_count, fp) ==
+             header->tile_count;
+        ok = fclose(fp) == 0 && ok;
+        if (!ok || rename(temp, path) != 0) {
+                unlink(temp);
+                return -1;
+        }
+        return 0;
+}
+
+/* [Name]:       open_destination
+ * [Purpose]:    Maps the kept destination shared and writable, if it has
+ *               the expected shape and maxval
+ * [Parameters]: 1 const char* (dir), 2 ints (width, height), 1 unsigned
+ *               (maxval)
+ * [Return]:     Pnm_ppm over the mapping (blocked methods), or NULL
+ */
+static Pnm_ppm open_destination(const char *dir, int width, int height,
+                                unsigned maxval)
+{
+        char    path[PATH_MAX];
+        Pnm_ppm ppm;
+        int     fd;
+
+        state_path(path, dir, "destination");
+        fd = open(path, O_RDWR);
+        if (fd < 0) {
+                return NULL;
+        }
+        ppm = Tilefile_map_shared(fd);
+        close(fd);                      /* the mapping stays valid */
+
+        if (ppm != NULL && ((int)ppm->width != width ||
+                            (int)ppm->height != height ||
+                            ppm->denominator != maxval)) {
+                Pnm_ppmfree(&ppm);
+        }
+        return ppm;
+}
+
+/* [Name]:       save_destination
+ * [Purpose]:    Writes a freshly built destination as a tiled image,
+ *               replacing the kept one atomically
+ * [Parameters]: 1 const char* (dir), 1 Pnm_ppm (ppm)
+ * [Return]:     0 on success, -1 on a write error
+ */
+static int save_destination(const char *dir, Pnm_ppm ppm)
+{
+        char  path[PATH_MAX], temp[PATH_MAX];
+        FILE *fp;
+        int   ok;
+
+        state_path(path, dir, "destination");
+        state_path(temp, dir, "destination.tmp");
+        fp = fopen(temp, "wb");
+        if (fp == NULL) {
+                return -1;
+        }
+        ok = Tilefile_write(fp, ppm, 0) == 0;
+        ok = fclose(fp) == 0 && ok;
+        if (!ok || rename(temp, path) != 0) {
+                unlink(temp);
+                return -1;
+        }
+        return 0;
+}
+
+/* [Name]:       state_path
+ * [Purpose]:    Builds the path of a file in the state directory
+ * [Parameters]: 1 char* (path, PATH_MAX bytes), 2 const char* (dir, name)
+ * [Return]:     void
+ */
+static void state_path(char *path, const char *dir, const char *name)
+{
+        snprintf(path, PATH_MAX, "%s/%s", dir, name);
+}
+
+/*---------------------------------------------------------------
+ |                       Thread Helpers                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       run_bands
+ * [Purpose]:    Splits the block rows into bands, one per thread, and runs
+ *               work on each (see Bands_run)
+ * [Parameters]: 1 update* (u), 2 ints (rows, threads), 1 thread body (work)
+ * [Return]:     Sum of the bands' changed counts
+ */
+static long run_bands(update *u, int rows, int threads, void *work(void *))
+{
+        int  count   = threads < rows ? threads : rows;
+        long changed = 0;
+
+        count = count < 1 ? 1 : count;
+
+        band bands[count];
+        for (int i = 0; i < count; i++) {
+                bands[i].u       = u;
+                bands[i].changed = 0;
+                Bands_split(rows, 1, count, i, &bands[i].first,
+                            &bands[i].end);
+        }
+        Bands_run(bands, count, sizeof(band), work);
+
+        for (int i = 0; i < count; i++) {
+                changed += bands[i].changed;
+        }
+        return changed;
+}
@@ -0,0 +1,34 @@
+/*
+ *      incremental.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Incremental re-transformation (-incremental) for sequences of
+ *        images that change little from one run to the next
+ *      - A state directory keeps a hash of every source tile (the
+ *        UArray2b block grid) and the previous destination; a run
+ *        re-transforms only the tiles whose hash changed, writing them into
+ *        the kept destination in place
+ */
+
+#ifndef INCREMENTAL_INCLUDED
+#define INCREMENTAL_INCLUDED
+
+#include <stdio.h>
+
+#include "pnm.h"
+
+/* What a run did */
+typedef struct Incremental_stats {
+        long tiles;             /* source tiles */
+        long changed;           /* tiles re-transformed */
+        int  rebuilt;           /* no usable state: everything was redone */
+} Incremental_stats;
+
+extern Pnm_ppm Incremental_transform(Pnm_ppm ppm, const char *dir,
+                                     int transform_type, int magnitude,
+                                     int threads, Incremental_stats *stats,
+                                     float *time);
+extern void    Incremental_log      (const Incremental_stats *stats,
+                                     FILE *fp);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ *      incremental_test.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Tests -incremental's state directory (see incremental.c): the
+ *        layout of the hashes file, that an unchanged image reuses every
+ *        tile and a one-pixel change redoes exactly one, and that state
+ *        for another transformation, or damaged or missing state, forces
+ *        a rebuild; every result is checked pixel by pixel
+ *      - Exits nonzero if any check fails
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "a2blocked.h"
+#include "incremental.h"
+#include "mem.h"
+#include "transform.h"
+#include "uarray2b.h"
+
+#define WIDTH  200
+#define HEIGHT 150
+#define TILE   32               /* blocksize of the source */
+
+/* The hashes file's header, as incremental.c writes it */
+typedef struct state_header {
+        char     magic[8];
+        uint32_t width, height;
+        uint32_t maxval;
+        uint32_t tile_width, tile_height;
+        int32_t  transform_type, magnitude;
+        uint64_t tile_count;
+} state_header;
+
+static int checks = 0;
+static int failed = 0;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void    check      (int ok, const char *what);
+static Pnm_ppm new_image  (int changed_col, int changed_row);
+static void    pixel_at   (int col, int row, int changed_col,
+                           int changed_row, struct Pnm_rgb *pixel);
+static int     run        (const char *dir, int magnitude, int changed_col,
+                           int changed_row, int threads,
+                           Incremental_stats *stats);
+static void    state_file (char *path, const char *dir, const char *name);
+
+int main(void)
+{
+        char dir[] = "/tmp/incremental_test.XXXXXX";
+        char hashes[256], destination[256];
+        long tiles = ((WIDTH + TILE - 1) / TILE) *
+                     ((HEIGHT + TILE - 1) / TILE);
+        Incremental_stats stats;
+
+        if (mkdtemp(dir) == NULL) {
+                perror("mkdtemp");
+                return EXIT_FAILURE;
+        }
+        state_file(hashes, dir, "hashes");
+        state_file(destination, dir, "destination");
+
+        /* first run: no state, everything is built and saved */
+        check(run(dir, 90, -1, -1, 1, &stats), "first run's pixels");
+        check(stats.rebuilt && stats.tiles == tiles &&
+              stats.changed == tiles, "first run rebuilds");
+
+        state_header header;
+        struct stat  st;
+        FILE *fp = fopen(hashes, "rb");
+        check(fp != NULL && fread(&header, sizeof(header), 1, fp) == 1,
+              "hashes file has a header");
+        if (fp != NULL) {
+                fclose(fp);
+        }
+        check(memcmp(header.magic, "PPMINC2", 8) == 0 &&
+              header.width == WIDTH && header.height == HEIGHT &&
+              header.maxval == 255 && header.tile_width == TILE &&
+              header.tile_height == TILE && header.transform_type == ROTATE &&
+              header.magnitude == 90 && header.tile_count == (uint64_t)tiles,
+              "hashes header fields");
+        check(stat(hashes, &st) == 0 && st.st_size ==
+              (off_t)(sizeof(header) + tiles * sizeof(uint64_t)),
+              "one 64-bit hash per tile");
+        check(stat(destination, &st) == 0 && st.st_size >=
+              (off_t)WIDTH * HEIGHT * 3, "destination kept");
+
+        /* same image: every tile reused */
+        check(run(dir, 90, -1, -1, 3, &stats), "unchanged run's pixels");
+        check(!stats.rebuilt && stats.changed == 0, "unchanged run reuses");
+
+        /* one pixel changed: its tile alone is redone */
+        check(run(dir, 90, 100, 70, 3, &stats), "changed run's pixels");
+        check(!stats.rebuilt && stats.changed == 1, "one tile redone");
+        check(run(dir, 90, -1, -1, 1, &stats), "changed back");
+        check(!stats.rebuilt && stats.changed == 1, "changed back redone");
+
+        /* state for another transformation is not used */
+        check(run(dir, 270, -1, -1, 1, &stats), "other rotation's pixels");
+        check(stats.rebuilt, "other rotation rebuilds");
+
+        /* damaged or missing state is not used */
+        fp = fopen(hashes, "r+b");
+        if (fp != NULL) {
+                fputc('X', fp);
+                fclose(fp);
+        }
+        check(run(dir, 270, -1, -1, 1, &stats) && stats.rebuilt,
+              "bad magic rebuilds");
+        check(truncate(hashes, sizeof(header) + 8) == 0 &&
+              run(dir, 270, -1, -1, 1, &stats) && stats.rebuilt,
+              "short hashes rebuild");
+        check(unlink(destination) == 0 && run(dir, 270, -1, -1, 1, &stats) &&
+              stats.rebuilt, "missing destination rebuilds");
+        check(run(dir, 270, -1, -1, 1, &stats) && !stats.rebuilt,
+              "rebuilt state is used again");
+
+        unlink(hashes);
+        unlink(destination);
+        rmdir(dir);
+
+        printf("incremental_test: %d checks, %d failed\n", checks, failed);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* [Name]:       check
+ * [Purpose]:    Counts a check and reports it if it failed
+ * [Parameters]: 1 int (ok), 1 const char* (what was checked)
+ * [Return]:     void
+ */
+static void check(int ok, const char *what)
+{
+        checks++;
+        if (!ok) {
+                failed++;
+                fprintf(stderr, "FAIL %s\n", what);
+        }
+}
+
+/* [Name]:       pixel_at
+ * [Purpose]:    The test image's pixel at (col, row); the pixel at
+ *               (changed_col, changed_row) is inverted
+ * [Parameters]: 4 ints (col, row, changed_col, changed_row),
+ *               1 Pnm_rgb (pixel, filled in)
+ * [Return]:     void
+ */
+static void pixel_at(int col, int row, int changed_col, int changed_row,
+                     struct Pnm_rgb *pixel)
+{
+        pixel->red   = (col * 7) & 0xff;
+        pixel->green = (row * 13) & 0xff;
+        pixel->blue  = (col ^ row) & 0xff;
+        if (col == changed_col && row == changed_row) {
+                pixel->red = 255 - pixel->red;
+        }
+}
+
+/* [Name]:       new_image
+ * [Purpose]:    Makes the WIDTH x HEIGHT test image in blocked storage
+ *               with TILE x TILE blocks
+ * [Parameters]: 2 ints (changed_col, changed_row; -1 for none)
+ * [Return]:     The image
+ */
+static Pnm_ppm new_image(int changed_col, int changed_row)
+{
+        A2Methods_T methods = uarray2_methods_blocked;
+        Pnm_ppm     ppm;
+
+        NEW(ppm);
+        ppm->width       = WIDTH;
+        ppm->height      = HEIGHT;
+        ppm->denominator = 255;
+        ppm->methods     = methods;
+        ppm->pixels      = methods->new_with_blocksize(WIDTH, HEIGHT,
+                                                       sizeof(struct Pnm_rgb),
+                                                       TILE);
+        for (int row = 0; row < HEIGHT; row++) {
+                for (int col = 0; col < WIDTH; col++) {
+                        pixel_at(col, row, changed_col, changed_row,
+                                 methods->at(ppm->pixels, col, row));
+                }
+        }
+        return ppm;
+}
+
+/* [Name]:       run
+ * [Purpose]:    Rotates the test image incrementally with the state in dir
+ *               and checks every pixel of the result
+ * [Parameters]: 1 const char* (dir), 4 ints (magnitude, 90 or 270;
+ *               changed_col, changed_row; threads), 1 Incremental_stats*
+ *               (stats, filled in)
+ * [Return]:     1 if the result is right, 0 otherwise
+ */
+static int run(const char *dir, int magnitude, int changed_col,
+               int changed_row, int threads, Incremental_stats *stats)
+{
+        Pnm_ppm ppm = Incremental_transform(new_image(changed_col,
+                                                      changed_row),
+                                            dir, ROTATE, magnitude, threads,
+                                            stats, NULL);
+        int ok = ppm != NULL && ppm->width == HEIGHT &&
+                 ppm->height == WIDTH;
+
+        for (int row = 0; ok && row < HEIGHT; row++) {
+                for (int col = 0; ok && col < WIDTH; col++) {
+                        struct Pnm_rgb want;
+                        int dest_col = magnitude == 90 ? HEIGHT - 1 - row
+                                                       : row;
+                        int dest_row = magnitude == 90 ? col
+                                                       : WIDTH - 1 - col;
+                        pixel_at(col, row, changed_col, changed_row, &want);
+                        ok = memcmp(ppm->methods->at(ppm->pixels, dest_col,
+                                                     dest_row),
+                                    &want, sizeof(want)) == 0;
+                }
+        }
+        if (ppm != NULL) {
+                Pnm_ppmfree(&ppm);
+        }
+        return ok;
+}
+
+/* [Name]:       state_file
+ * [Purpose]:    Builds the path of a file in the state directory
+ * [Parameters]: 1 char* (path, 256 bytes), 2 const char* (dir, name)
+ * [Return]:     void
+ */
+static void state_file(char *path, const char *dir, const char *name)
+{
+        snprintf(path, 256, "%s/%s", dir, name);
+}
@@ -0,0 +1,346 @@
+/*
+ *      lib_test.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Tests the embeddable library (libppmtrans.h) and ppmtrans's own
+ *        transform against a pixel-at-a-time reference: every operation,
+ *        pixel format, traversal, thread count and copy tuning, on padded
+ *        rows whose padding must survive untouched
+ *      - The plain transform (which hands plain images to the library)
+ *        and the blocked one (which moves tiles itself) must both agree
+ *        with the reference, and so with each other
+ *      - Bad arguments must fail with EINVAL
+ *      - Exits nonzero if any check fails
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a2blocked.h"
+#include "a2plain.h"
+#include "libppmtrans.h"
+#include "transform.h"
+
+/* Extra pixels of padding at the end of each row */
+#define PAD 3
+
+/* Padding and untouched destination bytes are filled with this */
+#define FILL 0xab
+
+/* Image sizes: odd, a single row and column, and big enough for bands
+ * and block-major tiles */
+static const int sizes[][2] = { { 37, 23 }, { 1, 9 }, { 9, 1 },
+                                { 301, 199 } };
+
+static const Ppmtrans_format formats[] = { PPMTRANS_RGB8, PPMTRANS_RGBA8,
+                                           PPMTRANS_RGB16,
+                                           PPMTRANS_PNM_RGB };
+
+static const Ppmtrans_traversal traversals[] = { PPMTRANS_DEFAULT,
+                                                 PPMTRANS_ROW_MAJOR,
+                                                 PPMTRANS_COL_MAJOR,
+                                                 PPMTRANS_BLOCK_MAJOR };
+
+static int checks = 0;
+static int failed = 0;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void check        (int ok, const char *what, int op, int width,
+                          int height);
+static void dest_cell    (Ppmtrans_op op, int width, int height, int col,
+                          int row, int *dest_col, int *dest_row);
+static void op_transform (Ppmtrans_op op, int *type, int *magnitude);
+static void fill_source  (unsigned char *pixels, long bytes);
+static void test_library (Ppmtrans_format format, Ppmtrans_op op,
+                          int width, int height);
+static void test_errors  (void);
+static void test_transform(A2Methods_T methods, Ppmtrans_op op, int width,
+                           int height, int threads);
+
+int main(void)
+{
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+                for (int op = PPMTRANS_ROTATE_0; op <= PPMTRANS_TRANSPOSE;
+                     op++) {
+                        for (size_t f = 0;
+                             f < sizeof(formats) / sizeof(formats[0]); f++) {
+                                test_library(formats[f], op, sizes[s][0],
+                                             sizes[s][1]);
+                        }
+                        for (int threads = 1; threads <= 3; threads += 2) {
+                                test_transform(uarray2_methods_plain, op,
+                                               sizes[s][0], sizes[s][1],
+                                               threads);
+                                test_transform(uarray2_methods_blocked, op,
+                                               sizes[s][0], sizes[s][1],
+                                               threads);
+                        }
+                }
+        }
+        test_errors();
+
+        printf("lib_test: %d checks, %d failed\n", checks, failed);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* [Name]:       check
+ * [Purpose]:    Counts a check and reports it if it failed
+ * [Parameters]: 1 int (ok), 1 const char* (what was checked), 3 ints
+ *               (op, source width and height)
+ * [Return]:     void
+ */
+static void check(int ok, const char *what, int op, int width, int height)
+{
+        checks++;
+        if (!ok) {
+                failed++;
+                fprintf(stderr, "FAIL %s: op %d on %dx%d\n", what, op, width,
+                        height);
+        }
+}
+
+/* [Name]:       dest_cell
+ * [Purpose]:    Reference: where an operation sends source (col, row);
+ *               quarter turns and transpose swap the axes, then the
+ *               destination columns and/or rows are mirrored
+ * [Parameters]: 1 Ppmtrans_op (op), 4 ints (source width and height, col,
+ *               row), 2 int* (dest_col, dest_row; set)
+ * [Return]:     void
+ */
+static void dest_cell(Ppmtrans_op op, int width, int height, int col,
+                      int row, int *dest_col, int *dest_row)
+{
+        *dest_col = col;
+        *dest_row = row;
+        if (op == PPMTRANS_ROTATE_90 || op == PPMTRANS_ROTATE_270 ||
+            op == PPMTRANS_TRANSPOSE) {
+                *dest_col = row;
+                *dest_row = col;
+        }
+        if (op == PPMTRANS_ROTATE_90 || op == PPMTRANS_ROTATE_180 ||
+            op == PPMTRANS_FLIP_HORIZONTAL) {
+                *dest_col = (op == PPMTRANS_ROTATE_90 ? height : width) - 1 -
+                            *dest_col;
+        }
+        if (op == PPMTRANS_ROTATE_180 || op == PPMTRANS_ROTATE_270 ||
+            op == PPMTRANS_FLIP_VERTICAL) {
+                *dest_row = (op == PPMTRANS_ROTATE_270 ? width : height) - 1 -
+                            *dest_row;
+        }
+}
+
+/* [Name]:       op_transform
+ * [Purpose]:    Gives ppmtrans's transform type and magnitude for an op
+ * [Parameters]: 1 Ppmtrans_op (op), 2 int* (type, magnitude; set)
+ * [Return]:     void
+ */
+static void op_transform(Ppmtrans_op op, int *type, int *magnitude)
+{
+        if (op == PPMTRANS_FLIP_HORIZONTAL || op == PPMTRANS_FLIP_VERTICAL) {
+                *type      = FLIP;
+                *magnitude = op == PPMTRANS_FLIP_HORIZONTAL ? HORIZ : VERT;
+        } else if (op == PPMTRANS_TRANSPOSE) {
+                *type      = TRANSPOSE;
+                *magnitude = 0;
+        } else {
+                *type      = ROTATE;
+                *magnitude = 90 * (op - PPMTRANS_ROTATE_0);
+        }
+}
+
+/* [Name]:       fill_source
+ * [Purpose]:    Fills a buffer with a pattern that makes neighbouring
+ *               pixels differ
+ * [Parameters]: 1 unsigned char* (pixels), 1 long (bytes)
+ * [Return]:     void
+ */
+static void fill_source(unsigned char *pixels, long bytes)
+{
+        for (long i = 0; i < bytes; i++) {
+                pixels[i] = (unsigned char)((i * 2654435761u) >> 13);
+        }
+}
+
+/*---------------------------------------------------------------
+ |                        Library Tests                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       test_library
+ * [Purpose]:    Runs one op on one format through Ppmtrans_transform with
+ *               every traversal, 1 and 3 threads, and with and without
+ *               prefetch and non-temporal stores; each result must match
+ *               the reference, padding included
+ * [Parameters]: 1 Ppmtrans_format (format), 1 Ppmtrans_op (op), 2 ints
+ *               (source width, height)
+ * [Return]:     void
+ */
+static void test_library(Ppmtrans_format format, Ppmtrans_op op, int width,
+                         int height)
+{
+        int  size = Ppmtrans_pixel_size(format);
+        int  out_width, out_height;
+
+        check(Ppmtrans_output_size(op, width, height, &out_width,
+                                   &out_height) == 0, "output size", op,
+              width, height);
+
+        Ppmtrans_image source = { NULL, width, height,
+                                  (long)(width + PAD) * size, format };
+        Ppmtrans_image dest   = { NULL, out_width, out_height,
+                                  (long)(out_width + PAD) * size, format };
+        long src_bytes = source.stride * height;
+        long dst_bytes = dest.stride * out_height;
+        unsigned char *expected = malloc(dst_bytes);
+
+        source.pixels = malloc(src_bytes);
+        dest.pixels   = malloc(dst_bytes);
+        if (source.pixels == NULL || dest.pixels == NULL ||
+            expected == NULL) {
+                fprintf(stderr, "lib_test: out of memory\n");
+                exit(EXIT_FAILURE);
+        }
+        fill_source(source.pixels, src_bytes);
+        memset(expected, FILL, dst_bytes);
+        for (int row = 0; row < height; row++) {
+                for (int col = 0; col < width; col++) {
+                        int dc, dr;
+                        dest_cell(op, width, height, col, row, &dc, &dr);
+                        memcpy(expected + dr * dest.stride + (long)dc * size,
+                               (unsigned char *)source.pixels +
+                               row * source.stride + (long)col * size, size);
+                }
+        }
+
+        for (size_t t = 0; t < sizeof(traversals) / sizeof(traversals[0]);
+             t++) {
+                for (int variant = 0; variant < 8; variant++) {
+                        Ppmtrans_options options;
+                        options.op        = op;
+                        options.traversal = traversals[t];
+                        options.threads   = variant & 1 ? 3 : 1;
+                        options.prefetch  = variant & 2 ? 8 : 0;
+                        options.nt_stores = variant & 4 ? 1 : 0;
+
+                        memset(dest.pixels, FILL, dst_bytes);
+                        int status = Ppmtrans_transform(&source, &dest,
+                                                        &options);
+                        check(status == 0 && memcmp(dest.pixels, expected,
+                                                    dst_bytes) == 0,
+                              "Ppmtrans_transform", op, width, height);
+                }
+        }
+
+        free(expected);
+        free(source.pixels);
+        free(dest.pixels);
+}
+
+/* [Name]:       test_errors
+ * [Purpose]:    Checks that mismatched formats and sizes, short strides
+ *               and overlapping buffers are refused with EINVAL
+ * [Parameters]: None
+ * [Return]:     void
+ */
+static void test_errors(void)
+{
+        unsigned char    buffer[4 * 8 * 8];
+        Ppmtrans_image   source  = { buffer, 4, 2, 12, PPMTRANS_RGB8 };
+        Ppmtrans_image   dest    = { buffer + 64, 2, 4, 6, PPMTRANS_RGB8 };
+        Ppmtrans_options options = { PPMTRANS_ROTATE_90, PPMTRANS_DEFAULT, 1,
+                                     0, 0 };
+        Ppmtrans_image   bad;
+
+        errno = 0;
+        check(Ppmtrans_transform(&source, &dest, &options) == 0,
+              "well-formed call", options.op, 4, 2);
+
+        bad = dest;
+        bad.format = PPMTRANS_RGBA8;
+        errno = 0;
+        check(Ppmtrans_transform(&source, &bad, &options) == -1 &&
+              errno == EINVAL, "format mismatch refused", options.op, 4, 2);
+
+        bad = dest;
+        bad.width = 4;
+        errno = 0;
+        check(Ppmtrans_transform(&source, &bad, &options) == -1 &&
+              errno == EINVAL, "wrong size refused", options.op, 4, 2);
+
+        bad = source;
+        bad.stride = 11;
+        errno = 0;
+        check(Ppmtrans_transform(&bad, &dest, &options) == -1 &&
+              errno == EINVAL, "short stride refused", options.op, 4, 2);
+
+        bad = dest;
+        bad.pixels = buffer + 6;
+        errno = 0;
+        check(Ppmtrans_transform(&source, &bad, &options) == -1 &&
+              errno == EINVAL, "overlap refused", options.op, 4, 2);
+}
+
+/*---------------------------------------------------------------
+ |                       Transform Tests                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       test_transform
+ * [Purpose]:    Runs one op through ppmtrans's transform on an image held
+ *               by methods, and checks every pixel against the reference
+ * [Parameters]: 1 A2Methods_T (methods), 1 Ppmtrans_op (op), 3 ints
+ *               (source width, height, threads)
+ * [Return]:     void
+ */
+static void test_transform(A2Methods_T methods, Ppmtrans_op op, int width,
+                           int height, int threads)
+{
+        struct Pnm_ppm image;
+        Pnm_ppm        ppm = &image;
+        long           bytes = (long)width * height * sizeof(struct Pnm_rgb);
+        unsigned char *pattern = malloc(bytes);
+        int            type, magnitude, ok = 1;
+
+        if (pattern == NULL) {
+                fprintf(stderr, "lib_test: out of memory\n");
+                exit(EXIT_FAILURE);
+        }
+        fill_source(pattern, bytes);
+        image.width       = width;
+        image.height      = height;
+        image.denominator = 255;
+        image.methods     = methods;
+        image.pixels      = methods->new(width, height,
+                                         sizeof(struct Pnm_rgb));
+        for (int row = 0; row < height; row++) {
+                for (int col = 0; col < width; col++) {
+                        memcpy(methods->at(image.pixels, col, row),
+                               pattern + ((long)row * width + col) *
+                               sizeof(struct Pnm_rgb),
+                               sizeof(struct Pnm_rgb));
+                }
+        }
+
+        op_transform(op, &type, &magnitude);
+        ppm = transform(ppm, methods, methods->map_default, type, magnitude,
+                        threads, NULL);
+
+        for (int row = 0; ok && row < height; row++) {
+                for (int col = 0; ok && col < width; col++) {
+                        int dc, dr;
+                        dest_cell(op, width, height, col, row, &dc, &dr);
+                        ok = memcmp(methods->at(ppm->pixels, dc, dr),
+                                    pattern + ((long)row * width + col) *
+                                    sizeof(struct Pnm_rgb),
+                                    sizeof(struct Pnm_rgb)) == 0;
+                }
+        }
+        ok = ok && (int)ppm->width  == (swaps_axes(type, magnitude) ? height
+                                                                    : width);
+        check(ok, methods == uarray2_methods_plain ? "plain transform"
+                                                   : "blocked transform",
+              op, width, height);
+
+        methods->free(&ppm->pixels);
+        free(pattern);
+}
@@ -0,0 +1,448 @@
+/*
+ *      libppmtrans.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Rotates, flips or transposes caller-owned pixel buffers
+ *      - Every operation maps source (col, row) to a destination cell whose
+ *        byte offset is affine in col and row, so the whole transform is a
+ *        walk over the source with two fixed destination strides
+ *      - The walk is split into bands along its outer dimension, one band
+ *        per thread; bands write disjoint destination cells
+ *      - Tuned copies prefetch a fixed distance ahead on whichever side
+ *        strides across rows (the sequential side is left to the
+ *        hardware prefetcher), and may store destination pixels with
+ *        non-temporal stores when both are word aligned
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "bands.h"
+#include "libppmtrans.h"
+
+/* Tiles of block-major traversal hold at most this many bytes */
+#define TILE_BYTES (64 * 1024)
+
+/* Where each source pixel goes: destination byte offset of source (col,
+ * row) is origin + col * col_step + row * row_step */
+typedef struct geometry {
+        long origin;
+        long col_step;
+        long row_step;
+} geometry;
+
+/* Work description for one band; closure for the band workers */
+typedef struct band {
+        const unsigned char *source;
+        unsigned char       *destination;
+        long                 stride;            /* source row stride */
+        int                  width, height;     /* source dimensions */
+        int                  pixel_size;
+        geometry             geo;
+        Ppmtrans_traversal   traversal;
+        int                  tile;              /* block-major tile edge */
+        int                  first, end;        /* outer-dimension range */
+        int                  prefetch;          /* pixels ahead, or 0 */
+        int                  nt_stores;
+} band;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static int   image_ok     (const Ppmtrans_image *image);
+static void  geometry_init(geometry *geo, Ppmtrans_op op, int width,
+                           int height, long stride, int pixel_size);
+static void *walk_band    (void *cl);
+static void  copy_pixels  (const unsigned char *src, long src_step,
+                           unsigned char *dst, long dst_step, int count,
+                           int pixel_size);
+static void  copy_tuned   (const unsigned char *src, long src_step,
+                           unsigned char *dst, long dst_step, int count,
+                           const band *b);
+static void  copy_line    (const band *b, const unsigned char *src,
+                           long src_step, unsigned char *dst,
+                           long dst_step, int count);
+static int   tile_edge    (int pixel_size);
+
+/*---------------------------------------------------------------
+ |                        Public Functions                      |
+ *--------------------------------------------------------------*/
+/* [Name]:       Ppmtrans_pixel_size
+ * [Purpose]:    Gives the size of one pixel of a format
+ * [Parameters]: 1 Ppmtrans_format (format)
+ * [Return]:     Bytes per pixel, or -1 for an unknown format
+ */
+int Ppmtrans_pixel_size(Ppmtrans_format format)
+{
+        switch (format) {
+        case PPMTRANS_RGB8:    return 3;
+        case PPMTRANS_RGBA8:   return 4;
+        case PPMTRANS_RGB16:   return 3 * sizeof(unsigned short);
+        case PPMTRANS_PNM_RGB: return 3 * sizeof(unsigned);
+        }
+        return -1;
+}
+
+/* [Name]:       Ppmtrans_output_size
+ * [Purpose]:    Gives the dimensions of the image an operation produces, so
+ *               the caller can size the destination buffer
+ * [Parameters]: 1 Ppmtrans_op (op), 2 ints (source width, height), 2 int*
+ *               (out_width, out_height; filled in on success)
+ * [Return]:     0 on success, -1 (errno EINVAL) for a bad op or size
+ */
+int Ppmtrans_output_size(Ppmtrans_op op, int width, int height,
+                         int *out_width, int *out_height)
+{
+        if (width <= 0 || height <= 0 || out_width == NULL ||
+            out_height == NULL || op < PPMTRANS_ROTATE_0 ||
+            op > PPMTRANS_TRANSPOSE) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        if (op == PPMTRANS_ROTATE_90 || op == PPMTRANS_ROTATE_270 ||
+            op == PPMTRANS_TRANSPOSE) {
+                *out_width  = height;
+                *out_height = width;
+        } else {
+                *out_width  = width;
+                *out_height = height;
+        }
+        return 0;
+}
+
+/* [Name]:       Ppmtrans_transform
+ * [Purpose]:    Writes the transformed source into destination. Both images
+ *               must have the same format, destination must have the
+ *               dimensions given by Ppmtrans_output_size, and the two buffers
+ *               must not overlap. Padding bytes between rows of destination
+ *               are left untouched.
+ * [Parameters]: 2 const Ppmtrans_image* (source, destination),
+ *               1 const Ppmtrans_options* (options)
+ * [Return]:     0 on success, -1 (errno EINVAL) if the arguments do not fit
+ *               together
+ */
+int Ppmtrans_transform(const Ppmtrans_image *source,
+                       const Ppmtrans_image *destination,
+                       const Ppmtrans_options *options)
+{
+        int out_width, out_height;
+
+        if (source == NULL || destination == NULL || options == NULL ||
+            !image_ok(source) || !image_ok(destination) ||
+            source->format != destination->format ||
+            Ppmtrans_output_size(options->op, source->width, source->height,
+                                 &out_width, &out_height) != 0 ||
+            destination->width != out_width ||
+            destination->height != out_height ||
+            options->traversal < PPMTRANS_DEFAULT ||
+            options->traversal > PPMTRANS_BLOCK_MAJOR) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        const unsigned char *src = source->pixels;
+        unsigned char       *dst = destination->pixels;
+        long src_bytes = (source->height - 1) * source->stride +
+                         (long)source->width * Ppmtrans_pixel_size(
+                                                       source->format);
+        long dst_bytes = (destination->height - 1) * destination->stride +
+                         (long)destination->width * Ppmtrans_pixel_size(
+                                                       destination->format);
+        if (src < dst + dst_bytes && dst < src + src_bytes) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        band proto;
+        proto.source      = src;
+        proto.destination = dst;
+        proto.stride      = source->stride;
+        proto.width       = source->width;
+        proto.height      = source->height;
+        proto.pixel_size  = Ppmtrans_pixel_size(source->format);
+        proto.traversal   = options->traversal;
+        proto.tile        = tile_edge(proto.pixel_size);
+        proto.prefetch    = options->prefetch > 0 ? options->prefetch : 0;
+        proto.nt_stores   = options->nt_stores != 0;
+        geometry_init(&proto.geo, options->op, source->width, source->height,
+                      destination->stride, proto.pixel_size);
+
+        /* rows of the source become columns of the destination: tile it */
+        if (proto.traversal == PPMTRANS_DEFAULT) {
+                proto.traversal = (options->op == PPMTRANS_ROTATE_90 ||
+                                   options->op == PPMTRANS_ROTATE_270 ||
+                                   options->op == PPMTRANS_TRANSPOSE)
+                                  ? PPMTRANS_BLOCK_MAJOR
+                                  : PPMTRANS_ROW_MAJOR;
+        }
+
+        /* the outer dimension is split into bands */
+        int lines = proto.traversal == PPMTRANS_COL_MAJOR ? source->width
+                                                          : source->height;
+        /* block-major band edges stay on tile boundaries */
+        int align = proto.traversal == PPMTRANS_BLOCK_MAJOR ? proto.tile : 1;
+        int count = Bands_count(options->threads, lines, align);
+        band bands[count];
+        for (int i = 0; i < count; i++) {
+                bands[i] = proto;
+                Bands_split(lines, align, count, i, &bands[i].first,
+                            &bands[i].end);
+        }
+        Bands_run(bands, count, sizeof(band), walk_band);
+
+        return 0;
+}
+
+/*---------------------------------------------------------------
+ |                      Transform Functions                     |
+ *--------------------------------------------------------------*/
+/* [Name]:       geometry_init
+ * [Purpose]:    Works out where source pixels land in the destination for
+ *               an operation
+ * [Parameters]: 1 geometry* (geo, filled in), 1 Ppmtrans_op (op), 2 ints
+ *               (source width, height), 1 long (destination stride), 1 int
+ *               (pixel_size)
+ * [Return]:     void
+ */
+static void geometry_init(geometry *geo, Ppmtrans_op op, int width,
+                          int height, long stride, int pixel_size)
+{
+        long px = pixel_size;
+
+        /* destination (dcol, drow) = (a*col + b*row + c, d*col + e*row + f)
+         * and its offset is drow * stride + dcol * px */
+        switch (op) {
+        case PPMTRANS_ROTATE_0:
+                geo->col_step = px;
+                geo->row_step = stride;
+                geo->origin   = 0;
+                break;
+        case PPMTRANS_ROTATE_90:        /* (height - row - 1, col) */
+                geo->col_step = stride;
+                geo->row_step = -px;
+                geo->origin   = (height - 1) * px;
+                break;
+        case PPMTRANS_ROTATE_180:       /* (w - col - 1, h - row - 1) */
+                geo->col_step = -px;
+                geo->row_step = -stride;
+                geo->origin   = (height - 1) * stride + (width - 1) * px;
+                break;
+        case PPMTRANS_ROTATE_270:       /* (row, width - col - 1) */
+                geo->col_step = -stride;
+                geo->row_step = px;
+                geo->origin   = (width - 1) * stride;
+                break;
+        case PPMTRANS_FLIP_HORIZONTAL:  /* (width - col - 1, row) */
+                geo->col_step = -px;
+                geo->row_step = stride;
+                geo->origin   = (width - 1) * px;
+                break;
+        case PPMTRANS_FLIP_VERTICAL:    /* (col, height - row - 1) */
+                geo->col_step = px;
+                geo->row_step = -stride;
+                geo->origin   = (height - 1) * stride;
+                break;
+        case PPMTRANS_TRANSPOSE:        /* (row, col) */
+                geo->col_step = stride;
+                geo->row_step = px;
+                geo->origin   = 0;
+                break;
+        }
+}
+
+/* [Name]:       walk_band
+ * [Purpose]:    Moves every source pixel of one band to its destination,
+ *               visiting them in the band's traversal order
+ * [Parameters]: 1 void* (closure; the band)
+ * [Return]:     NULL
+ */
+static void *walk_band(void *cl)
+{
+        band *b  = cl;
+        long  px = b->pixel_size;
+
+        if (b->traversal == PPMTRANS_ROW_MAJOR) {
+                for (int row = b->first; row < b->end; row++) {
+                        copy_line(b, b->source + row * b->stride, px,
+                                  b->destination + b->geo.origin +
+                                  row * b->geo.row_step, b->geo.col_step,
+                                  b->width);
+                }
+        } else if (b->traversal == PPMTRANS_COL_MAJOR) {
+                for (int col = b->first; col < b->end; col++) {
+                        copy_line(b, b->source + col * px, b->stride,
+                                  b->destination + b->geo.origin +
+                                  col * b->geo.col_step, b->geo.row_step,
+                                  b->height);
+                }
+        } else {
+                for (int row0 = b->first; row0 < b->end; row0 += b->tile) {
+                        int rows = b->end - row0 < b->tile ? b->end - row0
+                                                           : b->tile;
+                        for (int col0 = 0; col0 < b->width; col0 += b->tile) {
+                                int cols = b->width - col0 < b->tile
+                                           ? b->width - col0 : b->tile;
+                                for (int row = row0; row < row0 + rows;
+                                     row++) {
+                                        copy_line(b, b->source +
+                                                  row * b->stride +
+                                                  col0 * px, px,
+                                                  b->destination +
+                                                  b->geo.origin +
+                                                  row * b->geo.row_step +
+                                                  col0 * b->geo.col_step,
+                                                  b->geo.col_step, cols);
+                                }
+                        }
+                }
+        }
+#if defined(__SSE2__)
+        if (b->nt_stores) {
+                _mm_sfence();   /* order the streamed stores before use */
+        }
+#endif
+        return NULL;
+}
+
+/* [Name]:       copy_line
+ * [Purpose]:    Copies one run of the walk, tuned if the band asks for it
+ * [Parameters]: 1 const band* (b), 1 const unsigned char* (src), 1 long
+ *               (src_step), 1 unsigned char* (dst), 1 long (dst_step),
+ *               1 int (count)
+ * [Return]:     void
+ */
+static void copy_line(const band *b, const unsigned char *src, long src_step,
+                      unsigned char *dst, long dst_step, int count)
+{
+        if (b->prefetch > 0 || b->nt_stores) {
+                copy_tuned(src, src_step, dst, dst_step, count, b);
+        } else {
+                copy_pixels(src, src_step, dst, dst_step, count,
+                            b->pixel_size);
+        }
+}
+
+/* [Name]:       copy_pixels
+ * [Purpose]:    Copies a run of pixels between two strided lines; the size
+ *               is switched on once so each loop copies a constant size
+ * [Parameters]: 1 const unsigned char* (src), 1 long (src_step),
+ *               1 unsigned char* (dst), 1 long (dst_step), 2 ints (count,
+ *               pixel_size)
+ * [Return]:     void
+ */
+static void copy_pixels(const unsigned char *src, long src_step,
+                        unsigned char *dst, long dst_step, int count,
+                        int pixel_size)
+{
+#define COPY_LOOP(SIZE) do {                                            \
+        for (int i = 0; i < count; i++) {                               \
+                memcpy(dst, src, (SIZE));                               \
+                src += src_step;                                        \
+                dst += dst_step;                                        \
+        }                                                               \
+} while (0)
+
+        switch (pixel_size) {
+        case 3:  COPY_LOOP(3);  break;
+        case 4:  COPY_LOOP(4);  break;
+        case 6:  COPY_LOOP(6);  break;
+        case 12: COPY_LOOP(12); break;
+        default: COPY_LOOP(pixel_size); break;
+        }
+
+#undef COPY_LOOP
+}
+
+/* [Name]:       copy_tuned
+ * [Purpose]:    Copies a run of pixels like copy_pixels, prefetching the
+ *               cell b->prefetch pixels ahead on each side whose step
+ *               crosses rows (not the destination when streaming it), and
+ *               storing the destination with non-temporal word stores when
+ *               asked to and it is word aligned
+ * [Parameters]: 1 const unsigned char* (src), 1 long (src_step),
+ *               1 unsigned char* (dst), 1 long (dst_step), 1 int (count),
+ *               1 const band* (b)
+ * [Return]:     void
+ */
+static void copy_tuned(const unsigned char *src, long src_step,
+                       unsigned char *dst, long dst_step, int count,
+                       const band *b)
+{
+        int  size      = b->pixel_size;
+        int  ahead     = b->prefetch < count ? b->prefetch : 0;
+        int  fetch_src = ahead > 0 && src_step != size;
+        int  fetch_dst = ahead > 0 && dst_step != size &&
+                         dst_step != -size && !b->nt_stores;
+        int  stream    = 0;
+        long src_ahead = ahead * src_step;
+        long dst_ahead = ahead * dst_step;
+
+#if defined(__SSE2__)
+        stream = b->nt_stores && size % 4 == 0 &&
+                 ((uintptr_t)dst | (uintptr_t)dst_step) % 4 == 0;
+#endif
+        for (int i = 0; i < count; i++) {
+                if (i + ahead < count) {
+                        if (fetch_src) {
+                                __builtin_prefetch(src + src_ahead, 0, 3);
+                        }
+                        if (fetch_dst) {
+                                __builtin_prefetch(dst + dst_ahead, 1, 1);
+                        }
+                }
+#if defined(__SSE2__)
+                if (stream) {
+                        for (int word = 0; word < size; word += 4) {
+                                int value;
+                                memcpy(&value, src + word, 4);
+                                _mm_stream_si32((int *)(dst + word), value);
+                        }
+                        src += src_step;
+                        dst += dst_step;
+                        continue;
+                }
+#endif
+                memcpy(dst, src, size);
+                src += src_step;
+                dst += dst_step;
+        }
+        (void)stream;
+}
+
+/*---------------------------------------------------------------
+ |                        Helper Functions                      |
+ *--------------------------------------------------------------*/
+/* [Name]:       image_ok
+ * [Purpose]:    Checks that an image description is self-consistent
+ * [Parameters]: 1 const Ppmtrans_image* (image)
+ * [Return]:     1 if usable, 0 otherwise
+ */
+static int image_ok(const Ppmtrans_image *image)
+{
+        int size = Ppmtrans_pixel_size(image->format);
+
+        return image->pixels != NULL && size > 0 && image->width > 0 &&
+               image->height > 0 &&
+               image->stride >= (long)image->width * size;
+}
+
+/* [Name]:       tile_edge
+ * [Purpose]:    Picks the block-major tile edge: the largest power of two
+ *               whose square tile fits in TILE_BYTES
+ * [Parameters]: 1 int (pixel_size)
+ * [Return]:     Tile edge in pixels
+ */
+static int tile_edge(int pixel_size)
+{
+        int edge = 1;
+
+        while ((long)(2 * edge) * (2 * edge) * pixel_size <= TILE_BYTES) {
+                edge *= 2;
+        }
+        return edge;
+}
@@ -0,0 +1,71 @@
+/*
+ *      libppmtrans.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Embeddable interface to ppmtrans's transformations
+ *      - Works directly on caller-owned pixel buffers (no ppm encoding, no
+ *        files); the caller picks the pixel format, row stride, thread
+ *        count and traversal order, and may tune the copy with software
+ *        prefetch and non-temporal stores
+ *      - Depends only on libc and pthreads; link with libppmtrans.a
+ *        and -lpthread
+ */
+
+#ifndef LIBPPMTRANS_INCLUDED
+#define LIBPPMTRANS_INCLUDED
+
+/* Bumped whenever a declaration below changes incompatibly */
+#define PPMTRANS_API_VERSION 2
+
+/* Layout of one pixel; channels are in memory order */
+typedef enum Ppmtrans_format {
+        PPMTRANS_RGB8,          /* 3 bytes: r, g, b                     */
+        PPMTRANS_RGBA8,         /* 4 bytes: r, g, b, a (a is carried)   */
+        PPMTRANS_RGB16,         /* 3 native-endian unsigned shorts      */
+        PPMTRANS_PNM_RGB        /* struct Pnm_rgb: 3 unsigned ints      */
+} Ppmtrans_format;
+
+typedef enum Ppmtrans_op {
+        PPMTRANS_ROTATE_0,
+        PPMTRANS_ROTATE_90,
+        PPMTRANS_ROTATE_180,
+        PPMTRANS_ROTATE_270,
+        PPMTRANS_FLIP_HORIZONTAL,
+        PPMTRANS_FLIP_VERTICAL,
+        PPMTRANS_TRANSPOSE
+} Ppmtrans_op;
+
+/* Order in which source pixels are visited */
+typedef enum Ppmtrans_traversal {
+        PPMTRANS_DEFAULT,       /* best order for the operation         */
+        PPMTRANS_ROW_MAJOR,
+        PPMTRANS_COL_MAJOR,
+        PPMTRANS_BLOCK_MAJOR    /* square tiles sized to fit in cache   */
+} Ppmtrans_traversal;
+
+/* A caller-owned image; row r starts at (char *)pixels + r * stride */
+typedef struct Ppmtrans_image {
+        void            *pixels;
+        int              width, height;
+        long             stride;        /* bytes, >= width * pixel size */
+        Ppmtrans_format  format;
+} Ppmtrans_image;
+
+typedef struct Ppmtrans_options {
+        Ppmtrans_op        op;
+        Ppmtrans_traversal traversal;
+        int                threads;     /* < 1 means 1 */
+        int                prefetch;    /* pixels ahead on a strided side,
+                                           0 for none */
+        int                nt_stores;   /* nonzero: stream destination
+                                           stores past the caches */
+} Ppmtrans_options;
+
+extern int Ppmtrans_pixel_size (Ppmtrans_format format);
+extern int Ppmtrans_output_size(Ppmtrans_op op, int width, int height,
+                                int *out_width, int *out_height);
+extern int Ppmtrans_transform  (const Ppmtrans_image *source,
+                                const Ppmtrans_image *destination,
+                                const Ppmtrans_options *options);
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ *      pam.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Reads and writes PAM (P7) images row by row through a stdio
+ *        stream
+ *      - Pixels are 4-byte words; a row that the storage keeps contiguous
+ *        (every row of plain storage, and of blocked storage whose tiles
+ *        are as wide as the image) of a depth-4 image is read and written
+ *        in place, without a per-pixel unpacking pass
+ *      - Encoding reads sparse images without expanding their uniform
+ *        tiles
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "a2blocked.h"
+#include "a2plain.h"
+#include "a2sparse.h"
+#include "mem.h"
+#include "pam.h"
+#include "uarray2b.h"
+
+typedef A2Methods_UArray2 A2;
+
+/* Longest header line we accept */
+#define MAX_LINE 256
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static int  header_field(const char *line, Pam_header *header, int *seen);
+static int  tupltype_fits(const Pam_header *header);
+static Pam_pixel *row_run(A2Methods_T methods, A2 pixels, int row);
+static const Pam_pixel *pixel_at(A2Methods_T methods, A2 pixels, int col,
+                                 int row);
+
+/*---------------------------------------------------------------
+ |                       Header Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Pam_probe
+ * [Purpose]:    Checks whether a stream starts with the P7 magic number
+ *               without consuming anything: regular files are peeked at
+ *               with pread, other streams by pushing the bytes back
+ * [Parameters]: 1 FILE* (fp, nothing read from it yet)
+ * [Return]:     1 if fp holds a PAM image, 0 otherwise
+ */
+int Pam_probe(FILE *fp)
+{
+        unsigned char magic[2];
+        struct stat   st;
+        int           first, second;
+
+        assert(fp != NULL);
+
+        if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)) {
+                off_t offset = lseek(fileno(fp), 0, SEEK_CUR);
+                return offset >= 0 &&
+                       pread(fileno(fp), magic, 2, offset) == 2 &&
+                       magic[0] == 'P' && magic[1] == '7';
+        }
+
+        /* glibc keeps a pushback area, so two bytes can go back */
+        first = getc(fp);
+        if (first == EOF) {
+                return 0;
+        }
+        second = getc(fp);
+        if (second != EOF) {
+                ungetc(second, fp);
+        }
+        ungetc(first, fp);
+        return first == 'P' && second == '7';
+}
+
+/* [Name]:       Pam_read_header
+ * [Purpose]:    Reads a P7 header (WIDTH, HEIGHT, DEPTH, MAXVAL and any
+ *               TUPLTYPE lines, up to ENDHDR), consuming exactly the header
+ *               so that the next byte read is the raster. A standard
+ *               TUPLTYPE must agree with DEPTH.
+ * [Parameters]: 1 FILE* (fp), 1 Pam_header* (header, filled in on success)
+ * [Return]:     1 if a supported P7 header was read, 0 otherwise
+ */
+int Pam_read_header(FILE *fp, Pam_header *header)
+{
+        char line[MAX_LINE];
+        int  seen = 0;          /* bit per required field */
+
+        assert(fp != NULL && header != NULL);
+
+        if (fgets(line, MAX_LINE, fp) == NULL ||
+            strcmp(line, "P7\n") != 0) {
+                return 0;
+        }
+        header->tupltype[0] = '\0';
+        while (fgets(line, MAX_LINE, fp) != NULL) {
+                char *text = line + strspn(line, " \t\r");
+                if (strchr(line, '\n') == NULL) {
+                        return 0;       /* line too long */
+                }
+                if (strncmp(text, "ENDHDR", 6) == 0) {
+                        return seen == 0xf && header->width > 0 &&
+                               header->height > 0 && header->depth >= 1 &&
+                               header->depth <= 4 && header->maxval >= 1 &&
+                               header->maxval <= 255 &&
+                               tupltype_fits(header);
+                }
+                if (*text != '#' && *text != '\n' &&
+                    header_field(text, header, &seen) != 1) {
+                        return 0;
+                }
+        }
+        return 0;
+}
+
+/* [Name]:       header_field
+ * [Purpose]:    Parses one "<NAME> <value>" line of a P7 header; repeated
+ *               TUPLTYPE lines are joined with spaces, as the format asks
+ * [Parameters]: 1 const char* (line), 1 Pam_header* (header),
+ *               1 int* (seen; bits of the numeric fields found so far)
+ * [Return]:     1 if the line was understood, 0 otherwise
+ */
+static int header_field(const char *line, Pam_header *header, int *seen)
+{
+        static const char *names[] = { "WIDTH", "HEIGHT", "DEPTH",
+                                       "MAXVAL" };
+        int *fields[] = { &header->width, &header->height, &header->depth,
+                          &header->maxval };
+        char name[16];
+        int  length;
+
+        if (sscanf(line, "%15s %n", name, &length) != 1) {
+                return 0;
+        }
+        if (strcmp(name, "TUPLTYPE") == 0) {
+                size_t used = strlen(header->tupltype);
+                size_t more = strcspn(line + length, "\r\n");
+                if (used + (used > 0) + more >= PAM_MAX_TUPLTYPE) {
+                        return 0;
+                }
+                if (used > 0) {
+                        header->tupltype[used++] = ' ';
+                }
+                memcpy(header->tupltype + used, line + length, more);
+                header->tupltype[used + more] = '\0';
+                return 1;
+        }
+        for (int f = 0; f < 4; f++) {
+                char *end;
+                long  value;
+                if (strcmp(name, names[f]) != 0) {
+                        continue;
+                }
+                value = strtol(line + length, &end, 10);
+                if (end == line + length || value < 0 ||
+                    value > 0x7fffffff) {
+                        return 0;
+                }
+                *fields[f] = value;
+                *seen     |= 1 << f;
+                return 1;
+        }
+        return 0;
+}
+
+/* [Name]:       tupltype_fits
+ * [Purpose]:    Checks a standard tuple type against the depth it implies
+ *               (RGB 3, RGB_ALPHA 4, GRAYSCALE and BLACKANDWHITE 1, their
+ *               _ALPHA forms 2); a missing or non-standard tuple type says
+ *               nothing about the depth
+ * [Parameters]: 1 const Pam_header* (header)
+ * [Return]:     1 if the depth fits, 0 otherwise
+ */
+static int tupltype_fits(const Pam_header *header)
+{
+        static const struct {
+                const char *name;
+                int         depth;
+        } types[] = {
+                { "RGB",                 3 }, { "RGB_ALPHA",           4 },
+                { "GRAYSCALE",           1 }, { "GRAYSCALE_ALPHA",     2 },
+                { "BLACKANDWHITE",       1 }, { "BLACKANDWHITE_ALPHA", 2 },
+        };
+
+        size_t length = strlen(header->tupltype);
+
+        while (length > 0 && strchr(" \t", header->tupltype[length - 1])) {
+                length--;               /* trailing blanks are not part */
+        }
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+                if (strlen(types[i].name) == length &&
+                    strncmp(header->tupltype, types[i].name, length) == 0) {
+                        return header->depth == types[i].depth;
+                }
+        }
+        return 1;
+}
+
+/*---------------------------------------------------------------
+ |                     Read / Write Functions                   |
+ *--------------------------------------------------------------*/
+/* [Name]:       Pam_read
+ * [Purpose]:    Reads a P7 image from a stream into 4-byte pixels held by
+ *               methods; its maxval becomes the image's denominator
+ * [Parameters]: 1 FILE* (fp), 1 A2Methods_T (methods), 1 Pam_header*
+ *               (header, filled in)
+ * [Return]:     The image, or NULL if fp does not hold a complete,
+ *               supported PAM image
+ */
+Pnm_ppm Pam_read(FILE *fp, A2Methods_T methods, Pam_header *header)
+{
+        unsigned char *row_buf;
+        long           row_bytes;
+        Pnm_ppm        image;
+
+        assert(fp != NULL && methods != NULL && header != NULL);
+
+        if (Pam_read_header(fp, header) != 1) {
+                return NULL;
+        }
+        row_bytes = (long)header->width * header->depth;
+        row_buf   = malloc(row_bytes);
+        if (row_buf == NULL) {
+                return NULL;
+        }
+
+        NEW(image);
+        image->width       = header->width;
+        image->height      = header->height;
+        image->denominator = header->maxval;
+        image->methods     = methods;
+        image->pixels      = methods->new(header->width, header->height,
+                                          sizeof(Pam_pixel));
+
+        for (int row = 0; row < header->height; row++) {
+                Pam_pixel *run = row_run(methods, image->pixels, row);
+                if (run != NULL && header->depth == sizeof(Pam_pixel)) {
+                        if (fread(run, row_bytes, 1, fp) != 1) {
+                                break;
+                        }
+                        continue;
+                }
+                if (fread(row_buf, row_bytes, 1, fp) != 1) {
+                        break;
+                }
+                for (int col = 0; col < header->width; col++) {
+                        Pam_pixel pixel = 0;
+                        memcpy(&pixel, row_buf + (long)col * header->depth,
+                               header->depth);
+                        *(Pam_pixel *)methods->at(image->pixels, col, row) =
+                                pixel;
+                }
+        }
+        free(row_buf);
+        if (ferror(fp) || feof(fp)) {
+                Pnm_ppmfree(&image);
+                return NULL;
+        }
+        return image;
+}
+
+/* [Name]:       Pam_write
+ * [Purpose]:    Writes an image of 4-byte pixels as P7 to a stream, with
+ *               the depth and tuple type of header
+ * [Parameters]: 1 FILE* (fp), 1 Pnm_ppm (image), 1 const Pam_header*
+ *               (header)
+ * [Return]:     0 on success, -1 on a write error
+ */
+int Pam_write(FILE *fp, Pnm_ppm image, const Pam_header *header)
+{
+        unsigned char *row_buf;
+        long           row_bytes;
+        int            status = 0;
+
+        assert(fp != NULL && image != NULL && header != NULL);
+        assert(image->methods->size(image->pixels) == sizeof(Pam_pixel));
+
+        row_bytes = (long)image->width * header->depth;
+        row_buf   = malloc(row_bytes);
+        if (row_buf == NULL) {
+                return -1;
+        }
+
+        if (fprintf(fp, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %d\nMAXVAL %u\n",
+                    image->width, image->height, header->depth,
+                    image->denominator) < 0 ||
+            (header->tupltype[0] != '\0' &&
+             fprintf(fp, "TUPLTYPE %s\n", header->tupltype) < 0) ||
+            fputs("ENDHDR\n", fp) == EOF) {
+                status = -1;
+        }
+        for (unsigned row = 0; status == 0 && row < image->height; row++) {
+                const void *bytes = row_buf;
+                Pam_pixel  *run   = row_run(image->methods, image->pixels,
+                                            row);
+                if (run != NULL && header->depth == sizeof(Pam_pixel)) {
+                        bytes = run;
+                } else {
+                        for (unsigned col = 0; col < image->width; col++) {
+                                memcpy(row_buf + (long)col * header->depth,
+                                       pixel_at(image->methods,
+                                                image->pixels, col, row),
+                                       header->depth);
+                        }
+                }
+                if (fwrite(bytes, row_bytes, 1, fp) != 1) {
+                        status = -1;
+                }
+        }
+
+        free(row_buf);
+        if (fflush(fp) != 0) {
+                status = -1;
+        }
+        return status;
+}
+
+/* [Name]:       row_run
+ * [Purpose]:    Finds where a row of pixels starts, if the storage keeps
+ *               the whole row contiguous
+ * [Parameters]: 1 A2Methods_T (methods), 1 A2 (pixels), 1 int (row)
+ * [Return]:     Pointer to the row's first pixel, or NULL
+ */
+static Pam_pixel *row_run(A2Methods_T methods, A2 pixels, int row)
+{
+        if (methods == uarray2_methods_plain ||
+            (methods == uarray2_methods_blocked &&
+             UArray2b_tile_width(pixels) >= methods->width(pixels))) {
+                return methods->at(pixels, 0, row);
+        }
+        return NULL;
+}
+
+/* [Name]:       pixel_at
+ * [Purpose]:    Reads a pixel for encoding; uniform tiles of a sparse
+ *               image answer with their value instead of being expanded
+ * [Parameters]: 1 A2Methods_T (methods), 1 A2 (pixels), 2 ints (col, row)
+ * [Return]:     Pointer to the pixel (read only)
+ */
+static const Pam_pixel *pixel_at(A2Methods_T methods, A2 pixels, int col,
+                                 int row)
+{
+        if (methods == uarray2_methods_sparse) {
+                return UArray2b_get(pixels, col, row);
+        }
+        return methods->at(pixels, col, row);
+}
@@ -0,0 +1,45 @@
+/*
+ *      pam.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Reads and writes PAM (P7) images, so images with alpha
+ *        (RGB_ALPHA, GRAYSCALE_ALPHA) are transformed without being split
+ *        into colour and alpha first
+ *      - Every pixel is held as one 4-byte word, whatever its depth: the
+ *        samples in file order, one byte each, zero-padded to four; an
+ *        RGB_ALPHA row therefore has the same bytes in a file as in memory
+ *      - The tuple type is carried through untouched; transformations only
+ *        move whole pixels, so any tuple type of depth 1 to 4 and maxval
+ *        up to 255 is supported
+ */
+
+#ifndef PAM_INCLUDED
+#define PAM_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "a2methods.h"
+#include "pnm.h"
+
+#define PAM_MAX_TUPLTYPE 64
+
+/* One pixel of a PAM image */
+typedef uint32_t Pam_pixel;
+
+/* Parsed P7 header; width and height live in the image */
+typedef struct Pam_header {
+        int  width, height;
+        int  depth;                     /* samples per pixel, 1 to 4 */
+        int  maxval;
+        char tupltype[PAM_MAX_TUPLTYPE];        /* "" if none was given */
+} Pam_header;
+
+extern int     Pam_probe       (FILE *fp);
+extern int     Pam_read_header (FILE *fp, Pam_header *header);
+extern Pnm_ppm Pam_read        (FILE *fp, A2Methods_T methods,
+                                Pam_header *header);
+extern int     Pam_write       (FILE *fp, Pnm_ppm image,
+                                const Pam_header *header);
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ *      pam_test.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Tests PAM reading and writing (see pam.h): images of depth 1 to 4
+ *        on plain, blocked and sparse storage must be written back byte for
+ *        byte as they were read, and keep their pixels through a rotation
+ *      - Tests the header parser: comments, blank lines and repeated
+ *        TUPLTYPE lines are accepted and exactly the header is consumed;
+ *        missing fields, unsupported depths and maxvals, tuple types that
+ *        disagree with DEPTH and short rasters are refused
+ *      - Tests Pam_probe on files and on streams it cannot peek into
+ *      - Exits nonzero if any check fails
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a2blocked.h"
+#include "a2plain.h"
+#include "a2sparse.h"
+#include "pam.h"
+#include "transform.h"
+
+#define MAX_BYTES (1 << 16)     /* largest test file */
+
+/* Sizes whose rows fit in one default tile, and one whose rows do not */
+static const int sizes[][2] = { { 37, 23 }, { 1, 1 }, { 300, 7 } };
+
+/* A standard tuple type for each depth */
+static const char *tupltypes[] = { "", "GRAYSCALE", "GRAYSCALE_ALPHA",
+                                   "RGB", "RGB_ALPHA" };
+
+static int checks = 0;
+static int failed = 0;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void          check      (int ok, const char *what, int depth,
+                                 const char *storage);
+static unsigned char sample     (int col, int row, int s);
+static FILE         *pam_stream (const char *header, int width, int height,
+                                 int depth, long raster_bytes);
+static long          contents   (FILE *fp, unsigned char *bytes);
+static int           pixels_ok  (Pnm_ppm image, int depth, int magnitude);
+static int           header_ok  (const char *text, Pam_header *header);
+static void test_round_trips(void);
+static void test_headers    (void);
+static void test_probe      (void);
+
+int main(void)
+{
+        test_round_trips();
+        test_headers();
+        test_probe();
+
+        printf("pam_test: %d checks, %d failed\n", checks, failed);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* [Name]:       check
+ * [Purpose]:    Counts a check and reports it, with the depth and storage,
+ *               if it failed
+ * [Parameters]: 1 int (ok), 1 const char* (what was checked), 1 int
+ *               (depth, 0 if none), 1 const char* (storage, or "")
+ * [Return]:     void
+ */
+static void check(int ok, const char *what, int depth, const char *storage)
+{
+        checks++;
+        if (!ok) {
+                failed++;
+                fprintf(stderr, "FAIL %s: depth %d %s\n", what, depth,
+                        storage);
+        }
+}
+
+/* [Name]:       sample
+ * [Purpose]:    The test images' sample s of the pixel at (col, row)
+ * [Parameters]: 3 ints (col, row, s)
+ * [Return]:     The sample
+ */
+static unsigned char sample(int col, int row, int s)
+{
+        return (col * 7 + row * 13 + s * 61 + (col ^ row)) & 0xff;
+}
+
+/* [Name]:       pam_stream
+ * [Purpose]:    Makes a temporary file holding header followed by
+ *               raster_bytes of the test raster, rewound
+ * [Parameters]: 1 const char* (header), 3 ints (width, height, depth),
+ *               1 long (raster_bytes; may be short of a whole raster)
+ * [Return]:     The file
+ */
+static FILE *pam_stream(const char *header, int width, int height,
+                        int depth, long raster_bytes)
+{
+        FILE *fp = tmpfile();
+        long  written = 0;
+
+        if (fp == NULL) {
+                perror("tmpfile");
+                exit(EXIT_FAILURE);
+        }
+        fputs(header, fp);
+        for (int row = 0; row < height; row++) {
+                for (int col = 0; col < width; col++) {
+                        for (int s = 0; s < depth; s++) {
+                                if (written++ < raster_bytes) {
+                                        fputc(sample(col, row, s), fp);
+                                }
+                        }
+                }
+        }
+        rewind(fp);
+        return fp;
+}
+
+/* [Name]:       contents
+ * [Purpose]:    Reads a whole file from its start
+ * [Parameters]: 1 FILE* (fp), 1 unsigned char* (bytes, MAX_BYTES)
+ * [Return]:     Number of bytes read
+ */
+static long contents(FILE *fp, unsigned char *bytes)
+{
+        rewind(fp);
+        return fread(bytes, 1, MAX_BYTES, fp);
+}
+
+/* [Name]:       pixels_ok
+ * [Purpose]:    Checks every pixel of a test image that was rotated by
+ *               magnitude degrees: its samples, zero-padded to four bytes
+ * [Parameters]: 1 Pnm_ppm (image), 2 ints (depth; magnitude, 0, 90 or 180)
+ * [Return]:     1 if every pixel is right, 0 otherwise
+ */
+static int pixels_ok(Pnm_ppm image, int depth, int magnitude)
+{
+        int width  = magnitude == 90 ? image->height : image->width;
+        int height = magnitude == 90 ? image->width : image->height;
+
+        for (int row = 0; row < height; row++) {
+                for (int col = 0; col < width; col++) {
+                        unsigned char want[sizeof(Pam_pixel)] = { 0 };
+                        int dest_col = col, dest_row = row;
+                        if (magnitude == 90) {
+                                dest_col = height - 1 - row;
+                                dest_row = col;
+                        } else if (magnitude == 180) {
+                                dest_col = width - 1 - col;
+                                dest_row = height - 1 - row;
+                        }
+                        for (int s = 0; s < depth; s++) {
+                                want[s] = sample(col, row, s);
+                        }
+                        if (memcmp(image->methods->at(image->pixels,
+                                                      dest_col, dest_row),
+                                   want, sizeof(want)) != 0) {
+                                return 0;
+                        }
+                }
+        }
+        return 1;
+}
+
+/* [Name]:       header_ok
+ * [Purpose]:    Parses a header given as text
+ * [Parameters]: 1 const char* (text), 1 Pam_header* (header, filled in)
+ * [Return]:     What Pam_read_header returns for it
+ */
+static int header_ok(const char *text, Pam_header *header)
+{
+        FILE *fp = pam_stream(text, 0, 0, 0, 0);
+        int   ok = Pam_read_header(fp, header);
+
+        fclose(fp);
+        return ok;
+}
+
+/*---------------------------------------------------------------
+ |                           Tests                              |
+ *--------------------------------------------------------------*/
+/* [Name]:       test_round_trips
+ * [Purpose]:    Reads test images of every depth on every storage, checks
+ *               their pixels, writes them back and compares the bytes, then
+ *               checks their pixels after 90 and 180 degree rotations
+ * [Parameters]: None
+ * [Return]:     void
+ */
+static void test_round_trips(void)
+{
+        A2Methods_T storages[] = { uarray2_methods_plain,
+                                   uarray2_methods_blocked,
+                                   uarray2_methods_sparse };
+        const char *names[]    = { "plain", "blocked", "sparse" };
+        static unsigned char in[MAX_BYTES], out[MAX_BYTES];
+
+        for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+                int width = sizes[z][0], height = sizes[z][1];
+                for (int depth = 1; depth <= 4; depth++) {
+                        for (int m = 0; m < 3; m++) {
+                                char        text[256];
+                                Pam_header  header;
+                                Pnm_ppm     image;
+                                FILE       *fp, *written;
+                                long        length;
+
+                                snprintf(text, sizeof(text),
+                                         "P7\nWIDTH %d\nHEIGHT %d\n"
+                                         "DEPTH %d\nMAXVAL 255\n"
+                                         "TUPLTYPE %s\nENDHDR\n", width,
+                                         height, depth, tupltypes[depth]);
+                                fp = pam_stream(text, width, height, depth,
+                                                (long)width * height *
+                                                depth);
+                                length = contents(fp, in);
+                                rewind(fp);
+                                image = Pam_read(fp, storages[m], &header);
+                                fclose(fp);
+                                check(image != NULL &&
+                                      header.depth == depth &&
+                                      strcmp(header.tupltype,
+                                             tupltypes[depth]) == 0,
+                                      "read", depth, names[m]);
+                                if (image == NULL) {
+                                        continue;
+                                }
+                                check(pixels_ok(image, depth, 0),
+                                      "pixels read", depth, names[m]);
+
+                                written = tmpfile();
+                                check(written != NULL &&
+                                      Pam_write(written, image,
+                                                &header) == 0 &&
+                                      contents(written, out) == length &&
+                                      memcmp(in, out, length) == 0,
+                                      "written back unchanged", depth,
+                                      names[m]);
+                                if (written != NULL) {
+                                        fclose(written);
+                                }
+
+                                image = transform_words(image, storages[m],
+                                                        ROTATE, 90, NULL);
+                                check(pixels_ok(image, depth, 90),
+                                      "rotated 90", depth, names[m]);
+                                Pnm_ppmfree(&image);
+
+                                fp = pam_stream(text, width, height, depth,
+                                                (long)width * height *
+                                                depth);
+                                image = Pam_read(fp, storages[m], &header);
+                                fclose(fp);
+                                image = transform_words(image, storages[m],
+                                                        ROTATE, 180, NULL);
+                                check(pixels_ok(image, depth, 180),
+                                      "rotated 180", depth, names[m]);
+                                Pnm_ppmfree(&image);
+                        }
+                }
+        }
+}
+
+/* [Name]:       test_headers
+ * [Purpose]:    Checks which headers are accepted and what is read from
+ *               them, that the raster's first byte is the next one read,
+ *               and that a short raster is refused
+ * [Parameters]: None
+ * [Return]:     void
+ */
+static void test_headers(void)
+{
+        Pam_header header;
+        Pnm_ppm    image;
+        FILE      *fp;
+
+        check(header_ok("P7\n# made by hand\nWIDTH 5\n\n  HEIGHT 3\n"
+                        "DEPTH 4\nMAXVAL 200\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+                        &header) &&
+              header.width == 5 && header.height == 3 &&
+              header.depth == 4 && header.maxval == 200 &&
+              strcmp(header.tupltype, "RGB_ALPHA") == 0,
+              "comments and blank lines", 4, "");
+        check(header_ok("P7\nWIDTH 2\nHEIGHT 2\nDEPTH 3\nMAXVAL 255\n"
+                        "TUPLTYPE PAINT\nTUPLTYPE MIX\nENDHDR\n", &header) &&
+              strcmp(header.tupltype, "PAINT MIX") == 0,
+              "TUPLTYPE lines joined", 3, "");
+        check(header_ok("P7\nWIDTH 2\nHEIGHT 2\nDEPTH 2\nMAXVAL 255\n"
+                        "ENDHDR\n", &header) && header.tupltype[0] == '\0',
+              "no TUPLTYPE", 2, "");
+        check(header_ok("P7\nWIDTH 2\nHEIGHT 2\nDEPTH 3\nMAXVAL 255\n"
+                        "TUPLTYPE RGB \nENDHDR\n", &header),
+              "trailing blank after TUPLTYPE", 3, "");
+
+        check(!header_ok("P7\nWIDTH 2\nHEIGHT 2\nDEPTH 4\nMAXVAL 255\n"
+                         "TUPLTYPE RGB\nENDHDR\n", &header),
+              "RGB of depth 4 refused", 4, "");
+        check(!header_ok("P7\nWIDTH 2\nHEIGHT 2\nDEPTH 1\nMAXVAL 255\n"
+                         "TUPLTYPE GRAYSCALE_ALPHA\nENDHDR\n", &header),
+              "GRAYSCALE_ALPHA of depth 1 refused", 1, "");
+        check(!header_ok("P7\nWIDTH 2\nHEIGHT 2\nDEPTH 3\nMAXVAL 255\n"
+                         "TUPLTYPE BLACKANDWHITE\nENDHDR\n", &header),
+              "BLACKANDWHITE of depth 3 refused", 3, "");
+        check(!header_ok("P7\nWIDTH 2\nDEPTH 3\nMAXVAL 255\nENDHDR\n",
+                         &header), "missing HEIGHT refused", 3, "");
+        check(!header_ok("P7\nWIDTH 2\nHEIGHT 2\nDEPTH 5\nMAXVAL 255\n"
+                         "ENDHDR\n", &header), "depth 5 refused", 5, "");
+        check(!header_ok("P7\nWIDTH 2\nHEIGHT 2\nDEPTH 3\nMAXVAL 256\n"
+                         "ENDHDR\n", &header), "maxval 256 refused", 3, "");
+        check(!header_ok("P7\nWIDTH 2\nHEIGHT 2\nDEPTH 3\nMAXVAL 255\n"
+                         "COLOURS 3\nENDHDR\n", &header),
+              "unknown field refused", 3, "");
+        check(!header_ok("P7\nWIDTH 2\nHEIGHT 2\nDEPTH 3\nMAXVAL 255\n",
+                         &header), "missing ENDHDR refused", 3, "");
+        check(!header_ok("P6\n2 2\n255\n", &header), "P6 refused", 0, "");
+
+        fp = pam_stream("P7\nWIDTH 4\nHEIGHT 4\nDEPTH 3\nMAXVAL 255\n"
+                        "ENDHDR\n", 4, 4, 3, 4 * 4 * 3);
+        check(Pam_read_header(fp, &header) && getc(fp) == sample(0, 0, 0),
+              "exactly the header consumed", 3, "");
+        fclose(fp);
+
+        fp = pam_stream("P7\nWIDTH 4\nHEIGHT 4\nDEPTH 3\nMAXVAL 255\n"
+                        "ENDHDR\n", 4, 4, 3, 4 * 4 * 3 - 1);
+        image = Pam_read(fp, uarray2_methods_plain, &header);
+        check(image == NULL, "short raster refused", 3, "");
+        fclose(fp);
+        if (image != NULL) {
+                Pnm_ppmfree(&image);
+        }
+}
+
+/* [Name]:       test_probe
+ * [Purpose]:    Pam_probe must recognise P7 without consuming anything,
+ *               both on a file it peeks at and on a memory stream, which
+ *               has no descriptor and gets its bytes pushed back
+ * [Parameters]: None
+ * [Return]:     void
+ */
+static void test_probe(void)
+{
+        char  pam[] = "P7\nWIDTH 1\n";
+        char  ppm[] = "P6\n1 1\n";
+        FILE *fp;
+
+        fp = pam_stream(pam, 0, 0, 0, 0);
+        check(Pam_probe(fp) && getc(fp) == 'P' && getc(fp) == '7',
+              "file probed as PAM, nothing consumed", 0, "");
+        fclose(fp);
+        fp = pam_stream(ppm, 0, 0, 0, 0);
+        check(!Pam_probe(fp) && getc(fp) == 'P', "file probed as not PAM",
+              0, "");
+        fclose(fp);
+
+        fp = fmemopen(pam, strlen(pam), "r");
+        check(fp != NULL && Pam_probe(fp) && getc(fp) == 'P' &&
+              getc(fp) == '7', "stream probed as PAM, nothing consumed",
+              0, "");
+        if (fp != NULL) {
+                fclose(fp);
+        }
+        fp = fmemopen(ppm, strlen(ppm), "r");
+        check(fp != NULL && !Pam_probe(fp) && getc(fp) == 'P',
+              "stream probed as not PAM", 0, "");
+        if (fp != NULL) {
+                fclose(fp);
+        }
+        fp = fmemopen(pam, 1, "r");
+        check(fp != NULL && !Pam_probe(fp) && getc(fp) == 'P',
+              "one-byte stream probed as not PAM", 0, "");
+        if (fp != NULL) {
+                fclose(fp);
+        }
+}
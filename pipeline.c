@@ -0,0 +1,624 @@
+/*
+ *      pipeline.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Pipelined reader -> transform -> writer mode for streamed P6 input
+ *      - A reader thread fills fixed-size strips of raw rows, transform
+ *        workers decode/transform/encode them, and a writer (the calling
+ *        thread) emits encoded destination strips in order
+ *      - Strip k is handled by worker k % workers; every stage-to-stage
+ *        link is a bounded single-producer/single-consumer ring of
+ *        RING_SLOTS preallocated buffers (double-buffered), so the rings
+ *        need no locks and strip order is kept without reordering
+ *      - A stage that finds its ring full (or empty) polls it briefly, then
+ *        sleeps on a futex: every publish and release bumps the ring's
+ *        event word and wakes it, so a stalled input costs no CPU
+ *      - Rows that only depend on rows already read (rotate 0, flip
+ *        horizontal) are emitted as soon as their strip is transformed;
+ *        90/270/transpose read the whole source first and then transform
+ *        one destination strip at a time, overlapping output encoding with
+ *        the tail of the transform
+ *      - Traced per strip, so gaps between a stage's spans are its waits
+ *        on the rings
+ */
+
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "pipeline.h"
+#include "pnm.h"
+#include "trace.h"
+
+typedef A2Methods_UArray2 A2;
+
+/* Buffers per ring; 2 lets a producer fill one while the consumer drains
+ * the other */
+#define RING_SLOTS 2
+
+/* Strips hold roughly this many bytes of raster */
+#define STRIP_BYTES (256 * 1024)
+
+/* Polls of a full/empty ring (yielding between them) before sleeping */
+#define SPIN_TRIES 64
+
+/* Bounded SPSC ring of strip buffers */
+typedef struct ring {
+        unsigned char *slots[RING_SLOTS];
+        long           head;            /* only written by the producer */
+        long           tail;            /* only written by the consumer */
+        int            event;           /* bumped on every head/tail move;
+                                           the futex a waiting side sleeps
+                                           on */
+} ring;
+
+/* Shared state of one pipeline run */
+typedef struct pipeline {
+        FILE               *in, *out;
+        A2Methods_T         methods;
+        A2                  source, destination;
+        A2Methods_applyfun *apply;
+        void               *cl;
+        Pipeline_order      order;
+        int                 src_maxval, dst_maxval;
+        long                src_row_bytes, dst_row_bytes;
+        int                 src_strip_rows, dst_strip_rows;
+        int                 src_strips, dst_strips;
+        int                 workers;
+        ring               *in_rings;   /* reader -> worker k             */
+        ring               *out_rings;  /* worker k -> writer             */
+        int                 arrived;    /* workers done reading source    */
+        int                 barrier;    /* event word for arrived         */
+        int                 failed;
+} pipeline;
+
+/* Closure for a transform worker thread */
+typedef struct worker {
+        pipeline *p;
+        int       id;
+} worker;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static int            ring_init      (ring *r, long bytes);
+static void           ring_free      (ring *r);
+static unsigned char *ring_reserve   (ring *r, pipeline *p);
+static void           ring_publish   (ring *r);
+static unsigned char *ring_peek      (ring *r, pipeline *p);
+static void           ring_release   (ring *r);
+
+static void          *reader_thread  (void *cl);
+static void          *worker_thread  (void *cl);
+static void           run_writer     (pipeline *p);
+static void           transform_rows (pipeline *p, int first, int end);
+static void           transform_cols (pipeline *p, int first, int end);
+static void           emit_strip     (pipeline *p, int id, int strip);
+static void           wait_for_source(pipeline *p);
+static int            strip_rows     (long row_bytes);
+static int            is_failed      (pipeline *p);
+static void           fail           (pipeline *p);
+static void           post_event     (int *event);
+static void           wait_event     (int *event, int seen);
+
+/*---------------------------------------------------------------
+ |                        Pipeline Driver                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Pipeline_run
+ * [Purpose]:    Streams the raster that follows an already-read P6 header
+ *               through the reader, transform and writer stages, writing
+ *               the transformed P6 image to out
+ * [Parameters]: 2 FILE* (in, positioned at the raster; out),
+ *               1 Ppmio_header* (header of the input), 1 int (out_maxval,
+ *               maxval of the output; apply may change pixel values),
+ *               1 A2Methods_T (methods), 1 A2 (destination, already sized),
+ *               1 applyfun* (apply; places a source pixel in destination),
+ *               1 void* (cl, closure for apply), 1 Pipeline_order (order),
+ *               1 int (threads, number of transform workers)
+ * [Return]:     0 on success, -1 on a read, write or allocation error
+ */
+int Pipeline_run(FILE *in, FILE *out, Ppmio_header *header, int out_maxval,
+                 A2Methods_T methods, A2 destination, A2Methods_applyfun *apply,
+                 void *cl, Pipeline_order order, int threads)
+{
+        pipeline p;
+        int      status = 0;
+
+        assert(in != NULL && out != NULL && header != NULL);
+        assert(methods != NULL && destination != NULL && apply != NULL);
+
+        p.in             = in;
+        p.out            = out;
+        p.methods        = methods;
+        p.destination    = destination;
+        p.apply          = apply;
+        p.cl             = cl;
+        p.order          = order;
+        p.src_maxval     = header->maxval;
+        p.dst_maxval     = out_maxval;
+        p.src_row_bytes  = Ppmio_row_bytes(header->width, header->maxval);
+        p.dst_row_bytes  = Ppmio_row_bytes(methods->width(destination),
+                                           out_maxval);
+        p.src_strip_rows = strip_rows(p.src_row_bytes);
+        p.dst_strip_rows = order == PIPELINE_ROWS ? p.src_strip_rows
+                                                  : strip_rows(p.dst_row_bytes);
+        p.src_strips     = (header->height + p.src_strip_rows - 1) /
+                           p.src_strip_rows;
+        p.dst_strips     = (methods->height(destination) +
+                            p.dst_strip_rows - 1) / p.dst_strip_rows;
+        p.workers        = threads < 1 ? 1 : threads;
+        p.arrived        = 0;
+        p.barrier        = 0;
+        p.failed         = 0;
+
+        /* rows are emitted with their source strip, so the strips agree */
+        assert(order != PIPELINE_ROWS ||
+               p.src_strip_rows == p.dst_strip_rows);
+
+        p.source    = methods->new(header->width, header->height,
+                                   sizeof(struct Pnm_rgb));
+        p.in_rings  = calloc(p.workers, sizeof(ring));
+        p.out_rings = calloc(p.workers, sizeof(ring));
+        if (p.in_rings == NULL || p.out_rings == NULL) {
+                status = -1;
+        }
+        for (int i = 0; status == 0 && i < p.workers; i++) {
+                if (ring_init(&p.in_rings[i],
+                              p.src_strip_rows * p.src_row_bytes) != 0 ||
+                    ring_init(&p.out_rings[i],
+                              p.dst_strip_rows * p.dst_row_bytes) != 0) {
+                        status = -1;
+                }
+        }
+
+        fprintf(out, "P6\n%d %d\n%d\n", methods->width(destination),
+                methods->height(destination), out_maxval);
+
+        if (status == 0) {
+                pthread_t reader;
+                pthread_t workers[p.workers];
+                worker    closures[p.workers];
+                int       started = 0;
+
+                if (pthread_create(&reader, NULL, reader_thread, &p) != 0) {
+                        fail(&p);
+                } else {
+                        for (; started < p.workers; started++) {
+                                closures[started].p  = &p;
+                                closures[started].id = started;
+                                if (pthread_create(&workers[started], NULL,
+                                                   worker_thread,
+                                                   &closures[started]) != 0) {
+                                        fail(&p);
+                                        break;
+                                }
+                        }
+                        run_writer(&p);
+                        for (int i = 0; i < started; i++) {
+                                pthread_join(workers[i], NULL);
+                        }
+                        pthread_join(reader, NULL);
+                }
+                status = is_failed(&p) ? -1 : 0;
+        }
+
+        if (fflush(out) != 0 || ferror(out)) {
+                status = -1;
+        }
+
+        for (int i = 0; i < p.workers; i++) {
+                if (p.in_rings != NULL) {
+                        ring_free(&p.in_rings[i]);
+                }
+                if (p.out_rings != NULL) {
+                        ring_free(&p.out_rings[i]);
+                }
+        }
+        free(p.in_rings);
+        free(p.out_rings);
+        methods->free(&p.source);
+
+        return status;
+}
+
+/*---------------------------------------------------------------
+ |                         Stage Functions                      |
+ *--------------------------------------------------------------*/
+/* [Name]:       reader_thread
+ * [Purpose]:    Reader stage: reads raw source strips into the ring of the
+ *               worker that owns each strip
+ * [Parameters]: 1 void* (closure; the pipeline)
+ * [Return]:     NULL
+ */
+static void *reader_thread(void *cl)
+{
+        pipeline *p      = cl;
+        int       height = p->methods->height(p->source);
+
+        for (int k = 0; k < p->src_strips; k++) {
+                ring *r = &p->in_rings[k % p->workers];
+                int first = k * p->src_strip_rows;
+                int rows  = height - first < p->src_strip_rows ?
+                            height - first : p->src_strip_rows;
+
+                unsigned char *buf = ring_reserve(r, p);
+                if (buf == NULL) {
+                        return NULL;
+                }
+                long start = Trace_now();
+                if (fread(buf, p->src_row_bytes, rows, p->in) !=
+                    (size_t)rows) {
+                        fail(p);
+                        return NULL;
+                }
+                Trace_span("read strip", start, k);
+                ring_publish(r);
+        }
+        return NULL;
+}
+
+/* [Name]:       worker_thread
+ * [Purpose]:    Transform stage: decodes its source strips, applies the
+ *               transform and hands encoded destination strips to the
+ *               writer as soon as their rows are final
+ * [Parameters]: 1 void* (closure; the worker)
+ * [Return]:     NULL
+ */
+static void *worker_thread(void *cl)
+{
+        worker   *w = cl;
+        pipeline *p = w->p;
+        int height  = p->methods->height(p->source);
+        int by_rows = p->order == PIPELINE_ROWS ||
+                      p->order == PIPELINE_ROWS_REVERSED;
+
+        /* phase 1: everything that only needs the strips read so far */
+        for (int k = w->id; k < p->src_strips; k += p->workers) {
+                ring *r   = &p->in_rings[w->id];
+                int first = k * p->src_strip_rows;
+                int end   = first + p->src_strip_rows > height ?
+                            height : first + p->src_strip_rows;
+
+                unsigned char *buf = ring_peek(r, p);
+                if (buf == NULL) {
+                        return NULL;
+                }
+                long start = Trace_now();
+                for (int row = first; row < end; row++) {
+                        Ppmio_unpack_row(buf + (row - first) *
+                                         p->src_row_bytes, p->src_maxval,
+                                         p->methods, p->source, row);
+                }
+                ring_release(r);
+                Trace_span("decode strip", start, k);
+
+                if (by_rows) {
+                        start = Trace_now();
+                        transform_rows(p, first, end);
+                        Trace_span("transform strip", start, k);
+                }
+                if (p->order == PIPELINE_ROWS) {
+                        emit_strip(p, w->id, k);
+                }
+        }
+        if (p->order == PIPELINE_ROWS) {
+                return NULL;
+        }
+
+        /* phase 2: destination strips that needed the whole source */
+        wait_for_source(p);
+        for (int k = w->id; k < p->dst_strips && !is_failed(p);
+             k += p->workers) {
+                if (!by_rows) {
+                        int dst_h = p->methods->height(p->destination);
+                        int first = k * p->dst_strip_rows;
+                        int end   = first + p->dst_strip_rows > dst_h ?
+                                    dst_h : first + p->dst_strip_rows;
+                        long start = Trace_now();
+                        transform_cols(p, first, end);
+                        Trace_span("transform strip", start, k);
+                }
+                emit_strip(p, w->id, k);
+        }
+        return NULL;
+}
+
+/* [Name]:       run_writer
+ * [Purpose]:    Writer stage: writes encoded destination strips in order
+ * [Parameters]: 1 pipeline* (p)
+ * [Return]:     void
+ */
+static void run_writer(pipeline *p)
+{
+        int height = p->methods->height(p->destination);
+
+        for (int k = 0; k < p->dst_strips; k++) {
+                ring *r   = &p->out_rings[k % p->workers];
+                int first = k * p->dst_strip_rows;
+                int rows  = height - first < p->dst_strip_rows ?
+                            height - first : p->dst_strip_rows;
+
+                unsigned char *buf = ring_peek(r, p);
+                if (buf == NULL) {
+                        return;
+                }
+                long start = Trace_now();
+                if (fwrite(buf, p->dst_row_bytes, rows, p->out) !=
+                    (size_t)rows) {
+                        fail(p);
+                        return;
+                }
+                Trace_span("write strip", start, k);
+                ring_release(r);
+        }
+}
+
+/* [Name]:       transform_rows
+ * [Purpose]:    Applies the transform to source rows [first, end)
+ * [Parameters]: 1 pipeline* (p), 2 ints (first, end)
+ * [Return]:     void
+ */
+static void transform_rows(pipeline *p, int first, int end)
+{
+        int width = p->methods->width(p->source);
+
+        for (int row = first; row < end; row++) {
+                for (int col = 0; col < width; col++) {
+                        p->apply(col, row, p->source,
+                                 p->methods->at(p->source, col, row), p->cl);
+                }
+        }
+}
+
+/* [Name]:       transform_cols
+ * [Purpose]:    Applies the transform to the source columns that feed
+ *               destination rows [first, end)
+ * [Parameters]: 1 pipeline* (p), 2 ints (first, end; destination rows)
+ * [Return]:     void
+ */
+static void transform_cols(pipeline *p, int first, int end)
+{
+        int width  = p->methods->width(p->source);
+        int height = p->methods->height(p->source);
+        int col_lo = first;
+        int col_hi = end;
+
+        if (p->order == PIPELINE_COLS_REVERSED) {
+                col_lo = width - end;
+                col_hi = width - first;
+        }
+
+        for (int row = 0; row < height; row++) {
+                for (int col = col_lo; col < col_hi; col++) {
+                        p->apply(col, row, p->source,
+                                 p->methods->at(p->source, col, row), p->cl);
+                }
+        }
+}
+
+/* [Name]:       emit_strip
+ * [Purpose]:    Encodes destination strip 'strip' into the worker's ring
+ *               for the writer
+ * [Parameters]: 1 pipeline* (p), 2 ints (id, worker; strip, strip index)
+ * [Return]:     void
+ */
+static void emit_strip(pipeline *p, int id, int strip)
+{
+        ring *r    = &p->out_rings[id];
+        int height = p->methods->height(p->destination);
+        int first  = strip * p->dst_strip_rows;
+        int end    = first + p->dst_strip_rows > height ?
+                     height : first + p->dst_strip_rows;
+
+        unsigned char *buf = ring_reserve(r, p);
+        if (buf == NULL) {
+                return;
+        }
+        long start = Trace_now();
+        for (int row = first; row < end; row++) {
+                Ppmio_pack_row(buf + (row - first) * p->dst_row_bytes,
+                               p->dst_maxval, p->methods, p->destination,
+                               row);
+        }
+        Trace_span("encode strip", start, strip);
+        ring_publish(r);
+}
+
+/* [Name]:       wait_for_source
+ * [Purpose]:    Barrier between the phases: returns once every worker has
+ *               finished with its source strips (or the pipeline failed)
+ * [Parameters]: 1 pipeline* (p)
+ * [Return]:     void
+ */
+static void wait_for_source(pipeline *p)
+{
+        __atomic_add_fetch(&p->arrived, 1, __ATOMIC_ACQ_REL);
+        post_event(&p->barrier);
+        for (int spins = 0; !is_failed(p); spins++) {
+                int seen = __atomic_load_n(&p->barrier, __ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&p->arrived, __ATOMIC_ACQUIRE) >=
+                    p->workers) {
+                        return;
+                }
+                if (spins < SPIN_TRIES) {
+                        sched_yield();
+                } else {
+                        wait_event(&p->barrier, seen);
+                }
+        }
+}
+
+/*---------------------------------------------------------------
+ |                         Ring Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       ring_init
+ * [Purpose]:    Allocates the slot buffers of a ring
+ * [Parameters]: 1 ring* (r), 1 long (bytes per slot)
+ * [Return]:     0 on success, -1 if out of memory
+ */
+static int ring_init(ring *r, long bytes)
+{
+        r->head  = 0;
+        r->tail  = 0;
+        r->event = 0;
+        for (int i = 0; i < RING_SLOTS; i++) {
+                r->slots[i] = malloc(bytes);
+                if (r->slots[i] == NULL) {
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+/* [Name]:       ring_free
+ * [Purpose]:    Frees the slot buffers of a ring
+ * [Parameters]: 1 ring* (r)
+ * [Return]:     void
+ */
+static void ring_free(ring *r)
+{
+        for (int i = 0; i < RING_SLOTS; i++) {
+                free(r->slots[i]);
+                r->slots[i] = NULL;
+        }
+}
+
+/* [Name]:       ring_reserve
+ * [Purpose]:    Producer side: waits for a free slot, polling briefly and
+ *               then sleeping until the consumer releases one
+ * [Parameters]: 1 ring* (r), 1 pipeline* (p)
+ * [Return]:     The slot buffer to fill, or NULL if the pipeline failed
+ */
+static unsigned char *ring_reserve(ring *r, pipeline *p)
+{
+        long head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+        for (int spins = 0; ; spins++) {
+                int seen = __atomic_load_n(&r->event, __ATOMIC_ACQUIRE);
+                if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) <
+                    RING_SLOTS) {
+                        return r->slots[head % RING_SLOTS];
+                }
+                if (is_failed(p)) {
+                        return NULL;
+                }
+                if (spins < SPIN_TRIES) {
+                        sched_yield();
+                } else {
+                        wait_event(&r->event, seen);
+                }
+        }
+}
+
+/* [Name]:       ring_publish
+ * [Purpose]:    Producer side: hands the reserved slot to the consumer
+ * [Parameters]: 1 ring* (r)
+ * [Return]:     void
+ */
+static void ring_publish(ring *r)
+{
+        long head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+        post_event(&r->event);
+}
+
+/* [Name]:       ring_peek
+ * [Purpose]:    Consumer side: waits for the oldest published slot,
+ *               polling briefly and then sleeping until the producer
+ *               publishes one
+ * [Parameters]: 1 ring* (r), 1 pipeline* (p)
+ * [Return]:     The slot buffer to drain, or NULL if the pipeline failed
+ */
+static unsigned char *ring_peek(ring *r, pipeline *p)
+{
+        long tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+        for (int spins = 0; ; spins++) {
+                int seen = __atomic_load_n(&r->event, __ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != tail) {
+                        return r->slots[tail % RING_SLOTS];
+                }
+                if (is_failed(p)) {
+                        return NULL;
+                }
+                if (spins < SPIN_TRIES) {
+                        sched_yield();
+                } else {
+                        wait_event(&r->event, seen);
+                }
+        }
+}
+
+/* [Name]:       ring_release
+ * [Purpose]:    Consumer side: returns the drained slot to the producer
+ * [Parameters]: 1 ring* (r)
+ * [Return]:     void
+ */
+static void ring_release(ring *r)
+{
+        long tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+        post_event(&r->event);
+}
+
+/*---------------------------------------------------------------
+ |                          Misc Helpers                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       strip_rows
+ * [Purpose]:    Number of rows in a strip of about STRIP_BYTES bytes
+ * [Parameters]: 1 long (row_bytes)
+ * [Return]:     Rows per strip, at least 1
+ */
+static int strip_rows(long row_bytes)
+{
+        long rows = STRIP_BYTES / row_bytes;
+        return rows < 1 ? 1 : (int)rows;
+}
+
+/* [Name]:       is_failed / fail
+ * [Purpose]:    Read / raise the pipeline's failure flag; raising it wakes
+ *               every sleeping stage, and each gives up
+ * [Parameters]: 1 pipeline* (p)
+ * [Return]:     1 if failed (is_failed) / void (fail)
+ */
+static int is_failed(pipeline *p)
+{
+        return __atomic_load_n(&p->failed, __ATOMIC_ACQUIRE);
+}
+
+static void fail(pipeline *p)
+{
+        __atomic_store_n(&p->failed, 1, __ATOMIC_RELEASE);
+        for (int i = 0; i < p->workers; i++) {
+                post_event(&p->in_rings[i].event);
+                post_event(&p->out_rings[i].event);
+        }
+        post_event(&p->barrier);
+}
+
+/* [Name]:       post_event / wait_event
+ * [Purpose]:    Bump an event word and wake everyone sleeping on it /
+ *               sleep until the word moves past 'seen' (returns at once
+ *               if it already has; may also return spuriously)
+ * [Parameters]: 1 int* (event), 1 int (seen; wait_event only)
+ * [Return]:     void
+ */
+static void post_event(int *event)
+{
+        __atomic_add_fetch(event, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, event, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL,
+                0);
+}
+
+static void wait_event(int *event, int seen)
+{
+        syscall(SYS_futex, event, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
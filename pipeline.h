@@ -0,0 +1,34 @@
+/*
+ *      pipeline.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Pipelined reader -> transform -> writer mode for streamed (piped)
+ *        P6 input and output
+ *      - Fixed-size strips of rows travel between the stages through
+ *        bounded, lock-free single-producer/single-consumer rings
+ */
+
+#ifndef PIPELINE_INCLUDED
+#define PIPELINE_INCLUDED
+
+#include <stdio.h>
+
+#include "a2methods.h"
+#include "ppmio.h"
+
+/* Which part of the source feeds destination row r; decides how early the
+ * writer may start emitting rows */
+typedef enum Pipeline_order {
+        PIPELINE_ROWS,           /* source row r: rotate 0, flip h      */
+        PIPELINE_ROWS_REVERSED,  /* source row h-r-1: rotate 180, flip v */
+        PIPELINE_COLS,           /* source col r: rotate 90, transpose  */
+        PIPELINE_COLS_REVERSED   /* source col w-r-1: rotate 270        */
+} Pipeline_order;
+
+extern int Pipeline_run(FILE *in, FILE *out, Ppmio_header *header,
+                        int out_maxval, A2Methods_T methods,
+                        A2Methods_UArray2 destination,
+                        A2Methods_applyfun *apply, void *cl,
+                        Pipeline_order order, int threads);
+
+#endif
@@ -0,0 +1,289 @@
+/*
+ *      pixelop.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Parses an -ops chain into steps and, once the input maxval is
+ *        known, compiles each run of channel-wise operations (invert,
+ *        maxval, gamma) into a single lookup table over 0..maxval;
+ *        samples above the maxval (a lying raster) are clamped to it
+ *        before they index a table
+ *      - A pixel is carried through the steps as one vector of four
+ *        lanes (GCC vector extension): gray is a lane-wise multiply by
+ *        the luma weights, swap is a shuffle
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assert.h"
+#include "mem.h"
+#include "pixelop.h"
+
+#define T Pixelop_T
+
+/* One pixel: {red, green, blue, unused} */
+typedef unsigned px4 __attribute__ ((vector_size (16)));
+
+/* Chains longer than this are rejected */
+#define MAX_STEPS 32
+
+/* Largest maxval a ppm may have */
+#define MAXVAL_LIMIT 65535
+
+/* Luma weights (ITU-R BT.601), in thousandths */
+static const px4 LUMA = { 299, 587, 114, 0 };
+
+/* Step kinds; LUT is a compiled run of the channel-wise kinds */
+typedef enum { GRAY, INVERT, SWAP, MAXVAL, GAMMA, LUT } step_kind;
+
+typedef struct step {
+        step_kind kind;
+        px4       order;        /* SWAP: source lane of each lane     */
+        unsigned  maxval;       /* MAXVAL: the new maxval; LUT: the
+                                   largest index of table             */
+        double    gamma;        /* GAMMA: the exponent                */
+        unsigned *table;        /* LUT: 0..maxval in -> value out     */
+} step;
+
+struct T {
+        int  count;             /* parsed steps                       */
+        step steps[MAX_STEPS];
+        int  compiled;          /* steps after Pixelop_prepare        */
+        step program[MAX_STEPS];
+};
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static int      parse_step  (const char *text, long len, step *out);
+static int      channel_wise(step_kind kind);
+static unsigned map_value   (const step *op, unsigned value,
+                             unsigned maxval);
+static void     free_tables (T chain);
+
+/*---------------------------------------------------------------
+ |                      Chain Functions                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       Pixelop_parse
+ * [Purpose]:    Parses a comma-separated list of operations, e.g.
+ *               "gray,gamma:2.2,maxval:255"
+ * [Parameters]: 1 c-string (spec)
+ * [Return]:     The chain, or NULL if spec is not a valid list
+ */
+T Pixelop_parse(const char *spec)
+{
+        T chain;
+
+        assert(spec != NULL);
+        NEW(chain);
+        chain->count    = 0;
+        chain->compiled = 0;
+
+        while (1) {
+                const char *comma = strchr(spec, ',');
+                long len = comma != NULL ? comma - spec : (long)strlen(spec);
+                if (chain->count == MAX_STEPS ||
+                    !parse_step(spec, len, &chain->steps[chain->count])) {
+                        FREE(chain);
+                        return NULL;
+                }
+                chain->count++;
+                if (comma == NULL) {
+                        return chain;
+                }
+                spec = comma + 1;
+        }
+}
+
+/* [Name]:       Pixelop_free
+ * [Purpose]:    Frees a chain and its lookup tables
+ * [Parameters]: 1 T* (chain)
+ * [Return]:     void
+ */
+void Pixelop_free(T *chain)
+{
+        assert(chain != NULL && *chain != NULL);
+        free_tables(*chain);
+        FREE(*chain);
+}
+
+/* [Name]:       Pixelop_prepare
+ * [Purpose]:    Compiles the chain for input of the given maxval: each run
+ *               of channel-wise operations becomes one lookup table, with
+ *               the maxval changes inside it folded in
+ * [Parameters]: 1 T (chain), 1 unsigned (maxval of the input)
+ * [Return]:     maxval of the output
+ */
+unsigned Pixelop_prepare(T chain, unsigned maxval)
+{
+        assert(chain != NULL && maxval >= 1 && maxval <= MAXVAL_LIMIT);
+
+        free_tables(chain);
+        for (int i = 0; i < chain->count; i++) {
+                step *op = &chain->steps[i];
+                if (!channel_wise(op->kind)) {
+                        chain->program[chain->compiled++] = *op;
+                        continue;
+                }
+
+                step *lut = &chain->program[chain->compiled++];
+                unsigned in_maxval = maxval;
+                lut->kind   = LUT;
+                lut->maxval = in_maxval;
+                lut->table  = ALLOC((in_maxval + 1) * sizeof(unsigned));
+                for (unsigned v = 0; v <= in_maxval; v++) {
+                        lut->table[v] = v;
+                }
+                for (; i < chain->count && channel_wise(chain->steps[i].kind);
+                     i++) {
+                        op = &chain->steps[i];
+                        for (unsigned v = 0; v <= in_maxval; v++) {
+                                lut->table[v] = map_value(op, lut->table[v],
+                                                          maxval);
+                        }
+                        if (op->kind == MAXVAL) {
+                                maxval = op->maxval;
+                        }
+                }
+                i--;    /* the loop header steps past the run's end */
+        }
+        return maxval;
+}
+
+/* [Name]:       Pixelop_apply
+ * [Purpose]:    Runs a prepared chain on one pixel, in place
+ * [Parameters]: 1 T (chain), 1 Pnm_rgb (pixel)
+ * [Return]:     void
+ */
+void Pixelop_apply(T chain, Pnm_rgb pixel)
+{
+        px4 v = { pixel->red, pixel->green, pixel->blue, 0 };
+
+        for (int i = 0; i < chain->compiled; i++) {
+                const step *op = &chain->program[i];
+                if (op->kind == LUT) {
+                        px4 top  = { op->maxval, op->maxval, op->maxval, 0 };
+                        px4 over = (px4)(v > top);
+                        v = (v & ~over) | (top & over);
+                        v = (px4){ op->table[v[0]], op->table[v[1]],
+                                   op->table[v[2]], 0 };
+                } else if (op->kind == SWAP) {
+                        v = __builtin_shuffle(v, op->order);
+                } else {
+                        px4 w = v * LUMA;
+                        unsigned y = (w[0] + w[1] + w[2] + 500) / 1000;
+                        v = (px4){ y, y, y, 0 };
+                }
+        }
+        pixel->red   = v[0];
+        pixel->green = v[1];
+        pixel->blue  = v[2];
+}
+
+/*---------------------------------------------------------------
+ |                        Step Functions                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       parse_step
+ * [Purpose]:    Parses one operation ("name" or "name:argument")
+ * [Parameters]: 1 c-string (text), 1 long (len, characters of text that
+ *               belong to this operation), 1 step* (out, filled in)
+ * [Return]:     1 if the operation is valid, 0 otherwise
+ */
+static int parse_step(const char *text, long len, step *out)
+{
+        char  word[32];
+        char *arg, *endptr;
+
+        if (len <= 0 || len >= (long)sizeof(word)) {
+                return 0;
+        }
+        memcpy(word, text, len);
+        word[len] = '\0';
+        arg = strchr(word, ':');
+        if (arg != NULL) {
+                *arg++ = '\0';
+        }
+
+        if (strcmp(word, "gray") == 0 && arg == NULL) {
+                out->kind = GRAY;
+        } else if (strcmp(word, "invert") == 0 && arg == NULL) {
+                out->kind = INVERT;
+        } else if (strcmp(word, "swap") == 0 && arg != NULL &&
+                   strlen(arg) == 3) {
+                const char *names = "rgb";
+                out->kind  = SWAP;
+                out->order = (px4){ 0, 0, 0, 3 };
+                for (int lane = 0; lane < 3; lane++) {
+                        const char *name = strchr(names, arg[lane]);
+                        if (arg[lane] == '\0' || name == NULL ||
+                            strchr(arg + lane + 1, arg[lane]) != NULL) {
+                                return 0;
+                        }
+                        out->order[lane] = name - names;
+                }
+        } else if (strcmp(word, "maxval") == 0 && arg != NULL) {
+                long value = strtol(arg, &endptr, 10);
+                if (*arg == '\0' || *endptr != '\0' || value < 1 ||
+                    value > MAXVAL_LIMIT) {
+                        return 0;
+                }
+                out->kind   = MAXVAL;
+                out->maxval = value;
+        } else if (strcmp(word, "gamma") == 0 && arg != NULL) {
+                double value = strtod(arg, &endptr);
+                if (*arg == '\0' || *endptr != '\0' || !(value > 0.0) ||
+                    value > 100.0) {
+                        return 0;
+                }
+                out->kind  = GAMMA;
+                out->gamma = value;
+        } else {
+                return 0;
+        }
+        out->table = NULL;
+        return 1;
+}
+
+/* [Name]:       channel_wise
+ * [Purpose]:    Tells whether an operation maps each channel on its own,
+ *               the same way for all three (so it fits a lookup table)
+ * [Parameters]: 1 step_kind (kind)
+ * [Return]:     1 if so, 0 otherwise
+ */
+static int channel_wise(step_kind kind)
+{
+        return kind == INVERT || kind == MAXVAL || kind == GAMMA;
+}
+
+/* [Name]:       map_value
+ * [Purpose]:    Applies one channel-wise operation to a channel value
+ * [Parameters]: 1 const step* (op), 2 unsigneds (value, current maxval)
+ * [Return]:     The new value
+ */
+static unsigned map_value(const step *op, unsigned value, unsigned maxval)
+{
+        if (op->kind == INVERT) {
+                return maxval - value;
+        } else if (op->kind == MAXVAL) {
+                return ((unsigned long)value * op->maxval + maxval / 2) /
+                       maxval;
+        }
+        return (unsigned)(maxval * pow((double)value / maxval, op->gamma) +
+                          0.5);
+}
+
+/* [Name]:       free_tables
+ * [Purpose]:    Drops the compiled program and its lookup tables
+ * [Parameters]: 1 T (chain)
+ * [Return]:     void
+ */
+static void free_tables(T chain)
+{
+        for (int i = 0; i < chain->compiled; i++) {
+                if (chain->program[i].kind == LUT) {
+                        FREE(chain->program[i].table);
+                }
+        }
+        chain->compiled = 0;
+}
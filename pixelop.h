@@ -0,0 +1,28 @@
+/*
+ *      pixelop.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - A chain of per-pixel operations (-ops) applied to each pixel as
+ *        the transformation moves it, instead of in passes of their own
+ *      - Operations, applied left to right: gray (luma), invert,
+ *        swap:<perm> (e.g. swap:bgr), maxval:<n> (rescale) and
+ *        gamma:<g> (v -> maxval * (v / maxval)^g)
+ *      - Pixelop_prepare fixes the input maxval; consecutive invert,
+ *        maxval and gamma operations then collapse into one lookup table
+ */
+
+#ifndef PIXELOP_INCLUDED
+#define PIXELOP_INCLUDED
+
+#include "pnm.h"
+
+#define T Pixelop_T
+typedef struct T *T;
+
+extern T        Pixelop_parse  (const char *spec);
+extern void     Pixelop_free   (T *chain);
+extern unsigned Pixelop_prepare(T chain, unsigned maxval);
+extern void     Pixelop_apply  (T chain, Pnm_rgb pixel);
+
+#undef T
+#endif
@@ -0,0 +1,462 @@
+/*
+ *      planner.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Cost model behind -auto
+ *      - Each candidate (plain row-major, plain column-major, blocked
+ *        block-major) is priced as per-pixel work plus memory traffic on
+ *        each side of the copy. A side that walks memory in order streams
+ *        cache lines; a side that strides across rows touches a new line
+ *        on every pixel, which is only cheap while the lines it cycles
+ *        through stay in L1; past that each pixel pays an L2, LLC or
+ *        memory access, plus a TLB miss once the rows are a page or more
+ *        apart and there are more of them than the TLB holds; a tiled
+ *        side stays in cache as long as a source and a destination tile
+ *        fit in L2
+ *      - The constants were calibrated against -time runs of 3000x2000
+ *        and 5000x3000 quarter turns, where the strided walks took about
+ *        20 ns a pixel and the tile moves 3 to 12
+ *      - The strategy is then picked by what the job allows: streaming for
+ *        piped input, in-place swaps for shape-preserving transforms, and
+ *        moving tiled input's tiles within its private mapping when two
+ *        copies would not fit the budget. The mapping does not save the
+ *        source's memory (each page is copied on its first write), only
+ *        the second array, and only when the tiles can move in place.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "a2plain.h"
+#include "a2blocked.h"
+#include "planner.h"
+#include "ppmio.h"
+#include "tilefile.h"
+#include "transform.h"
+#include "uarray2b.h"
+
+/* Cost model constants, in nanoseconds */
+#define PLAIN_PIXEL_NS   1.0    /* library stride walk, per pixel */
+#define BLOCKED_PIXEL_NS 3.0    /* tile moves and the block grid */
+#define SEQ_LINE_NS      1.0    /* streamed, prefetched cache line */
+#define REUSE_LINE_NS    4.0    /* line fetched once, reused from cache */
+#define L2_HIT_NS        4.0    /* strided access, line still in L2 */
+#define LLC_HIT_NS       10.0   /* strided access, line still in the LLC */
+#define MISS_NS          20.0   /* strided access with no reuse */
+#define TLB_MISS_NS      8.0    /* strided access to a page not in the TLB */
+#define PAGE_FAULT_NS    250.0  /* first touch of a fresh page */
+#define COPY_PIXEL_NS    2.0    /* copying tiled input out of its mapping */
+
+/* Pages the second-level data TLB maps */
+#define TLB_ENTRIES 1536
+#define PAGE_BYTES  4096
+
+/* Image size assumed when the input cannot be probed (a pipe) */
+#define UNKNOWN_SIDE 8192
+
+/* Fallback cache sizes when sysconf does not know them */
+#define DEFAULT_L1   (32 * 1024)
+#define DEFAULT_L2   (1024 * 1024)
+#define DEFAULT_LLC  (8 * 1024 * 1024)
+#define DEFAULT_LINE 64
+
+/* How one side of the copy walks memory */
+typedef enum pattern {
+        SEQUENTIAL,
+        STRIDED,
+        TILED
+} pattern;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static double side_ns     (pattern how, long pixels, long bytes, long crossed,
+                           long stride, long tile_bytes,
+                           const Planner_caches *caches);
+static long   plan_tile   (const Planner_job *job,
+                           const Planner_caches *caches, int width,
+                           int height, int *tile_width, int *tile_height);
+static long   cache_size  (int name, long fallback);
+static void   note        (Planner_plan *plan, const char *fmt, ...)
+                          __attribute__ ((format (printf, 2, 3)));
+
+/*---------------------------------------------------------------
+ |                       Probe Functions                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       Planner_caches_probe
+ * [Purpose]:    Reads the machine's data cache sizes
+ * [Parameters]: 1 Planner_caches* (caches, filled in)
+ * [Return]:     void
+ */
+void Planner_caches_probe(Planner_caches *caches)
+{
+        assert(caches != NULL);
+
+        caches->l1   = cache_size(_SC_LEVEL1_DCACHE_SIZE, DEFAULT_L1);
+        caches->l2   = cache_size(_SC_LEVEL2_CACHE_SIZE, DEFAULT_L2);
+        caches->llc  = cache_size(_SC_LEVEL3_CACHE_SIZE, caches->l2 >
+                                  DEFAULT_LLC ? caches->l2 : DEFAULT_LLC);
+        caches->line = cache_size(_SC_LEVEL1_DCACHE_LINESIZE, DEFAULT_LINE);
+}
+
+/* [Name]:       Planner_default_budget
+ * [Purpose]:    Default memory budget: half of physical memory
+ * [Parameters]: none
+ * [Return]:     Budget in bytes
+ */
+long Planner_default_budget(void)
+{
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long page  = sysconf(_SC_PAGESIZE);
+
+        if (pages <= 0 || page <= 0) {
+                return 1L << 30;
+        }
+        return pages / 2 * page;
+}
+
+/* [Name]:       Planner_probe
+ * [Purpose]:    Fills in what can be learned about the input without
+ *               consuming it: whether it is seekable or tiled, and its
+ *               dimensions (left 0 for pipes and plain ppm)
+ * [Parameters]: 1 int (fd), 1 Planner_job* (job)
+ * [Return]:     void
+ */
+void Planner_probe(int fd, Planner_job *job)
+{
+        struct stat st;
+
+        assert(job != NULL);
+
+        job->width       = 0;
+        job->height      = 0;
+        job->tiled       = 0;
+        job->tile_width  = 0;
+        job->tile_height = 0;
+        job->seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+        if (!job->seekable) {
+                return;
+        }
+
+        if (Tilefile_probe(fd)) {
+                Tilefile_header header;
+                if (pread(fd, &header, sizeof(header), 0) ==
+                    sizeof(header)) {
+                        job->tiled       = 1;
+                        job->width       = header.width;
+                        job->height      = header.height;
+                        job->tile_width  = header.tile_width;
+                        job->tile_height = header.tile_height;
+                }
+                return;
+        }
+
+        unsigned char buf[4096];
+        Ppmio_header  header;
+        off_t         base = lseek(fd, 0, SEEK_CUR);
+        ssize_t       got  = base < 0 ? -1 : pread(fd, buf, sizeof(buf),
+                                                   base);
+        if (got > 0 && Ppmio_parse_header(buf, got, &header) == 1) {
+                job->width  = header.width;
+                job->height = header.height;
+        }
+}
+
+/*---------------------------------------------------------------
+ |                        Plan Functions                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       Planner_choose
+ * [Purpose]:    Prices every storage/traversal candidate for the job, then
+ *               picks a strategy and records why
+ * [Parameters]: 1 const Planner_job* (job), 1 const Planner_caches*
+ *               (caches), 1 Planner_plan* (plan, filled in)
+ * [Return]:     void
+ */
+void Planner_choose(const Planner_job *job, const Planner_caches *caches,
+                    Planner_plan *plan)
+{
+        assert(job != NULL && caches != NULL && plan != NULL);
+
+        int  known  = job->width > 0 && job->height > 0;
+        int  width  = known ? job->width  : UNKNOWN_SIDE;
+        int  height = known ? job->height : UNKNOWN_SIDE;
+        long pixels = (long)width * height;
+        long bytes  = pixels * job->elem_size;
+        int  transpose, mirror_cols, mirror_rows;
+        int  tile_w, tile_h;
+        long cells  = plan_tile(job, caches, width, height, &tile_w, &tile_h);
+        long src_row = (long)width  * job->elem_size;  /* bytes */
+        long dst_row = (long)height * job->elem_size;  /* axes swapped */
+        long tile_bytes = 2L * tile_w * tile_h * job->elem_size;
+        double fresh    = (double)bytes / 4096 * PAGE_FAULT_NS;
+        double in_copy  = job->tiled ? pixels * COPY_PIXEL_NS : 0;
+
+        axis_mirrors(job->transform_type, job->magnitude, &transpose,
+                     &mirror_cols, &mirror_rows);
+        /* tiled input keeps its own tiles; blocked arrays cut them to fit */
+        int file_tiles = job->tiled && job->tile_width > 0 &&
+                         job->tile_height > 0;
+        int moves = UArray2b_moves_in_place(width, height,
+                file_tiles ? job->tile_width  : tile_w,
+                file_tiles ? job->tile_height : tile_h, transpose,
+                mirror_cols, mirror_rows);
+
+        plan->rationale[0] = '\0';
+        note(plan, "image %dx%d%s, %d-byte pixels, %.1f MiB; caches L1 %ld "
+             "KiB, L2 %ld KiB, LLC %ld KiB; %d thread(s); budget %.0f MiB",
+             width, height, known ? "" : " (not probed; assumed)",
+             job->elem_size, bytes / 1048576.0, caches->l1 / 1024,
+             caches->l2 / 1024, caches->llc / 1024, job->threads,
+             job->budget / 1048576.0);
+
+        /* row-major: source streams; a swapping transform strides down a
+         * destination column, crossing one destination row (height
+         * pixels long) per source column */
+        double row_ns = pixels * PLAIN_PIXEL_NS + in_copy + fresh +
+                side_ns(SEQUENTIAL, pixels, bytes, 0, 0, 0, caches) +
+                side_ns(transpose ? STRIDED : SEQUENTIAL, pixels, bytes,
+                        width, dst_row, 0, caches);
+        /* column-major: the source strides down columns, crossing its
+         * height rows; so does the destination unless the axes swap */
+        double col_ns = pixels * PLAIN_PIXEL_NS + in_copy + fresh +
+                side_ns(STRIDED, pixels, bytes, height, src_row, 0,
+                        caches) +
+                side_ns(transpose ? SEQUENTIAL : STRIDED, pixels, bytes,
+                        height, src_row, 0, caches);
+        /* block-major: both sides stay within a tile pair; tiled input is
+         * used as mapped, with no copy */
+        double blk_ns = pixels * BLOCKED_PIXEL_NS + fresh +
+                2 * side_ns(TILED, pixels, bytes, 0, 0, tile_bytes, caches);
+
+        note(plan, "estimates: row-major %.1f ms, column-major %.1f ms, "
+             "block-major (%dx%d tiles) %.1f ms", row_ns / 1e6, col_ns / 1e6,
+             tile_w, tile_h, blk_ns / 1e6);
+
+        if (blk_ns < row_ns && blk_ns < col_ns) {
+                plan->estimate_ns = blk_ns;
+                plan->map         = uarray2_methods_blocked->map_block_major;
+                plan->methods     = uarray2_methods_blocked;
+                if (job->tiled) {
+                        plan->tile_width  = 0;
+                        plan->tile_height = 0;
+                        plan->tile_cells  = 0;
+                        note(plan, "block-major wins; tiled input keeps "
+                             "the file's own blocks");
+                } else {
+                        plan->tile_width  = tile_w;
+                        plan->tile_height = tile_h;
+                        plan->tile_cells  = cells;
+                        note(plan, "block-major wins: a source and a "
+                             "destination tile (%ld KiB) fit in L2",
+                             tile_bytes / 1024);
+                }
+        } else {
+                plan->methods     = uarray2_methods_plain;
+                plan->tile_width  = 0;
+                plan->tile_height = 0;
+                plan->tile_cells  = 0;
+                plan->estimate_ns = row_ns <= col_ns ? row_ns : col_ns;
+                plan->map         = row_ns <= col_ns
+                                    ? uarray2_methods_plain->map_row_major
+                                    : uarray2_methods_plain->map_col_major;
+                note(plan, "%s wins%s", row_ns <= col_ns ? "row-major"
+                                                         : "column-major",
+                     transpose ? "; the strided side's lines stay in L1"
+                               : "");
+        }
+
+        /* strategy */
+        int shape_kept = !transpose;
+        if (job->fused) {
+                plan->strategy    = PLANNER_COPY;
+                plan->methods     = uarray2_methods_plain;
+                plan->map         = uarray2_methods_plain->map_default;
+                plan->tile_width  = 0;
+                plan->tile_height = 0;
+                plan->tile_cells  = 0;
+                plan->estimate_ns = row_ns;
+                note(plan, "strategy copy: crop/scale/free rotation run "
+                     "their own traversal; plain storage has the cheapest "
+                     "at()");
+        } else if (!job->seekable && job->threads >= 2) {
+                plan->strategy    = PLANNER_STREAM;
+                plan->methods     = uarray2_methods_plain;
+                plan->map         = uarray2_methods_plain->map_row_major;
+                plan->tile_width  = 0;
+                plan->tile_height = 0;
+                plan->tile_cells  = 0;
+                note(plan, "strategy stream: input is a pipe, so reading, "
+                     "transforming and writing overlap on %d threads",
+                     job->threads);
+        } else if (shape_kept) {
+                plan->strategy    = PLANNER_IN_PLACE;
+                plan->methods     = uarray2_methods_plain;
+                plan->map         = uarray2_methods_plain->map_row_major;
+                plan->tile_width  = 0;
+                plan->tile_height = 0;
+                plan->tile_cells  = 0;
+                plan->estimate_ns = pixels * PLAIN_PIXEL_NS + in_copy +
+                        2 * side_ns(SEQUENTIAL, pixels, bytes, 0, 0, 0,
+                                    caches);
+                note(plan, "strategy in-place: the shape is kept, so pixel "
+                     "pairs are swapped in the source (no second array, "
+                     "%.1f ms of page faults saved)", fresh / 1e6);
+        } else if (file_tiles && 2 * bytes > job->budget && moves) {
+                plan->strategy    = PLANNER_MAPPED;
+                plan->methods     = uarray2_methods_blocked;
+                plan->map         = uarray2_methods_blocked->map_block_major;
+                plan->tile_width  = 0;
+                plan->tile_height = 0;
+                plan->tile_cells  = 0;
+                note(plan, "strategy mapped: two copies would exceed the "
+                     "budget, so the file's tiles are moved within its "
+                     "private mapping; each page is copied on its first "
+                     "write, so the source still costs its full size, but "
+                     "no second array is made");
+        } else {
+                plan->strategy = PLANNER_COPY;
+                note(plan, "strategy copy");
+                if (file_tiles && 2 * bytes > job->budget) {
+                        note(plan, "mapping the input would not help: its "
+                             "edge tiles are partial along a mirrored axis, "
+                             "so the tiles cannot move in place and a second "
+                             "array is filled");
+                }
+        }
+
+        /* blocked tiles moved in place need no second array */
+        long peak = plan->strategy == PLANNER_IN_PLACE ||
+                    (plan->methods == uarray2_methods_blocked && moves)
+                    ? bytes : 2 * bytes;
+        if (peak > job->budget) {
+                note(plan, "warning: needs about %.0f MiB, over the budget",
+                     peak / 1048576.0);
+        }
+}
+
+/* [Name]:       Planner_log
+ * [Purpose]:    Writes the plan and its rationale
+ * [Parameters]: 1 const Planner_plan* (plan), 1 FILE* (fp)
+ * [Return]:     void
+ */
+void Planner_log(const Planner_plan *plan, FILE *fp)
+{
+        static const char *strategies[] = { "copy", "in-place", "stream",
+                                            "mapped" };
+
+        assert(plan != NULL && fp != NULL);
+
+        fprintf(fp, "PLAN\n");
+        fprintf(fp, "Strategy:\t%s\n", strategies[plan->strategy]);
+        fprintf(fp, "Storage:\t%s", plan->methods == uarray2_methods_plain
+                                    ? "plain" : "blocked");
+        if (plan->tile_width > 0) {
+                fprintf(fp, " (%dx%d tiles)", plan->tile_width,
+                        plan->tile_height);
+        }
+        fprintf(fp, "\nEstimate:\t%.1f ms\nRationale:\n%s",
+                plan->estimate_ns / 1e6, plan->rationale);
+}
+
+/*---------------------------------------------------------------
+ |                        Model Helpers                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       side_ns
+ * [Purpose]:    Prices the memory traffic of one side of the copy. A
+ *               strided side touches a new line on every pixel: it only
+ *               streams while the lines it cycles through (one per row
+ *               crossed) fit in L1, and otherwise pays for each pixel where
+ *               those lines still are, plus a TLB miss when the rows are a
+ *               page or more apart and outnumber the TLB.
+ * [Parameters]: 1 pattern (how), 2 longs (pixels, bytes), 2 longs
+ *               (crossed, rows a strided walk cycles through; stride,
+ *               bytes between them), 1 long (tile_bytes; working set of a
+ *               tile pair), 1 const Planner_caches* (caches)
+ * [Return]:     Estimated nanoseconds
+ */
+static double side_ns(pattern how, long pixels, long bytes, long crossed,
+                      long stride, long tile_bytes,
+                      const Planner_caches *caches)
+{
+        double lines  = (double)bytes / caches->line;
+        long   window = crossed * caches->line;
+        double ns;
+
+        if (how == SEQUENTIAL) {
+                return lines * SEQ_LINE_NS;
+        } else if (how == TILED) {
+                /* tile edges cost a little extra over pure streaming */
+                return lines * (tile_bytes <= caches->l2 ? 1.2 * SEQ_LINE_NS
+                                                         : REUSE_LINE_NS);
+        } else if (window <= caches->l1) {
+                return lines * SEQ_LINE_NS;
+        }
+
+        ns = window <= caches->l2  ? L2_HIT_NS
+           : window <= caches->llc ? LLC_HIT_NS : MISS_NS;
+        if (stride >= PAGE_BYTES && crossed > TLB_ENTRIES) {
+                ns += TLB_MISS_NS;
+        }
+        return pixels * ns;
+}
+
+/* [Name]:       plan_tile
+ * [Purpose]:    Picks the tile: the largest whose source and destination
+ *               tiles together fill at most half of L2, square unless the
+ *               image is too thin for it (see UArray2b_fit_tile)
+ * [Parameters]: 1 const Planner_job* (job), 1 const Planner_caches*
+ *               (caches), 2 ints (width, height), 2 int* (tile_width,
+ *               tile_height; set)
+ * [Return]:     The cell budget of a tile
+ */
+static long plan_tile(const Planner_job *job, const Planner_caches *caches,
+                      int width, int height, int *tile_width,
+                      int *tile_height)
+{
+        long cells = caches->l2 / 4 / job->elem_size;
+
+        UArray2b_fit_tile(width, height, cells, tile_width, tile_height);
+        return cells;
+}
+
+/* [Name]:       cache_size
+ * [Purpose]:    Reads one cache parameter from sysconf
+ * [Parameters]: 1 int (sysconf name), 1 long (fallback)
+ * [Return]:     The parameter, or fallback if unknown
+ */
+static long cache_size(int name, long fallback)
+{
+        long value = sysconf(name);
+        return value > 0 ? value : fallback;
+}
+
+/* [Name]:       note
+ * [Purpose]:    Appends one line to the plan's rationale
+ * [Parameters]: 1 Planner_plan* (plan), 1 c-string (printf format),
+ *               varargs
+ * [Return]:     void
+ */
+static void note(Planner_plan *plan, const char *fmt, ...)
+{
+        size_t  used = strlen(plan->rationale);
+        va_list args;
+
+        if (used + 4 >= sizeof(plan->rationale)) {
+                return;
+        }
+        plan->rationale[used++] = ' ';
+        plan->rationale[used++] = ' ';
+        va_start(args, fmt);
+        vsnprintf(plan->rationale + used, sizeof(plan->rationale) - used - 1,
+                  fmt, args);
+        va_end(args);
+        used = strlen(plan->rationale);
+        plan->rationale[used]     = '\n';
+        plan->rationale[used + 1] = '\0';
+}
@@ -0,0 +1,69 @@
+/*
+ *      planner.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Chooses how ppmtrans should run a transformation (-auto): the
+ *        storage (plain or blocked, and the block size), the traversal
+ *        order and the strategy, from a cost model of the image, the
+ *        transformation, the machine's caches, the thread count and a
+ *        memory budget
+ */
+
+#ifndef PLANNER_INCLUDED
+#define PLANNER_INCLUDED
+
+#include <stdio.h>
+
+#include "a2methods.h"
+
+typedef enum Planner_strategy {
+        PLANNER_COPY,           /* map the source into a new array     */
+        PLANNER_IN_PLACE,       /* swap pixel pairs in the source      */
+        PLANNER_STREAM,         /* -pipeline: overlap read/work/write  */
+        PLANNER_MAPPED          /* move tiled input's tiles within its
+                                   private file mapping */
+} Planner_strategy;
+
+/* What the planner knows about the job */
+typedef struct Planner_job {
+        int  transform_type, magnitude;
+        int  width, height;     /* 0 if the input could not be probed */
+        int  elem_size;
+        int  threads;
+        long budget;            /* bytes of memory the job may use */
+        int  seekable;          /* input is a regular file */
+        int  tiled;             /* input is a tiled image */
+        int  tile_width;        /* its tiles; 0 unless tiled */
+        int  tile_height;
+        int  fused;             /* -crop/-scale/free angle: own engines */
+} Planner_job;
+
+/* The machine's data caches, in bytes */
+typedef struct Planner_caches {
+        long l1, l2, llc;
+        long line;
+} Planner_caches;
+
+/* The chosen plan */
+typedef struct Planner_plan {
+        A2Methods_T       methods;
+        A2Methods_mapfun *map;
+        int               tile_width;   /* 0 unless blocked */
+        int               tile_height;
+        long              tile_cells;   /* planned tile budget for
+                                           UArray2b_set_default_tile; 0
+                                           keeps the default tiles */
+        Planner_strategy  strategy;
+        double            estimate_ns;
+        char              rationale[1024];
+} Planner_plan;
+
+extern void Planner_caches_probe(Planner_caches *caches);
+extern long Planner_default_budget(void);
+extern void Planner_probe (int fd, Planner_job *job);
+extern void Planner_choose(const Planner_job *job,
+                           const Planner_caches *caches,
+                           Planner_plan *plan);
+extern void Planner_log   (const Planner_plan *plan, FILE *fp);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ *      planner_test.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Tests the -auto planner's choices on fixed cache sizes, so the
+ *        results do not depend on the machine running the test
+ *      - Large quarter turns and transposes must go block-major, with a
+ *        tile pair that fits in L2; shape-keeping jobs must go in place;
+ *        fused, piped and tiled jobs get their own strategies
+ *      - Exits nonzero if any check fails
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a2blocked.h"
+#include "a2plain.h"
+#include "planner.h"
+#include "pnm.h"
+#include "transform.h"
+
+/* Cache sizes of a few machines: this project's, a small desktop, a
+ * server part */
+static const Planner_caches machines[] = {
+        { 48 * 1024, 2048 * 1024, 105 * 1024 * 1024, 64 },
+        { 32 * 1024,  256 * 1024,   8 * 1024 * 1024, 64 },
+        { 32 * 1024, 1024 * 1024,  32 * 1024 * 1024, 64 },
+};
+
+/* Images too big for any of their LLCs twice over */
+static const int large[][2] = { { 1501, 997 }, { 3000, 2000 },
+                                { 5003, 3001 } };
+
+static int checks = 0;
+static int failed = 0;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void check    (int ok, const char *what, const Planner_job *job);
+static void job_init (Planner_job *job, int transform_type, int magnitude,
+                      int width, int height, int threads);
+static void test_quarter_turns(void);
+static void test_shape_kept   (void);
+static void test_strategies   (void);
+
+int main(void)
+{
+        test_quarter_turns();
+        test_shape_kept();
+        test_strategies();
+
+        printf("planner_test: %d checks, %d failed\n", checks, failed);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* [Name]:       check
+ * [Purpose]:    Counts a check and reports it, with the job, if it failed
+ * [Parameters]: 1 int (ok), 1 const char* (what was checked),
+ *               1 const Planner_job* (job)
+ * [Return]:     void
+ */
+static void check(int ok, const char *what, const Planner_job *job)
+{
+        checks++;
+        if (!ok) {
+                failed++;
+                fprintf(stderr, "FAIL %s: type %d magnitude %d on %dx%d, "
+                        "%d thread(s)\n", what, job->transform_type,
+                        job->magnitude, job->width, job->height,
+                        job->threads);
+        }
+}
+
+/* [Name]:       job_init
+ * [Purpose]:    Describes an ordinary job: a seekable P6 file of the given
+ *               size, a budget that holds two copies, nothing fused
+ * [Parameters]: 1 Planner_job* (job, filled in), 5 ints (transform_type,
+ *               magnitude, width, height, threads)
+ * [Return]:     void
+ */
+static void job_init(Planner_job *job, int transform_type, int magnitude,
+                     int width, int height, int threads)
+{
+        memset(job, 0, sizeof(*job));
+        job->transform_type = transform_type;
+        job->magnitude      = magnitude;
+        job->width          = width;
+        job->height         = height;
+        job->elem_size      = sizeof(struct Pnm_rgb);
+        job->threads        = threads;
+        job->budget         = 4L * width * height * job->elem_size;
+        job->seekable       = 1;
+}
+
+/*---------------------------------------------------------------
+ |                           Tests                              |
+ *--------------------------------------------------------------*/
+/* [Name]:       test_quarter_turns
+ * [Purpose]:    Large 90 and 270 degree turns and transposes must be
+ *               planned block-major, copying, with tiles whose source and
+ *               destination pair fits in L2
+ * [Parameters]: None
+ * [Return]:     void
+ */
+static void test_quarter_turns(void)
+{
+        int types[]      = { ROTATE, ROTATE, TRANSPOSE };
+        int magnitudes[] = { 90, 270, 0 };
+
+        for (size_t m = 0; m < sizeof(machines) / sizeof(machines[0]); m++) {
+                for (size_t s = 0; s < sizeof(large) / sizeof(large[0]);
+                     s++) {
+                        for (int t = 0; t < 3; t++) {
+                                for (int threads = 1; threads <= 4;
+                                     threads += 3) {
+                                        Planner_job  job;
+                                        Planner_plan plan;
+                                        job_init(&job, types[t],
+                                                 magnitudes[t], large[s][0],
+                                                 large[s][1], threads);
+                                        Planner_choose(&job, &machines[m],
+                                                       &plan);
+
+                                        long pair = 2L * plan.tile_width *
+                                                    plan.tile_height *
+                                                    job.elem_size;
+                                        check(plan.methods ==
+                                              uarray2_methods_blocked,
+                                              "blocked storage", &job);
+                                        check(plan.strategy == PLANNER_COPY,
+                                              "copy strategy", &job);
+                                        check(plan.tile_width > 0 &&
+                                              plan.tile_height > 0 &&
+                                              plan.tile_cells > 0 &&
+                                              pair <= machines[m].l2,
+                                              "tile pair fits in L2", &job);
+                                }
+                        }
+                }
+        }
+}
+
+/* [Name]:       test_shape_kept
+ * [Purpose]:    Half turns and flips keep the shape, so they must be
+ *               planned in place on plain storage, whatever the size
+ * [Parameters]: None
+ * [Return]:     void
+ */
+static void test_shape_kept(void)
+{
+        int types[]      = { ROTATE, FLIP, FLIP };
+        int magnitudes[] = { 180, HORIZ, VERT };
+
+        for (size_t s = 0; s < sizeof(large) / sizeof(large[0]); s++) {
+                for (int t = 0; t < 3; t++) {
+                        Planner_job  job;
+                        Planner_plan plan;
+                        job_init(&job, types[t], magnitudes[t], large[s][0],
+                                 large[s][1], 1);
+                        Planner_choose(&job, &machines[0], &plan);
+                        check(plan.strategy == PLANNER_IN_PLACE &&
+                              plan.methods == uarray2_methods_plain &&
+                              plan.tile_cells == 0, "in place", &job);
+                }
+        }
+}
+
+/* [Name]:       test_strategies
+ * [Purpose]:    Fused work copies on plain storage; piped input streams
+ *               on two or more threads; tiled input keeps its own tiles,
+ *               and is moved within its mapping when two copies would
+ *               not fit the budget; an unprobed input still gets a plan;
+ *               the log names the choice
+ * [Parameters]: None
+ * [Return]:     void
+ */
+static void test_strategies(void)
+{
+        Planner_job  job;
+        Planner_plan plan;
+
+        job_init(&job, ROTATE, 90, 3000, 2000, 1);
+        job.fused = 1;
+        Planner_choose(&job, &machines[0], &plan);
+        check(plan.strategy == PLANNER_COPY &&
+              plan.methods == uarray2_methods_plain, "fused copy", &job);
+
+        job_init(&job, ROTATE, 90, 3000, 2000, 4);
+        job.seekable = 0;
+        Planner_choose(&job, &machines[0], &plan);
+        check(plan.strategy == PLANNER_STREAM &&
+              plan.methods == uarray2_methods_plain, "piped stream", &job);
+
+        job_init(&job, ROTATE, 90, 4096, 2048, 1);
+        job.tiled       = 1;
+        job.tile_width  = 256;
+        job.tile_height = 256;
+        Planner_choose(&job, &machines[0], &plan);
+        check(plan.methods == uarray2_methods_blocked &&
+              plan.strategy == PLANNER_COPY && plan.tile_cells == 0,
+              "tiled input keeps its tiles", &job);
+
+        job.budget = (long)job.width * job.height * job.elem_size;
+        Planner_choose(&job, &machines[0], &plan);
+        check(plan.strategy == PLANNER_MAPPED &&
+              plan.methods == uarray2_methods_blocked,
+              "tiled input over budget is mapped", &job);
+
+        job_init(&job, TRANSPOSE, 0, 0, 0, 1);
+        job.budget = 1L << 30;
+        Planner_choose(&job, &machines[0], &plan);
+        check(plan.methods != NULL && plan.map != NULL &&
+              strstr(plan.rationale, "not probed") != NULL,
+              "unprobed input", &job);
+
+        FILE *log = tmpfile();
+        char  text[4096];
+        size_t got = 0;
+        job_init(&job, ROTATE, 270, 3000, 2000, 1);
+        Planner_choose(&job, &machines[0], &plan);
+        if (log != NULL) {
+                Planner_log(&plan, log);
+                rewind(log);
+                got = fread(text, 1, sizeof(text) - 1, log);
+                fclose(log);
+        }
+        text[got] = '\0';
+        check(strncmp(text, "PLAN\n", 5) == 0 &&
+              strstr(text, "Storage:\tblocked") != NULL, "log", &job);
+}
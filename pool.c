@@ -0,0 +1,97 @@
+/*
+ *      pool.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Freed buffers are kept per thread (no locking), oldest evicted
+ *        first once the thread's slots are full
+ *      - A reused buffer is cleared before it is handed out, so it reads
+ *        the same as fresh calloc'd storage; clearing pages that are
+ *        already mapped costs far less than faulting in new ones
+ */
+
+#include <string.h>
+
+#include "assert.h"
+#include "mem.h"
+#include "pool.h"
+
+/* One freed buffer */
+typedef struct slot {
+        void *ptr;
+        long  bytes;
+} slot;
+
+/* This thread's pool; empty and disabled until Pool_enable */
+static __thread slot pool[POOL_MAX_SLOTS];
+static __thread int  pool_slots;
+static __thread int  pool_count;
+
+/* [Name]:       Pool_enable
+ * [Purpose]:    Lets the calling thread keep up to slots freed buffers
+ *               for reuse (0 disables pooling; buffers already kept are
+ *               freed)
+ * [Parameters]: 1 int (slots, at most POOL_MAX_SLOTS)
+ * [Return]:     void
+ */
+void Pool_enable(int slots)
+{
+        assert(slots >= 0 && slots <= POOL_MAX_SLOTS);
+
+        while (pool_count > slots) {
+                pool_count--;
+                FREE(pool[pool_count].ptr);
+        }
+        pool_slots = slots;
+}
+
+/* [Name]:       Pool_calloc
+ * [Purpose]:    Allocates zeroed storage for count elements of size bytes,
+ *               reusing a buffer of the same size from this thread's pool
+ *               if there is one
+ * [Parameters]: 2 longs (count, size; count * size > 0)
+ * [Return]:     The storage; release it with Pool_free
+ */
+void *Pool_calloc(long count, long size)
+{
+        long bytes = count * size;
+
+        assert(count > 0 && size > 0);
+
+        for (int i = 0; i < pool_count; i++) {
+                if (pool[i].bytes == bytes) {
+                        void *ptr = pool[i].ptr;
+                        pool_count--;
+                        memmove(pool + i, pool + i + 1,
+                                (pool_count - i) * sizeof(slot));
+                        memset(ptr, 0, bytes);
+                        return ptr;
+                }
+        }
+        return CALLOC(count, size);
+}
+
+/* [Name]:       Pool_free
+ * [Purpose]:    Releases storage from Pool_calloc: kept in this thread's
+ *               pool if it is enabled (evicting the oldest buffer when
+ *               full), freed otherwise
+ * [Parameters]: 1 void* (ptr; may be NULL), 1 long (bytes, as allocated)
+ * [Return]:     void
+ */
+void Pool_free(void *ptr, long bytes)
+{
+        if (ptr == NULL) {
+                return;
+        }
+        if (pool_slots == 0) {
+                FREE(ptr);
+                return;
+        }
+        if (pool_count == pool_slots) {
+                FREE(pool[0].ptr);
+                memmove(pool, pool + 1, (pool_slots - 1) * sizeof(slot));
+                pool_count--;
+        }
+        pool[pool_count].ptr   = ptr;
+        pool[pool_count].bytes = bytes;
+        pool_count++;
+}
@@ -0,0 +1,23 @@
+/*
+ *      pool.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Per-thread pool of freed array storage, beneath the arrays'
+ *        own new and free: a thread that enables it gets its freed
+ *        buffers back for allocations of the same size, so a steady run
+ *        of same-sized images does not go back to the allocator (or the
+ *        kernel, for large buffers) each time
+ *      - Threads that never enable it allocate and free as before
+ */
+
+#ifndef POOL_INCLUDED
+#define POOL_INCLUDED
+
+/* Most freed buffers one thread may keep */
+#define POOL_MAX_SLOTS 16
+
+extern void  Pool_enable(int slots);
+extern void *Pool_calloc(long count, long size);
+extern void  Pool_free  (void *ptr, long bytes);
+
+#endif
@@ -0,0 +1,1000 @@
+/*
+ *      ppmio.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Reads and writes binary (P6) ppm images with positional I/O
+ *      - The raster is split into row bands; each band is decoded/encoded on
+ *        its own thread with pread/pwrite at the band's computed offset
+ *      - With Ppmio_use_uring, each band keeps several chunk reads/writes
+ *        in flight on its own io_uring and decodes/encodes chunks as they
+ *        complete; without it (or when io_uring is unavailable) a band
+ *        moves one chunk at a time with pread/pwrite
+ *      - Traced per chunk: "pread"/"pwrite" (or "uring wait") spans show
+ *        I/O stalls apart from the "decode"/"encode" work
+ *      - Encoding reads sparse images without expanding their uniform
+ *        tiles
+ *      - Band I/O only applies to regular files; streams (pipes, sockets)
+ *        are read/written row by row, and plain (P3) ppm files are left to
+ *        Pnm_ppmread
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "a2sparse.h"
+#include "bands.h"
+#include "mem.h"
+#include "ppmio.h"
+#include "trace.h"
+#include "uarray2b.h"
+#include "uring.h"
+
+typedef A2Methods_UArray2 A2;
+
+/* Largest header we are willing to search for the raster offset */
+#define MAX_HEADER_BYTES (64 * 1024)
+
+/* Most pixels a stream may claim; its array is allocated before any row
+   arrives, so a lying header must not get to size it */
+#define MAX_STREAM_PIXELS (1L << 28)
+
+/* Each band is moved through a buffer of roughly this many bytes */
+#define CHUNK_BYTES (1024 * 1024)
+
+/* Chunks each band keeps in flight on io_uring; 0 uses pread/pwrite */
+static int uring_depth = 0;
+
+/* Work description for one band of rows; closure for the band workers */
+typedef struct band {
+        int         fd;
+        long        base;             /* file offset of the raster */
+        long        row_bytes;
+        long        skip_bytes;       /* read: bytes before the region */
+        long        span_bytes;       /* read: bytes of the region per row */
+        int         skip_rows;        /* read: rows above the region */
+        int         first_row, end_row;
+        int         maxval;
+        A2Methods_T methods;
+        A2          pixels;
+        int        *pending;          /* read, sparse: rows left to decode
+                                         in each block row (shared)    */
+        int         tile_h;
+        int         failed;
+} band;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static int   is_space     (unsigned char c);
+static int   skip_space   (const unsigned char *buf, long len, long *pos);
+static int   parse_number (const unsigned char *buf, long len, long *pos,
+                           int *value);
+static int   pread_full   (int fd, unsigned char *buf, long n, long offset);
+static int   pwrite_full  (int fd, const unsigned char *buf, long n,
+                           long offset);
+static void *read_band    (void *cl);
+static void  rows_decoded (band *b, int row, int count);
+static void *write_band   (void *cl);
+static int   read_band_uring (band *b, long rows);
+static int   write_band_uring(band *b, long rows);
+static int   run_bands    (band *bands, int count, void *work(void *));
+static int   is_regular   (int fd);
+static const struct Pnm_rgb *pixel_at(A2Methods_T methods, A2 pixels,
+                                      int col, int row);
+
+/*---------------------------------------------------------------
+ |                       Header Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Ppmio_parse_header
+ * [Purpose]:    Parses a P6 header held in memory (magic, width, height and
+ *               maxval, with optional comments) and records where the
+ *               raster begins.
+ * [Parameters]: 1 const unsigned char* (buf), 1 long (len, bytes in buf),
+ *               1 Ppmio_header* (header, filled in on success)
+ * [Return]:     1 if a complete P6 header was parsed, 0 if buf does not hold
+ *               a valid P6 header, -1 if more bytes are needed
+ */
+int Ppmio_parse_header(const unsigned char *buf, long len,
+                       Ppmio_header *header)
+{
+        long pos = 2;
+        int  status;
+
+        assert(buf != NULL && header != NULL);
+
+        if (len < 2) {
+                return -1;
+        }
+        if (buf[0] != 'P' || buf[1] != '6') {
+                return 0;
+        }
+        /* the magic number ends at whitespace or a comment ("P63" is not
+           P6) */
+        if (len < 3) {
+                return -1;
+        }
+        if (!is_space(buf[2]) && buf[2] != '#') {
+                return 0;
+        }
+
+        if ((status = parse_number(buf, len, &pos, &header->width))  != 1 ||
+            (status = parse_number(buf, len, &pos, &header->height)) != 1 ||
+            (status = parse_number(buf, len, &pos, &header->maxval)) != 1) {
+                return status;
+        }
+
+        /* exactly one whitespace character separates maxval & raster */
+        if (pos >= len) {
+                return -1;
+        }
+        if (!is_space(buf[pos])) {
+                return 0;
+        }
+        pos++;
+
+        if (header->width <= 0 || header->height <= 0 ||
+            header->maxval <= 0 || header->maxval > 65535) {
+                return 0;
+        }
+
+        header->offset = pos;
+        return 1;
+}
+
+/* [Name]:       Ppmio_read_header
+ * [Purpose]:    Reads a P6 header from a stream, consuming exactly the
+ *               header bytes so that the next byte read is the raster
+ * [Parameters]: 1 FILE* (fp), 1 Ppmio_header* (header, filled in on success)
+ * [Return]:     1 if a P6 header was read, 0 otherwise
+ */
+int Ppmio_read_header(FILE *fp, Ppmio_header *header)
+{
+        unsigned char buf[MAX_HEADER_BYTES];
+        long len    = 0;
+        int  status = -1;
+
+        assert(fp != NULL && header != NULL);
+
+        while (status == -1 && len < MAX_HEADER_BYTES) {
+                int c = getc(fp);
+                if (c == EOF) {
+                        return 0;
+                }
+                buf[len++] = c;
+                status = Ppmio_parse_header(buf, len, header);
+        }
+        return status == 1;
+}
+
+/* [Name]:       Ppmio_row_bytes
+ * [Purpose]:    Returns the number of raster bytes in one P6 row
+ * [Parameters]: 2 ints (width, maxval)
+ * [Return]:     Bytes per row (samples are 2 bytes wide if maxval > 255)
+ */
+long Ppmio_row_bytes(int width, int maxval)
+{
+        return (long)width * 3 * (maxval < 256 ? 1 : 2);
+}
+
+/* [Name]:       is_space
+ * [Purpose]:    Tells whether a byte is Netpbm header whitespace
+ * [Parameters]: 1 unsigned char (c)
+ * [Return]:     1 for space, tab, CR, LF, VT or FF, 0 otherwise
+ */
+static int is_space(unsigned char c)
+{
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+               c == '\f';
+}
+
+/* [Name]:       skip_space
+ * [Purpose]:    Advances pos past whitespace and '#' comments
+ * [Parameters]: 1 const unsigned char* (buf), 1 long (len), 1 long* (pos)
+ * [Return]:     1 if a non-space byte was reached, -1 if buf ran out
+ */
+static int skip_space(const unsigned char *buf, long len, long *pos)
+{
+        while (*pos < len) {
+                unsigned char c = buf[*pos];
+                if (c == '#') {
+                        while (*pos < len && buf[*pos] != '\n') {
+                                (*pos)++;
+                        }
+                } else if (is_space(c)) {
+                        (*pos)++;
+                } else {
+                        return 1;
+                }
+        }
+        return -1;
+}
+
+/* [Name]:       parse_number
+ * [Purpose]:    Parses one decimal header field starting at pos
+ * [Parameters]: 1 const unsigned char* (buf), 1 long (len), 1 long* (pos),
+ *               1 int* (value)
+ * [Return]:     1 on success, 0 on a malformed field, -1 if buf ran out
+ */
+static int parse_number(const unsigned char *buf, long len, long *pos,
+                        int *value)
+{
+        long n = 0;
+        int  digits = 0;
+
+        if (skip_space(buf, len, pos) != 1) {
+                return -1;
+        }
+        while (*pos < len && buf[*pos] >= '0' && buf[*pos] <= '9') {
+                n = n * 10 + (buf[*pos] - '0');
+                if (n > 0x7fffffff) {
+                        return 0;
+                }
+                digits++;
+                (*pos)++;
+        }
+        if (*pos >= len) {
+                return -1;
+        }
+        if (digits == 0) {
+                return 0;
+        }
+
+        *value = (int)n;
+        return 1;
+}
+
+/*---------------------------------------------------------------
+ |                      Row Packing Functions                   |
+ *--------------------------------------------------------------*/
+/* [Name]:       Ppmio_unpack_row
+ * [Purpose]:    Decodes one row of raster bytes into the given row of pixels
+ * [Parameters]: 1 const unsigned char* (bytes), 1 int (maxval),
+ *               1 A2Methods_T (methods), 1 A2 (pixels), 1 int (row)
+ * [Return]:     void
+ */
+void Ppmio_unpack_row(const unsigned char *bytes, int maxval,
+                      A2Methods_T methods, A2 pixels, int row)
+{
+        int width = methods->width(pixels);
+
+        if (maxval < 256) {
+                for (int col = 0; col < width; col++, bytes += 3) {
+                        Pnm_rgb pixel = methods->at(pixels, col, row);
+                        pixel->red    = bytes[0];
+                        pixel->green  = bytes[1];
+                        pixel->blue   = bytes[2];
+                }
+        } else {
+                for (int col = 0; col < width; col++, bytes += 6) {
+                        Pnm_rgb pixel = methods->at(pixels, col, row);
+                        pixel->red    = (bytes[0] << 8) | bytes[1];
+                        pixel->green  = (bytes[2] << 8) | bytes[3];
+                        pixel->blue   = (bytes[4] << 8) | bytes[5];
+                }
+        }
+}
+
+/* [Name]:       Ppmio_pack_row
+ * [Purpose]:    Encodes the given row of pixels into raster bytes
+ * [Parameters]: 1 unsigned char* (bytes), 1 int (maxval),
+ *               1 A2Methods_T (methods), 1 A2 (pixels), 1 int (row)
+ * [Return]:     void
+ */
+void Ppmio_pack_row(unsigned char *bytes, int maxval, A2Methods_T methods,
+                    A2 pixels, int row)
+{
+        int width = methods->width(pixels);
+
+        if (maxval < 256) {
+                for (int col = 0; col < width; col++, bytes += 3) {
+                        const struct Pnm_rgb *pixel =
+                                pixel_at(methods, pixels, col, row);
+                        bytes[0] = pixel->red;
+                        bytes[1] = pixel->green;
+                        bytes[2] = pixel->blue;
+                }
+        } else {
+                for (int col = 0; col < width; col++, bytes += 6) {
+                        const struct Pnm_rgb *pixel =
+                                pixel_at(methods, pixels, col, row);
+                        bytes[0] = pixel->red   >> 8;
+                        bytes[1] = pixel->red   & 0xff;
+                        bytes[2] = pixel->green >> 8;
+                        bytes[3] = pixel->green & 0xff;
+                        bytes[4] = pixel->blue  >> 8;
+                        bytes[5] = pixel->blue  & 0xff;
+                }
+        }
+}
+
+/* [Name]:       pixel_at
+ * [Purpose]:    Reads a pixel for encoding; uniform tiles of a sparse
+ *               image answer with their value instead of being expanded
+ * [Parameters]: 1 A2Methods_T (methods), 1 A2 (pixels), 2 ints (col, row)
+ * [Return]:     Pointer to the pixel (read only)
+ */
+static const struct Pnm_rgb *pixel_at(A2Methods_T methods, A2 pixels,
+                                      int col, int row)
+{
+        if (methods == uarray2_methods_sparse) {
+                return UArray2b_get(pixels, col, row);
+        }
+        return methods->at(pixels, col, row);
+}
+
+/*---------------------------------------------------------------
+ |                       Region Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Ppmio_clip_region
+ * [Purpose]:    Clips a region to the bounds of a width x height image
+ * [Parameters]: 1 const Ppmio_region* (region), 2 ints (width, height),
+ *               1 Ppmio_region* (clipped, filled in)
+ * [Return]:     1 if the clipped region is non-empty, 0 otherwise
+ */
+int Ppmio_clip_region(const Ppmio_region *region, int width, int height,
+                      Ppmio_region *clipped)
+{
+        long x0, y0, x1, y1;
+
+        assert(region != NULL && clipped != NULL);
+
+        x0 = region->x < 0 ? 0 : region->x;
+        y0 = region->y < 0 ? 0 : region->y;
+        x1 = (long)region->x + region->width;
+        y1 = (long)region->y + region->height;
+        x1 = x1 > width  ? width  : x1;
+        y1 = y1 > height ? height : y1;
+        if (x0 >= x1 || y0 >= y1) {
+                return 0;
+        }
+
+        clipped->x      = x0;
+        clipped->y      = y0;
+        clipped->width  = x1 - x0;
+        clipped->height = y1 - y0;
+        return 1;
+}
+
+/*---------------------------------------------------------------
+ |                   Positional Read / Write                    |
+ *--------------------------------------------------------------*/
+/* [Name]:       Ppmio_use_uring
+ * [Purpose]:    Selects the I/O backend of the band readers and writers:
+ *               with depth > 0 each band keeps up to depth chunks in flight
+ *               on io_uring (falling back to pread/pwrite where io_uring is
+ *               unavailable); 0 restores pread/pwrite
+ * [Parameters]: 1 int (depth)
+ * [Return]:     void
+ */
+void Ppmio_use_uring(int depth)
+{
+        uring_depth = depth > 0 ? depth : 0;
+}
+
+/* [Name]:       Ppmio_read
+ * [Purpose]:    Reads a P6 image from a regular file, decoding the raster
+ *               in row bands on up to 'threads' threads. The file offset of
+ *               fd is not moved, so the caller may fall back to another
+ *               reader when NULL is returned.
+ * [Parameters]: 1 int (fd), 1 A2Methods_T (methods), 1 int (threads)
+ * [Return]:     Pnm_ppm holding the image, or NULL if fd is not a regular
+ *               file holding a complete P6 image
+ */
+Pnm_ppm Ppmio_read(int fd, A2Methods_T methods, int threads)
+{
+        return Ppmio_read_region(fd, methods, threads, NULL);
+}
+
+/* [Name]:       Ppmio_read_region
+ * [Purpose]:    Like Ppmio_read, but decodes only the part of the image
+ *               inside region (clipped to the image); only the bytes of
+ *               those rows and columns are read from the file
+ * [Parameters]: 1 int (fd), 1 A2Methods_T (methods), 1 int (threads),
+ *               1 const Ppmio_region* (region, NULL for the whole image)
+ * [Return]:     Pnm_ppm holding the region, or NULL if fd is not a regular
+ *               file holding a complete P6 image or the region misses it
+ */
+Pnm_ppm Ppmio_read_region(int fd, A2Methods_T methods, int threads,
+                          const Ppmio_region *region)
+{
+        unsigned char header_buf[MAX_HEADER_BYTES];
+        Ppmio_header  header;
+        Ppmio_region  window;
+        struct stat   st;
+        long          base, got = 0;
+        int           status = -1;
+
+        assert(methods != NULL);
+
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                return NULL;
+        }
+        base = lseek(fd, 0, SEEK_CUR);
+        if (base < 0) {
+                return NULL;
+        }
+
+        /* read the header a page at a time until it parses */
+        while (status == -1 && got < MAX_HEADER_BYTES) {
+                long want = got + 4096 > MAX_HEADER_BYTES ?
+                            MAX_HEADER_BYTES - got : 4096;
+                ssize_t n = pread(fd, header_buf + got, want, base + got);
+                if (n <= 0) {
+                        return NULL;
+                }
+                got += n;
+                status = Ppmio_parse_header(header_buf, got, &header);
+        }
+        if (status != 1) {
+                return NULL;
+        }
+
+        /* a raster size that overflows can never fit in the file */
+        long row_bytes = Ppmio_row_bytes(header.width, header.maxval);
+        long raster_bytes, raster_end;
+        if (__builtin_mul_overflow(row_bytes, (long)header.height,
+                                   &raster_bytes) ||
+            __builtin_add_overflow(base + header.offset, raster_bytes,
+                                   &raster_end) ||
+            raster_end > st.st_size) {
+                return NULL;
+        }
+
+        window.x      = 0;
+        window.y      = 0;
+        window.width  = header.width;
+        window.height = header.height;
+        if (region != NULL && !Ppmio_clip_region(region, header.width,
+                                                 header.height, &window)) {
+                return NULL;
+        }
+        long pixel_bytes = Ppmio_row_bytes(1, header.maxval);
+
+        Pnm_ppm ppm;
+        NEW(ppm);
+        ppm->width       = window.width;
+        ppm->height      = window.height;
+        ppm->denominator = header.maxval;
+        ppm->methods     = methods;
+        ppm->pixels      = methods->new(window.width, window.height,
+                                        sizeof(struct Pnm_rgb));
+
+        /* a sparse array folds each block row once its last row lands */
+        int *pending     = NULL;
+        int  tile_height = 0;
+        if (methods == uarray2_methods_sparse) {
+                int blocks_h = UArray2b_blocks_height(ppm->pixels);
+                tile_height  = UArray2b_tile_height(ppm->pixels);
+                pending      = CALLOC(blocks_h, sizeof(int));
+                for (int k = 0; k < blocks_h; k++) {
+                        pending[k] = window.height - k * tile_height <
+                                     tile_height
+                                     ? window.height - k * tile_height
+                                     : tile_height;
+                }
+        }
+
+        int count = Bands_count(threads, window.height, 1);
+        band bands[count];
+        for (int i = 0; i < count; i++) {
+                bands[i].fd         = fd;
+                bands[i].base       = base + header.offset;
+                bands[i].row_bytes  = row_bytes;
+                bands[i].skip_bytes = window.x * pixel_bytes;
+                bands[i].span_bytes = window.width * pixel_bytes;
+                bands[i].skip_rows  = window.y;
+                Bands_split(window.height, 1, count, i, &bands[i].first_row,
+                            &bands[i].end_row);
+                bands[i].maxval     = header.maxval;
+                bands[i].methods    = methods;
+                bands[i].pixels     = ppm->pixels;
+                bands[i].pending    = pending;
+                bands[i].tile_h     = tile_height;
+                bands[i].failed     = 0;
+        }
+
+        status = run_bands(bands, count, read_band);
+        FREE(pending);
+        if (status != 0) {
+                Pnm_ppmfree(&ppm);
+                return NULL;
+        }
+        return ppm;
+}
+
+/* [Name]:       Ppmio_write
+ * [Purpose]:    Writes ppm as P6 to a regular file at fd's current offset.
+ *               The file is preallocated with fallocate, then the raster is
+ *               encoded in row bands on up to 'threads' threads. On success
+ *               fd's offset is left just past the image.
+ * [Parameters]: 1 int (fd), 1 Pnm_ppm (ppm), 1 int (threads)
+ * [Return]:     1 if written, 0 if fd is not a regular file (nothing is
+ *               written; caller should fall back), -1 on a write error
+ */
+int Ppmio_write(int fd, Pnm_ppm ppm, int threads)
+{
+        char header[64];
+        long base, total, row_bytes;
+        int  header_len, flags;
+
+        assert(ppm != NULL);
+
+        flags = fcntl(fd, F_GETFL);
+        if (!is_regular(fd) || flags < 0 || (flags & O_APPEND)) {
+                return 0;
+        }
+        if (ppm->denominator == 0 || ppm->denominator > 65535) {
+                return 0;
+        }
+        base = lseek(fd, 0, SEEK_CUR);
+        if (base < 0) {
+                return 0;
+        }
+
+        header_len = snprintf(header, sizeof(header), "P6\n%u %u\n%u\n",
+                              ppm->width, ppm->height, ppm->denominator);
+        row_bytes  = Ppmio_row_bytes(ppm->width, ppm->denominator);
+        total      = header_len + row_bytes * ppm->height;
+
+        /* not every filesystem supports fallocate; pwrite extends anyway */
+        if (fallocate(fd, 0, base, total) != 0 && errno != EOPNOTSUPP &&
+            errno != ENOSYS) {
+                return -1;
+        }
+        if (pwrite_full(fd, (unsigned char *)header, header_len, base) != 0) {
+                return -1;
+        }
+
+        int count = Bands_count(threads, ppm->height, 1);
+        band bands[count];
+        for (int i = 0; i < count; i++) {
+                bands[i].fd         = fd;
+                bands[i].base       = base + header_len;
+                bands[i].row_bytes  = row_bytes;
+                bands[i].skip_bytes = 0;
+                bands[i].span_bytes = row_bytes;
+                bands[i].skip_rows  = 0;
+                Bands_split(ppm->height, 1, count, i, &bands[i].first_row,
+                            &bands[i].end_row);
+                bands[i].maxval     = ppm->denominator;
+                bands[i].methods    = ppm->methods;
+                bands[i].pixels     = ppm->pixels;
+                bands[i].pending    = NULL;
+                bands[i].failed     = 0;
+        }
+
+        if (run_bands(bands, count, write_band) != 0) {
+                return -1;
+        }
+        if (lseek(fd, base + total, SEEK_SET) < 0) {
+                return -1;
+        }
+        return 1;
+}
+
+/* [Name]:       read_band
+ * [Purpose]:    Thread body: preads one band of rows a chunk at a time and
+ *               decodes it into the pixel array. Full-width rows are read
+ *               in one pread per chunk; for a narrower region only each
+ *               row's span is read.
+ * [Parameters]: 1 void* (closure; the band to read)
+ * [Return]:     NULL
+ */
+static void *read_band(void *cl)
+{
+        band *b    = cl;
+        int   full = b->span_bytes == b->row_bytes;
+        long  rows = CHUNK_BYTES / b->span_bytes > 0 ?
+                     CHUNK_BYTES / b->span_bytes : 1;
+        unsigned char *buf;
+
+        if (full && read_band_uring(b, rows)) {
+                return NULL;
+        }
+        buf = malloc(rows * b->span_bytes);
+        if (buf == NULL) {
+                b->failed = 1;
+                return NULL;
+        }
+
+        for (int row = b->first_row; row < b->end_row; row += rows) {
+                int  n      = b->end_row - row < rows ? b->end_row - row
+                                                      : rows;
+                long offset = b->base + (row + b->skip_rows) * b->row_bytes +
+                              b->skip_bytes;
+                long start  = Trace_now();
+                for (int i = 0; i < (full ? 1 : n); i++) {
+                        long len = full ? n * b->row_bytes : b->span_bytes;
+                        if (pread_full(b->fd, buf + i * b->span_bytes, len,
+                                       offset + i * b->row_bytes) != 0) {
+                                b->failed = 1;
+                                break;
+                        }
+                }
+                Trace_span("pread", start, row);
+                if (b->failed) {
+                        break;
+                }
+                start = Trace_now();
+                for (int i = 0; i < n; i++) {
+                        Ppmio_unpack_row(buf + i * b->span_bytes, b->maxval,
+                                         b->methods, b->pixels, row + i);
+                }
+                Trace_span("decode", start, row);
+                rows_decoded(b, row, n);
+        }
+
+        free(buf);
+        return NULL;
+}
+
+/* [Name]:       rows_decoded
+ * [Purpose]:    Counts rows off their block rows' pending totals; the band
+ *               that decodes a block row's last row compresses it, so a
+ *               sparse image never holds more than a few expanded block
+ *               rows at once. Does nothing for other arrays.
+ * [Parameters]: 1 band* (b), 2 ints (first row decoded, count of rows)
+ * [Return]:     void
+ */
+static void rows_decoded(band *b, int row, int count)
+{
+        if (b->pending == NULL) {
+                return;
+        }
+        while (count > 0) {
+                int blk_row = row / b->tile_h;
+                int here    = (blk_row + 1) * b->tile_h - row;
+                here = here < count ? here : count;
+                if (__atomic_sub_fetch(&b->pending[blk_row], here,
+                                       __ATOMIC_ACQ_REL) == 0) {
+                        UArray2b_compress_row(b->pixels, blk_row);
+                }
+                row   += here;
+                count -= here;
+        }
+}
+
+/* [Name]:       write_band
+ * [Purpose]:    Thread body: encodes one band of rows a chunk at a time and
+ *               pwrites it at its final offset
+ * [Parameters]: 1 void* (closure; the band to write)
+ * [Return]:     NULL
+ */
+static void *write_band(void *cl)
+{
+        band *b   = cl;
+        long rows = CHUNK_BYTES / b->row_bytes > 0 ?
+                    CHUNK_BYTES / b->row_bytes : 1;
+        unsigned char *buf;
+
+        if (write_band_uring(b, rows)) {
+                return NULL;
+        }
+        buf = malloc(rows * b->row_bytes);
+        if (buf == NULL) {
+                b->failed = 1;
+                return NULL;
+        }
+
+        for (int row = b->first_row; row < b->end_row; row += rows) {
+                int  n     = b->end_row - row < rows ? b->end_row - row
+                                                     : rows;
+                long start = Trace_now();
+                for (int i = 0; i < n; i++) {
+                        Ppmio_pack_row(buf + i * b->row_bytes, b->maxval,
+                                       b->methods, b->pixels, row + i);
+                }
+                Trace_span("encode", start, row);
+                start = Trace_now();
+                if (pwrite_full(b->fd, buf, n * b->row_bytes,
+                                b->base + row * b->row_bytes) != 0) {
+                        b->failed = 1;
+                        break;
+                }
+                Trace_span("pwrite", start, row);
+        }
+
+        free(buf);
+        return NULL;
+}
+
+/* [Name]:       read_band_uring
+ * [Purpose]:    Reads a band of full-width rows through io_uring: up to
+ *               depth chunks are in flight at once, and each chunk is
+ *               decoded as soon as it completes (in whatever order), after
+ *               which its buffer is reused for the next chunk
+ * [Parameters]: 1 band* (b), 1 long (rows per chunk)
+ * [Return]:     1 if the band was handled (b->failed tells how it went),
+ *               0 if io_uring is off or unavailable
+ */
+static int read_band_uring(band *b, long rows)
+{
+        if (uring_depth <= 0) {
+                return 0;
+        }
+        Uring_T ring = Uring_new(uring_depth, rows * b->row_bytes);
+        if (ring == NULL) {
+                return 0;
+        }
+
+        int depth = Uring_depth(ring);
+        int first[depth];               /* first row held by each slot */
+        int next = b->first_row;
+        int slot;
+
+        for (slot = 0; slot < depth && next < b->end_row; slot++) {
+                int n = b->end_row - next < rows ? b->end_row - next : rows;
+                first[slot] = next;
+                Uring_read(ring, slot, b->fd, n * b->row_bytes,
+                           b->base + next * b->row_bytes);
+                next += n;
+        }
+
+        int  status;
+        long start = Trace_now();
+        while ((status = Uring_wait(ring, &slot)) != 0) {
+                Trace_span("uring wait", start, -1);
+                if (status < 0) {
+                        b->failed = 1;
+                }
+                if (b->failed) {
+                        start = Trace_now();
+                        continue;       /* drain what is still in flight */
+                }
+                int row = first[slot];
+                int n   = b->end_row - row < rows ? b->end_row - row : rows;
+                unsigned char *buf = Uring_buffer(ring, slot);
+                start = Trace_now();
+                for (int i = 0; i < n; i++) {
+                        Ppmio_unpack_row(buf + i * b->row_bytes, b->maxval,
+                                         b->methods, b->pixels, row + i);
+                }
+                Trace_span("decode", start, row);
+                rows_decoded(b, row, n);
+                if (next < b->end_row) {
+                        n = b->end_row - next < rows ? b->end_row - next
+                                                     : rows;
+                        first[slot] = next;
+                        Uring_read(ring, slot, b->fd, n * b->row_bytes,
+                                   b->base + next * b->row_bytes);
+                        next += n;
+                }
+                start = Trace_now();
+        }
+
+        Uring_free(&ring);
+        return 1;
+}
+
+/* [Name]:       write_band_uring
+ * [Purpose]:    Writes a band through io_uring: chunks are encoded into
+ *               free buffers while up to depth earlier chunks are still
+ *               being written
+ * [Parameters]: 1 band* (b), 1 long (rows per chunk)
+ * [Return]:     1 if the band was handled (b->failed tells how it went),
+ *               0 if io_uring is off or unavailable
+ */
+static int write_band_uring(band *b, long rows)
+{
+        if (uring_depth <= 0) {
+                return 0;
+        }
+        Uring_T ring = Uring_new(uring_depth, rows * b->row_bytes);
+        if (ring == NULL) {
+                return 0;
+        }
+
+        int depth = Uring_depth(ring);
+        int used  = 0;                  /* slots handed out so far */
+        int slot;
+
+        for (int row = b->first_row; row < b->end_row && !b->failed;
+             row += rows) {
+                int  n     = b->end_row - row < rows ? b->end_row - row
+                                                     : rows;
+                long start = Trace_now();
+                if (used < depth) {
+                        slot = used++;
+                } else if (Uring_wait(ring, &slot) < 0) {
+                        b->failed = 1;
+                        break;
+                } else {
+                        Trace_span("uring wait", start, -1);
+                }
+                unsigned char *buf = Uring_buffer(ring, slot);
+                start = Trace_now();
+                for (int i = 0; i < n; i++) {
+                        Ppmio_pack_row(buf + i * b->row_bytes, b->maxval,
+                                       b->methods, b->pixels, row + i);
+                }
+                Trace_span("encode", start, row);
+                Uring_write(ring, slot, b->fd, n * b->row_bytes,
+                            b->base + row * b->row_bytes);
+        }
+
+        int  status;
+        long start = Trace_now();
+        while ((status = Uring_wait(ring, &slot)) != 0) {
+                if (status < 0) {
+                        b->failed = 1;
+                }
+        }
+        Trace_span("uring wait", start, -1);
+
+        Uring_free(&ring);
+        return 1;
+}
+
+/*---------------------------------------------------------------
+ |                     Sequential Read / Write                  |
+ *--------------------------------------------------------------*/
+/* [Name]:       Ppmio_read_stream
+ * [Purpose]:    Reads a P6 image from a stream (pipe, socket, ...) row by
+ *               row. Unlike Pnm_ppmread, a malformed or truncated image is
+ *               reported by returning NULL rather than raising, and so
+ *               is one claiming more than MAX_STREAM_PIXELS pixels.
+ * [Parameters]: 1 FILE* (fp), 1 A2Methods_T (methods)
+ * [Return]:     Pnm_ppm holding the image, or NULL on a bad image
+ */
+Pnm_ppm Ppmio_read_stream(FILE *fp, A2Methods_T methods)
+{
+        Ppmio_header header;
+        unsigned char *row_buf;
+        long row_bytes;
+
+        assert(fp != NULL && methods != NULL);
+
+        if (Ppmio_read_header(fp, &header) != 1 ||
+            (long)header.width * header.height > MAX_STREAM_PIXELS) {
+                return NULL;
+        }
+        row_bytes = Ppmio_row_bytes(header.width, header.maxval);
+        row_buf   = malloc(row_bytes);
+        if (row_buf == NULL) {
+                return NULL;
+        }
+
+        Pnm_ppm ppm;
+        NEW(ppm);
+        ppm->width       = header.width;
+        ppm->height      = header.height;
+        ppm->denominator = header.maxval;
+        ppm->methods     = methods;
+        ppm->pixels      = methods->new(header.width, header.height,
+                                        sizeof(struct Pnm_rgb));
+
+        for (int row = 0; row < header.height; row++) {
+                if (fread(row_buf, row_bytes, 1, fp) != 1) {
+                        free(row_buf);
+                        Pnm_ppmfree(&ppm);
+                        return NULL;
+                }
+                Ppmio_unpack_row(row_buf, header.maxval, methods,
+                                 ppm->pixels, row);
+        }
+
+        free(row_buf);
+        return ppm;
+}
+
+/* [Name]:       Ppmio_write_stream
+ * [Purpose]:    Writes ppm as P6 to a stream row by row
+ * [Parameters]: 1 FILE* (fp), 1 Pnm_ppm (ppm)
+ * [Return]:     0 on success, -1 on a write error
+ */
+int Ppmio_write_stream(FILE *fp, Pnm_ppm ppm)
+{
+        long row_bytes;
+        unsigned char *row_buf;
+        int status = 0;
+
+        assert(fp != NULL && ppm != NULL);
+
+        row_bytes = Ppmio_row_bytes(ppm->width, ppm->denominator);
+        row_buf   = malloc(row_bytes);
+        if (row_buf == NULL) {
+                return -1;
+        }
+
+        if (fprintf(fp, "P6\n%u %u\n%u\n", ppm->width, ppm->height,
+                    ppm->denominator) < 0) {
+                status = -1;
+        }
+        for (unsigned row = 0; status == 0 && row < ppm->height; row++) {
+                Ppmio_pack_row(row_buf, ppm->denominator, ppm->methods,
+                               ppm->pixels, row);
+                if (fwrite(row_buf, row_bytes, 1, fp) != 1) {
+                        status = -1;
+                }
+        }
+
+        free(row_buf);
+        if (fflush(fp) != 0) {
+                status = -1;
+        }
+        return status;
+}
+
+/*---------------------------------------------------------------
+ |                       Thread Helpers                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       run_bands
+ * [Purpose]:    Runs work on every band (see Bands_run) and collects
+ *               their failures
+ * [Parameters]: 1 band* (bands), 1 int (count), 1 thread body (work)
+ * [Return]:     0 if every band succeeded, -1 otherwise
+ */
+static int run_bands(band *bands, int count, void *work(void *))
+{
+        int status = 0;
+
+        Bands_run(bands, count, sizeof(band), work);
+        for (int i = 0; i < count; i++) {
+                if (bands[i].failed) {
+                        status = -1;
+                }
+        }
+        return status;
+}
+
+/* [Name]:       is_regular
+ * [Purpose]:    Checks whether fd refers to a regular file
+ * [Parameters]: 1 int (fd)
+ * [Return]:     1 if regular, 0 otherwise
+ */
+static int is_regular(int fd)
+{
+        struct stat st;
+        return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/* [Name]:       pread_full
+ * [Purpose]:    preads exactly n bytes, retrying short reads and EINTR
+ * [Parameters]: 1 int (fd), 1 unsigned char* (buf), 2 longs (n, offset)
+ * [Return]:     0 on success, -1 on error or end of file
+ */
+static int pread_full(int fd, unsigned char *buf, long n, long offset)
+{
+        while (n > 0) {
+                ssize_t got = pread(fd, buf, n, offset);
+                if (got < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (got <= 0) {
+                        return -1;
+                }
+                buf    += got;
+                offset += got;
+                n      -= got;
+        }
+        return 0;
+}
+
+/* [Name]:       pwrite_full
+ * [Purpose]:    pwrites exactly n bytes, retrying short writes and EINTR
+ * [Parameters]: 1 int (fd), 1 const unsigned char* (buf), 2 longs (n, offset)
+ * [Return]:     0 on success, -1 on error
+ */
+static int pwrite_full(int fd, const unsigned char *buf, long n, long offset)
+{
+        while (n > 0) {
+                ssize_t put = pwrite(fd, buf, n, offset);
+                if (put < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (put <= 0) {
+                        return -1;
+                }
+                buf    += put;
+                offset += put;
+                n      -= put;
+        }
+        return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ *      ppmio.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Reads and writes binary (P6) ppm images with positional I/O
+ *      - Once the header is parsed every row has a fixed byte length, so the
+ *        raster of a regular file is decoded/encoded in row bands, one band
+ *        per thread, with pread/pwrite at computed offsets
+ *      - A region read decodes only the bytes of the rows and columns
+ *        inside the region
+ *      - Band I/O can optionally go through io_uring, keeping several
+ *        chunks in flight per band
+ */
+
+#ifndef PPMIO_INCLUDED
+#define PPMIO_INCLUDED
+
+#include <stdio.h>
+
+#include "a2methods.h"
+#include "pnm.h"
+
+/* Parsed P6 header */
+typedef struct Ppmio_header {
+        int  width, height;
+        int  maxval;
+        long offset;            /* byte offset of the raster in the file */
+} Ppmio_header;
+
+/* Window of an image, in pixels */
+typedef struct Ppmio_region {
+        int x, y;
+        int width, height;
+} Ppmio_region;
+
+extern int     Ppmio_parse_header(const unsigned char *buf, long len,
+                                  Ppmio_header *header);
+extern int     Ppmio_read_header (FILE *fp, Ppmio_header *header);
+extern long    Ppmio_row_bytes   (int width, int maxval);
+extern void    Ppmio_unpack_row  (const unsigned char *bytes, int maxval,
+                                  A2Methods_T methods, A2Methods_UArray2 pixels,
+                                  int row);
+extern void    Ppmio_pack_row    (unsigned char *bytes, int maxval,
+                                  A2Methods_T methods, A2Methods_UArray2 pixels,
+                                  int row);
+
+extern int     Ppmio_clip_region (const Ppmio_region *region, int width,
+                                  int height, Ppmio_region *clipped);
+
+extern void    Ppmio_use_uring(int depth);
+extern Pnm_ppm Ppmio_read  (int fd, A2Methods_T methods, int threads);
+extern Pnm_ppm Ppmio_read_region(int fd, A2Methods_T methods, int threads,
+                                 const Ppmio_region *region);
+extern int     Ppmio_write (int fd, Pnm_ppm ppm, int threads);
+
+extern Pnm_ppm Ppmio_read_stream (FILE *fp, A2Methods_T methods);
+extern int     Ppmio_write_stream(FILE *fp, Pnm_ppm ppm);
+
+#endif
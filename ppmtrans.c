@@ -2,48 +2,65 @@
  *      ppmtrans.c
  *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
  *
- *      - Reads in ppm data either from a file or standard input
+ *      - Reads in ppm data either from a file or standard input; PAM
+ *        (P7) images, e.g. with alpha, are read and written as PAM
  *      - Transforms the ppm image based on user-specified transformation
  *        type and magnitude
- *      - Optionally records the time taken for the transformation
+ *      - Optionally runs per-pixel operations (-ops) during the transform
+ *      - Optionally records the time taken for the transformation, and
+ *        a timeline of decode, transform, encode and free (-trace)
+ *      - With -daemon, serves transform jobs over a Unix socket instead
+ *      - With -cache, reuses the output of an earlier run on the same
+ *        input and options instead of transforming again
+ *      - With -o, writes to a file; a plain rotate, flip or transpose to
+ *        P6 is then encoded straight into the mapped file as it is
+ *        transformed
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "a2methods.h"
 #include "a2plain.h"
 #include "a2blocked.h"
+#include "a2morton.h"
+#include "a2sparse.h"
+#include "cache.h"
 #include "cputiming.h"
+#include "daemon.h"
+#include "encode.h"
+#include "incremental.h"
 #include "mem.h"
+#include "pam.h"
 #include "pnm.h"
+#include "pipeline.h"
+#include "pixelop.h"
+#include "planner.h"
+#include "ppmio.h"
+#include "rotate.h"
+#include "scale.h"
+#include "stream.h"
+#include "tilefile.h"
+#include "trace.h"
+#include "transform.h"
+#include "uarray2b.h"
 
-typedef A2Methods_UArray2  A2;
-typedef A2Methods_applyfun applyfun;
-typedef A2Methods_Object   object;
-typedef A2Methods_mapfun   mapfun;
-
-/* Struct with transformed image; to pass in as closure for map functions */
-typedef struct result {
-        A2Methods_T methods;
-        A2          destination_map;
-        int         magnitude;
-} result;
-
-/* Transform type constants */
-static const int ROTATE    = 0;
-static const int FLIP      = 1;
-static const int TRANSPOSE = 2;
-
-/* Flip direction constants */
-static const int HORIZ = 1;
-static const int VERT  = 2;
+/* Output format constants */
+static const int OUT_PPM           = 0;
+static const int OUT_TILED         = 1;
+static const int OUT_TILED_INDEXED = 2;
 
 /* Macro for setting row/col/block methods */
 #define SET_METHODS(METHODS, MAP, WHAT) do {                    \
         methods = (METHODS);                                    \
+        methods_set = 1;                                        \
         assert(methods != NULL);                                \
         map = methods->MAP;                                     \
         if (map == NULL) {                                      \
@@ -54,31 +71,38 @@ static const int VERT  = 2;
         }                                                       \
 } while (0)
 
-/* Error Handling Functions */
+/* Error Handling Function */
 static void usage        (const char *progname);
-       void malloc_check (void *ptr);
-
-/* File Processing Function */
-Pnm_ppm process_file (char *filename, A2Methods_T methods);
-
-/* Image Transformation Functions */
-Pnm_ppm transform       (Pnm_ppm ppm, A2Methods_T methods, mapfun *map,
-                         int transform_type, int magnitude, float* time);
-void    transform_image (Pnm_ppm ppm, applyfun *apply,
-                         mapfun *map, result *dest_info, float *time);
-void    rotate_map      (int col, int row, A2 source, object *ptr, void *cl);
-void    flip_map        (int col, int row, A2 source, object *ptr, void *cl);
-void    transpose_map   (int col, int row, A2 source, object *ptr, void *cl);
-
-/* Image Transformation Helper Functions */
-A2        create_image   (Pnm_ppm ppm, A2Methods_T methods, int type,
-                          int magnitude);
-result    result_init    (A2Methods_T methods, int magnitude, A2 image);
-applyfun* transform_init (applyfun *apply, int transform_type);
-void      reassign       (Pnm_ppm ppm, A2 destination_map, A2Methods_T methods);
+
+/* File Processing Functions */
+Pnm_ppm process_file (char *filename, A2Methods_T methods, int threads,
+                      Ppmio_region *region);
+int     tiled_input  (char *filename);
+int     pam_input    (char *filename);
+long    pam_file     (char *filename, A2Methods_T methods, int transform_type,
+                      int magnitude, float *time);
+void    write_file   (Pnm_ppm ppm, int threads, int format);
+int     fetch_cache  (Cache_T cache, char *time_file, const char *progname);
+void    commit_cache (Cache_T *cache, char *time_file, const char *progname);
+long    pipeline_file(char *filename, A2Methods_T methods, int transform_type,
+                      int magnitude, int threads, Pixelop_T ops,
+                      float *time);
+int     stream_file  (char *filename, A2Methods_T methods, mapfun *map,
+                      int transform_type, int magnitude, float *time,
+                      Stream_stats *stats);
+
+/* Planning Functions */
+void plan_job (char *filename, Planner_job *job, Planner_plan *plan);
+void log_plan (Planner_plan *plan, char *file);
+void log_incremental (Incremental_stats *stats, char *file);
+void log_stream (Stream_stats *stats, char *file);
+void log_tuning (const tuning_used *used, char *file);
+void log_sparse (long source_uniform, long source_tiles,
+                 long dest_uniform, long dest_tiles, char *file);
+void log_cache (Cache_T cache, char *file);
 
 /* Timing Function */
-void print_time (float *time, char *file, float pixel_count);
+void print_time (float *time, char *file, long pixel_count);
 
 /*---------------------------------------------------------------
  |                              Main                            |
@@ -92,10 +116,38 @@ int main(int argc, char *argv[])
 {
         Pnm_ppm  ppm            = NULL;
         char    *time_file_name = NULL;
+        char    *trace_file     = NULL;
         char    *filename       = NULL;
+        char    *socket_path    = NULL;
+        char    *state_dir      = NULL;
+        char    *cache_dir      = NULL;
+        char    *output_file    = NULL;
+        char    *ops_spec       = NULL;
+        Pixelop_T ops           = NULL;
+        Cache_T  cache          = NULL;
         float   *time           = NULL;
         int      transform_type = ROTATE;
         int      magnitude      = 0;
+        int      threads        = sysconf(_SC_NPROCESSORS_ONLN);
+        int      pipelined      = 0;
+        int      streamed       = 0;
+        int      nt_stores      = 0;
+        int      prefetch       = 0;
+        int      methods_set    = 0;
+        int      planned        = 0;
+        int      in_place       = 0;
+        long     budget         = 0;
+        long     cache_limit    = 1024L * 1024 * 1024;
+        int      format         = OUT_PPM;
+        int      cropped        = 0;
+        int      scaled         = 0;
+        int      free_angle     = 0;
+        double   angle          = 0.0;
+        int      filled         = 0;
+        Ppmio_region   region;
+        Scale_spec     scale;
+        Rotate_options rotate_options = { ROTATE_BILINEAR, 0, { 0, 0, 0 },
+                                          1 };
         int      i;
 
         /* default to UArray2 methods */
@@ -116,20 +168,33 @@ int main(int argc, char *argv[])
                 } else if (strcmp(argv[i], "-block-major") == 0) {
                         SET_METHODS(uarray2_methods_blocked, map_block_major,
                                     "block-major");
+                } else if (strcmp(argv[i], "-sparse") == 0) {
+                        SET_METHODS(uarray2_methods_sparse, map_block_major,
+                                    "block-major");
+                } else if (strcmp(argv[i], "-morton-major") == 0) {
+                        SET_METHODS(uarray2_methods_morton, map_default,
+                                    "Morton-order");
+                } else if (strcmp(argv[i], "-hilbert-major") == 0) {
+                        SET_METHODS(uarray2_methods_morton, map_default,
+                                    "Hilbert-order");
+                        map = uarray2_map_hilbert;
                 } else if (strcmp(argv[i], "-rotate") == 0) {
                         if (!(i + 1 < argc)) {      /* no rotate value */
                                 usage(argv[0]);
                         }
                         char *endptr;
-                        magnitude = strtol(argv[++i], &endptr, 10);
-                        if (!(magnitude == 0 || magnitude == 90 ||
-                              magnitude == 180 || magnitude == 270)) {
+                        angle = strtod(argv[++i], &endptr);
+                        if (!(*endptr == '\0') || !isfinite(angle)) {
                                 fprintf(stderr,
-                                        "Rotation must be 0, 90, 180 or 270\n");
+                                        "Rotation must be a number of "
+                                        "degrees\n");
                                 usage(argv[0]);
                         }
-                        if (!(*endptr == '\0')) {    /* Not a number */
-                                usage(argv[0]);
+                        /* quarter turns take the exact, lossless path */
+                        free_angle = fmod(angle, 90.0) != 0.0;
+                        if (!free_angle) {
+                                magnitude = fmod(fmod(angle, 360.0) + 360.0,
+                                                 360.0);
                         }
                         transform_type = ROTATE;
                 } else if (strcmp(argv[i], "-flip") == 0) {
@@ -147,14 +212,190 @@ int main(int argc, char *argv[])
                                 usage(argv[0]);
                         }
                         transform_type = FLIP;
+                        free_angle     = 0;
                 } else if (strcmp(argv[i], "-transpose") == 0) {
                         transform_type = TRANSPOSE;
+                        free_angle     = 0;
+                } else if (strcmp(argv[i], "-interp") == 0) {
+                        if (!(i + 1 < argc)) {      /* no filter */
+                                usage(argv[0]);
+                        }
+                        i++;
+                        if (strcmp(argv[i], "nearest") == 0) {
+                                rotate_options.filter = ROTATE_NEAREST;
+                        } else if (strcmp(argv[i], "bilinear") == 0) {
+                                rotate_options.filter = ROTATE_BILINEAR;
+                        } else {
+                                fprintf(stderr, "Interpolation must be "
+                                                "nearest or bilinear\n");
+                                usage(argv[0]);
+                        }
+                } else if (strcmp(argv[i], "-expand") == 0) {
+                        rotate_options.expand = 1;
+                } else if (strcmp(argv[i], "-fill") == 0) {
+                        unsigned *channels[] = { &rotate_options.fill.red,
+                                                 &rotate_options.fill.green,
+                                                 &rotate_options.fill.blue };
+                        if (!(i + 3 < argc)) {      /* missing channel */
+                                usage(argv[0]);
+                        }
+                        for (int c = 0; c < 3; c++) {
+                                char *endptr;
+                                long value = strtol(argv[++i], &endptr, 10);
+                                if (!(*endptr == '\0') || value < 0 ||
+                                    value > 65535) {
+                                        fprintf(stderr, "Fill must be "
+                                                "<red> <green> <blue>\n");
+                                        usage(argv[0]);
+                                }
+                                *channels[c] = value;
+                        }
+                        filled = 1;
+                } else if (strcmp(argv[i], "-threads") == 0) {
+                        if (!(i + 1 < argc)) {      /* no thread count */
+                                usage(argv[0]);
+                        }
+                        char *endptr;
+                        long count = strtol(argv[++i], &endptr, 10);
+                        if (!(*endptr == '\0') || count < 1 ||
+                            count > INT_MAX) {
+                                fprintf(stderr, "Threads must be between 1 "
+                                                "and %d\n", INT_MAX);
+                                usage(argv[0]);
+                        }
+                        threads = count;
+                } else if (strcmp(argv[i], "-crop") == 0) {
+                        int *fields[] = { &region.x, &region.y,
+                                          &region.width, &region.height };
+                        if (!(i + 4 < argc)) {      /* missing crop value */
+                                usage(argv[0]);
+                        }
+                        for (int f = 0; f < 4; f++) {
+                                char *endptr;
+                                long value = strtol(argv[++i], &endptr, 10);
+                                if (!(*endptr == '\0') || value < 0 ||
+                                    value > 0x7fffffff || (f >= 2 &&
+                                    value == 0)) {
+                                        fprintf(stderr, "Crop must be "
+                                                "<x> <y> <width> <height>, "
+                                                "with a non-empty size\n");
+                                        usage(argv[0]);
+                                }
+                                *fields[f] = value;
+                        }
+                        cropped = 1;
+                } else if (strcmp(argv[i], "-scale") == 0) {
+                        if (!(i + 1 < argc)) {      /* no scale value */
+                                usage(argv[0]);
+                        }
+                        if (!Scale_parse(argv[++i], &scale)) {
+                                fprintf(stderr, "Scale must be 1/<N> or "
+                                                "<width>x<height>\n");
+                                usage(argv[0]);
+                        }
+                        scaled = 1;
+                } else if (strcmp(argv[i], "-tiled") == 0) {
+                        format = OUT_TILED;
+                } else if (strcmp(argv[i], "-tile-index") == 0) {
+                        format = OUT_TILED_INDEXED;
+                } else if (strcmp(argv[i], "-auto") == 0) {
+                        planned = 1;
+                } else if (strcmp(argv[i], "-budget") == 0) {
+                        if (!(i + 1 < argc)) {      /* no budget */
+                                usage(argv[0]);
+                        }
+                        char *endptr;
+                        budget = strtol(argv[++i], &endptr, 10);
+                        if (!(*endptr == '\0') || budget < 1 ||
+                            budget > LONG_MAX / (1024 * 1024)) {
+                                fprintf(stderr, "Budget must be between 1 "
+                                                "and %ld MiB\n",
+                                        LONG_MAX / (1024 * 1024));
+                                usage(argv[0]);
+                        }
+                        budget *= 1024 * 1024;
+                } else if (strcmp(argv[i], "-incremental") == 0) {
+                        if (!(i + 1 < argc)) {      /* no state directory */
+                                usage(argv[0]);
+                        }
+                        state_dir = argv[++i];
+                } else if (strcmp(argv[i], "-cache") == 0) {
+                        if (!(i + 1 < argc)) {      /* no cache directory */
+                                usage(argv[0]);
+                        }
+                        cache_dir = argv[++i];
+                } else if (strcmp(argv[i], "-cache-limit") == 0) {
+                        if (!(i + 1 < argc)) {      /* no limit */
+                                usage(argv[0]);
+                        }
+                        char *endptr;
+                        cache_limit = strtol(argv[++i], &endptr, 10);
+                        if (!(*endptr == '\0') || cache_limit < 1 ||
+                            cache_limit > LONG_MAX / (1024 * 1024)) {
+                                fprintf(stderr, "Cache limit must be "
+                                                "between 1 and %ld MiB\n",
+                                        LONG_MAX / (1024 * 1024));
+                                usage(argv[0]);
+                        }
+                        cache_limit *= 1024 * 1024;
+                } else if (strcmp(argv[i], "-uring") == 0) {
+                        if (!(i + 1 < argc)) {      /* no queue depth */
+                                usage(argv[0]);
+                        }
+                        char *endptr;
+                        long depth = strtol(argv[++i], &endptr, 10);
+                        if (!(*endptr == '\0') || depth < 1 ||
+                            depth > 4096) {
+                                fprintf(stderr, "Queue depth must be "
+                                                "between 1 and 4096\n");
+                                usage(argv[0]);
+                        }
+                        Ppmio_use_uring(depth);
+                } else if (strcmp(argv[i], "-ops") == 0) {
+                        if (!(i + 1 < argc)) {      /* no operations */
+                                usage(argv[0]);
+                        }
+                        if (ops != NULL) {
+                                Pixelop_free(&ops);
+                        }
+                        ops_spec = argv[++i];
+                        ops      = Pixelop_parse(ops_spec);
+                        if (ops == NULL) {
+                                fprintf(stderr, "Operations must be a "
+                                                "comma-separated list of "
+                                                "gray, invert, swap:<rgb>, "
+                                                "maxval:<n>, gamma:<g>\n");
+                                usage(argv[0]);
+                        }
+                } else if (strcmp(argv[i], "-nt-stores") == 0) {
+                        nt_stores = 1;
+                } else if (strcmp(argv[i], "-prefetch") == 0) {
+                        prefetch = 1;
+                } else if (strcmp(argv[i], "-stream") == 0) {
+                        streamed = 1;
+                } else if (strcmp(argv[i], "-pipeline") == 0) {
+                        pipelined = 1;
+                } else if (strcmp(argv[i], "-daemon") == 0) {
+                        if (!(i + 1 < argc)) {      /* no socket path */
+                                usage(argv[0]);
+                        }
+                        socket_path = argv[++i];
                 } else if (strcmp(argv[i], "-time") == 0) {
                         if (i == argc - 1) {
                                 usage(argv[0]);
                         } else {
                                 time_file_name = argv[++i];
                         }
+                } else if (strcmp(argv[i], "-o") == 0) {
+                        if (!(i + 1 < argc)) {      /* no output file */
+                                usage(argv[0]);
+                        }
+                        output_file = argv[++i];
+                } else if (strcmp(argv[i], "-trace") == 0) {
+                        if (!(i + 1 < argc)) {      /* no trace file */
+                                usage(argv[0]);
+                        }
+                        trace_file = argv[++i];
                 } else if (*argv[i] == '-') {
                         fprintf(stderr, "%s: unknown option '%s'\n", argv[0],
                                 argv[i]);
@@ -167,28 +408,373 @@ int main(int argc, char *argv[])
                 }
         }
 
+        /* jobs bring their own transformations; the rest is per-run */
+        if (socket_path != NULL &&
+            (filename != NULL || transform_type != ROTATE ||
+             magnitude != 0 || free_angle || cropped || scaled || filled ||
+             rotate_options.expand ||
+             rotate_options.filter != ROTATE_BILINEAR || ops_spec != NULL ||
+             nt_stores || prefetch || format != OUT_PPM || planned ||
+             budget > 0 || pipelined || streamed || state_dir != NULL ||
+             cache_dir != NULL || cache_limit != 1024L * 1024 * 1024 ||
+             output_file != NULL || time_file_name != NULL ||
+             trace_file != NULL)) {
+                fprintf(stderr, "%s: -daemon only combines with -threads, "
+                                "-uring and the storage options; jobs name "
+                                "their own transformations\n", argv[0]);
+                usage(argv[0]);
+        }
+        if (socket_path != NULL) {
+                Daemon_run(socket_path, methods, map, threads);
+                fprintf(stderr, "%s: cannot serve on %s: %s\n", argv[0],
+                        socket_path, strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        transform_tuning(nt_stores, prefetch);
+        transform_pixel_ops(ops);
+        /* written out at exit, however the run ends */
+        if (trace_file != NULL && Trace_open(trace_file) != 0) {
+                fprintf(stderr, "%s: cannot create %s\n", argv[0],
+                        trace_file);
+                exit(EXIT_FAILURE);
+        }
+        if (ops != NULL && (streamed || state_dir != NULL || scaled ||
+                            free_angle)) {
+                fprintf(stderr, "%s: -ops cannot be combined with -stream, "
+                                "-incremental, -scale or rotations other "
+                                "than quarter turns\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+        int pam = pam_input(filename);
+        if (pam && (planned || pipelined || streamed || state_dir != NULL ||
+                    cropped || scaled || free_angle || ops != NULL ||
+                    format != OUT_PPM)) {
+                fprintf(stderr, "%s: PAM images only combine with "
+                                "quarter-turn rotations, flips, transposes "
+                                "and the storage options\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+
         if (time_file_name != NULL) {
                 time = malloc(sizeof(float));
                 malloc_check(time);
                 *time = 0.0;
         }
 
-        ppm = process_file(filename, methods);
-        ppm = transform(ppm, methods, map, transform_type, magnitude, time);
+        Planner_plan      plan;
+        Incremental_stats stats;
+        if (planned) {
+                Planner_job job;
+                if (methods_set || pipelined) {
+                        fprintf(stderr, "%s: -auto chooses the storage, "
+                                        "traversal and -pipeline itself\n",
+                                argv[0]);
+                        exit(EXIT_FAILURE);
+                }
+                job.transform_type = transform_type;
+                job.magnitude      = magnitude;
+                job.elem_size      = sizeof(struct Pnm_rgb);
+                job.threads        = threads;
+                job.budget         = budget > 0 ? budget
+                                                : Planner_default_budget();
+                job.fused          = cropped || scaled || free_angle;
+                plan_job(filename, &job, &plan);
+
+                methods     = plan.methods;
+                map         = plan.map;
+                /* blocked arrays take the planned tiles from here on */
+                UArray2b_set_default_tile(plan.tile_cells);
+                methods_set = 1;
+                pipelined   = plan.strategy == PLANNER_STREAM;
+                in_place    = plan.strategy == PLANNER_IN_PLACE;
+        }
+
+        /* incremental state is kept per tile of the blocked source */
+        if (state_dir != NULL) {
+                if (pipelined || planned || scaled || free_angle ||
+                    (methods_set && methods != uarray2_methods_blocked)) {
+                        fprintf(stderr, "%s: -incremental works on blocked "
+                                        "storage and cannot be combined "
+                                        "with -pipeline, -auto, -scale or "
+                                        "rotations other than quarter "
+                                        "turns\n", argv[0]);
+                        exit(EXIT_FAILURE);
+                }
+                methods     = uarray2_methods_blocked;
+                map         = methods->map_default;
+                methods_set = 1;
+        }
+
+        /* tiled input is already blocked; keep it that way by default */
+        if (!methods_set && !pipelined && tiled_input(filename)) {
+                methods = uarray2_methods_blocked;
+                map     = methods->map_default;
+        }
+
+        if (pipelined && (cropped || scaled || free_angle)) {
+                fprintf(stderr, "%s: -crop, -scale and rotations other than "
+                                "quarter turns cannot be combined with "
+                                "-pipeline\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+        if (scaled && free_angle) {
+                fprintf(stderr, "%s: -scale only supports quarter-turn "
+                                "rotations\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+        rotate_options.threads = threads;
+
+        /* read-write, so the fused encoder can map it */
+        if (output_file != NULL) {
+                int fd = open(output_file, O_RDWR | O_CREAT | O_TRUNC, 0666);
+                if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+                        fprintf(stderr, "%s: cannot create %s\n", argv[0],
+                                output_file);
+                        exit(EXIT_FAILURE);
+                }
+                close(fd);
+        }
+
+        /* everything that shapes the output goes into the entry's name */
+        if (cache_dir != NULL) {
+                char  *options = NULL;
+                size_t length  = 0;
+                FILE  *key     = open_memstream(&options, &length);
+                if (filename == NULL) {
+                        fprintf(stderr, "%s: -cache needs an input file\n",
+                                argv[0]);
+                        exit(EXIT_FAILURE);
+                }
+                assert(key != NULL);
+                /* magnitude is stale after -transpose or a free angle */
+                int key_magnitude = transform_type == TRANSPOSE ||
+                                    free_angle ? 0 : magnitude;
+                fprintf(key, "type %d magnitude %d format %d",
+                        transform_type, key_magnitude, format);
+                if (free_angle) {
+                        fprintf(key, " angle %.17g filter %d expand %d",
+                                fmod(fmod(angle, 360.0) + 360.0, 360.0),
+                                rotate_options.filter, rotate_options.expand);
+                }
+                if (free_angle && filled) {
+                        fprintf(key, " fill %u %u %u",
+                                rotate_options.fill.red,
+                                rotate_options.fill.green,
+                                rotate_options.fill.blue);
+                }
+                if (cropped) {
+                        fprintf(key, " crop %d %d %d %d", region.x, region.y,
+                                region.width, region.height);
+                }
+                if (scaled) {
+                        fprintf(key, " scale %d %d %d", scale.divisor,
+                                scale.width, scale.height);
+                }
+                if (ops_spec != NULL) {
+                        fprintf(key, " ops %s", ops_spec);
+                }
+                if (planned && format != OUT_PPM) {
+                        fprintf(key, " planned");   /* may keep input tiles */
+                }
+                fclose(key);
+
+                cache = Cache_open(cache_dir, cache_limit, filename,
+                                   options);
+                free(options);
+                if (cache == NULL) {
+                        fprintf(stderr, "%s: cannot cache %s in %s\n",
+                                argv[0], filename, cache_dir);
+                        exit(EXIT_FAILURE);
+                }
+                if (fetch_cache(cache, time_file_name, argv[0])) {
+                        Cache_free(&cache);
+                        if (ops != NULL) {
+                                Pixelop_free(&ops);
+                        }
+                        free(time);
+                        return 0;
+                }
+        }
+
+        if (pam) {
+                long pixels = pam_file(filename, methods, transform_type,
+                                       magnitude, time);
+                if (time_file_name != NULL) {
+                        print_time(time, time_file_name, pixels);
+                        free(time);
+                }
+                commit_cache(&cache, time_file_name, argv[0]);
+                return 0;
+        }
+
+        if (streamed) {
+                Stream_stats stream_stats;
+                if (pipelined || planned || cropped || scaled || free_angle ||
+                    state_dir != NULL || format != OUT_PPM) {
+                        fprintf(stderr, "%s: -stream only combines with "
+                                        "quarter-turn rotations, flips, "
+                                        "transposes and the storage "
+                                        "options\n", argv[0]);
+                        exit(EXIT_FAILURE);
+                }
+                long start = Trace_now();
+                stream_file(filename, methods, map, transform_type,
+                            magnitude, time, &stream_stats);
+                Trace_span("stream", start, -1);
+                if (time_file_name != NULL) {
+                        print_time(time, time_file_name,
+                                   stream_stats.pixels);
+                        log_stream(&stream_stats, time_file_name);
+                        free(time);
+                }
+                commit_cache(&cache, time_file_name, argv[0]);
+                return 0;
+        }
+
+        if (pipelined) {
+                long start  = Trace_now();
+                long pixels = pipeline_file(filename, methods,
+                                            transform_type, magnitude,
+                                            threads, ops, time);
+                Trace_span("pipeline", start, -1);
+                if (time_file_name != NULL) {
+                        print_time(time, time_file_name, pixels);
+                        if (planned) {
+                                log_plan(&plan, time_file_name);
+                        }
+                        free(time);
+                }
+                if (ops != NULL) {
+                        Pixelop_free(&ops);
+                }
+                commit_cache(&cache, time_file_name, argv[0]);
+                return 0;
+        }
+
+        long start = Trace_now();
+        ppm = process_file(filename, methods, threads,
+                           cropped ? &region : NULL);
+        Trace_span("decode", start, -1);
+        long pixels = (long)ppm->width * ppm->height;  /* source pixels */
+        int tuned    = 0;
+        long source_uniform = 0, source_tiles = 0;
+        if (methods == uarray2_methods_sparse) {
+                /* decoding filled every tile; fold the flat ones back */
+                source_uniform = UArray2b_compress(ppm->pixels);
+                source_tiles   = (long)UArray2b_blocks_width(ppm->pixels) *
+                                 UArray2b_blocks_height(ppm->pixels);
+        }
+        if (output_file != NULL && !free_angle && !scaled &&
+            state_dir == NULL && format == OUT_PPM) {
+                fflush(stdout);
+                start = Trace_now();
+                int status = Encode_transform(STDOUT_FILENO, ppm,
+                                              transform_type, magnitude, ops,
+                                              threads, time);
+                Trace_span("transform+encode", start, -1);
+                if (status < 0) {
+                        fprintf(stderr, "File write error.\n");
+                        exit(EXIT_FAILURE);
+                }
+                if (status > 0) {
+                        if (time_file_name != NULL) {
+                                print_time(time, time_file_name, pixels);
+                                if (planned) {
+                                        log_plan(&plan, time_file_name);
+                                }
+                                free(time);
+                        }
+                        start = Trace_now();
+                        Pnm_ppmfree(&ppm);
+                        Trace_span("free", start, -1);
+                        if (ops != NULL) {
+                                Pixelop_free(&ops);
+                        }
+                        commit_cache(&cache, time_file_name, argv[0]);
+                        return 0;
+                }
+        }
+        start = Trace_now();
+        if (free_angle) {
+                if (filled && (rotate_options.fill.red   > ppm->denominator ||
+                               rotate_options.fill.green > ppm->denominator ||
+                               rotate_options.fill.blue  > ppm->denominator)) {
+                        fprintf(stderr, "%s: -fill exceeds the image's "
+                                        "maxval %u\n", argv[0],
+                                ppm->denominator);
+                        exit(EXIT_FAILURE);
+                }
+                ppm = Rotate_any(ppm, methods, angle, &rotate_options, time);
+        } else if (scaled) {
+                int out_width, out_height;
+                if (!Scale_output_size(&scale, transform_type, magnitude,
+                                       ppm->width, ppm->height, &out_width,
+                                       &out_height)) {
+                        fprintf(stderr, "%s: -scale can only shrink the "
+                                        "image\n", argv[0]);
+                        exit(EXIT_FAILURE);
+                }
+                ppm = Scale_transform(ppm, methods, transform_type,
+                                      magnitude, &scale, threads, time);
+        } else if (state_dir != NULL) {
+                ppm = Incremental_transform(ppm, state_dir, transform_type,
+                                            magnitude, threads, &stats,
+                                            time);
+                if (ppm == NULL) {
+                        fprintf(stderr, "%s: cannot update the state in "
+                                        "%s\n", argv[0], state_dir);
+                        exit(EXIT_FAILURE);
+                }
+        } else if (in_place) {
+                ppm = transform_in_place(ppm, methods, transform_type,
+                                         magnitude, time);
+        } else {
+                ppm = transform(ppm, methods, map, transform_type, magnitude,
+                                threads, time);
+                tuned = nt_stores || prefetch;
+        }
+        Trace_span("transform", start, -1);
 
         if (time_file_name != NULL) {
-                print_time(time, time_file_name, ppm->width * ppm->height);
+                print_time(time, time_file_name, pixels);
+                if (planned) {
+                        log_plan(&plan, time_file_name);
+                }
+                if (state_dir != NULL) {
+                        log_incremental(&stats, time_file_name);
+                }
+                if (tuned) {
+                        tuning_used used;
+                        transform_tuning_used(&used);
+                        log_tuning(&used, time_file_name);
+                }
+                if (methods == uarray2_methods_sparse) {
+                        log_sparse(source_uniform, source_tiles,
+                                   UArray2b_compress(ppm->pixels),
+                                   (long)UArray2b_blocks_width(ppm->pixels) *
+                                   UArray2b_blocks_height(ppm->pixels),
+                                   time_file_name);
+                }
                 free(time);
         }
 
-        Pnm_ppmwrite(stdout, ppm);
+        start = Trace_now();
+        write_file(ppm, threads, format);
+        Trace_span("encode", start, -1);
+        start = Trace_now();
         Pnm_ppmfree(&ppm);
+        Trace_span("free", start, -1);
+        if (ops != NULL) {
+                Pixelop_free(&ops);
+        }
+        commit_cache(&cache, time_file_name, argv[0]);
 
         return 0;
 }
 
 /*---------------------------------------------------------------
- |                    Error Handling Functions                  |
+ |                    Error Handling Function                   |
  *--------------------------------------------------------------*/
 /* [Name]:       usage
  * [Purpose]:    Print the proper usage of ppmtrans to stderr.
@@ -199,268 +785,534 @@ static void usage(const char *progname)
 {
         fprintf(stderr, "Usage: %s [-rotate <angle>] [-flip <direction>] "
                         "[-transpose] [{row,col,block}-major] "
-                        "[-time <timing_file>] [filename]\n",
+                        "[{morton,hilbert}-major] [-sparse] "
+                        "[-interp {nearest,bilinear}] [-expand] "
+                        "[-fill <red> <green> <blue>] "
+                        "[-crop <x> <y> <width> <height>] "
+                        "[-scale {1/<N>,<width>x<height>}] "
+                        "[-threads <count>] [-uring <depth>] "
+                        "[-nt-stores] [-prefetch] [-ops <op,...>] "
+                        "[-pipeline] [-stream] "
+                        "[-auto] [-budget <MiB>] "
+                        "[-incremental <state_dir>] "
+                        "[-cache <dir>] [-cache-limit <MiB>] "
+                        "[-tiled] [-tile-index] [-daemon <socket>] "
+                        "[-o <file>] [-time <timing_file>] "
+                        "[-trace <trace.json>] "
+                        "[filename]\n",
                         progname);
         exit(1);
 }
 
-/* [Name]:       malloc_check
- * [Purpose]:    Exits the program and prints to stderr if malloc'd ptr == NULL
- * [Parameters]: 1 void* (ptr)
- * [Return]:     void
- */
-void malloc_check(void *ptr)
-{
-        if (ptr == NULL) {
-                fprintf(stderr, "Malloc error\n");
-                exit(EXIT_FAILURE);
-        }
-}
-
 /*---------------------------------------------------------------
  |                   File Processing Functions                  |
  *--------------------------------------------------------------*/
 /* [Name]:       process_file
  * [Purpose]:    Read binary ppm data from a file or stdin into a Pnm_ppm.
- * [Parameters]: 1 c-string (filename), 1 A2Methods_T (methods)
+ *               Tiled images are mapped in, regular P6 files are decoded in
+ *               parallel row bands; anything else goes through Pnm_ppmread.
+ *               With a region, tiled and regular P6 input only decode the
+ *               tiles/bytes inside it; other input is cropped after reading.
+ * [Parameters]: 1 c-string (filename), 1 A2Methods_T (methods),
+ *               1 int (threads), 1 Ppmio_region* (region, NULL for the
+ *               whole image)
  * [Return]:     Pnm_ppm containing binary ppm data
  */
-Pnm_ppm process_file(char *filename, A2Methods_T methods)
+Pnm_ppm process_file(char *filename, A2Methods_T methods, int threads,
+                     Ppmio_region *region)
 {
         Pnm_ppm ppm = NULL;
+        FILE   *inputfp = stdin;
 
-        if (filename == NULL) {
-                ppm = Pnm_ppmread(stdin, methods);
-        } else {
-                FILE* inputfp;
-
+        if (filename != NULL) {
                 inputfp = fopen(filename, "r");
                 if (inputfp == NULL) {
                         fprintf(stderr, "File read error.\n");
                         exit(EXIT_FAILURE);
                 }
+        }
 
+        if (Tilefile_probe(fileno(inputfp))) {
+                ppm = Tilefile_read_region(fileno(inputfp), methods, region);
+                if (ppm == NULL) {
+                        fprintf(stderr, region == NULL
+                                        ? "Bad tiled image.\n"
+                                        : "Bad tiled image, or crop region "
+                                          "outside the image.\n");
+                        exit(EXIT_FAILURE);
+                }
+        } else {
+                ppm = Ppmio_read_region(fileno(inputfp), methods, threads,
+                                        region);
+        }
+        if (ppm == NULL) {
                 ppm = Pnm_ppmread(inputfp, methods);
+                if (region != NULL && !crop_image(ppm, methods, region)) {
+                        fprintf(stderr, "Crop region lies outside the "
+                                        "image.\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
 
+        if (filename != NULL) {
                 fclose(inputfp);
         }
-
         return ppm;
 }
 
-/*---------------------------------------------------------------
- |                    Transformation Functions                  |
- *--------------------------------------------------------------*/
-/* [Name]:       transform
- * [Purpose]:    Transforms the given ppm file (rotate/flip/transpose).
- *               Records time taken for transformation, if needed.
- * [Parameters]: 1 Pnm_ppm (source ppm image), 1 A2Methods_T (methods),
- *               1 mapfun* (map), 2 ints (transform_type [see constants],
- *               transform magnitude), 1 float* (time)
- * [Return]:     Transformed image in a Pnm_ppm
+/* [Name]:       tiled_input
+ * [Purpose]:    Checks whether the input (file or stdin) is a tiled image
+ * [Parameters]: 1 c-string (filename, NULL for stdin)
+ * [Return]:     1 if the input is a tiled image, 0 otherwise
  */
-Pnm_ppm transform(Pnm_ppm ppm, A2Methods_T methods, mapfun *map,
-                  int transform_type, int magnitude, float *time)
+int tiled_input(char *filename)
 {
-        A2 image = create_image(ppm, methods, transform_type, magnitude);
-        applyfun *apply = NULL;
-        result *dest_info = malloc(sizeof(struct result));
-        malloc_check(dest_info);
-
-        *dest_info = result_init(methods, magnitude, image);
-        apply = transform_init(apply, transform_type);
-        transform_image(ppm, apply, map, dest_info, time);
-        reassign(ppm, dest_info->destination_map, methods);
+        int fd, tiled;
 
-        free(dest_info);
-        return ppm;
+        if (filename == NULL) {
+                return Tilefile_probe(STDIN_FILENO);
+        }
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+                return 0;
+        }
+        tiled = Tilefile_probe(fd);
+        close(fd);
+        return tiled;
 }
 
-/* [Name]:       rotate_map
- * [Purpose]:    Copies source pixel content into a pixel in the destination
- *               image, based on rotation algorithms -- (CALLED BY MAP)
- * [Parameters]: 2 ints (col/row index), 1 A2 (source), 1 object* (content at
- *               the col/row index), 1 void* (closure; will be information
- *               about the destination image)
- * [Return]:     void
+/* [Name]:       pam_input
+ * [Purpose]:    Checks whether the input (file or stdin) is a PAM image
+ * [Parameters]: 1 c-string (filename, NULL for stdin)
+ * [Return]:     1 if the input is a PAM image, 0 otherwise
  */
-void rotate_map(int col, int row, A2 source, object *ptr, void *cl)
+int pam_input(char *filename)
 {
-        result *info        = (result *) cl;
-        A2Methods_T methods = info->methods;
-        int rotation        = info->magnitude;
-        A2 destination      = info->destination_map;
+        FILE *fp;
+        int   pam;
+
+        if (filename == NULL) {
+                return Pam_probe(stdin);
+        }
+        fp = fopen(filename, "r");
+        if (fp == NULL) {
+                return 0;
+        }
+        pam = Pam_probe(fp);
+        fclose(fp);
+        return pam;
+}
 
-        int height = methods->height(source);
-        int width  = methods->width(source);
+/* [Name]:       pam_file
+ * [Purpose]:    Reads a PAM image into 4-byte pixels, transforms it and
+ *               writes it to stdout as PAM with the same depth and tuple
+ *               type. Records the time taken for the transformation in
+ *               time, if needed.
+ * [Parameters]: 1 c-string (filename, NULL for stdin), 1 A2Methods_T
+ *               (methods), 2 ints (transform_type, magnitude),
+ *               1 float* (time)
+ * [Return]:     Number of pixels in the image
+ */
+long pam_file(char *filename, A2Methods_T methods, int transform_type,
+              int magnitude, float *time)
+{
+        FILE      *inputfp = stdin;
+        Pam_header header;
+        Pnm_ppm    image;
 
-        Pnm_rgb source_pixel = ((Pnm_rgb) ptr);
-        Pnm_rgb dest_pixel;
+        if (filename != NULL) {
+                inputfp = fopen(filename, "r");
+                if (inputfp == NULL) {
+                        fprintf(stderr, "File read error.\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
 
-        if (rotation == 0) {
-                dest_pixel = methods->at(destination, col, row);
-        } else if (rotation == 90) {
-                dest_pixel = methods->at(destination, height - row - 1, col);
-        } else if (rotation == 180) {
-                dest_pixel = methods->at(destination, width - col - 1,
-                                         height - row - 1);
-        } else if (rotation == 270) {
-                dest_pixel = methods->at(destination, row, width - col - 1);
+        long start = Trace_now();
+        image = Pam_read(inputfp, methods, &header);
+        if (image == NULL) {
+                fprintf(stderr, "Bad PAM image, not of depth 1 to 4 "
+                                "with maxval up to 255, or with a "
+                                "TUPLTYPE that does not match its "
+                                "DEPTH.\n");
+                exit(EXIT_FAILURE);
+        }
+        if (filename != NULL) {
+                fclose(inputfp);
         }
+        if (methods == uarray2_methods_sparse) {
+                UArray2b_compress(image->pixels);
+        }
+        Trace_span("decode", start, -1);
+
+        long pixels = (long)image->width * image->height;
+        start = Trace_now();
+        image = transform_words(image, methods, transform_type, magnitude,
+                                time);
+        Trace_span("transform", start, -1);
 
-        *dest_pixel = *source_pixel;
+        start = Trace_now();
+        if (Pam_write(stdout, image, &header) != 0) {
+                fprintf(stderr, "File write error.\n");
+                exit(EXIT_FAILURE);
+        }
+        Trace_span("encode", start, -1);
+        start = Trace_now();
+        Pnm_ppmfree(&image);
+        Trace_span("free", start, -1);
+        return pixels;
 }
 
-/* [Name]:       flip_map
- * [Purpose]:    Copies source pixel content into a pixel in the destination
- *               image, based on flip algorithms -- (CALLED BY MAP)
- * [Parameters]: 2 ints (col/row index), 1 A2 (source), 1 object* (content at
- *               the col/row index), 1 void* (closure; will be information
- *               about the destination image)
+/* [Name]:       write_file
+ * [Purpose]:    Write the ppm to stdout in the requested format. P6 output
+ *               to a regular file is encoded in parallel row bands;
+ *               otherwise Pnm_ppmwrite is used.
+ * [Parameters]: 1 Pnm_ppm (ppm), 2 ints (threads, format [see constants])
  * [Return]:     void
  */
-void flip_map(int col, int row, A2 source, object *ptr, void *cl)
+void write_file(Pnm_ppm ppm, int threads, int format)
 {
-        result *info        = (result *) cl;
-        A2Methods_T methods = info->methods;
-        int flip_type       = info->magnitude;
-        A2 destination      = info->destination_map;
+        int status;
+
+        if (format != OUT_PPM) {
+                if (Tilefile_write(stdout, ppm,
+                                   format == OUT_TILED_INDEXED) != 0) {
+                        fprintf(stderr, "File write error.\n");
+                        exit(EXIT_FAILURE);
+                }
+                return;
+        }
 
-        int height = methods->height(source);
-        int width  = methods->width(source);
+        fflush(stdout);
+        status = Ppmio_write(STDOUT_FILENO, ppm, threads);
+        if (status < 0) {
+                fprintf(stderr, "File write error.\n");
+                exit(EXIT_FAILURE);
+        } else if (status == 0) {
+                Pnm_ppmwrite(stdout, ppm);
+        }
+}
 
-        Pnm_rgb source_pixel = ((Pnm_rgb) ptr);
-        Pnm_rgb dest_pixel;
+/* [Name]:       pipeline_file
+ * [Purpose]:    Transforms a streamed P6 image with the pipelined reader ->
+ *               transform -> writer stages, writing the result to stdout
+ *               while the input is still arriving. Records the time taken
+ *               by the whole pipeline in time, if needed.
+ * [Parameters]: 1 c-string (filename, NULL for stdin), 1 A2Methods_T
+ *               (methods), 3 ints (transform_type, magnitude, threads),
+ *               1 Pixelop_T (ops, NULL for none), 1 float* (time)
+ * [Return]:     Number of pixels in the image
+ */
+long pipeline_file(char *filename, A2Methods_T methods, int transform_type,
+                   int magnitude, int threads, Pixelop_T ops, float *time)
+{
+        FILE *inputfp = stdin;
+        Ppmio_header header;
+        CPUTime_T timer;
 
-        if (flip_type == HORIZ) {
-                dest_pixel = methods->at(destination, width - col - 1, row);
-        } else if (flip_type == VERT) {
-                dest_pixel = methods->at(destination, col, height - row - 1);
+        if (filename != NULL) {
+                inputfp = fopen(filename, "r");
+                if (inputfp == NULL) {
+                        fprintf(stderr, "File read error.\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+        if (Ppmio_read_header(inputfp, &header) != 1) {
+                fprintf(stderr, "-pipeline needs binary (P6) ppm input\n");
+                exit(EXIT_FAILURE);
+        }
+
+        /* header-only ppm; create_image swaps its dimensions as needed */
+        struct Pnm_ppm shape = { header.width, header.height, header.maxval,
+                                 NULL, methods };
+        A2 image = create_image(&shape, methods, transform_type, magnitude);
+        result dest_info = result_init(methods, magnitude, image);
+        applyfun *apply  = transform_init(NULL, transform_type);
+        int out_maxval   = ops != NULL ? Pixelop_prepare(ops, header.maxval)
+                                       : (unsigned)header.maxval;
+
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
         }
 
-        *dest_pixel = *source_pixel;
+        if (Pipeline_run(inputfp, stdout, &header, out_maxval, methods, image,
+                         apply, &dest_info,
+                         pipeline_order(transform_type, magnitude),
+                         threads) != 0) {
+                fprintf(stderr, "Pipeline read/write error.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+
+        methods->free(&image);
+        if (filename != NULL) {
+                fclose(inputfp);
+        }
+        return (long)header.width * header.height;
 }
 
-/* [Name]:       transpose_map
- * [Purpose]:    Copies source pixel content into a pixel in the destination
- *               image, based on transpose algorithms -- (CALLED BY MAP)
- * [Parameters]: 2 ints (col/row index), 1 A2 (source), 1 object* (content at
- *               the col/row index), 1 void* (closure; will be information
- *               about the destination image)
- * [Return]:     void
+/* [Name]:       stream_file
+ * [Purpose]:    Transforms every frame of a multi-frame P6 stream (e.g. raw
+ *               video), writing the frames to stdout as they are done.
+ *               Records the time taken in time, if needed.
+ * [Parameters]: 1 c-string (filename, NULL for stdin), 1 A2Methods_T
+ *               (methods), 1 mapfun* (map), 2 ints (transform_type,
+ *               magnitude), 1 float* (time), 1 Stream_stats* (stats)
+ * [Return]:     Number of frames transformed
  */
-void transpose_map(int col, int row, A2 source, object *ptr, void *cl)
+int stream_file(char *filename, A2Methods_T methods, mapfun *map,
+                int transform_type, int magnitude, float *time,
+                Stream_stats *stats)
 {
-        (void) source;
-        result *info        = (result *) cl;
-        A2Methods_T methods = info->methods;
-        A2 destination      = info->destination_map;
+        FILE *inputfp = stdin;
+        CPUTime_T timer;
 
-        Pnm_rgb source_pixel = ((Pnm_rgb) ptr);
-        Pnm_rgb dest_pixel;
+        if (filename != NULL) {
+                inputfp = fopen(filename, "r");
+                if (inputfp == NULL) {
+                        fprintf(stderr, "File read error.\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+
+        if (Stream_run(inputfp, stdout, methods, map, transform_type,
+                       magnitude, stats) != 0) {
+                fprintf(stderr, "Stream read/write error after %ld "
+                                "frame(s).\n", stats->frames);
+                exit(EXIT_FAILURE);
+        }
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+        if (filename != NULL) {
+                fclose(inputfp);
+        }
+        return stats->frames;
+}
 
-        dest_pixel = methods->at(destination, row, col);
+/* [Name]:       fetch_cache
+ * [Purpose]:    Writes a cached result to stdout if there is one; otherwise
+ *               starts capturing stdout so this run's result is kept
+ * [Parameters]: 1 Cache_T (cache), 1 c-string (time_file, NULL for none),
+ *               1 c-string (progname)
+ * [Return]:     1 if the cached result was written, 0 if the run must go on
+ */
+int fetch_cache(Cache_T cache, char *time_file, const char *progname)
+{
+        long start = Trace_now();
+        int  hit   = Cache_fetch(cache, STDOUT_FILENO);
 
-        *dest_pixel = *source_pixel;
+        if (hit < 0) {
+                fprintf(stderr, "%s: cannot write the cached result\n",
+                        progname);
+                exit(EXIT_FAILURE);
+        }
+        if (hit) {
+                Trace_span("cache", start, -1);
+                if (time_file != NULL) {
+                        /* nothing was timed; the file holds only this */
+                        FILE *fp = fopen(time_file, "w");
+                        if (fp == NULL) {
+                                fprintf(stderr, "Time file read error\n");
+                                exit(EXIT_FAILURE);
+                        }
+                        Cache_log(cache, fp);
+                        fclose(fp);
+                }
+                return 1;
+        }
+        if (Cache_capture(cache) != 0) {
+                fprintf(stderr, "%s: cannot capture the result for the "
+                                "cache\n", progname);
+                exit(EXIT_FAILURE);
+        }
+        return 0;
 }
 
-/*---------------------------------------------------------------
- |                Transformation Helper Functions               |
- *--------------------------------------------------------------*/
-/* [Name]:       create_image
- * [Purpose]:    Creates an destination A2 based on (edited) dimensions
- *               (if rotated by 90/270 degrees, or transposed -
- *                width & height are swapped).
- * [Parameters]: 1 Pnm_ppm (source ppm), 1 A2Methods_T (methods),
- *               2 ints (transformation type and magnitude)
- * [Return]:     Empty destination A2
+/* [Name]:       commit_cache
+ * [Purpose]:    Ends a run that is being cached: its captured result goes
+ *               to the real stdout and becomes an entry
+ * [Parameters]: 1 Cache_T* (cache, NULL contents when not caching),
+ *               1 c-string (time_file, NULL for none), 1 c-string (progname)
+ * [Return]:     void
  */
-A2 create_image(Pnm_ppm ppm, A2Methods_T methods, int type, int magnitude)
+void commit_cache(Cache_T *cache, char *time_file, const char *progname)
 {
-        int width  = ppm->width;
-        int height = ppm->height;
-        int size   = sizeof(struct Pnm_rgb);
-
-        if ((type == ROTATE && (magnitude == 90 || magnitude == 270)) ||
-             type == TRANSPOSE) {
-                ppm->width  = height;
-                ppm->height = width;
-                return methods->new(height, width, size);
-        } else {
-                return methods->new(width, height, size);
+        if (*cache == NULL) {
+                return;
+        }
+        long start = Trace_now();
+        if (Cache_commit(*cache) != 0) {
+                fprintf(stderr, "%s: cannot write the result\n", progname);
+                exit(EXIT_FAILURE);
+        }
+        Trace_span("cache", start, -1);
+        if (time_file != NULL) {
+                log_cache(*cache, time_file);
         }
+        Cache_free(cache);
 }
 
-/* [Name]:       result_init
- * [Purpose]:    Initializes the result struct that contains the methods,
- *               magnitude and destination image.
- * [Parameters]: 1 A2Methods_T (methods), 1 int (magnitude), 1 A2 (image)
- * [Return]:     Initialized result
+/*---------------------------------------------------------------
+ |                      Planning Functions                      |
+ *--------------------------------------------------------------*/
+/* [Name]:       plan_job
+ * [Purpose]:    Probes the input (without consuming it) and lets the
+ *               planner choose how to run the job
+ * [Parameters]: 1 c-string (filename, NULL for stdin), 1 Planner_job*
+ *               (job; everything but the input facts filled in),
+ *               1 Planner_plan* (plan, filled in)
+ * [Return]:     void
  */
-result result_init(A2Methods_T methods, int magnitude, A2 image)
+void plan_job(char *filename, Planner_job *job, Planner_plan *plan)
 {
-        result dest_info;
+        Planner_caches caches;
+        int fd = STDIN_FILENO;
 
-        dest_info.methods         = methods;
-        dest_info.magnitude       = magnitude;
-        dest_info.destination_map = image;
+        if (filename != NULL) {
+                fd = open(filename, O_RDONLY);
+                if (fd < 0) {
+                        fprintf(stderr, "File read error.\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+        Planner_probe(fd, job);
+        if (filename != NULL) {
+                close(fd);
+        }
 
-        return dest_info;
+        Planner_caches_probe(&caches);
+        Planner_choose(job, &caches, plan);
 }
 
-/* [Name]:       transform_init
- * [Purpose]:    Assigns the appropriate apply function to the applyfun*
- * [Parameters]: 1 applyfun* (apply), 1 int (transform_type)
- * [Return]:     Initialized applyfun*
+/* [Name]:       log_plan
+ * [Purpose]:    Appends the plan and its rationale to the timing file
+ * [Parameters]: 1 Planner_plan* (plan), 1 c-string (file)
+ * [Return]:     void
  */
-applyfun* transform_init(applyfun *apply, int transform_type)
+void log_plan(Planner_plan *plan, char *file)
 {
-        if (transform_type == ROTATE) {
-                apply = rotate_map;
-        } else if (transform_type == FLIP) {
-                apply = flip_map;
-        } else if (transform_type == TRANSPOSE) {
-                apply = transpose_map;
+        FILE *fp = fopen(file, "a");
+        if (fp == NULL) {
+                fprintf(stderr, "Time file read error\n");
+                exit(EXIT_FAILURE);
         }
+        Planner_log(plan, fp);
+        fclose(fp);
+}
 
-        return apply;
+/* [Name]:       log_cache
+ * [Purpose]:    Appends what the result cache did to the timing file
+ * [Parameters]: 1 Cache_T (cache), 1 c-string (file)
+ * [Return]:     void
+ */
+void log_cache(Cache_T cache, char *file)
+{
+        FILE *fp = fopen(file, "a");
+        if (fp == NULL) {
+                fprintf(stderr, "Time file read error\n");
+                exit(EXIT_FAILURE);
+        }
+        Cache_log(cache, fp);
+        fclose(fp);
 }
 
-/* [Name]:       transform_image
- * [Purpose]:    Maps applyfun on the source image to create transformed image
- *               Records the duration taken for the applyfun in time, if needed
- * [Parameters]: 1 Pnm_ppm (ppm), 1 applyfun* (apply), 1 mapfun* (map),
- *               1 result* (dest_info), 1 float* (time)
+/* [Name]:       log_incremental
+ * [Purpose]:    Appends what an incremental run did to the timing file
+ * [Parameters]: 1 Incremental_stats* (stats), 1 c-string (file)
  * [Return]:     void
  */
-void transform_image(Pnm_ppm ppm, applyfun *apply, mapfun *map,
-                     result *dest_info, float *time)
+void log_incremental(Incremental_stats *stats, char *file)
 {
-        CPUTime_T timer;
-        if (time != NULL) {
-                timer = CPUTime_New();
-                CPUTime_Start(timer);
+        FILE *fp = fopen(file, "a");
+        if (fp == NULL) {
+                fprintf(stderr, "Time file read error\n");
+                exit(EXIT_FAILURE);
         }
+        Incremental_log(stats, fp);
+        fclose(fp);
+}
 
-        map(ppm->pixels, apply, dest_info);
+/* [Name]:       log_stream
+ * [Purpose]:    Appends frame count, throughput and latency percentiles to
+ *               the timing file
+ * [Parameters]: 1 Stream_stats* (stats), 1 c-string (file)
+ * [Return]:     void
+ */
+void log_stream(Stream_stats *stats, char *file)
+{
+        FILE *fp = fopen(file, "a");
+        if (fp == NULL) {
+                fprintf(stderr, "Time file read error\n");
+                exit(EXIT_FAILURE);
+        }
+        Stream_log(stats, fp);
+        fclose(fp);
+}
 
-        if (time != NULL) {
-                *time = CPUTime_Stop(timer);
-                CPUTime_Free(&timer);
+/* [Name]:       log_tuning
+ * [Purpose]:    Appends what the copy tuning did during the transformation
+ *               to the timing file: the stores used and, for prefetch, the
+ *               sides it fetched, their stride and how many prefetches
+ *               were issued, so runs with and without it can be compared
+ * [Parameters]: 1 const tuning_used* (used), 1 c-string (file)
+ * [Return]:     void
+ */
+void log_tuning(const tuning_used *used, char *file)
+{
+        FILE *fp = fopen(file, "a");
+        if (fp == NULL) {
+                fprintf(stderr, "Time file read error\n");
+                exit(EXIT_FAILURE);
+        }
+        fprintf(fp, "TUNING\n");
+        fprintf(fp, "Stores:\t\t%s\n", used->nt_stores ? "non-temporal"
+                                                        : "cached");
+        if (used->distance > 0) {
+                fprintf(fp, "Prefetch:\t%d pixels ahead on the %s, "
+                        "%ld-byte stride, %ld prefetches\n", used->distance,
+                        used->source && used->dest ? "source and destination"
+                        : used->source ? "source" : "destination",
+                        used->stride, used->prefetches);
+        } else {
+                fprintf(fp, "Prefetch:\toff (no side of the walk crosses "
+                        "rows, or the rows fit in cache)\n");
         }
+        fclose(fp);
 }
 
-/* [Name]:       reassign
- * [Purpose]:    Reassigns the A2 in ppm to the transformed A2, and frees
- *               heap-allocated data of the previous A2.
- * [Parameters]: 1 Pnm_ppm (ppm), 1 A2 (transformed A2), 1 A2Methods_T methods
+/* [Name]:       log_sparse
+ * [Purpose]:    Appends how many tiles of a sparse image were uniform
+ *               after decoding and after the transformation to the file
+ * [Parameters]: 4 longs (uniform and total tiles of the source, then of
+ *               the destination), 1 char* (file)
  * [Return]:     void
  */
-void reassign(Pnm_ppm ppm, A2 destination_map, A2Methods_T methods)
+void log_sparse(long source_uniform, long source_tiles, long dest_uniform,
+                long dest_tiles, char *file)
 {
-        A2 buff = ppm->pixels;
-        ppm->pixels = destination_map;
-        methods->free(&buff);
+        FILE *fp = fopen(file, "a");
+        if (fp == NULL) {
+                fprintf(stderr, "Time file read error\n");
+                exit(EXIT_FAILURE);
+        }
+        fprintf(fp, "SPARSE\n");
+        fprintf(fp, "Source:\t\t%ld of %ld tiles uniform\n", source_uniform,
+                source_tiles);
+        fprintf(fp, "Destination:\t%ld of %ld tiles uniform\n", dest_uniform,
+                dest_tiles);
+        fclose(fp);
 }
 
 /*---------------------------------------------------------------
@@ -470,10 +1322,11 @@ void reassign(Pnm_ppm ppm, A2 destination_map, A2Methods_T methods)
  * [Purpose]:    Prints the timing the map function took onto the given
  *               file.
  * [Parameters]: 1 float* (time it took), 1 char* (file to print timings to),
- *               1 float (pixel count)
+ *               1 long (pixel count; the division is done in double, so
+ *               it stays exact past 2^31 pixels)
  * [Return]:     void
  */
-void print_time(float *time, char *file, float pixel_count)
+void print_time(float *time, char *file, long pixel_count)
 {
         FILE *fp = fopen(file, "w");
         if (fp == NULL) {
@@ -484,6 +1337,6 @@ void print_time(float *time, char *file, float pixel_count)
         fprintf(fp, "TIMING\n"
                     "Total:\t\t%.0f nanoseconds\n"
                     "Per pixel:\t%.0f nanoseconds\n",
-                    *time, *time / pixel_count);
+                    *time, (double)*time / pixel_count);
         fclose(fp);
 }
\ No newline at end of file
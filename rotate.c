@@ -0,0 +1,300 @@
+/*
+ *      rotate.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Arbitrary-angle rotation by inverse mapping: every destination
+ *        pixel is sampled from the source point that rotates onto it
+ *      - The source is first packed into a row-major array of 16-bit
+ *        {r, g, b, 0} cells, so a sample is a plain load instead of an
+ *        A2Methods call, and four cells fit in half a cache line
+ *      - The destination is produced in square tiles (the blocked
+ *        array's blocksize, or DEFAULT_TILE); a tile's source footprint
+ *        is a small rotated square, so its reads stay in cache
+ *      - Within a tile row the source coordinate is stepped incrementally
+ *        (one add per axis per pixel), and bilinear interpolation works on
+ *        all channels at once with GCC vector extensions
+ *      - Packing and sampling are split into bands across threads
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "assert.h"
+#include "bands.h"
+#include "cputiming.h"
+#include "mem.h"
+#include "rotate.h"
+#include "trace.h"
+#include "transform.h"
+
+/* One pixel's channels {r, g, b, unused}, for vector arithmetic */
+typedef float v4f __attribute__ ((vector_size (16)));
+
+/* Packed source cell */
+typedef struct cell {
+        unsigned short c[4];
+} cell;
+
+/* Destination tile edge when the destination is not blocked */
+#define DEFAULT_TILE 64
+
+/* Everything the band workers share */
+typedef struct rotation {
+        A2Methods_T   methods;
+        A2            source, destination;
+        cell         *packed;
+        int           src_width, src_height;
+        int           dst_width, dst_height;
+        double        cos_t, sin_t;
+        double        src_cx, src_cy;   /* rotation center, source */
+        double        dst_cx, dst_cy;   /* rotation center, destination */
+        Rotate_filter filter;
+        v4f           fill;
+        int           tile;
+} rotation;
+
+/* Rows [first, end) of work for one thread: source rows when packing,
+ * destination rows (whole tile rows) when sampling */
+typedef struct band {
+        const rotation *r;
+        int             first, end;
+} band;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void *pack_band     (void *cl);
+static void *sample_band   (void *cl);
+static v4f   sample        (const rotation *r, double sx, double sy);
+static v4f   texel         (const rotation *r, int x, int y);
+static void  run_bands     (const rotation *r, int rows, int align,
+                            int threads, void *work(void *));
+
+/*---------------------------------------------------------------
+ |                      Rotation Functions                      |
+ *--------------------------------------------------------------*/
+/* [Name]:       Rotate_any
+ * [Purpose]:    Rotates ppm clockwise by any angle. Records the time taken
+ *               in time, if needed.
+ * [Parameters]: 1 Pnm_ppm (ppm), 1 A2Methods_T (methods), 1 double
+ *               (degrees, clockwise), 1 const Rotate_options* (options),
+ *               1 float* (time)
+ * [Return]:     The rotated image in ppm
+ */
+Pnm_ppm Rotate_any(Pnm_ppm ppm, A2Methods_T methods, double degrees,
+                   const Rotate_options *options, float *time)
+{
+        rotation  r;
+        double    theta = fmod(degrees, 360.0) * M_PI / 180.0;
+        CPUTime_T timer;
+
+        assert(ppm != NULL && methods != NULL && options != NULL);
+
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+
+        r.methods    = methods;
+        r.source     = ppm->pixels;
+        r.src_width  = ppm->width;
+        r.src_height = ppm->height;
+        r.cos_t      = cos(theta);
+        r.sin_t      = sin(theta);
+        r.filter     = options->filter;
+        r.fill       = (v4f){ options->fill.red, options->fill.green,
+                              options->fill.blue, 0 };
+
+        if (options->expand) {
+                /* bounding box of the rotated image; the epsilon keeps
+                 * rounding noise from adding a whole row or column */
+                double w = r.src_width, h = r.src_height;
+                r.dst_width  = ceil(w * fabs(r.cos_t) + h * fabs(r.sin_t) -
+                                    1e-6);
+                r.dst_height = ceil(w * fabs(r.sin_t) + h * fabs(r.cos_t) -
+                                    1e-6);
+        } else {
+                r.dst_width  = r.src_width;
+                r.dst_height = r.src_height;
+        }
+        r.src_cx = r.src_width  / 2.0;
+        r.src_cy = r.src_height / 2.0;
+        r.dst_cx = r.dst_width  / 2.0;
+        r.dst_cy = r.dst_height / 2.0;
+
+        r.destination = methods->new(r.dst_width, r.dst_height,
+                                     sizeof(struct Pnm_rgb));
+        r.tile = methods->blocksize(r.destination) > 1
+                 ? methods->blocksize(r.destination) : DEFAULT_TILE;
+        r.packed = malloc((long)r.src_width * r.src_height * sizeof(cell));
+        malloc_check(r.packed);
+
+        run_bands(&r, r.src_height, 1, options->threads, pack_band);
+        run_bands(&r, r.dst_height, r.tile, options->threads, sample_band);
+
+        free(r.packed);
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+
+        ppm->width  = r.dst_width;
+        ppm->height = r.dst_height;
+        reassign(ppm, r.destination, methods);
+        return ppm;
+}
+
+/* [Name]:       pack_band
+ * [Purpose]:    Thread body: copies one band of source rows into the packed
+ *               array
+ * [Parameters]: 1 void* (closure; the band)
+ * [Return]:     NULL
+ */
+static void *pack_band(void *cl)
+{
+        band           *b = cl;
+        const rotation *r = b->r;
+        long        start = Trace_now();
+
+        for (int row = b->first; row < b->end; row++) {
+                cell *line = r->packed + (long)row * r->src_width;
+                for (int col = 0; col < r->src_width; col++) {
+                        Pnm_rgb pixel = r->methods->at(r->source, col, row);
+                        line[col].c[0] = pixel->red;
+                        line[col].c[1] = pixel->green;
+                        line[col].c[2] = pixel->blue;
+                        line[col].c[3] = 0;
+                }
+        }
+        Trace_span("pack band", start, b->first);
+        return NULL;
+}
+
+/* [Name]:       sample_band
+ * [Purpose]:    Thread body: fills one band of destination tile rows, tile
+ *               by tile. Each tile row segment starts from an exactly
+ *               computed source point and steps by (cos, -sin) per pixel.
+ * [Parameters]: 1 void* (closure; the band)
+ * [Return]:     NULL
+ */
+static void *sample_band(void *cl)
+{
+        band           *b = cl;
+        const rotation *r = b->r;
+
+        for (int y0 = b->first; y0 < b->end; y0 += r->tile) {
+                int  y1    = y0 + r->tile < b->end ? y0 + r->tile : b->end;
+                long start = Trace_now();
+                for (int x0 = 0; x0 < r->dst_width; x0 += r->tile) {
+                        int x1 = x0 + r->tile < r->dst_width
+                                 ? x0 + r->tile : r->dst_width;
+                        for (int y = y0; y < y1; y++) {
+                                /* pixel centers, relative to the centers
+                                 * of rotation; source is back in index
+                                 * space (center of pixel i is at i) */
+                                double dx = x0 + 0.5 - r->dst_cx;
+                                double dy = y  + 0.5 - r->dst_cy;
+                                double sx = r->cos_t * dx + r->sin_t * dy +
+                                            r->src_cx - 0.5;
+                                double sy = -r->sin_t * dx + r->cos_t * dy +
+                                            r->src_cy - 0.5;
+                                for (int x = x0; x < x1; x++) {
+                                        v4f v = sample(r, sx, sy) + 0.5f;
+                                        Pnm_rgb pixel = r->methods->at(
+                                                r->destination, x, y);
+                                        pixel->red   = v[0];
+                                        pixel->green = v[1];
+                                        pixel->blue  = v[2];
+                                        sx += r->cos_t;
+                                        sy -= r->sin_t;
+                                }
+                        }
+                }
+                Trace_span("tile row", start, y0);
+        }
+        return NULL;
+}
+
+/* [Name]:       sample
+ * [Purpose]:    Samples the source at a point in index space
+ * [Parameters]: 1 const rotation* (r), 2 doubles (sx, sy)
+ * [Return]:     The sampled channels
+ */
+static v4f sample(const rotation *r, double sx, double sy)
+{
+        if (r->filter == ROTATE_NEAREST) {
+                return texel(r, (int)floor(sx + 0.5), (int)floor(sy + 0.5));
+        }
+
+        double fx0 = floor(sx), fy0 = floor(sy);
+        if (fx0 < -1 || fy0 < -1 || fx0 >= r->src_width ||
+            fy0 >= r->src_height) {
+                return r->fill;
+        }
+
+        int x = fx0, y = fy0;
+        v4f p00, p01, p10, p11;
+        if (x >= 0 && y >= 0 && x + 1 < r->src_width &&
+            y + 1 < r->src_height) {
+                const cell *c0 = r->packed + (long)y * r->src_width + x;
+                const cell *c1 = c0 + r->src_width;
+                p00 = (v4f){ c0[0].c[0], c0[0].c[1], c0[0].c[2], 0 };
+                p01 = (v4f){ c0[1].c[0], c0[1].c[1], c0[1].c[2], 0 };
+                p10 = (v4f){ c1[0].c[0], c1[0].c[1], c1[0].c[2], 0 };
+                p11 = (v4f){ c1[1].c[0], c1[1].c[1], c1[1].c[2], 0 };
+        } else {
+                /* along the edges, missing neighbours blend in the fill */
+                p00 = texel(r, x,     y);
+                p01 = texel(r, x + 1, y);
+                p10 = texel(r, x,     y + 1);
+                p11 = texel(r, x + 1, y + 1);
+        }
+
+        float fx = sx - fx0, fy = sy - fy0;
+        v4f   wx = { fx, fx, fx, fx };
+        v4f   wy = { fy, fy, fy, fy };
+        v4f   top    = p00 + (p01 - p00) * wx;
+        v4f   bottom = p10 + (p11 - p10) * wx;
+        return top + (bottom - top) * wy;
+}
+
+/* [Name]:       texel
+ * [Purpose]:    Reads one packed source cell, or the fill color outside
+ *               the source
+ * [Parameters]: 1 const rotation* (r), 2 ints (x, y)
+ * [Return]:     The cell's channels
+ */
+static v4f texel(const rotation *r, int x, int y)
+{
+        if (x < 0 || y < 0 || x >= r->src_width || y >= r->src_height) {
+                return r->fill;
+        }
+        const cell *c = r->packed + (long)y * r->src_width + x;
+        return (v4f){ c->c[0], c->c[1], c->c[2], 0 };
+}
+
+/*---------------------------------------------------------------
+ |                       Thread Helpers                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       run_bands
+ * [Purpose]:    Splits rows into bands (edges on multiples of align) and
+ *               runs work on each (see Bands_run)
+ * [Parameters]: 1 const rotation* (r), 3 ints (rows, align, threads),
+ *               1 thread body (work)
+ * [Return]:     void
+ */
+static void run_bands(const rotation *r, int rows, int align, int threads,
+                      void *work(void *))
+{
+        int  count = Bands_count(threads, rows, align);
+        band bands[count];
+
+        for (int i = 0; i < count; i++) {
+                bands[i].r = r;
+                Bands_split(rows, align, count, i, &bands[i].first,
+                            &bands[i].end);
+        }
+        Bands_run(bands, count, sizeof(band), work);
+}
@@ -0,0 +1,32 @@
+/*
+ *      rotate.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Rotation by any angle (clockwise, in degrees), for deskewing
+ *      - Nearest-neighbour or bilinear sampling; uncovered destination
+ *        pixels get a fill color, and the canvas either keeps the source
+ *        size (corners are cut off) or expands to hold the whole image
+ */
+
+#ifndef ROTATE_INCLUDED
+#define ROTATE_INCLUDED
+
+#include "a2methods.h"
+#include "pnm.h"
+
+typedef enum Rotate_filter {
+        ROTATE_NEAREST,
+        ROTATE_BILINEAR
+} Rotate_filter;
+
+typedef struct Rotate_options {
+        Rotate_filter  filter;
+        int            expand;  /* nonzero: canvas holds the whole image */
+        struct Pnm_rgb fill;    /* color of uncovered pixels */
+        int            threads;
+} Rotate_options;
+
+extern Pnm_ppm Rotate_any(Pnm_ppm ppm, A2Methods_T methods, double degrees,
+                          const Rotate_options *options, float *time);
+
+#endif
@@ -0,0 +1,290 @@
+/*
+ *      scale.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Downscales while rotating/flipping/transposing, in one pass over
+ *        the source
+ *      - Each source column lands in one destination column (or row) and
+ *        each source row in one destination row (or column), see
+ *        axis_positions, so the destination cell of source (col, row) is
+ *        col_part[col] + row_part[row], from two small tables
+ *      - Each cell accumulates {red, green, blue, count} as one vector of
+ *        64-bit lanes (GCC vector extension), so the add is a single
+ *        vector operation
+ *      - Source rows are split into bands whose edges fall on destination
+ *        cell boundaries, so bands never share a cell and need no locking
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assert.h"
+#include "bands.h"
+#include "cputiming.h"
+#include "mem.h"
+#include "scale.h"
+#include "trace.h"
+#include "transform.h"
+
+/* Running {red, green, blue, count} of one destination cell */
+typedef unsigned long long sum4 __attribute__ ((vector_size (32)));
+
+/* Work description for one band of source rows */
+typedef struct band {
+        A2Methods_T  methods;
+        A2           source;
+        int          width;
+        int          first_row, end_row;
+        const long  *col_part, *row_part;
+        sum4        *sums;
+} band;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static long  cell        (long t, long in, long out, int divisor);
+static void  axis_tables (int transform_type, int magnitude, int width,
+                          int height, int out_width, int out_height,
+                          int divisor, long *col_part, long *row_part);
+static void *sum_band    (void *cl);
+
+/*---------------------------------------------------------------
+ |                        Scale Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Scale_parse
+ * [Purpose]:    Parses a -scale argument: "1/N" or "WxH"
+ * [Parameters]: 1 c-string (text), 1 Scale_spec* (spec, filled in)
+ * [Return]:     1 if text is a valid scale, 0 otherwise
+ */
+int Scale_parse(const char *text, Scale_spec *spec)
+{
+        char *endptr;
+        long  a, b;
+
+        assert(text != NULL && spec != NULL);
+
+        if (strncmp(text, "1/", 2) == 0) {
+                a = strtol(text + 2, &endptr, 10);
+                if (*endptr != '\0' || a < 1 || a > 0x7fffffff) {
+                        return 0;
+                }
+                spec->divisor = a;
+                spec->width   = 0;
+                spec->height  = 0;
+                return 1;
+        }
+
+        a = strtol(text, &endptr, 10);
+        if (*endptr != 'x') {
+                return 0;
+        }
+        b = strtol(endptr + 1, &endptr, 10);
+        if (*endptr != '\0' || a < 1 || b < 1 || a > 0x7fffffff ||
+            b > 0x7fffffff) {
+                return 0;
+        }
+        spec->divisor = 0;
+        spec->width   = a;
+        spec->height  = b;
+        return 1;
+}
+
+/* [Name]:       Scale_output_size
+ * [Purpose]:    Works out the size of a source image once it is transformed
+ *               and scaled
+ * [Parameters]: 1 const Scale_spec* (spec), 2 ints (transform_type,
+ *               magnitude), 2 ints (source width, height), 2 int*
+ *               (out_width, out_height; filled in)
+ * [Return]:     1 on success, 0 if spec would enlarge the image
+ */
+int Scale_output_size(const Scale_spec *spec, int transform_type,
+                      int magnitude, int width, int height, int *out_width,
+                      int *out_height)
+{
+        assert(spec != NULL && out_width != NULL && out_height != NULL);
+
+        if (swaps_axes(transform_type, magnitude)) {
+                int swap = width;
+                width    = height;
+                height   = swap;
+        }
+        if (spec->divisor > 0) {
+                /* round up in long: width + divisor can pass INT_MAX */
+                *out_width  = ((long)width  + spec->divisor - 1) /
+                              spec->divisor;
+                *out_height = ((long)height + spec->divisor - 1) /
+                              spec->divisor;
+                return 1;
+        }
+        if (spec->width > width || spec->height > height) {
+                return 0;
+        }
+        *out_width  = spec->width;
+        *out_height = spec->height;
+        return 1;
+}
+
+/* [Name]:       Scale_transform
+ * [Purpose]:    Transforms ppm and downscales it in the same pass: each
+ *               destination pixel is the mean of the transformed source
+ *               pixels in its box. The source is read once, in row bands on
+ *               up to 'threads' threads. Records the time taken in time, if
+ *               needed.
+ * [Parameters]: 1 Pnm_ppm (ppm), 1 A2Methods_T (methods), 2 ints
+ *               (transform_type [see transform.h], magnitude), 1 const
+ *               Scale_spec* (spec; must not enlarge, see
+ *               Scale_output_size), 1 int (threads), 1 float* (time)
+ * [Return]:     The scaled, transformed image in ppm
+ */
+Pnm_ppm Scale_transform(Pnm_ppm ppm, A2Methods_T methods, int transform_type,
+                        int magnitude, const Scale_spec *spec, int threads,
+                        float *time)
+{
+        int       width  = ppm->width;
+        int       height = ppm->height;
+        int       out_width = 0, out_height = 0, ok;
+        CPUTime_T timer;
+
+        ok = Scale_output_size(spec, transform_type, magnitude, width, height,
+                               &out_width, &out_height);
+        assert(ok);
+
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+
+        long  cells    = (long)out_width * out_height;
+        long *col_part = CALLOC(width, sizeof(long));
+        long *row_part = CALLOC(height, sizeof(long));
+        sum4 *sums     = NULL;
+        if (posix_memalign((void **)&sums, sizeof(sum4),
+                           cells * sizeof(sum4)) != 0) {
+                sums = NULL;
+        }
+        malloc_check(sums);
+        memset(sums, 0, cells * sizeof(sum4));
+        axis_tables(transform_type, magnitude, width, height, out_width,
+                    out_height, spec->divisor, col_part, row_part);
+
+        /* split rows into bands, moving each edge down to where row_part
+         * changes so no destination cell is shared */
+        int count = Bands_count(threads, height, 1);
+        band bands[count];
+        int  used = 0, row = 0;
+        for (int i = 0; i < count && row < height; i++) {
+                int end = (long)height * (i + 1) / count;
+                end = end <= row ? row + 1 : end;
+                while (end < height && row_part[end] == row_part[end - 1]) {
+                        end++;
+                }
+                bands[used].methods   = methods;
+                bands[used].source    = ppm->pixels;
+                bands[used].width     = width;
+                bands[used].first_row = row;
+                bands[used].end_row   = end;
+                bands[used].col_part  = col_part;
+                bands[used].row_part  = row_part;
+                bands[used].sums      = sums;
+                used++;
+                row = end;
+        }
+        Bands_run(bands, used, sizeof(band), sum_band);
+
+        A2 image = methods->new(out_width, out_height,
+                                sizeof(struct Pnm_rgb));
+        for (int r = 0; r < out_height; r++) {
+                for (int c = 0; c < out_width; c++) {
+                        sum4 s = sums[(long)r * out_width + c];
+                        unsigned long long n = s[3];
+                        Pnm_rgb pixel = methods->at(image, c, r);
+                        pixel->red   = (s[0] + n / 2) / n;
+                        pixel->green = (s[1] + n / 2) / n;
+                        pixel->blue  = (s[2] + n / 2) / n;
+                }
+        }
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+
+        free(sums);
+        FREE(col_part);
+        FREE(row_part);
+
+        ppm->width  = out_width;
+        ppm->height = out_height;
+        reassign(ppm, image, methods);
+        return ppm;
+}
+
+/* [Name]:       cell
+ * [Purpose]:    Maps a transformed coordinate to its destination cell along
+ *               one axis
+ * [Parameters]: 3 longs (t, in [transformed length], out [scaled length]),
+ *               1 int (divisor; 0 to scale in -> out)
+ * [Return]:     Cell index along the axis
+ */
+static long cell(long t, long in, long out, int divisor)
+{
+        return divisor > 0 ? t / divisor : t * out / in;
+}
+
+/* [Name]:       axis_tables
+ * [Purpose]:    Fills the tables that give each source column's and row's
+ *               share of its destination cell index
+ * [Parameters]: 2 ints (transform_type, magnitude), 2 ints (source width,
+ *               height), 2 ints (out_width, out_height), 1 int (divisor),
+ *               2 long* (col_part, row_part; width and height entries)
+ * [Return]:     void
+ */
+static void axis_tables(int transform_type, int magnitude, int width,
+                        int height, int out_width, int out_height,
+                        int divisor, long *col_part, long *row_part)
+{
+        int swap = swaps_axes(transform_type, magnitude);
+
+        axis_positions(transform_type, magnitude, width, height, col_part,
+                       row_part);
+        for (int c = 0; c < width; c++) {
+                long t = col_part[c];
+                col_part[c] = swap ? cell(t, width, out_height, divisor) *
+                                     out_width
+                                   : cell(t, width, out_width, divisor);
+        }
+        for (int r = 0; r < height; r++) {
+                long t = row_part[r];
+                row_part[r] = swap ? cell(t, height, out_width, divisor)
+                                   : cell(t, height, out_height, divisor) *
+                                     out_width;
+        }
+}
+
+/*---------------------------------------------------------------
+ |                       Thread Helpers                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       sum_band
+ * [Purpose]:    Thread body: adds every pixel of one band of source rows
+ *               into its destination cell
+ * [Parameters]: 1 void* (closure; the band)
+ * [Return]:     NULL
+ */
+static void *sum_band(void *cl)
+{
+        band *b     = cl;
+        long  start = Trace_now();
+
+        for (int row = b->first_row; row < b->end_row; row++) {
+                sum4 *line = b->sums + b->row_part[row];
+                for (int col = 0; col < b->width; col++) {
+                        Pnm_rgb pixel = b->methods->at(b->source, col, row);
+                        line[b->col_part[col]] += (sum4){ pixel->red,
+                                                          pixel->green,
+                                                          pixel->blue, 1 };
+                }
+        }
+        Trace_span("scale band", start, b->first_row);
+        return NULL;
+}
@@ -0,0 +1,34 @@
+/*
+ *      scale.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Area-averaging (box filter) downscale fused with rotate, flip or
+ *        transpose: every source pixel is read once and added straight
+ *        into the destination cell it lands in, so the full-resolution
+ *        transformed image is never built
+ */
+
+#ifndef SCALE_INCLUDED
+#define SCALE_INCLUDED
+
+#include "a2methods.h"
+#include "pnm.h"
+
+/* Requested output size: either 1/divisor of the transformed image, or
+ * exactly width x height (divisor 0) */
+typedef struct Scale_spec {
+        int divisor;
+        int width, height;
+} Scale_spec;
+
+extern int     Scale_parse      (const char *text, Scale_spec *spec);
+extern int     Scale_output_size(const Scale_spec *spec,
+                                 int transform_type, int magnitude,
+                                 int width, int height, int *out_width,
+                                 int *out_height);
+extern Pnm_ppm Scale_transform  (Pnm_ppm ppm, A2Methods_T methods,
+                                 int transform_type, int magnitude,
+                                 const Scale_spec *spec, int threads,
+                                 float *time);
+
+#endif
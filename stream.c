@@ -0,0 +1,467 @@
+/*
+ *      stream.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Three stages, one thread each: a decoder reads frame N+1 while the
+ *        calling thread transforms frame N and a writer encodes frame N-1
+ *      - Stages hand frames over through two-slot queues (mutex and
+ *        condition variable; frames are large, so handovers are rare). A
+ *        slot keeps its pixel array when it is recycled, and the array is
+ *        only reallocated when a frame's size differs from the one the
+ *        slot last held, so steady state allocates nothing.
+ *      - The writer records each frame's latency; percentiles are taken
+ *        once the stream ends
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "assert.h"
+#include "ppmio.h"
+#include "stream.h"
+#include "trace.h"
+#include "transform.h"
+
+/* Frames per queue; 2 lets a stage fill one while the next drains one */
+#define QUEUE_SLOTS 2
+
+/* One frame in flight */
+typedef struct frame {
+        int    width, height;
+        int    maxval;
+        A2     pixels;          /* kept across reuses of the slot */
+        double started;         /* monotonic ns when its header arrived */
+} frame;
+
+/* Bounded queue of frames between two stages */
+typedef struct queue {
+        frame           slots[QUEUE_SLOTS];
+        long            head;           /* frames published */
+        long            tail;           /* frames released */
+        int             closed;         /* producer is done */
+        pthread_mutex_t lock;
+        pthread_cond_t  changed;
+} queue;
+
+/* Shared state of one run */
+typedef struct stream {
+        FILE        *in, *out;
+        A2Methods_T  methods;
+        queue        decoded, transformed;
+        int          read_failed;       /* bad frame; set by the decoder */
+        int          write_failed;      /* set by the writer */
+        double      *latencies;         /* writer only */
+        long         latency_count, latency_cap;
+} stream;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void  *decode_frames   (void *cl);
+static void  *write_frames    (void *cl);
+static int    decode_frame    (stream *s, frame *f, unsigned char **row_buf,
+                               long *row_cap);
+static void   fit_pixels      (A2Methods_T methods, frame *f, int width,
+                               int height);
+static void   queue_init      (queue *q);
+static void   queue_free      (queue *q, A2Methods_T methods);
+static frame *queue_reserve   (queue *q);
+static void   queue_publish   (queue *q);
+static frame *queue_peek      (queue *q);
+static void   queue_release   (queue *q);
+static void   queue_close     (queue *q);
+static void   percentiles     (stream *s, Stream_stats *stats);
+static int    compare_doubles (const void *a, const void *b);
+static double now_ns          (void);
+
+/*---------------------------------------------------------------
+ |                       Stream Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Stream_run
+ * [Purpose]:    Transforms every P6 frame of in, writing the results to out
+ *               in order, until in reaches EOF
+ * [Parameters]: 2 FILE* (in, out), 1 A2Methods_T (methods), 1
+ *               A2Methods_mapfun* (map), 2 ints (transform_type [see
+ *               constants], magnitude), 1 Stream_stats* (stats, filled in)
+ * [Return]:     0 if the stream ended cleanly, -1 on a malformed or
+ *               truncated frame or a write error
+ */
+int Stream_run(FILE *in, FILE *out, A2Methods_T methods,
+               A2Methods_mapfun *map, int transform_type, int magnitude,
+               Stream_stats *stats)
+{
+        stream    s;
+        pthread_t decoder, writer;
+        applyfun *apply = transform_init(NULL, transform_type);
+        int       swap  = swaps_axes(transform_type, magnitude);
+        double    start = now_ns();
+
+        assert(in != NULL && out != NULL && methods != NULL && map != NULL);
+        assert(stats != NULL);
+
+        memset(&s, 0, sizeof(s));
+        s.in      = in;
+        s.out     = out;
+        s.methods = methods;
+        queue_init(&s.decoded);
+        queue_init(&s.transformed);
+        memset(stats, 0, sizeof(*stats));
+
+        if (pthread_create(&decoder, NULL, decode_frames, &s) != 0) {
+                return -1;
+        }
+        if (pthread_create(&writer, NULL, write_frames, &s) != 0) {
+                __atomic_store_n(&s.write_failed, 1, __ATOMIC_RELAXED);
+                queue_close(&s.transformed);
+                while (queue_peek(&s.decoded) != NULL) {
+                        queue_release(&s.decoded);
+                }
+                pthread_join(decoder, NULL);
+                queue_free(&s.decoded, methods);
+                return -1;
+        }
+
+        frame *source;
+        while ((source = queue_peek(&s.decoded)) != NULL) {
+                frame *dest = queue_reserve(&s.transformed);
+                fit_pixels(methods, dest,
+                           swap ? source->height : source->width,
+                           swap ? source->width  : source->height);
+                dest->maxval  = source->maxval;
+                dest->started = source->started;
+
+                result info  = result_init(methods, magnitude, dest->pixels);
+                long   begun = Trace_now();
+                map(source->pixels, apply, &info);
+                Trace_span("transform frame", begun, stats->frames);
+
+                stats->frames++;
+                stats->pixels += (long)source->width * source->height;
+                queue_release(&s.decoded);
+                queue_publish(&s.transformed);
+        }
+        queue_close(&s.transformed);
+
+        pthread_join(decoder, NULL);
+        pthread_join(writer, NULL);
+
+        stats->elapsed_ns = now_ns() - start;
+        percentiles(&s, stats);
+
+        free(s.latencies);
+        queue_free(&s.decoded, methods);
+        queue_free(&s.transformed, methods);
+        return s.read_failed || s.write_failed ? -1 : 0;
+}
+
+/* [Name]:       Stream_log
+ * [Purpose]:    Prints frame count, throughput and latency percentiles, for
+ *               the timing file
+ * [Parameters]: 1 const Stream_stats* (stats), 1 FILE* (fp)
+ * [Return]:     void
+ */
+void Stream_log(const Stream_stats *stats, FILE *fp)
+{
+        assert(stats != NULL && fp != NULL);
+
+        fprintf(fp, "STREAM\n");
+        fprintf(fp, "Frames:\t\t%ld\n", stats->frames);
+        fprintf(fp, "Throughput:\t%.2f frames/s\n",
+                stats->elapsed_ns > 0
+                ? stats->frames * 1e9 / stats->elapsed_ns : 0.0);
+        fprintf(fp, "Latency p50:\t%.3f ms\n", stats->p50_ns / 1e6);
+        fprintf(fp, "Latency p90:\t%.3f ms\n", stats->p90_ns / 1e6);
+        fprintf(fp, "Latency p99:\t%.3f ms\n", stats->p99_ns / 1e6);
+        fprintf(fp, "Latency max:\t%.3f ms\n", stats->max_ns / 1e6);
+}
+
+/*---------------------------------------------------------------
+ |                        Stage Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       decode_frames
+ * [Purpose]:    Decoder thread: reads frames into free slots until EOF, a
+ *               bad frame, or a write error downstream. Frames before a
+ *               bad one are still transformed and written.
+ * [Parameters]: 1 void* (closure; the stream)
+ * [Return]:     NULL
+ */
+static void *decode_frames(void *cl)
+{
+        stream        *s       = cl;
+        unsigned char *row_buf = NULL;
+        long           row_cap = 0;
+
+        while (!__atomic_load_n(&s->write_failed, __ATOMIC_RELAXED)) {
+                frame *f = queue_reserve(&s->decoded);
+                long start = Trace_now();
+                int status = decode_frame(s, f, &row_buf, &row_cap);
+                if (status <= 0) {
+                        s->read_failed = status < 0;
+                        break;
+                }
+                Trace_span("decode frame", start, -1);
+                queue_publish(&s->decoded);
+        }
+        queue_close(&s->decoded);
+
+        free(row_buf);
+        return NULL;
+}
+
+/* [Name]:       write_frames
+ * [Purpose]:    Writer thread: encodes transformed frames in order and
+ *               records their latencies. After a write error it keeps
+ *               draining, so the other stages can finish.
+ * [Parameters]: 1 void* (closure; the stream)
+ * [Return]:     NULL
+ */
+static void *write_frames(void *cl)
+{
+        stream *s = cl;
+        frame  *f;
+
+        while ((f = queue_peek(&s->transformed)) != NULL) {
+                struct Pnm_ppm ppm = { f->width, f->height, f->maxval,
+                                       f->pixels, s->methods };
+                long start = Trace_now();
+                if (!__atomic_load_n(&s->write_failed, __ATOMIC_RELAXED) &&
+                    Ppmio_write_stream(s->out, &ppm) != 0) {
+                        __atomic_store_n(&s->write_failed, 1,
+                                         __ATOMIC_RELAXED);
+                }
+                Trace_span("encode frame", start, -1);
+
+                if (s->latency_count == s->latency_cap) {
+                        long    cap  = s->latency_cap ? 2 * s->latency_cap
+                                                      : 256;
+                        double *grow = realloc(s->latencies,
+                                               cap * sizeof(double));
+                        malloc_check(grow);
+                        s->latencies   = grow;
+                        s->latency_cap = cap;
+                }
+                s->latencies[s->latency_count++] = now_ns() - f->started;
+                queue_release(&s->transformed);
+        }
+        return NULL;
+}
+
+/* [Name]:       decode_frame
+ * [Purpose]:    Reads one frame into a slot, reusing its pixel array when
+ *               the size matches and growing the shared row buffer as
+ *               needed
+ * [Parameters]: 1 stream* (s), 1 frame* (f), 1 unsigned char** (row_buf),
+ *               1 long* (row_cap)
+ * [Return]:     1 if a frame was read, 0 at a clean EOF, -1 on a bad frame
+ */
+static int decode_frame(stream *s, frame *f, unsigned char **row_buf,
+                        long *row_cap)
+{
+        Ppmio_header header;
+        int          c = getc(s->in);
+
+        if (c == EOF) {
+                return 0;
+        }
+        ungetc(c, s->in);
+        if (Ppmio_read_header(s->in, &header) != 1) {
+                return -1;
+        }
+        f->started = now_ns();
+
+        long row_bytes = Ppmio_row_bytes(header.width, header.maxval);
+        if (row_bytes > *row_cap) {
+                unsigned char *grow = realloc(*row_buf, row_bytes);
+                malloc_check(grow);
+                *row_buf = grow;
+                *row_cap = row_bytes;
+        }
+        fit_pixels(s->methods, f, header.width, header.height);
+        f->maxval = header.maxval;
+
+        for (int row = 0; row < header.height; row++) {
+                if (fread(*row_buf, row_bytes, 1, s->in) != 1) {
+                        return -1;
+                }
+                Ppmio_unpack_row(*row_buf, header.maxval, s->methods,
+                                 f->pixels, row);
+        }
+        return 1;
+}
+
+/* [Name]:       fit_pixels
+ * [Purpose]:    Makes a slot's pixel array width x height, keeping the
+ *               existing one when it already has that size
+ * [Parameters]: 1 A2Methods_T (methods), 1 frame* (f), 2 ints (width,
+ *               height)
+ * [Return]:     void
+ */
+static void fit_pixels(A2Methods_T methods, frame *f, int width, int height)
+{
+        if (f->pixels != NULL && f->width == width && f->height == height) {
+                return;
+        }
+        if (f->pixels != NULL) {
+                methods->free(&f->pixels);
+        }
+        f->pixels = methods->new(width, height, sizeof(struct Pnm_rgb));
+        f->width  = width;
+        f->height = height;
+}
+
+/*---------------------------------------------------------------
+ |                        Queue Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       queue_init
+ * [Purpose]:    Initializes an empty queue whose slots hold no pixels yet
+ * [Parameters]: 1 queue* (q)
+ * [Return]:     void
+ */
+static void queue_init(queue *q)
+{
+        memset(q->slots, 0, sizeof(q->slots));
+        q->head   = 0;
+        q->tail   = 0;
+        q->closed = 0;
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_cond_init(&q->changed, NULL);
+}
+
+/* [Name]:       queue_free
+ * [Purpose]:    Frees the slots' pixel arrays and the queue's lock
+ * [Parameters]: 1 queue* (q), 1 A2Methods_T (methods)
+ * [Return]:     void
+ */
+static void queue_free(queue *q, A2Methods_T methods)
+{
+        for (int i = 0; i < QUEUE_SLOTS; i++) {
+                if (q->slots[i].pixels != NULL) {
+                        methods->free(&q->slots[i].pixels);
+                }
+        }
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->changed);
+}
+
+/* [Name]:       queue_reserve
+ * [Purpose]:    Producer: waits for a free slot
+ * [Parameters]: 1 queue* (q)
+ * [Return]:     The slot to fill
+ */
+static frame *queue_reserve(queue *q)
+{
+        pthread_mutex_lock(&q->lock);
+        while (q->head - q->tail == QUEUE_SLOTS) {
+                pthread_cond_wait(&q->changed, &q->lock);
+        }
+        frame *f = &q->slots[q->head % QUEUE_SLOTS];
+        pthread_mutex_unlock(&q->lock);
+        return f;
+}
+
+/* [Name]:       queue_publish
+ * [Purpose]:    Producer: hands the reserved slot to the consumer
+ * [Parameters]: 1 queue* (q)
+ * [Return]:     void
+ */
+static void queue_publish(queue *q)
+{
+        pthread_mutex_lock(&q->lock);
+        q->head++;
+        pthread_cond_broadcast(&q->changed);
+        pthread_mutex_unlock(&q->lock);
+}
+
+/* [Name]:       queue_peek
+ * [Purpose]:    Consumer: waits for the oldest published slot
+ * [Parameters]: 1 queue* (q)
+ * [Return]:     The slot, or NULL once the queue is closed and drained
+ */
+static frame *queue_peek(queue *q)
+{
+        frame *f = NULL;
+
+        pthread_mutex_lock(&q->lock);
+        while (q->tail == q->head && !q->closed) {
+                pthread_cond_wait(&q->changed, &q->lock);
+        }
+        if (q->tail != q->head) {
+                f = &q->slots[q->tail % QUEUE_SLOTS];
+        }
+        pthread_mutex_unlock(&q->lock);
+        return f;
+}
+
+/* [Name]:       queue_release
+ * [Purpose]:    Consumer: returns the peeked slot to the producer
+ * [Parameters]: 1 queue* (q)
+ * [Return]:     void
+ */
+static void queue_release(queue *q)
+{
+        pthread_mutex_lock(&q->lock);
+        q->tail++;
+        pthread_cond_broadcast(&q->changed);
+        pthread_mutex_unlock(&q->lock);
+}
+
+/* [Name]:       queue_close
+ * [Purpose]:    Producer: no more slots will be published
+ * [Parameters]: 1 queue* (q)
+ * [Return]:     void
+ */
+static void queue_close(queue *q)
+{
+        pthread_mutex_lock(&q->lock);
+        q->closed = 1;
+        pthread_cond_broadcast(&q->changed);
+        pthread_mutex_unlock(&q->lock);
+}
+
+/*---------------------------------------------------------------
+ |                       Timing Helpers                         |
+ *--------------------------------------------------------------*/
+/* [Name]:       percentiles
+ * [Purpose]:    Sorts the recorded latencies and picks the percentiles
+ *               (nearest rank)
+ * [Parameters]: 1 stream* (s), 1 Stream_stats* (stats, filled in)
+ * [Return]:     void
+ */
+static void percentiles(stream *s, Stream_stats *stats)
+{
+        long n = s->latency_count;
+
+        if (n == 0) {
+                return;
+        }
+        qsort(s->latencies, n, sizeof(double), compare_doubles);
+        stats->p50_ns = s->latencies[(n * 50 + 99) / 100 - 1];
+        stats->p90_ns = s->latencies[(n * 90 + 99) / 100 - 1];
+        stats->p99_ns = s->latencies[(n * 99 + 99) / 100 - 1];
+        stats->max_ns = s->latencies[n - 1];
+}
+
+/* [Name]:       compare_doubles
+ * [Purpose]:    qsort comparator for ascending doubles
+ * [Parameters]: 2 const void* (a, b)
+ * [Return]:     Negative, zero or positive
+ */
+static int compare_doubles(const void *a, const void *b)
+{
+        double x = *(const double *)a, y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+
+/* [Name]:       now_ns
+ * [Purpose]:    Reads the monotonic clock
+ * [Parameters]: none
+ * [Return]:     Nanoseconds
+ */
+static double now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
@@ -0,0 +1,32 @@
+/*
+ *      stream.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Multi-frame mode (-stream) for raw video: concatenated P6 frames
+ *        are read until EOF and each is transformed and written in turn
+ *      - Decoding, transforming and writing run as three overlapping stages,
+ *        and the pixel arrays are reused across frames of equal size
+ */
+
+#ifndef STREAM_INCLUDED
+#define STREAM_INCLUDED
+
+#include <stdio.h>
+
+#include "a2methods.h"
+
+/* What a run did; latencies run from a frame's header arriving to the
+ * frame being written, in nanoseconds */
+typedef struct Stream_stats {
+        long   frames;
+        long   pixels;          /* source pixels over all frames */
+        double elapsed_ns;
+        double p50_ns, p90_ns, p99_ns, max_ns;
+} Stream_stats;
+
+extern int  Stream_run(FILE *in, FILE *out, A2Methods_T methods,
+                       A2Methods_mapfun *map, int transform_type,
+                       int magnitude, Stream_stats *stats);
+extern void Stream_log(const Stream_stats *stats, FILE *fp);
+
+#endif
@@ -0,0 +1,530 @@
+/*
+ *      tilefile.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Native tiled image container read and written by ppmtrans
+ *      - Reading maps the whole file once; with the blocked methods the
+ *        mapping becomes the UArray2b's tile storage as-is, otherwise the
+ *        tiles are copied into the requested representation
+ *      - A region read copies out only the tiles the region intersects, so
+ *        the rest of the file is never paged in
+ *      - Writing lays the tiles out exactly as UArray2b keeps them in
+ *        memory, so a blocked destination is written tile by tile without
+ *        repacking, whatever its tile shape; a sparse one writes each
+ *        uniform tile from its fill value, without expanding it
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "a2blocked.h"
+#include "a2sparse.h"
+#include "mem.h"
+#include "tilefile.h"
+#include "uarray2b.h"
+
+typedef A2Methods_UArray2 A2;
+
+/* A live mapping of a tiled file; closure for unmap */
+typedef struct mapping {
+        void  *base;
+        size_t length;
+} mapping;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static int  header_ok   (Tilefile_header *header, const unsigned char *base,
+                         long file_size);
+static void unmap       (void *storage, void *cl);
+static void copy_cell   (int col, int row, UArray2b_T array2b, void *elem,
+                         void *cl);
+static void copy_region (UArray2b_T tiles, Pnm_ppm ppm, Ppmio_region *window);
+static void gather_tile (Pnm_ppm ppm, int col0, int row0, int cols,
+                         int rows, unsigned char *tile);
+static void fill_tile   (const void *value, long cells, int size,
+                         unsigned char *tile);
+static uint64_t tile_offset(const Tilefile_header *header, uint64_t blk_col,
+                            uint64_t blk_row);
+static long align_up    (long n, long align);
+static Pnm_ppm map_tiles(int fd, A2Methods_T methods,
+                         const Ppmio_region *region, int flags);
+
+/*---------------------------------------------------------------
+ |                        Read Functions                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       Tilefile_probe
+ * [Purpose]:    Checks whether fd is a regular file that starts with the
+ *               tiled container's magic number (fd's offset is not moved)
+ * [Parameters]: 1 int (fd)
+ * [Return]:     1 if fd holds a tiled image, 0 otherwise
+ */
+int Tilefile_probe(int fd)
+{
+        char        magic[8];
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                return 0;
+        }
+        return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+               memcmp(magic, TILEFILE_MAGIC, sizeof(magic)) == 0;
+}
+
+/* [Name]:       Tilefile_read
+ * [Purpose]:    Loads a tiled image with a single mmap of the whole file.
+ *               With the blocked methods the mapping is used directly as
+ *               the pixel storage (and unmapped when the pixels are freed);
+ *               other methods get a copy.
+ * [Parameters]: 1 int (fd, regular file), 1 A2Methods_T (methods)
+ * [Return]:     Pnm_ppm holding the image, or NULL if fd does not hold a
+ *               valid tiled image
+ */
+Pnm_ppm Tilefile_read(int fd, A2Methods_T methods)
+{
+        return Tilefile_read_region(fd, methods, NULL);
+}
+
+/* [Name]:       Tilefile_read_region
+ * [Purpose]:    Like Tilefile_read, but loads only the part of the image
+ *               inside region (clipped to the image). Only the tiles that
+ *               intersect the region are touched.
+ * [Parameters]: 1 int (fd, regular file), 1 A2Methods_T (methods),
+ *               1 const Ppmio_region* (region, NULL for the whole image)
+ * [Return]:     Pnm_ppm holding the region, or NULL if fd does not hold a
+ *               valid tiled image or the region misses it
+ */
+Pnm_ppm Tilefile_read_region(int fd, A2Methods_T methods,
+                             const Ppmio_region *region)
+{
+        /* private mapping: transforms may scribble on it, the file stays */
+        return map_tiles(fd, methods, region, MAP_PRIVATE);
+}
+
+/* [Name]:       Tilefile_map_shared
+ * [Purpose]:    Loads a tiled image as blocked pixels over a shared mapping
+ *               of the file: writes to the pixels update the file in place,
+ *               and only the pages of the tiles written are written back
+ * [Parameters]: 1 int (fd, regular file opened for reading and writing)
+ * [Return]:     Pnm_ppm holding the image (blocked methods), or NULL if fd
+ *               does not hold a valid tiled image
+ */
+Pnm_ppm Tilefile_map_shared(int fd)
+{
+        return map_tiles(fd, uarray2_methods_blocked, NULL, MAP_SHARED);
+}
+
+/* [Name]:       map_tiles
+ * [Purpose]:    Maps a tiled file with the given mmap flags and loads the
+ *               region of it (see Tilefile_read_region)
+ * [Parameters]: 1 int (fd), 1 A2Methods_T (methods), 1 const
+ *               Ppmio_region* (region, NULL for the whole image), 1 int
+ *               (flags; MAP_PRIVATE or MAP_SHARED)
+ * [Return]:     Pnm_ppm holding the region, or NULL
+ */
+static Pnm_ppm map_tiles(int fd, A2Methods_T methods,
+                         const Ppmio_region *region, int flags)
+{
+        struct stat     st;
+        Tilefile_header header;
+        Ppmio_region    window;
+        unsigned char  *base;
+        mapping        *map;
+
+        assert(methods != NULL);
+
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+            st.st_size < (long)sizeof(header)) {
+                return NULL;
+        }
+
+        base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+        if (base == MAP_FAILED) {
+                return NULL;
+        }
+        memcpy(&header, base, sizeof(header));
+        if (!header_ok(&header, base, st.st_size)) {
+                munmap(base, st.st_size);
+                return NULL;
+        }
+
+        window.x      = 0;
+        window.y      = 0;
+        window.width  = header.width;
+        window.height = header.height;
+        if (region != NULL && !Ppmio_clip_region(region, header.width,
+                                                 header.height, &window)) {
+                munmap(base, st.st_size);
+                return NULL;
+        }
+        int whole = window.width  == (int)header.width &&
+                    window.height == (int)header.height;
+
+        NEW(map);
+        map->base   = base;
+        map->length = st.st_size;
+
+        UArray2b_T tiles = UArray2b_wrap(header.width, header.height,
+                                         header.elem_size, header.tile_width,
+                                         header.tile_height,
+                                         base + header.data_offset, unmap,
+                                         map);
+
+        Pnm_ppm ppm;
+        NEW(ppm);
+        ppm->width       = window.width;
+        ppm->height      = window.height;
+        ppm->denominator = header.maxval;
+        ppm->methods     = methods;
+
+        if (!whole || methods == uarray2_methods_sparse) {
+                ppm->pixels = methods->new(window.width, window.height,
+                                           header.elem_size);
+                copy_region(tiles, ppm, &window);
+                UArray2b_free(&tiles);
+        } else if (methods == uarray2_methods_blocked) {
+                ppm->pixels = tiles;
+        } else {
+                ppm->pixels = methods->new(header.width, header.height,
+                                           header.elem_size);
+                UArray2b_map(tiles, copy_cell, ppm);
+                UArray2b_free(&tiles);
+        }
+
+        return ppm;
+}
+
+/* [Name]:       header_ok
+ * [Purpose]:    Validates a tiled header against the file it came from;
+ *               the tiles must be contiguous so they can back a UArray2b
+ * [Parameters]: 1 Tilefile_header* (header), 1 const unsigned char* (base
+ *               of the mapped file), 1 long (file_size)
+ * [Return]:     1 if the header describes a usable image, 0 otherwise
+ */
+static int header_ok(Tilefile_header *header, const unsigned char *base,
+                     long file_size)
+{
+        if (memcmp(header->magic, TILEFILE_MAGIC, sizeof(header->magic)) != 0
+            || header->version    != TILEFILE_VERSION
+            || header->byte_order != TILEFILE_BYTE_ORDER
+            || header->elem_size  != sizeof(struct Pnm_rgb)) {
+                return 0;
+        }
+
+        /* every dimension becomes an int in Pnm_ppm and UArray2b */
+        uint64_t tw = header->tile_width;
+        uint64_t th = header->tile_height;
+        if (header->width == 0 || header->height == 0 || tw == 0 ||
+            th == 0 || tw > header->width || th > header->height ||
+            header->width > INT_MAX || header->height > INT_MAX ||
+            header->maxval == 0 || header->maxval > 65535) {
+                return 0;
+        }
+
+        /* a size that overflows 64 bits can never match the file */
+        uint64_t blocks_w = (header->width  + tw - 1) / tw;
+        uint64_t blocks_h = (header->height + th - 1) / th;
+        uint64_t pixels, data_bytes, tile_count, data_end;
+        if (__builtin_mul_overflow(header->width, (uint64_t)header->height,
+                                   &pixels) ||
+            __builtin_mul_overflow(pixels, header->elem_size, &data_bytes) ||
+            __builtin_mul_overflow(blocks_w, blocks_h, &tile_count) ||
+            __builtin_add_overflow(header->data_offset, data_bytes,
+                                   &data_end) ||
+            header->data_bytes != data_bytes ||
+            header->tile_count != tile_count ||
+            header->data_offset % TILEFILE_ALIGN != 0 ||
+            data_end > (uint64_t)file_size) {
+                return 0;
+        }
+
+        if (header->flags & TILEFILE_INDEXED) {
+                const uint64_t *index;
+                uint64_t        index_bytes, index_end;
+                if (__builtin_mul_overflow(tile_count, sizeof(uint64_t),
+                                           &index_bytes) ||
+                    __builtin_add_overflow(header->index_offset, index_bytes,
+                                           &index_end) ||
+                    header->index_offset % sizeof(uint64_t) != 0 ||
+                    index_end > header->data_offset) {
+                        return 0;
+                }
+                index = (const uint64_t *)(base + header->index_offset);
+                for (uint64_t i = 0; i < header->tile_count; i++) {
+                        if (index[i] != tile_offset(header, i % blocks_w,
+                                                    i / blocks_w)) {
+                                return 0;
+                        }
+                }
+        }
+
+        return 1;
+}
+
+/* [Name]:       unmap
+ * [Purpose]:    Release function for mapped tile storage
+ * [Parameters]: 2 void* (storage, unused; closure, the mapping)
+ * [Return]:     void
+ */
+static void unmap(void *storage, void *cl)
+{
+        mapping *map = cl;
+        (void) storage;
+
+        munmap(map->base, map->length);
+        FREE(map);
+}
+
+/* [Name]:       copy_cell
+ * [Purpose]:    Copies one mapped cell into the ppm's own pixels
+ *               -- (CALLED BY MAP)
+ * [Parameters]: 2 ints (col, row), 1 UArray2b_T (array2b), 2 void* (elem,
+ *               closure; the Pnm_ppm being filled)
+ * [Return]:     void
+ */
+static void copy_cell(int col, int row, UArray2b_T array2b, void *elem,
+                      void *cl)
+{
+        Pnm_ppm ppm = cl;
+        (void) array2b;
+
+        *(Pnm_rgb)ppm->methods->at(ppm->pixels, col, row) = *(Pnm_rgb)elem;
+}
+
+/* [Name]:       copy_region
+ * [Purpose]:    Copies the cells of window out of the mapped tiles into the
+ *               ppm's own pixels, one intersecting tile at a time. A sparse
+ *               destination compresses each of its block rows as soon as
+ *               the copy has filled it.
+ * [Parameters]: 1 UArray2b_T (tiles), 1 Pnm_ppm (ppm, window-sized),
+ *               1 Ppmio_region* (window, within the image)
+ * [Return]:     void
+ */
+static void copy_region(UArray2b_T tiles, Pnm_ppm ppm, Ppmio_region *window)
+{
+        A2Methods_T methods = ppm->methods;
+        int tw    = UArray2b_tile_width(tiles);
+        int th    = UArray2b_tile_height(tiles);
+        int x     = window->x;
+        int y     = window->y;
+        int x_end = x + window->width;
+        int y_end = y + window->height;
+        int sparse = methods == uarray2_methods_sparse;
+        int dest_h = sparse ? UArray2b_tile_height(ppm->pixels) : 0;
+        int folded = 0;                 /* sparse block rows compressed */
+
+        for (int blk_row = y / th; blk_row * th < y_end; blk_row++) {
+                int row0 = blk_row * th > y ? blk_row * th : y;
+                int row1 = (blk_row + 1) * th < y_end ? (blk_row + 1) * th
+                                                      : y_end;
+                for (int blk_col = x / tw; blk_col * tw < x_end; blk_col++) {
+                        int col0 = blk_col * tw > x ? blk_col * tw : x;
+                        int col1 = (blk_col + 1) * tw < x_end
+                                   ? (blk_col + 1) * tw : x_end;
+                        for (int row = row0; row < row1; row++) {
+                                for (int col = col0; col < col1; col++) {
+                                        Pnm_rgb cell = methods->at(
+                                                ppm->pixels, col - x,
+                                                row - y);
+                                        *cell = *(Pnm_rgb)UArray2b_at(
+                                                tiles, col, row);
+                                }
+                        }
+                }
+                /* rows above row1 are done; so is the last block row */
+                while (sparse && ((folded + 1) * dest_h <= row1 - y ||
+                                  row1 == y_end) &&
+                       folded * dest_h < window->height) {
+                        UArray2b_compress_row(ppm->pixels, folded++);
+                }
+        }
+}
+
+/*---------------------------------------------------------------
+ |                        Write Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Tilefile_write
+ * [Purpose]:    Writes ppm as a tiled image: header, optional tile index,
+ *               padding to a page boundary, then every tile in block
+ *               row-major order. Blocked and sparse pixels keep their
+ *               tile shape and are written straight from their tiles; a
+ *               uniform sparse tile is written from its value.
+ * [Parameters]: 1 FILE* (fp), 1 Pnm_ppm (ppm), 1 int (indexed; write the
+ *               tile index if nonzero)
+ * [Return]:     0 on success, -1 on a write error
+ */
+int Tilefile_write(FILE *fp, Pnm_ppm ppm, int indexed)
+{
+        Tilefile_header header;
+        A2Methods_T     methods = ppm->methods;
+        int             blocked = methods == uarray2_methods_blocked;
+        int             sparse  = methods == uarray2_methods_sparse;
+        int             size    = sizeof(struct Pnm_rgb);
+        int             tw, th;
+
+        assert(fp != NULL && ppm != NULL);
+
+        if (blocked || sparse) {
+                tw = UArray2b_tile_width(ppm->pixels);
+                th = UArray2b_tile_height(ppm->pixels);
+        } else {
+                UArray2b_tile_64K(ppm->width, ppm->height, size, &tw, &th);
+        }
+
+        int blocks_w = (ppm->width  + tw - 1) / tw;
+        int blocks_h = (ppm->height + th - 1) / th;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TILEFILE_MAGIC, sizeof(header.magic));
+        header.version      = TILEFILE_VERSION;
+        header.byte_order   = TILEFILE_BYTE_ORDER;
+        header.width        = ppm->width;
+        header.height       = ppm->height;
+        header.maxval       = ppm->denominator;
+        header.elem_size    = size;
+        header.tile_width   = tw;
+        header.tile_height  = th;
+        header.flags        = indexed ? TILEFILE_INDEXED : 0;
+        header.data_bytes   = (uint64_t)ppm->width * ppm->height * size;
+        header.tile_count   = (uint64_t)blocks_w * blocks_h;
+        header.index_offset = indexed ? sizeof(header) : 0;
+        header.data_offset  = align_up(sizeof(header) + (indexed ?
+                                       header.tile_count * sizeof(uint64_t)
+                                       : 0), TILEFILE_ALIGN);
+
+        if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+                return -1;
+        }
+        long written = sizeof(header);
+
+        for (uint64_t i = 0; indexed && i < header.tile_count; i++) {
+                uint64_t offset = tile_offset(&header, i % blocks_w,
+                                              i / blocks_w);
+                if (fwrite(&offset, sizeof(offset), 1, fp) != 1) {
+                        return -1;
+                }
+                written += sizeof(offset);
+        }
+        for (; written < (long)header.data_offset; written++) {
+                if (putc(0, fp) == EOF) {
+                        return -1;
+                }
+        }
+
+        unsigned char *tile = blocked ? NULL : malloc((long)tw * th * size);
+        if (!blocked && tile == NULL) {
+                return -1;
+        }
+        const void *filled = NULL;      /* sparse: value tile now holds */
+        for (int blk_row = 0; blk_row < blocks_h; blk_row++) {
+                int rows = (int)ppm->height - blk_row * th < th
+                           ? (int)ppm->height - blk_row * th : th;
+                for (int blk_col = 0; blk_col < blocks_w; blk_col++) {
+                        int cols = (int)ppm->width - blk_col * tw < tw
+                                   ? (int)ppm->width - blk_col * tw : tw;
+                        const void *data, *value = NULL;
+                        if (sparse) {
+                                value = UArray2b_uniform(ppm->pixels,
+                                                         blk_col, blk_row);
+                        }
+                        if (value != NULL) {
+                                /* edge tiles have fewer cells; refill only
+                                   when the value changes */
+                                if (filled == NULL ||
+                                    memcmp(filled, value, size) != 0) {
+                                        fill_tile(value, (long)tw * th,
+                                                  size, tile);
+                                        filled = value;
+                                }
+                                data = tile;
+                        } else if (blocked || sparse) {
+                                data = UArray2b_block(ppm->pixels, blk_col,
+                                                      blk_row);
+                        } else {
+                                gather_tile(ppm, blk_col * tw, blk_row * th,
+                                            cols, rows, tile);
+                                data = tile;
+                        }
+                        if (fwrite(data, (long)cols * rows * size, 1, fp)
+                            != 1) {
+                                free(tile);
+                                return -1;
+                        }
+                }
+        }
+        free(tile);
+
+        return fflush(fp) == 0 ? 0 : -1;
+}
+
+/* [Name]:       gather_tile
+ * [Purpose]:    Copies the cells of one block of a non-blocked image into a
+ *               tile buffer, row by row
+ * [Parameters]: 1 Pnm_ppm (ppm), 4 ints (first column and row of the block,
+ *               its columns and rows), 1 unsigned char* (tile, cols * rows
+ *               cells)
+ * [Return]:     void
+ */
+static void gather_tile(Pnm_ppm ppm, int col0, int row0, int cols, int rows,
+                        unsigned char *tile)
+{
+        Pnm_rgb cells = (Pnm_rgb)tile;
+
+        for (int y = 0; y < rows; y++) {
+                for (int x = 0; x < cols; x++) {
+                        cells[(long)y * cols + x] =
+                                *(Pnm_rgb)ppm->methods->at(ppm->pixels,
+                                                           col0 + x,
+                                                           row0 + y);
+                }
+        }
+}
+
+/* [Name]:       fill_tile
+ * [Purpose]:    Fills a tile buffer with copies of one cell value
+ * [Parameters]: 1 const void* (value, size bytes), 1 long (cells),
+ *               1 int (size), 1 unsigned char* (tile, cells * size bytes)
+ * [Return]:     void
+ */
+static void fill_tile(const void *value, long cells, int size,
+                      unsigned char *tile)
+{
+        for (long i = 0; i < cells; i++) {
+                memcpy(tile + i * size, value, size);
+        }
+}
+
+/* [Name]:       tile_offset
+ * [Purpose]:    Computes where a tile starts in the file, following the
+ *               UArray2b layout: every full row of blocks above it, then
+ *               the tiles to its left, all as tall as its own row of blocks
+ * [Parameters]: 1 const Tilefile_header* (header), 2 uint64_ts (block
+ *               column and row)
+ * [Return]:     File offset of the tile's first cell
+ */
+static uint64_t tile_offset(const Tilefile_header *header, uint64_t blk_col,
+                            uint64_t blk_row)
+{
+        uint64_t th   = header->tile_height;
+        uint64_t rows = header->height - blk_row * th < th
+                        ? header->height - blk_row * th : th;
+
+        return header->data_offset + header->elem_size *
+               (blk_row * th * header->width +
+                blk_col * header->tile_width * rows);
+}
+
+/* [Name]:       align_up
+ * [Purpose]:    Rounds n up to a multiple of align
+ * [Parameters]: 2 longs (n, align)
+ * [Return]:     Rounded value
+ */
+static long align_up(long n, long align)
+{
+        return (n + align - 1) / align * align;
+}
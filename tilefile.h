@@ -0,0 +1,57 @@
+/*
+ *      tilefile.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Native tiled image container read and written by ppmtrans
+ *      - Fixed binary header, then (optionally) a tile index, then every
+ *        tile of the image in UArray2b layout, starting on a page boundary
+ *      - Tiles may be rectangular, and edge tiles hold only the cells
+ *        inside the image, so the tiles fill exactly width * height cells
+ *      - Loading is a single mmap: the blocked array uses the mapping
+ *        directly as its tile storage, with no parsing or repacking
+ *      - A shared mapping lets a caller update tiles of the file in place
+ */
+
+#ifndef TILEFILE_INCLUDED
+#define TILEFILE_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "a2methods.h"
+#include "pnm.h"
+#include "ppmio.h"
+
+#define TILEFILE_MAGIC      "PPMTILE1"
+#define TILEFILE_VERSION    2
+#define TILEFILE_BYTE_ORDER 0x01020304u    /* as written by this host */
+#define TILEFILE_ALIGN      4096           /* tiles start page aligned */
+
+/* Header flags */
+#define TILEFILE_INDEXED 0x1               /* tile index follows header */
+
+/* On-disk header; all fields in host byte order */
+typedef struct Tilefile_header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t width, height;
+        uint32_t maxval;
+        uint32_t elem_size;                /* bytes per pixel cell */
+        uint32_t tile_width, tile_height;  /* full tiles */
+        uint32_t flags;
+        uint32_t reserved;                 /* 0 */
+        uint64_t data_bytes;               /* width * height * elem_size */
+        uint64_t tile_count;
+        uint64_t index_offset;             /* 0 unless TILEFILE_INDEXED */
+        uint64_t data_offset;              /* multiple of TILEFILE_ALIGN */
+} Tilefile_header;
+
+extern int     Tilefile_probe(int fd);
+extern Pnm_ppm Tilefile_read (int fd, A2Methods_T methods);
+extern Pnm_ppm Tilefile_read_region(int fd, A2Methods_T methods,
+                                    const Ppmio_region *region);
+extern Pnm_ppm Tilefile_map_shared(int fd);
+extern int     Tilefile_write(FILE *fp, Pnm_ppm ppm, int indexed);
+
+#endif
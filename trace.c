@@ -0,0 +1,212 @@
+/*
+ *      trace.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Each thread appends its spans to its own chunks of events, so
+ *        recording takes no lock; the lock is only taken to link in a new
+ *        chunk (once every CHUNK_EVENTS spans of a thread)
+ *      - Thread ids are handed out on a thread's first span, the thread
+ *        that opened the trace being 0
+ *      - The file is written when the trace is closed, which Trace_open
+ *        arranges to happen at exit as well, so runs ending in an error
+ *        still leave their timeline behind
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "mem.h"
+#include "trace.h"
+
+/* Spans per chunk */
+#define CHUNK_EVENTS 1024
+
+/* One recorded span; times are monotonic nanoseconds */
+typedef struct event {
+        const char *name;
+        long        start, end;
+        long        arg;
+} event;
+
+/* A run of one thread's events */
+typedef struct chunk {
+        struct chunk *next;             /* in the list of all chunks */
+        int           tid;
+        int           count;
+        event         events[CHUNK_EVENTS];
+} chunk;
+
+/* Trace state; chunks and next_tid are guarded by lock */
+static int             tracing  = 0;
+static FILE           *out      = NULL;
+static long            epoch    = 0;
+static chunk          *chunks   = NULL;
+static int             next_tid = 0;
+static pthread_mutex_t lock     = PTHREAD_MUTEX_INITIALIZER;
+
+/* The calling thread's chunk being filled, and its id (-1: none yet) */
+static __thread chunk *current   = NULL;
+static __thread int    thread_id = -1;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static long   monotonic_ns(void);
+static chunk *new_chunk   (void);
+static void   close_at_exit(void);
+
+/*---------------------------------------------------------------
+ |                        Trace Functions                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Trace_open
+ * [Purpose]:    Starts tracing into the given file, which is created now
+ *               and written when the trace is closed (or at exit)
+ * [Parameters]: 1 c-string (path)
+ * [Return]:     0 on success, -1 if the file cannot be created
+ */
+int Trace_open(const char *path)
+{
+        assert(path != NULL && !tracing);
+
+        out = fopen(path, "w");
+        if (out == NULL) {
+                return -1;
+        }
+        epoch     = monotonic_ns();
+        thread_id = next_tid++;
+        tracing   = 1;
+        atexit(close_at_exit);
+        return 0;
+}
+
+/* [Name]:       Trace_now
+ * [Purpose]:    Timestamp for the start of a span
+ * [Parameters]: none
+ * [Return]:     Monotonic nanoseconds, or 0 while tracing is off
+ */
+long Trace_now(void)
+{
+        return tracing ? monotonic_ns() : 0;
+}
+
+/* [Name]:       Trace_span
+ * [Purpose]:    Records a span from start until now on the calling thread
+ * [Parameters]: 1 c-string (name, a literal), 1 long (start, from
+ *               Trace_now), 1 long (arg, -1 for none)
+ * [Return]:     void
+ */
+void Trace_span(const char *name, long start, long arg)
+{
+        if (!tracing) {
+                return;
+        }
+        if (current == NULL || current->count == CHUNK_EVENTS) {
+                current = new_chunk();
+        }
+
+        event *e = &current->events[current->count++];
+        e->name  = name;
+        e->start = start;
+        e->end   = monotonic_ns();
+        e->arg   = arg;
+}
+
+/* [Name]:       Trace_close
+ * [Purpose]:    Stops tracing and writes every thread's spans out as a
+ *               Chrome trace (times in microseconds since Trace_open).
+ *               The other threads must be done recording.
+ * [Parameters]: none
+ * [Return]:     void
+ */
+void Trace_close(void)
+{
+        if (!tracing) {
+                return;
+        }
+        tracing = 0;
+
+        int pid   = getpid();
+        int first = 1;
+        fprintf(out, "{\"traceEvents\":[\n");
+        for (int tid = 0; tid < next_tid; tid++) {
+                fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+                             "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":"
+                             "\"%s %d\"}}", first ? "" : ",\n", pid, tid,
+                        tid == 0 ? "main" : "worker", tid);
+                first = 0;
+        }
+        while (chunks != NULL) {
+                chunk *c = chunks;
+                for (int i = 0; i < c->count; i++) {
+                        event *e = &c->events[i];
+                        fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\","
+                                     "\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+                                     "\"dur\":%.3f", e->name, pid, c->tid,
+                                (e->start - epoch) / 1000.0,
+                                (e->end - e->start) / 1000.0);
+                        if (e->arg >= 0) {
+                                fprintf(out, ",\"args\":{\"n\":%ld}",
+                                        e->arg);
+                        }
+                        fprintf(out, "}");
+                }
+                chunks = c->next;
+                FREE(c);
+        }
+        fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+        fclose(out);
+        out     = NULL;
+        current = NULL;
+}
+
+/*---------------------------------------------------------------
+ |                     Clock & Chunk Helpers                    |
+ *--------------------------------------------------------------*/
+/* [Name]:       monotonic_ns
+ * [Purpose]:    Reads the monotonic clock
+ * [Parameters]: none
+ * [Return]:     Nanoseconds
+ */
+static long monotonic_ns(void)
+{
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/* [Name]:       new_chunk
+ * [Purpose]:    Gives the calling thread a fresh chunk (and an id, on its
+ *               first span), linking it into the list of all chunks
+ * [Parameters]: none
+ * [Return]:     The new chunk
+ */
+static chunk *new_chunk(void)
+{
+        chunk *c;
+
+        NEW(c);
+        c->count = 0;
+        pthread_mutex_lock(&lock);
+        if (thread_id < 0) {
+                thread_id = next_tid++;
+        }
+        c->tid  = thread_id;
+        c->next = chunks;
+        chunks  = c;
+        pthread_mutex_unlock(&lock);
+        return c;
+}
+
+/* [Name]:       close_at_exit
+ * [Purpose]:    atexit hook: flushes the trace if it is still open
+ * [Parameters]: none
+ * [Return]:     void
+ */
+static void close_at_exit(void)
+{
+        Trace_close();
+}
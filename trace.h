@@ -0,0 +1,22 @@
+/*
+ *      trace.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Timeline of a run (-trace) in Chrome trace event format, for
+ *        chrome://tracing or Perfetto: one complete ("X") event per span,
+ *        on the thread that ran it
+ *      - A span is taken with start = Trace_now() ... Trace_span(name,
+ *        start, arg); names must be string literals (they are kept, not
+ *        copied) and arg is shown as the span's "n" (-1 for none)
+ *      - Both calls cost one flag test while tracing is off
+ */
+
+#ifndef TRACE_INCLUDED
+#define TRACE_INCLUDED
+
+extern int  Trace_open (const char *path);
+extern long Trace_now  (void);
+extern void Trace_span (const char *name, long start, long arg);
+extern void Trace_close(void);
+
+#endif
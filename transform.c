@@ -0,0 +1,1177 @@
+/*
+ *      transform.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Transforms a ppm image based on transformation type and magnitude
+ *      - Optionally records the time taken for the transformation
+ *      - Optional tuning of the copy (transform_tuning): non-temporal
+ *        stores write destination pixels around the caches, since the
+ *        destination is not read again before output; on plain images,
+ *        software prefetch fetches the cells of the side that strides
+ *        across rows a fixed distance ahead, the distance chosen from the
+ *        image's size (see transform_tuning_used for what it did)
+ *      - Per-pixel operations (transform_pixel_ops) run on each pixel as
+ *        it is copied (or swapped, in place), so they cost no pass of
+ *        their own; on a sparse image a uniform tile's value is operated
+ *        on once
+ *      - Sparse images are transformed tile by tile instead: a destination
+ *        tile whose source cells all lie in uniform tiles of one value is
+ *        set uniform without touching any cell; bands of destination tile
+ *        rows go to 'threads' threads
+ *      - Plain images are handed to the library (Ppmtrans_transform),
+ *        which moves them on 'threads' threads by stride arithmetic on the
+ *        raw rows, tuned or not; the map is only walked when per-pixel
+ *        operations need it
+ *      - Blocked images are transformed a tile at a time by the blocked
+ *        array itself (UArray2b_transform) instead of a pixel at a time
+ *        through the map, unless per-pixel operations or copy tuning
+ *        need the map
+ *      - Images of 4-byte pixels (PAM) are moved 4x4 pixels at a time:
+ *        four source row runs are loaded as vectors, transposed and/or
+ *        mirrored in registers and stored as four destination row runs
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "assert.h"
+#include "a2blocked.h"
+#include "a2plain.h"
+#include "a2sparse.h"
+#include "bands.h"
+#include "cputiming.h"
+#include "libppmtrans.h"
+#include "trace.h"
+#include "transform.h"
+#include "uarray2b.h"
+
+/* Prefetching only pays once the strided side's lines (one per row or
+ * column crossed) no longer fit in L2 */
+#define PREFETCH_MIN_FOOTPRINT (256 * 1024)
+#define CACHE_LINE             64
+#define PAGE_BYTES             4096
+
+/* Prefetch distances in pixels: nearby for strides within a page, further
+ * ahead when every step also misses the TLB */
+#define PREFETCH_NEAR 8
+#define PREFETCH_FAR  16
+
+/* Where a source cell lands: (col, row) -> (dest_col, dest_row) */
+typedef void targetfun(int magnitude, int width, int height, int col,
+                       int row, int *dest_col, int *dest_row);
+
+/* Destination tile rows [first, end) of a sparse transformation, for one
+ * thread */
+typedef struct sparse_band {
+        UArray2b_T source, destination;
+        targetfun *inverse;
+        int        magnitude;
+        int        first, end;
+} sparse_band;
+
+/* Copy tuning selected by transform_tuning */
+static int stream_stores = 0;
+static int prefetching   = 0;
+
+/* What the tuning did on the last transform */
+static tuning_used last_tuning;
+
+/* Per-pixel operations selected by transform_pixel_ops, or NULL */
+static Pixelop_T pixel_ops = NULL;
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static void copy_pixel     (result *info, A2 source, int col, int row,
+                            Pnm_rgb source_pixel, targetfun *target);
+static void store_pixel    (Pnm_rgb dest, Pnm_rgb source, int streaming);
+static void rotate_target  (int magnitude, int width, int height, int col,
+                            int row, int *dest_col, int *dest_row);
+static void flip_target    (int magnitude, int width, int height, int col,
+                            int row, int *dest_col, int *dest_row);
+static void transpose_target(int magnitude, int width, int height, int col,
+                             int row, int *dest_col, int *dest_row);
+static void transform_sparse(UArray2b_T source, UArray2b_T destination,
+                             int transform_type, int magnitude, int threads,
+                             float *time);
+static void *sparse_rows    (void *cl);
+static void sparse_tile     (UArray2b_T source, UArray2b_T destination,
+                             targetfun *inverse, int magnitude,
+                             int blk_col, int blk_row);
+static const void *uniform_value(UArray2b_T array2b, int c0, int r0,
+                                 int c1, int r1);
+static Pnm_ppm transform_tiles(Pnm_ppm ppm, int transform_type,
+                               int magnitude, float *time);
+static Pnm_ppm transform_plain(Pnm_ppm ppm, mapfun *map, int transform_type,
+                               int magnitude, int threads, float *time);
+static void note_prefetch  (int distance, int col_major, int swap, int width,
+                            int height, int size);
+static int  word_quad  (A2Methods_T methods, A2 source, A2 destination,
+                        targetfun *target, int magnitude, int col, int row);
+static void word_cells (A2Methods_T methods, A2 source, A2 destination,
+                        targetfun *target, int magnitude, int col, int row);
+
+/*---------------------------------------------------------------
+ |                    Error Handling Function                   |
+ *--------------------------------------------------------------*/
+/* [Name]:       malloc_check
+ * [Purpose]:    Exits the program and prints to stderr if malloc'd ptr == NULL
+ * [Parameters]: 1 void* (ptr)
+ * [Return]:     void
+ */
+void malloc_check(void *ptr)
+{
+        if (ptr == NULL) {
+                fprintf(stderr, "Malloc error\n");
+                exit(EXIT_FAILURE);
+        }
+}
+
+/*---------------------------------------------------------------
+ |                    Transformation Functions                  |
+ *--------------------------------------------------------------*/
+/* [Name]:       transform
+ * [Purpose]:    Transforms the given ppm file (rotate/flip/transpose).
+ *               Records time taken for transformation, if needed.
+ * [Parameters]: 1 Pnm_ppm (source ppm image), 1 A2Methods_T (methods),
+ *               1 mapfun* (map), 3 ints (transform_type [see constants],
+ *               transform magnitude, threads), 1 float* (time)
+ * [Return]:     Transformed image in a Pnm_ppm
+ */
+Pnm_ppm transform(Pnm_ppm ppm, A2Methods_T methods, mapfun *map,
+                  int transform_type, int magnitude, int threads,
+                  float *time)
+{
+        memset(&last_tuning, 0, sizeof(last_tuning));
+        last_tuning.nt_stores = stream_stores;
+
+        if (methods == uarray2_methods_blocked && pixel_ops == NULL &&
+            !stream_stores && !prefetching) {
+                return transform_tiles(ppm, transform_type, magnitude, time);
+        }
+        if (methods == uarray2_methods_plain && pixel_ops == NULL &&
+            (long)ppm->width * ppm->height > 0) {
+                return transform_plain(ppm, map, transform_type, magnitude,
+                                       threads, time);
+        }
+
+        long start = Trace_now();
+        A2 image = create_image(ppm, methods, transform_type, magnitude);
+        applyfun *apply = NULL;
+        result *dest_info;
+
+        Trace_span("alloc", start, -1);
+
+        if (pixel_ops != NULL) {
+                ppm->denominator = Pixelop_prepare(pixel_ops,
+                                                   ppm->denominator);
+        }
+        if (methods == uarray2_methods_sparse) {
+                transform_sparse(ppm->pixels, image, transform_type,
+                                 magnitude, threads, time);
+                reassign(ppm, image, methods);
+                return ppm;
+        }
+
+        dest_info = malloc(sizeof(struct result));
+        malloc_check(dest_info);
+
+        *dest_info = result_init(methods, magnitude, image);
+        dest_info->streaming = stream_stores;
+        apply = transform_init(apply, transform_type);
+        transform_image(ppm, apply, map, dest_info, time);
+        reassign(ppm, dest_info->destination_map, methods);
+
+        free(dest_info);
+        return ppm;
+}
+
+/* [Name]:       rotate_map
+ * [Purpose]:    Copies source pixel content into a pixel in the destination
+ *               image, based on rotation algorithms -- (CALLED BY MAP)
+ * [Parameters]: 2 ints (col/row index), 1 A2 (source), 1 object* (content at
+ *               the col/row index), 1 void* (closure; will be information
+ *               about the destination image)
+ * [Return]:     void
+ */
+void rotate_map(int col, int row, A2 source, object *ptr, void *cl)
+{
+        copy_pixel((result *) cl, source, col, row, (Pnm_rgb) ptr,
+                   rotate_target);
+}
+
+/* [Name]:       flip_map
+ * [Purpose]:    Copies source pixel content into a pixel in the destination
+ *               image, based on flip algorithms -- (CALLED BY MAP)
+ * [Parameters]: 2 ints (col/row index), 1 A2 (source), 1 object* (content at
+ *               the col/row index), 1 void* (closure; will be information
+ *               about the destination image)
+ * [Return]:     void
+ */
+void flip_map(int col, int row, A2 source, object *ptr, void *cl)
+{
+        copy_pixel((result *) cl, source, col, row, (Pnm_rgb) ptr,
+                   flip_target);
+}
+
+/* [Name]:       transpose_map
+ * [Purpose]:    Copies source pixel content into a pixel in the destination
+ *               image, based on transpose algorithms -- (CALLED BY MAP)
+ * [Parameters]: 2 ints (col/row index), 1 A2 (source), 1 object* (content at
+ *               the col/row index), 1 void* (closure; will be information
+ *               about the destination image)
+ * [Return]:     void
+ */
+void transpose_map(int col, int row, A2 source, object *ptr, void *cl)
+{
+        copy_pixel((result *) cl, source, col, row, (Pnm_rgb) ptr,
+                   transpose_target);
+}
+
+/* [Name]:       copy_pixel
+ * [Purpose]:    Copies one source pixel to where the transformation puts
+ *               it
+ * [Parameters]: 1 result* (info), 1 A2 (source), 2 ints (col, row),
+ *               1 Pnm_rgb (source_pixel), 1 targetfun* (target)
+ * [Return]:     void
+ */
+static void copy_pixel(result *info, A2 source, int col, int row,
+                       Pnm_rgb source_pixel, targetfun *target)
+{
+        A2Methods_T methods = info->methods;
+        int dest_col, dest_row;
+
+        target(info->magnitude, methods->width(source),
+               methods->height(source), col, row, &dest_col, &dest_row);
+        if (pixel_ops != NULL) {
+                struct Pnm_rgb moved = *source_pixel;
+                Pixelop_apply(pixel_ops, &moved);
+                store_pixel(methods->at(info->destination_map, dest_col,
+                                        dest_row), &moved, info->streaming);
+                return;
+        }
+        store_pixel(methods->at(info->destination_map, dest_col, dest_row),
+                    source_pixel, info->streaming);
+}
+
+/* [Name]:       store_pixel
+ * [Purpose]:    Writes one destination pixel, with non-temporal stores
+ *               (which bypass the caches and skip the read-for-ownership)
+ *               when streaming and the target supports them
+ * [Parameters]: 2 Pnm_rgb (dest, source), 1 int (streaming)
+ * [Return]:     void
+ */
+static void store_pixel(Pnm_rgb dest, Pnm_rgb source, int streaming)
+{
+#if defined(__SSE2__)
+        if (streaming) {
+                _mm_stream_si32((int *)&dest->red,   source->red);
+                _mm_stream_si32((int *)&dest->green, source->green);
+                _mm_stream_si32((int *)&dest->blue,  source->blue);
+                return;
+        }
+#else
+        (void) streaming;
+#endif
+        *dest = *source;
+}
+
+/* [Name]:       rotate_target
+ * [Purpose]:    Destination of a source cell under a rotation
+ * [Parameters]: 5 ints (magnitude, source width and height, col, row),
+ *               2 int* (dest_col, dest_row)
+ * [Return]:     void
+ */
+static void rotate_target(int magnitude, int width, int height, int col,
+                          int row, int *dest_col, int *dest_row)
+{
+        if (magnitude == 90) {
+                *dest_col = height - row - 1;
+                *dest_row = col;
+        } else if (magnitude == 180) {
+                *dest_col = width - col - 1;
+                *dest_row = height - row - 1;
+        } else if (magnitude == 270) {
+                *dest_col = row;
+                *dest_row = width - col - 1;
+        } else {
+                *dest_col = col;
+                *dest_row = row;
+        }
+}
+
+/* [Name]:       flip_target
+ * [Purpose]:    Destination of a source cell under a flip
+ * [Parameters]: 5 ints (flip type, source width and height, col, row),
+ *               2 int* (dest_col, dest_row)
+ * [Return]:     void
+ */
+static void flip_target(int magnitude, int width, int height, int col,
+                        int row, int *dest_col, int *dest_row)
+{
+        *dest_col = magnitude == HORIZ ? width - col - 1 : col;
+        *dest_row = magnitude == VERT ? height - row - 1 : row;
+}
+
+/* [Name]:       transpose_target
+ * [Purpose]:    Destination of a source cell under a transpose
+ * [Parameters]: 5 ints (unused magnitude, width and height; col, row),
+ *               2 int* (dest_col, dest_row)
+ * [Return]:     void
+ */
+static void transpose_target(int magnitude, int width, int height, int col,
+                             int row, int *dest_col, int *dest_row)
+{
+        (void) magnitude;
+        (void) width;
+        (void) height;
+        *dest_col = row;
+        *dest_row = col;
+}
+
+/* [Name]:       transform_sparse
+ * [Purpose]:    Transforms a sparse image one destination tile at a time,
+ *               finding each tile's source cells through the inverse
+ *               transformation, so uniform regions stay uniform. Bands of
+ *               tile rows run on up to threads threads; no two bands
+ *               share a destination tile. Records time taken for
+ *               transformation, if needed.
+ * [Parameters]: 2 UArray2b_T (source, destination), 3 ints
+ *               (transform_type [see constants], magnitude, threads),
+ *               1 float* (time)
+ * [Return]:     void
+ */
+static void transform_sparse(UArray2b_T source, UArray2b_T destination,
+                             int transform_type, int magnitude, int threads,
+                             float *time)
+{
+        targetfun *inverse = transpose_target;  /* its own inverse */
+        CPUTime_T timer;
+
+        if (transform_type == ROTATE) {
+                inverse   = rotate_target;
+                magnitude = (360 - magnitude) % 360;
+        } else if (transform_type == FLIP) {
+                inverse   = flip_target;        /* also its own inverse */
+        }
+
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+
+        int height = UArray2b_height(destination);
+        int th     = UArray2b_tile_height(destination);
+        int count  = Bands_count(threads, height, th);
+
+        sparse_band bands[count];
+        for (int i = 0; i < count; i++) {
+                int first, end;
+                Bands_split(height, th, count, i, &first, &end);
+                bands[i].source      = source;
+                bands[i].destination = destination;
+                bands[i].inverse     = inverse;
+                bands[i].magnitude   = magnitude;
+                bands[i].first       = first / th;
+                bands[i].end         = (end + th - 1) / th;
+        }
+        Bands_run(bands, count, sizeof(sparse_band), sparse_rows);
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+}
+
+/* [Name]:       sparse_rows
+ * [Purpose]:    Thread body: fills the destination tile rows of one band
+ * [Parameters]: 1 void* (cl; a sparse_band)
+ * [Return]:     NULL
+ */
+static void *sparse_rows(void *cl)
+{
+        sparse_band *b = cl;
+
+        for (int row = b->first; row < b->end; row++) {
+                long start = Trace_now();
+                for (int col = 0; col < UArray2b_blocks_width(b->destination);
+                     col++) {
+                        sparse_tile(b->source, b->destination, b->inverse,
+                                    b->magnitude, col, row);
+                }
+                Trace_span("tile row", start, row);
+        }
+        return NULL;
+}
+
+/* [Name]:       sparse_tile
+ * [Purpose]:    Fills one destination tile of a sparse transformation. The
+ *               tile's source cells form a rectangle (the transformations
+ *               only permute and mirror the axes); if every source tile
+ *               under it is uniform with the same value, the destination
+ *               tile is made uniform too, otherwise its cells are copied
+ * [Parameters]: 2 UArray2b_T (source, destination), 1 targetfun* (inverse),
+ *               1 int (magnitude of the inverse), 2 ints (block column and
+ *               row of the destination tile)
+ * [Return]:     void
+ */
+static void sparse_tile(UArray2b_T source, UArray2b_T destination,
+                        targetfun *inverse, int magnitude, int blk_col,
+                        int blk_row)
+{
+        int width  = UArray2b_width(destination);
+        int height = UArray2b_height(destination);
+        int size   = UArray2b_size(source);
+        int cols, rows;
+        int c0, r0, c1, r1;
+
+        UArray2b_block_shape(destination, blk_col, blk_row, &cols, &rows);
+
+        int x0 = blk_col * UArray2b_tile_width(destination), x1 = x0 + cols;
+        int y0 = blk_row * UArray2b_tile_height(destination), y1 = y0 + rows;
+        const void *value = NULL;
+
+        inverse(magnitude, width, height, x0, y0, &c0, &r0);
+        inverse(magnitude, width, height, x1 - 1, y1 - 1, &c1, &r1);
+        if (c0 > c1) {
+                int swap = c0; c0 = c1; c1 = swap;
+        }
+        if (r0 > r1) {
+                int swap = r0; r0 = r1; r1 = swap;
+        }
+
+        value = uniform_value(source, c0, r0, c1, r1);
+        if (value != NULL && pixel_ops != NULL) {
+                struct Pnm_rgb moved = *(const struct Pnm_rgb *)value;
+                Pixelop_apply(pixel_ops, &moved);
+                UArray2b_set_uniform(destination, blk_col, blk_row, &moved);
+                return;
+        } else if (value != NULL) {
+                UArray2b_set_uniform(destination, blk_col, blk_row, value);
+                return;
+        }
+
+        for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                        int col, row;
+                        void *cell = UArray2b_at(destination, x, y);
+                        inverse(magnitude, width, height, x, y, &col, &row);
+                        memcpy(cell, UArray2b_get(source, col, row), size);
+                        if (pixel_ops != NULL) {
+                                Pixelop_apply(pixel_ops, cell);
+                        }
+                }
+        }
+}
+
+/* [Name]:       uniform_value
+ * [Purpose]:    Finds the one value of a rectangle of a sparse array, if
+ *               every tile it overlaps is uniform with the same value
+ * [Parameters]: 1 UArray2b_T (array2b), 4 ints (first and last column and
+ *               row of the rectangle, inclusive)
+ * [Return]:     Pointer to the value, or NULL if the rectangle is mixed
+ */
+static const void *uniform_value(UArray2b_T array2b, int c0, int r0, int c1,
+                                 int r1)
+{
+        int tw   = UArray2b_tile_width(array2b);
+        int th   = UArray2b_tile_height(array2b);
+        int size = UArray2b_size(array2b);
+        const void *value = NULL;
+
+        for (int row = r0 / th; row <= r1 / th; row++) {
+                for (int col = c0 / tw; col <= c1 / tw; col++) {
+                        const void *uniform = UArray2b_uniform(array2b, col,
+                                                               row);
+                        if (uniform == NULL || (value != NULL &&
+                            memcmp(uniform, value, size) != 0)) {
+                                return NULL;
+                        }
+                        value = uniform;
+                }
+        }
+        return value;
+}
+
+/* [Name]:       transform_words
+ * [Purpose]:    Transforms an image of 4-byte pixels (rotate/flip/
+ *               transpose) in 4x4 groups of pixels; groups that are not
+ *               whole, or not stored as row runs, are copied a pixel at a
+ *               time. Sparse and blocked images go tile by tile as in
+ *               transform. Records time taken for transformation, if
+ *               needed.
+ * [Parameters]: 1 Pnm_ppm (ppm), 1 A2Methods_T (methods), 2 ints
+ *               (transform_type [see constants], magnitude), 1 float*
+ *               (time)
+ * [Return]:     Transformed image in a Pnm_ppm
+ */
+Pnm_ppm transform_words(Pnm_ppm ppm, A2Methods_T methods, int transform_type,
+                        int magnitude, float *time)
+{
+        int width  = ppm->width;
+        int height = ppm->height;
+        targetfun *target = transpose_target;
+        CPUTime_T timer;
+
+        assert(methods->size(ppm->pixels) == sizeof(uint32_t));
+
+        if (methods == uarray2_methods_blocked) {
+                return transform_tiles(ppm, transform_type, magnitude, time);
+        }
+
+        long start = Trace_now();
+        A2 image = create_image(ppm, methods, transform_type, magnitude);
+        Trace_span("alloc", start, -1);
+
+        if (methods == uarray2_methods_sparse) {
+                transform_sparse(ppm->pixels, image, transform_type,
+                                 magnitude, 1, time);
+                reassign(ppm, image, methods);
+                return ppm;
+        }
+        if (transform_type == ROTATE) {
+                target = rotate_target;
+        } else if (transform_type == FLIP) {
+                target = flip_target;
+        }
+
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+
+        start = Trace_now();
+        for (int row = 0; row < height; row += 4) {
+                for (int col = 0; col < width; col += 4) {
+                        if (row + 4 > height || col + 4 > width ||
+                            !word_quad(methods, ppm->pixels, image, target,
+                                       magnitude, col, row)) {
+                                word_cells(methods, ppm->pixels, image,
+                                           target, magnitude, col, row);
+                        }
+                }
+        }
+        Trace_span("map", start, -1);
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+        reassign(ppm, image, methods);
+        return ppm;
+}
+
+/* [Name]:       transform_tiles
+ * [Purpose]:    Transforms a blocked image as a transpose and/or mirrors
+ *               of its block grid and tiles (see UArray2b_transform).
+ *               Records time taken for transformation, if needed.
+ * [Parameters]: 1 Pnm_ppm (ppm, blocked pixels), 2 ints (transform_type
+ *               [see constants], magnitude), 1 float* (time)
+ * [Return]:     Transformed image in a Pnm_ppm
+ */
+static Pnm_ppm transform_tiles(Pnm_ppm ppm, int transform_type,
+                               int magnitude, float *time)
+{
+        UArray2b_T tiles = ppm->pixels;
+        int transpose, mirror_cols, mirror_rows;
+        CPUTime_T timer;
+
+        axis_mirrors(transform_type, magnitude, &transpose, &mirror_cols,
+                     &mirror_rows);
+
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+
+        long start = Trace_now();
+        UArray2b_transform(&tiles, transpose, mirror_cols, mirror_rows);
+        Trace_span("tiles", start, -1);
+        ppm->pixels = tiles;
+        if (transpose) {
+                unsigned swap = ppm->width;
+                ppm->width    = ppm->height;
+                ppm->height   = swap;
+        }
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+        return ppm;
+}
+
+/* [Name]:       transform_plain
+ * [Purpose]:    Transforms a plain image with the library: both arrays
+ *               are single row-major allocations, so they are described
+ *               to Ppmtrans_transform as caller-owned buffers. The map
+ *               picks the traversal; the copy tuning is passed along.
+ *               Records time taken for transformation, if needed.
+ * [Parameters]: 1 Pnm_ppm (ppm, plain pixels), 1 mapfun* (map), 3 ints
+ *               (transform_type [see constants], magnitude, threads),
+ *               1 float* (time)
+ * [Return]:     Transformed image in a Pnm_ppm
+ */
+static Pnm_ppm transform_plain(Pnm_ppm ppm, mapfun *map, int transform_type,
+                               int magnitude, int threads, float *time)
+{
+        A2Methods_T methods = uarray2_methods_plain;
+        A2          source  = ppm->pixels;
+        int         size    = methods->size(source);
+        Ppmtrans_options options;
+        Ppmtrans_image   from, to;
+        CPUTime_T timer;
+
+        assert(size == sizeof(struct Pnm_rgb));
+
+        from.pixels = methods->at(source, 0, 0);
+        from.width  = ppm->width;
+        from.height = ppm->height;
+        from.stride = (long)ppm->width * size;
+        from.format = PPMTRANS_PNM_RGB;
+
+        long start = Trace_now();
+        A2 image = create_image(ppm, methods, transform_type, magnitude);
+        Trace_span("alloc", start, -1);
+
+        to.pixels = methods->at(image, 0, 0);
+        to.width  = ppm->width;
+        to.height = ppm->height;
+        to.stride = (long)ppm->width * size;
+        to.format = PPMTRANS_PNM_RGB;
+
+        if (transform_type == ROTATE) {
+                options.op = magnitude == 90  ? PPMTRANS_ROTATE_90
+                           : magnitude == 180 ? PPMTRANS_ROTATE_180
+                           : magnitude == 270 ? PPMTRANS_ROTATE_270
+                                              : PPMTRANS_ROTATE_0;
+        } else if (transform_type == FLIP) {
+                options.op = magnitude == HORIZ ? PPMTRANS_FLIP_HORIZONTAL
+                                                : PPMTRANS_FLIP_VERTICAL;
+        } else {
+                options.op = PPMTRANS_TRANSPOSE;
+        }
+        options.traversal = map == methods->map_col_major
+                            ? PPMTRANS_COL_MAJOR : PPMTRANS_ROW_MAJOR;
+        options.threads   = threads;
+        options.nt_stores = stream_stores;
+        options.prefetch  = prefetching ? prefetch_distance(from.width,
+                                                            from.height)
+                                        : 0;
+        note_prefetch(options.prefetch, options.traversal ==
+                      PPMTRANS_COL_MAJOR, swaps_axes(transform_type,
+                                                     magnitude),
+                      from.width, from.height, size);
+
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+
+        start = Trace_now();
+        int status = Ppmtrans_transform(&from, &to, &options);
+        Trace_span("map", start, -1);
+        assert(status == 0);
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+        reassign(ppm, image, methods);
+        return ppm;
+}
+
+/* [Name]:       word_quad
+ * [Purpose]:    Moves the 4x4 group of pixels at (col, row). The group
+ *               lands on a 4x4 group of the destination, transposed if the
+ *               transformation swaps the axes and mirrored along either
+ *               axis; where the source group's corner lands says which.
+ * [Parameters]: 1 A2Methods_T (methods), 2 A2 (source, destination),
+ *               1 targetfun* (target), 3 ints (magnitude, col, row)
+ * [Return]:     1 if moved, 0 if either group is not four row runs
+ */
+static int word_quad(A2Methods_T methods, A2 source, A2 destination,
+                     targetfun *target, int magnitude, int col, int row)
+{
+        int width  = methods->width(source);
+        int height = methods->height(source);
+        int c0, r0, c1, r1, next_col, next_row;
+        uint32_t *src[4], *dst[4];
+
+        target(magnitude, width, height, col, row, &c0, &r0);
+        target(magnitude, width, height, col + 3, row + 3, &c1, &r1);
+        target(magnitude, width, height, col + 1, row, &next_col, &next_row);
+        int transposed  = next_row != r0;       /* a source row runs down */
+        int mirror_cols = c0 > c1;              /* vectors are reversed */
+        int mirror_rows = r0 > r1;              /* vectors go bottom up */
+        int dest_col    = mirror_cols ? c1 : c0;
+        int dest_row    = mirror_rows ? r1 : r0;
+
+        for (int k = 0; k < 4; k++) {
+                src[k] = methods->at(source, col, row + k);
+                dst[k] = methods->at(destination, dest_col, dest_row + k);
+                if ((uint32_t *)methods->at(source, col + 3, row + k) !=
+                    src[k] + 3 ||
+                    (uint32_t *)methods->at(destination, dest_col + 3,
+                                            dest_row + k) != dst[k] + 3) {
+                        return 0;
+                }
+        }
+
+#if defined(__SSE2__)
+        __m128i v[4];
+        for (int k = 0; k < 4; k++) {
+                v[k] = _mm_loadu_si128((const __m128i *)src[k]);
+        }
+        if (transposed) {
+                __m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+                __m128i t1 = _mm_unpacklo_epi32(v[2], v[3]);
+                __m128i t2 = _mm_unpackhi_epi32(v[0], v[1]);
+                __m128i t3 = _mm_unpackhi_epi32(v[2], v[3]);
+                v[0] = _mm_unpacklo_epi64(t0, t1);
+                v[1] = _mm_unpackhi_epi64(t0, t1);
+                v[2] = _mm_unpacklo_epi64(t2, t3);
+                v[3] = _mm_unpackhi_epi64(t2, t3);
+        }
+        for (int k = 0; k < 4; k++) {
+                __m128i out = mirror_cols ? _mm_shuffle_epi32(
+                                                v[k], _MM_SHUFFLE(0, 1, 2, 3))
+                                          : v[k];
+                _mm_storeu_si128((__m128i *)dst[mirror_rows ? 3 - k : k],
+                                 out);
+        }
+#else
+        for (int k = 0; k < 4; k++) {
+                uint32_t *out = dst[mirror_rows ? 3 - k : k];
+                for (int i = 0; i < 4; i++) {
+                        out[mirror_cols ? 3 - i : i] = transposed
+                                                       ? src[i][k]
+                                                       : src[k][i];
+                }
+        }
+#endif
+        return 1;
+}
+
+/* [Name]:       word_cells
+ * [Purpose]:    Moves the pixels of the 4x4 group at (col, row) that lie
+ *               inside the image one at a time
+ * [Parameters]: 1 A2Methods_T (methods), 2 A2 (source, destination),
+ *               1 targetfun* (target), 3 ints (magnitude, col, row)
+ * [Return]:     void
+ */
+static void word_cells(A2Methods_T methods, A2 source, A2 destination,
+                       targetfun *target, int magnitude, int col, int row)
+{
+        int width  = methods->width(source);
+        int height = methods->height(source);
+
+        for (int y = row; y < row + 4 && y < height; y++) {
+                for (int x = col; x < col + 4 && x < width; x++) {
+                        int dest_col, dest_row;
+                        target(magnitude, width, height, x, y, &dest_col,
+                               &dest_row);
+                        *(uint32_t *)methods->at(destination, dest_col,
+                                                 dest_row) =
+                                *(uint32_t *)methods->at(source, x, y);
+                }
+        }
+}
+
+/* [Name]:       transform_in_place
+ * [Purpose]:    Applies a shape-preserving transformation (rotate 0/180,
+ *               flip) by swapping pixel pairs within ppm's own pixels, so
+ *               no second array is allocated; per-pixel operations run on
+ *               each pixel as it is swapped. Records time taken for
+ *               transformation, if needed.
+ * [Parameters]: 1 Pnm_ppm (ppm), 1 A2Methods_T (methods), 2 ints
+ *               (transform_type [see constants], magnitude), 1 float*
+ *               (time)
+ * [Return]:     Transformed image in a Pnm_ppm
+ */
+Pnm_ppm transform_in_place(Pnm_ppm ppm, A2Methods_T methods,
+                           int transform_type, int magnitude, float *time)
+{
+        int width  = ppm->width;
+        int height = ppm->height;
+        int mirror_cols = (transform_type == FLIP && magnitude == HORIZ) ||
+                          (transform_type == ROTATE && magnitude == 180);
+        int mirror_rows = (transform_type == FLIP && magnitude == VERT) ||
+                          (transform_type == ROTATE && magnitude == 180);
+        CPUTime_T timer;
+
+        assert(mirror_cols || mirror_rows ||
+               (transform_type == ROTATE && magnitude == 0));
+
+        if (pixel_ops != NULL) {
+                ppm->denominator = Pixelop_prepare(pixel_ops,
+                                                   ppm->denominator);
+        }
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+
+        /* visit each pair once: the top half of the rows when rows are
+         * mirrored (plus the left half of a middle row), else the left
+         * half of every row; with operations to run, pixels that are
+         * their own mate are visited too */
+        int fused = pixel_ops != NULL;
+        int rows  = mirror_rows ? (height + 1) / 2 : height;
+        for (int row = 0; row < rows && (mirror_rows || mirror_cols || fused);
+             row++) {
+                int mate_row = mirror_rows ? height - row - 1 : row;
+                int cols     = width;
+                if (!mirror_cols || mate_row == row) {
+                        cols = mirror_cols ? (width + fused) / 2 : width;
+                }
+                for (int col = 0; col < cols; col++) {
+                        int mate_col = mirror_cols ? width - col - 1 : col;
+                        Pnm_rgb a = methods->at(ppm->pixels, col, row);
+                        Pnm_rgb b = methods->at(ppm->pixels, mate_col,
+                                                mate_row);
+                        struct Pnm_rgb swap = *a;
+                        *a = *b;
+                        *b = swap;
+                        if (fused) {
+                                Pixelop_apply(pixel_ops, a);
+                                if (b != a) {
+                                        Pixelop_apply(pixel_ops, b);
+                                }
+                        }
+                }
+        }
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+        return ppm;
+}
+
+/* [Name]:       crop_image
+ * [Purpose]:    Cuts ppm down to region (clipped to the image). Used when
+ *               the reader could not restrict decoding to the region itself.
+ * [Parameters]: 1 Pnm_ppm (ppm), 1 A2Methods_T (methods),
+ *               1 const Ppmio_region* (region)
+ * [Return]:     1 if ppm now holds the region, 0 if the region misses the
+ *               image (ppm is unchanged)
+ */
+int crop_image(Pnm_ppm ppm, A2Methods_T methods, const Ppmio_region *region)
+{
+        Ppmio_region window;
+
+        if (!Ppmio_clip_region(region, ppm->width, ppm->height, &window)) {
+                return 0;
+        }
+        if (window.width == (int)ppm->width &&
+            window.height == (int)ppm->height) {
+                return 1;
+        }
+
+        A2 image = methods->new(window.width, window.height,
+                                sizeof(struct Pnm_rgb));
+        for (int row = 0; row < window.height; row++) {
+                for (int col = 0; col < window.width; col++) {
+                        *(Pnm_rgb)methods->at(image, col, row) =
+                                *(Pnm_rgb)methods->at(ppm->pixels,
+                                                      window.x + col,
+                                                      window.y + row);
+                }
+        }
+        ppm->width  = window.width;
+        ppm->height = window.height;
+        reassign(ppm, image, methods);
+        return 1;
+}
+
+/*---------------------------------------------------------------
+ |                Transformation Helper Functions               |
+ *--------------------------------------------------------------*/
+/* [Name]:       create_image
+ * [Purpose]:    Creates an destination A2 based on (edited) dimensions
+ *               (if rotated by 90/270 degrees, or transposed -
+ *                width & height are swapped), with cells the size of the
+ *               source's (RGB pixels for a header-only ppm).
+ * [Parameters]: 1 Pnm_ppm (source ppm), 1 A2Methods_T (methods),
+ *               2 ints (transformation type and magnitude)
+ * [Return]:     Empty destination A2
+ */
+A2 create_image(Pnm_ppm ppm, A2Methods_T methods, int type, int magnitude)
+{
+        int width  = ppm->width;
+        int height = ppm->height;
+        int size   = ppm->pixels != NULL ? methods->size(ppm->pixels)
+                                         : (int)sizeof(struct Pnm_rgb);
+
+        if (swaps_axes(type, magnitude)) {
+                ppm->width  = height;
+                ppm->height = width;
+                return methods->new(height, width, size);
+        } else {
+                return methods->new(width, height, size);
+        }
+}
+
+/* [Name]:       result_init
+ * [Purpose]:    Initializes the result struct that contains the methods,
+ *               magnitude and destination image.
+ * [Parameters]: 1 A2Methods_T (methods), 1 int (magnitude), 1 A2 (image)
+ * [Return]:     Initialized result
+ */
+result result_init(A2Methods_T methods, int magnitude, A2 image)
+{
+        result dest_info;
+
+        dest_info.methods         = methods;
+        dest_info.magnitude       = magnitude;
+        dest_info.destination_map = image;
+        dest_info.streaming       = 0;
+
+        return dest_info;
+}
+
+/* [Name]:       transform_init
+ * [Purpose]:    Assigns the appropriate apply function to the applyfun*
+ * [Parameters]: 1 applyfun* (apply), 1 int (transform_type)
+ * [Return]:     Initialized applyfun*
+ */
+applyfun* transform_init(applyfun *apply, int transform_type)
+{
+        if (transform_type == ROTATE) {
+                apply = rotate_map;
+        } else if (transform_type == FLIP) {
+                apply = flip_map;
+        } else if (transform_type == TRANSPOSE) {
+                apply = transpose_map;
+        }
+
+        return apply;
+}
+
+/* [Name]:       transform_image
+ * [Purpose]:    Maps applyfun on the source image to create transformed image
+ *               Records the duration taken for the applyfun in time, if needed
+ * [Parameters]: 1 Pnm_ppm (ppm), 1 applyfun* (apply), 1 mapfun* (map),
+ *               1 result* (dest_info), 1 float* (time)
+ * [Return]:     void
+ */
+void transform_image(Pnm_ppm ppm, applyfun *apply, mapfun *map,
+                     result *dest_info, float *time)
+{
+        CPUTime_T timer;
+        if (time != NULL) {
+                timer = CPUTime_New();
+                CPUTime_Start(timer);
+        }
+
+        long start = Trace_now();
+        map(ppm->pixels, apply, dest_info);
+        Trace_span("map", start, -1);
+#if defined(__SSE2__)
+        if (dest_info->streaming) {
+                _mm_sfence();   /* order the streamed stores before use */
+        }
+#endif
+
+        if (time != NULL) {
+                *time = CPUTime_Stop(timer);
+                CPUTime_Free(&timer);
+        }
+}
+
+/* [Name]:       transform_tuning
+ * [Purpose]:    Selects how transform copies pixels: non-temporal
+ *               destination stores and/or software prefetch
+ * [Parameters]: 2 ints (nt_stores, prefetch; nonzero enables)
+ * [Return]:     void
+ */
+void transform_tuning(int nt_stores, int prefetch)
+{
+        stream_stores = nt_stores != 0;
+        prefetching   = prefetch != 0;
+}
+
+/* [Name]:       transform_pixel_ops
+ * [Purpose]:    Selects the per-pixel operations run on every pixel the
+ *               transformation moves; they are prepared for the image's
+ *               maxval (which they may change) when a transform starts
+ * [Parameters]: 1 Pixelop_T (ops, NULL for none)
+ * [Return]:     void
+ */
+void transform_pixel_ops(Pixelop_T ops)
+{
+        pixel_ops = ops;
+}
+
+/* [Name]:       prefetch_distance
+ * [Purpose]:    Picks how many pixels ahead to prefetch for an image. A
+ *               quarter-turn copy walks one side across rows, touching one
+ *               line per row; while those lines fit in L2 they are reused
+ *               and prefetching only costs. Past that, rows within a page
+ *               prefetch nearby, and rows of a page or more (each step also
+ *               a TLB miss) prefetch further ahead.
+ * [Parameters]: 2 ints (source width, height)
+ * [Return]:     Distance in pixels, 0 for no prefetching
+ */
+int prefetch_distance(int width, int height)
+{
+        long lines     = width > height ? width : height;
+        long row_bytes = (long)width * sizeof(struct Pnm_rgb);
+
+        if (lines * CACHE_LINE <= PREFETCH_MIN_FOOTPRINT) {
+                return 0;
+        }
+        return row_bytes >= PAGE_BYTES ? PREFETCH_FAR : PREFETCH_NEAR;
+}
+
+/* [Name]:       transform_tuning_used
+ * [Purpose]:    Reports what the copy tuning did on the last transform:
+ *               which sides were prefetched, across what stride, and how
+ *               many prefetches that issued (none unless the image was
+ *               plain and a side of its walk crossed rows)
+ * [Parameters]: 1 tuning_used* (used, filled in)
+ * [Return]:     void
+ */
+void transform_tuning_used(tuning_used *used)
+{
+        assert(used != NULL);
+        *used = last_tuning;
+}
+
+/* [Name]:       note_prefetch
+ * [Purpose]:    Records which sides of a plain walk the library prefetches:
+ *               a side is prefetched when its step crosses rows, which is
+ *               the source under column-major and the destination when the
+ *               axes swap under row-major or stay under column-major. A
+ *               streamed destination is not prefetched. Each run of n
+ *               pixels issues n - distance prefetches per side.
+ * [Parameters]: 6 ints (distance, col_major, swap, source width, height,
+ *               pixel size)
+ * [Return]:     void
+ */
+static void note_prefetch(int distance, int col_major, int swap, int width,
+                          int height, int size)
+{
+        int  run    = col_major ? height : width;
+        int  runs   = col_major ? width  : height;
+        int  source = col_major;
+        int  dest   = col_major != swap && !stream_stores;
+
+        if (distance <= 0 || distance >= run || !(source || dest)) {
+                return;
+        }
+        last_tuning.distance   = distance;
+        last_tuning.source     = source;
+        last_tuning.dest       = dest;
+        last_tuning.stride     = (long)(dest && swap ? height : width) *
+                                 size;
+        last_tuning.prefetches = (long)(source + dest) * runs *
+                                 (run - distance);
+}
+
+/* [Name]:       reassign
+ * [Purpose]:    Reassigns the A2 in ppm to the transformed A2, and frees
+ *               heap-allocated data of the previous A2.
+ * [Parameters]: 1 Pnm_ppm (ppm), 1 A2 (transformed A2), 1 A2Methods_T methods
+ * [Return]:     void
+ */
+void reassign(Pnm_ppm ppm, A2 destination_map, A2Methods_T methods)
+{
+        A2   buff  = ppm->pixels;
+        long start = Trace_now();
+        ppm->pixels = destination_map;
+        methods->free(&buff);
+        Trace_span("free", start, -1);
+}
+
+/* [Name]:       pipeline_order
+ * [Purpose]:    Tells the pipeline which source rows/columns feed each
+ *               destination row for the given transformation
+ * [Parameters]: 2 ints (transform_type, magnitude)
+ * [Return]:     Pipeline_order of the transformation
+ */
+Pipeline_order pipeline_order(int transform_type, int magnitude)
+{
+        if (transform_type == TRANSPOSE) {
+                return PIPELINE_COLS;
+        } else if (transform_type == FLIP) {
+                return magnitude == HORIZ ? PIPELINE_ROWS
+                                          : PIPELINE_ROWS_REVERSED;
+        } else if (magnitude == 90) {
+                return PIPELINE_COLS;
+        } else if (magnitude == 180) {
+                return PIPELINE_ROWS_REVERSED;
+        } else if (magnitude == 270) {
+                return PIPELINE_COLS_REVERSED;
+        }
+        return PIPELINE_ROWS;
+}
+
+/*---------------------------------------------------------------
+ |                        Axis Functions                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       swaps_axes
+ * [Purpose]:    Tells whether a transformation turns source columns into
+ *               destination rows (and rows into columns)
+ * [Parameters]: 2 ints (transform_type, magnitude)
+ * [Return]:     1 for rotate 90/270 and transpose, 0 otherwise
+ */
+int swaps_axes(int transform_type, int magnitude)
+{
+        return transform_type == TRANSPOSE ||
+               (transform_type == ROTATE &&
+                (magnitude == 90 || magnitude == 270));
+}
+
+/* [Name]:       axis_mirrors
+ * [Purpose]:    Breaks a transformation into a transpose followed by
+ *               mirrors, as UArray2b_transform takes it
+ * [Parameters]: 2 ints (transform_type, magnitude), 3 int* (transpose,
+ *               mirror_cols, mirror_rows; set to 1 if applied, else 0)
+ * [Return]:     void
+ */
+void axis_mirrors(int transform_type, int magnitude, int *transpose,
+                  int *mirror_cols, int *mirror_rows)
+{
+        *transpose   = swaps_axes(transform_type, magnitude);
+        *mirror_cols = (transform_type == ROTATE &&
+                        (magnitude == 90 || magnitude == 180)) ||
+                       (transform_type == FLIP && magnitude == HORIZ);
+        *mirror_rows = (transform_type == ROTATE &&
+                        (magnitude == 180 || magnitude == 270)) ||
+                       (transform_type == FLIP && magnitude == VERT);
+}
+
+/* [Name]:       axis_positions
+ * [Purpose]:    A transformation sends each source column to one
+ *               destination column (or row, if it swaps the axes) and each
+ *               source row to one destination row (or column); fills in
+ *               those destination indices
+ * [Parameters]: 2 ints (transform_type, magnitude), 2 ints (source width,
+ *               height), 2 long* (col_pos, row_pos; width and height
+ *               entries)
+ * [Return]:     void
+ */
+void axis_positions(int transform_type, int magnitude, int width,
+                    int height, long *col_pos, long *row_pos)
+{
+        int cols_reversed = (transform_type == ROTATE &&
+                             (magnitude == 180 || magnitude == 270)) ||
+                            (transform_type == FLIP && magnitude == HORIZ);
+        int rows_reversed = (transform_type == ROTATE &&
+                             (magnitude == 90 || magnitude == 180)) ||
+                            (transform_type == FLIP && magnitude == VERT);
+
+        for (int c = 0; c < width; c++) {
+                col_pos[c] = cols_reversed ? width - c - 1 : c;
+        }
+        for (int r = 0; r < height; r++) {
+                row_pos[r] = rows_reversed ? height - r - 1 : r;
+        }
+}
@@ -0,0 +1,99 @@
+/*
+ *      transform.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Rotates, flips or transposes a Pnm_ppm held in any A2Methods
+ *        representation, using any of its map functions; plain images
+ *        go through the library (libppmtrans) on several threads
+ *      - Optionally streams destination stores and prefetches ahead on
+ *        the side of the copy that strides across rows
+ *      - Optionally runs a chain of per-pixel operations on each pixel as
+ *        it is moved
+ *      - Moves images of 4-byte pixels (PAM) with 4x4 vector transposes
+ *      - Crops a Pnm_ppm to a region when the reader could not decode
+ *        just the region
+ *      - Says how a transformation moves the axes, for the readers and
+ *        writers that place pixels themselves (scale, encode, ...)
+ */
+
+#ifndef TRANSFORM_INCLUDED
+#define TRANSFORM_INCLUDED
+
+#include "a2methods.h"
+#include "pipeline.h"
+#include "pixelop.h"
+#include "pnm.h"
+#include "ppmio.h"
+
+typedef A2Methods_UArray2  A2;
+typedef A2Methods_applyfun applyfun;
+typedef A2Methods_Object   object;
+typedef A2Methods_mapfun   mapfun;
+
+/* Struct with transformed image; to pass in as closure for map functions */
+typedef struct result {
+        A2Methods_T methods;
+        A2          destination_map;
+        int         magnitude;
+        int         streaming;          /* non-temporal destination stores */
+} result;
+
+/* What the copy tuning did on a transform (see transform_tuning_used) */
+typedef struct tuning_used {
+        int  nt_stores;
+        int  distance;          /* prefetch distance in pixels, 0 if none */
+        int  source, dest;      /* sides prefetched */
+        long stride;            /* bytes between a side's prefetches */
+        long prefetches;        /* prefetches issued */
+} tuning_used;
+
+/* Transform type constants */
+static const int ROTATE    = 0;
+static const int FLIP      = 1;
+static const int TRANSPOSE = 2;
+
+/* Flip direction constants */
+static const int HORIZ = 1;
+static const int VERT  = 2;
+
+/* Error Handling Function */
+void malloc_check (void *ptr);
+
+/* Image Transformation Functions */
+Pnm_ppm transform       (Pnm_ppm ppm, A2Methods_T methods, mapfun *map,
+                         int transform_type, int magnitude, int threads,
+                         float* time);
+void    transform_image (Pnm_ppm ppm, applyfun *apply,
+                         mapfun *map, result *dest_info, float *time);
+void    rotate_map      (int col, int row, A2 source, object *ptr, void *cl);
+void    flip_map        (int col, int row, A2 source, object *ptr, void *cl);
+void    transpose_map   (int col, int row, A2 source, object *ptr, void *cl);
+Pnm_ppm transform_words (Pnm_ppm ppm, A2Methods_T methods,
+                         int transform_type, int magnitude, float *time);
+Pnm_ppm transform_in_place(Pnm_ppm ppm, A2Methods_T methods,
+                           int transform_type, int magnitude, float *time);
+int     crop_image      (Pnm_ppm ppm, A2Methods_T methods,
+                         const Ppmio_region *region);
+
+/* Image Transformation Helper Functions */
+A2        create_image   (Pnm_ppm ppm, A2Methods_T methods, int type,
+                          int magnitude);
+result    result_init    (A2Methods_T methods, int magnitude, A2 image);
+applyfun* transform_init (applyfun *apply, int transform_type);
+void      reassign       (Pnm_ppm ppm, A2 destination_map, A2Methods_T methods);
+Pipeline_order pipeline_order(int transform_type, int magnitude);
+
+/* Axis Functions */
+int  swaps_axes    (int transform_type, int magnitude);
+void axis_mirrors  (int transform_type, int magnitude, int *transpose,
+                    int *mirror_cols, int *mirror_rows);
+void axis_positions(int transform_type, int magnitude, int width,
+                    int height, long *col_pos, long *row_pos);
+
+/* Copy Tuning Functions */
+void transform_tuning  (int nt_stores, int prefetch);
+void transform_tuning_used(tuning_used *used);
+void transform_pixel_ops(Pixelop_T ops);
+int  prefetch_distance (int width, int height);
+
+#endif
@@ -1,115 +1,109 @@
-#line 50 "www/solutions/uarray2.nw"
-#include "assert.h"
-#include "mem.h"
-#include "uarray.h"
-#include "uarray2.h"
-
-#define T UArray2_T
-
-/* 
- * Element (i, j) in the world of ideas maps to
- * rows[j][i] where the square brackets stand for access
- * to a Hanson UArray_T
- */
-struct T {
-        int width, height;
-        int size;
-        UArray_T rows; /* UArray_T of 'height' UArray_Ts,
-                          each of length 'width' and size 'size' */
-};
-#line 79 "www/solutions/uarray2.nw"
-static inline UArray_T row(T a, int j)
-{
-        UArray_T *prow = UArray_at(a->rows, j);   /* Ramsey idiom */
-        return *prow;
-}
-#line 92 "www/solutions/uarray2.nw"
-static int is_ok(T a)
-{
-        return a && UArray_length(a->rows) == a->height &&
-               UArray_size(a->rows) == sizeof(UArray_T) &&
-               (a->height == 0 || (UArray_length(row(a, 0)) == a->width
-                                   && UArray_size  (row(a, 0)) == a->size));
-}
-#line 109 "www/solutions/uarray2.nw"
-T UArray2_new(int width, int height, int size)
-{
-        int i;  /* interates over row number */
-        T array;
-        NEW(array);
-        array->width  = width;
-        array->height = height;
-        array->size   = size;
-        array->rows   = UArray_new(height, sizeof(UArray_T));
-        for (i = 0; i < height; i++) {
-                UArray_T *rowp = UArray_at(array->rows, i);
-                *rowp = UArray_new(width, size);
-        }
-        assert(is_ok(array));
-        return array;
-}
-#line 131 "www/solutions/uarray2.nw"
-void UArray2_free(T *array2)
-{
-        int i;
-        assert(array2 && *array2);
-        for (i = 0; i < (*array2)->height; i++) {
-                UArray_T p = row(*array2, i);
-                UArray_free(&p);
-        }
-        UArray_free(&(*array2)->rows);
-        FREE(*array2);
-}
-#line 151 "www/solutions/uarray2.nw"
-void *UArray2_at(T array2, int i, int j)
-{
-        assert(array2);
-        return UArray_at(row(array2, j), i);
-}
-#line 162 "www/solutions/uarray2.nw"
-int UArray2_height(T array2)
-{
-        assert(array2);
-        return array2->height;
-}
-
-int UArray2_width(T array2)
-{
-        assert(array2);
-        return array2->width;
-}
-
-int UArray2_size(T array2)
-{
-        assert(array2);
-        return array2->size;
-}
-#line 193 "www/solutions/uarray2.nw"
-void UArray2_map_row_major(T array2, 
-                           void apply(int i, int j, T array2, 
-                                      void *elem, void *cl), 
-                           void *cl)
-{
-        assert(array2);
-        int h = array2->height;  /* keeping height and width in registers */
-        int w = array2->width;   /* avoids extra memory traffic           */
-        for (int j = 0; j < h; j++) {
-                /* don't want row/UArray_at in inner loop */
-                UArray_T thisrow = row(array2, j); 
-                for (int i = 0; i < w; i++)
-                        apply(i, j, array2, UArray_at(thisrow, i), cl);
-        }
-}
-#line 211 "www/solutions/uarray2.nw"
-void UArray2_map_col_major(T array2, 
-                           void apply(int i, int j, T array2, 
-                                      void *elem, void *cl), 
-                           void *cl)
-{
-        assert(array2);
-        int h = array2->height;  /* keeping height and width in registers */
-        int w = array2->width;   /* avoids extra memory traffic           */
-        for (int i = 0; i < w; i++)
-                for (int j = 0; j < h; j++)
-                        apply(i, j, array2, UArray_at(row(array2, j), i), cl);
-}
\ No newline at end of file
+#include <stddef.h>
+
+#include "assert.h"
+#include "mem.h"
+#include "pool.h"
+#include "uarray2.h"
+
+#define T UArray2_T
+
+/*
+ * Element (i, j) in the world of ideas maps to
+ * elems[(j * width + i) * size], one allocation in row-major
+ * order; offsets are computed in 64 bits, so neither a row nor
+ * the whole array is limited to 2^31 bytes
+ */
+struct T {
+        int width, height;
+        int size;
+        char *elems;
+};
+
+static inline char *row(T a, int j)
+{
+        return a->elems + (long)j * a->width * a->size;
+}
+
+static int is_ok(T a)
+{
+        return a && a->width >= 0 && a->height >= 0 && a->size > 0 &&
+               (a->elems != NULL || (long)a->width * a->height == 0);
+}
+
+T UArray2_new(int width, int height, int size)
+{
+        T array;
+        assert(width >= 0 && height >= 0 && size > 0);
+        NEW(array);
+        array->width  = width;
+        array->height = height;
+        array->size   = size;
+        array->elems  = (long)width * height > 0
+                        ? Pool_calloc((long)width * height, size) : NULL;
+        assert(is_ok(array));
+        return array;
+}
+
+void UArray2_free(T *array2)
+{
+        assert(array2 && *array2);
+        Pool_free((*array2)->elems,
+                  (long)(*array2)->width * (*array2)->height *
+                  (*array2)->size);
+        FREE(*array2);
+}
+
+void *UArray2_at(T array2, int i, int j)
+{
+        assert(array2);
+        assert(i >= 0 && i < array2->width && j >= 0 && j < array2->height);
+        return row(array2, j) + (long)i * array2->size;
+}
+
+int UArray2_height(T array2)
+{
+        assert(array2);
+        return array2->height;
+}
+
+int UArray2_width(T array2)
+{
+        assert(array2);
+        return array2->width;
+}
+
+int UArray2_size(T array2)
+{
+        assert(array2);
+        return array2->size;
+}
+
+void UArray2_map_row_major(T array2,
+                           void apply(int i, int j, T array2,
+                                      void *elem, void *cl),
+                           void *cl)
+{
+        assert(array2);
+        int h = array2->height;  /* keeping height and width in registers */
+        int w = array2->width;   /* avoids extra memory traffic           */
+        int s = array2->size;
+        for (int j = 0; j < h; j++) {
+                /* don't want row() in inner loop */
+                char *thisrow = row(array2, j);
+                for (int i = 0; i < w; i++)
+                        apply(i, j, array2, thisrow + (long)i * s, cl);
+        }
+}
+
+void UArray2_map_col_major(T array2,
+                           void apply(int i, int j, T array2,
+                                      void *elem, void *cl),
+                           void *cl)
+{
+        assert(array2);
+        int h = array2->height;  /* keeping height and width in registers */
+        int w = array2->width;   /* avoids extra memory traffic           */
+        for (int i = 0; i < w; i++)
+                for (int j = 0; j < h; j++)
+                        apply(i, j, array2, UArray2_at(array2, i, j), cl);
+}
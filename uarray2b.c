@@ -1,292 +1,972 @@
-/*
- *      uarray2b.c
- *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
- *
- *      - Unboxed 2D array that is polymorphic in data storage
- *      - Implements block-major mapping, with user-specified blocksize
- */
-
-#include "assert.h"
-#include "mem.h"
-#include "uarray.h"
-#include "uarray2.h"
-#include "uarray2b.h"
-#include <math.h>
-#include <stdio.h>
-
-#define T UArray2b_T
-
-/*---------------------------------------------------------------
- |             Private Helpers, No Client Access                |
- *--------------------------------------------------------------*/
-
-/* Initialization Functions */
-void UArray2b_init(T uarray2b, int width, int height, int size, int blocksize);
-void blocks_init(T uarray2b);
-void cell_init(int col, int row, UArray2_T uarray2, void *elem, void *cl);
-
-/* Memory Freeing Function */
-void blocks_free(int col, int row, UArray2_T blocks, void *elem, void *cl);
-
-/* Complete struct for UArray2b representation */
-struct T {
-        int width, height;
-        int size;
-        int blocksize;
-        UArray2_T blocks;
-};
-
-/*---------------------------------------------------------------
- |             Constructors / Destructors                       |
- *--------------------------------------------------------------*/
-/* [Name]:       UArray2b_new
- * [Purpose]:    Allocates memory for a 2D blocked array with user-specified
- *               dimensions and blocksize
- * [Parameters]: 4 ints (width, height, size of each data elem in bytes),
- *               blocksize)
- * [Return]:     Opaque representation of a UArray2b
- */
-T UArray2b_new (int width, int height, int size, int blocksize)
-{
-        T uarray2b;
-        NEW(uarray2b);
-        UArray2b_init(uarray2b, width, height, size, blocksize);
-
-        return uarray2b;
-}
-
-/* [Name]:       UArray2b_new_64K_block
- * [Purpose]:    Allocates memory for a 2D blocked array with user-specified
- *               dimensions and blocksize that can fit within a 64kb cache, if
- *               possible
- * [Parameters]: 4 ints (width, height, size of each data elem in bytes),
- *               blocksize)
- * [Return]:     Opaque representation of a UArray2b
- */
-T UArray2b_new_64K_block(int width, int height, int size)
-{
-        T   uarray2b;
-        int blocksize = 0;
-        int num_cells = 64000 / size;
-
-        if (num_cells < 1) {
-                blocksize = 1;
-        } else if (sqrt(num_cells) > width || sqrt(num_cells) > height) {
-                if (height < width) {
-                        blocksize = height;
-                } else {
-                        blocksize = width;
-                }
-        } else {
-                blocksize = (int)sqrt(num_cells);
-        }
-
-        NEW(uarray2b);
-        UArray2b_init(uarray2b, width, height, size, blocksize);
-
-        return uarray2b;
-}
-
-/* [Name]:       UArray2b_init
- * [Purpose]:    Initializes the metadata in the UArray2b representation
- * [Parameters]: 1 T (uarray2b), 4 ints (width, height, size of data element,
- *               blocksize)
- * [Return]:     void
- */
-void UArray2b_init(T uarray2b, int width, int height, int size, int blocksize)
-{
-        assert(width > 0 && height > 0 && size > 0 && blocksize > 0);
-        assert(blocksize <= width && blocksize <= height);
-
-        uarray2b->width     = width;
-        uarray2b->height    = height;
-        uarray2b->size      = size;
-        uarray2b->blocksize = blocksize;
-
-        blocks_init(uarray2b);
-}
-
-/* [Name]:       blocks_init
- * [Purpose]:    Initializes each block within the UArray2b
- * [Parameters]: 1 T (uarray2b)
- * [Return]:     void
- */
-void blocks_init(T uarray2b)
-{
-        int blocks_h = (int)ceil((double)uarray2b->height /
-                                 (double)uarray2b->blocksize);
-        int blocks_w = (int)ceil((double)uarray2b->width /
-                                 (double)uarray2b->blocksize);
-
-        uarray2b->blocks = UArray2_new(blocks_w, blocks_h, sizeof(UArray_T));
-        UArray2_map_row_major(uarray2b->blocks, cell_init, uarray2b);
-}
-
-/* [Name]:       cell_init
- * [Purpose]:    Initializes each block within the UArray2b as a UArray_T
- * [Parameters]: 2 ints (col and row coordinates of the current block),
- *               UArray2_T (uarray2 representation of all blocks),
- *               2 void* (block at (col, row), closure)
- * [Return]:
- */
-void cell_init(int col, int row, UArray2_T uarray2, void *elem, void *cl)
-{
-        (void) uarray2;
-        (void) col;
-        (void) row;
-
-        T uarray2b     = (T) cl;
-        UArray_T *buff = (UArray_T *)elem;
-        int blocksize  = uarray2b->blocksize;
-        int size       = uarray2b->size;
-
-        *buff = UArray_new(blocksize * blocksize, size);
-
-        assert(buff != NULL);
-}
-
-/* [Name]:       UArray2b_free
- * [Purpose]:    Frees the heap allocated memory of uarray2b
- * [Parameters]: 1 T* (uarray2b)
- * [Return]:     void
- */
-void UArray2b_free(T *uarray2b)
-{
-        assert(uarray2b != NULL && *uarray2b != NULL);
-
-        UArray2_map_row_major((*uarray2b)->blocks, blocks_free, NULL);
-        UArray2_free(&((*uarray2b)->blocks));
-
-        FREE(*uarray2b);
-}
-
-/* [Name]:       blocks_free
- * [Purpose]:    Frees the cells in each block of UArray2b
- * [Parameters]: 2 ints (col and row coordinates of the current block),
- *               UArray2_T (uarray2 representation of all blocks),
- *               2 void* (block at (col, row), closure)
- * [Return]:     void
- */
-void blocks_free(int col, int row, UArray2_T blocks, void *elem, void *cl)
-{
-        (void) cl;
-        (void) col;
-        (void) row;
-        (void) blocks;
-
-        UArray_free(elem);
-}
-
-/*---------------------------------------------------------------
- |             UArray2b Metadata Functions                      |
- *--------------------------------------------------------------*/
-/* [Name]:       UArray2b_width
- * [Purpose]:    Returns width of uarray2b
- * [Parameters]: 1 T (uarray2b)
- * [Return]:     Width of uarray2b
- */
-int UArray2b_width(T uarray2b)
-{
-        assert(uarray2b != NULL);
-        return uarray2b->width;
-}
-
-/* [Name]:       UArray2b_height
- * [Purpose]:    Returns height of uarray2b
- * [Parameters]: 1 T (uarray2b)
- * [Return]:     Height of uarray2b
- */
-int UArray2b_height (T uarray2b)
-{
-        assert(uarray2b != NULL);
-        return uarray2b->height;
-}
-
-/* [Name]:       UArray2b_size
- * [Purpose]:    Returns the size of each data element of uarray2b
- * [Parameters]: 1 T (uarray2b)
- * [Return]:     Size of each data element in uarray2b
- */
-int UArray2b_size (T uarray2b)
-{
-        assert(uarray2b != NULL);
-        return uarray2b->size;
-}
-
-/* [Name]:       UArray2b_blocksize
- * [Purpose]:    Returns blocksize of uarray2b
- * [Parameters]: 1 T (uarray2b)
- * [Return]:     Blocksize of uarray2b
- */
-int UArray2b_blocksize(T uarray2b)
-{
-        assert(uarray2b != NULL);
-        return uarray2b->blocksize;
-}
-
-/*---------------------------------------------------------------
- |                      Access Functions                        |
- *--------------------------------------------------------------*/
-/* [Name]:       UArray2b_at
- * [Purpose]:    Returns the element at the given (col, row)
- * [Parameters]: 1 T (uarray2b), 2 ints (col and row)
- * [Return]:     void* pointing to element at given index
- */
-void *UArray2b_at(T uarray2b, int col, int row)
-{
-        assert(uarray2b != NULL);
-        assert(col < uarray2b->width && row < uarray2b->height);
-
-        UArray2_T blocks = uarray2b->blocks;
-        int blocksize = uarray2b->blocksize;
-        UArray_T *curr_block = UArray2_at(blocks, col / blocksize,
-                                          row / blocksize);
-        return UArray_at(*curr_block,
-                         (blocksize * (row % blocksize)) + (col % blocksize));
-}
-
-/* [Name]:       UArray2b_map
- * [Purpose]:    Map function for UArray2b that does block-major mapping
- * [Parameters]: 1 T (uarray2b), 1 apply function, 1 void* (closure)
- * [Return]:     void
- */
-void UArray2b_map(T uarray2b, void apply(int col, int row, T uarray2b,
-                                        void *elem, void *cl), void *cl)
-{
-        UArray2_T uarray2 = uarray2b->blocks;
-        int blocksize  = uarray2b->blocksize;
-        int height     = uarray2b->height;
-        int width      = uarray2b->width;
-        int uarray2_w  = UArray2_width(uarray2);
-        int uarray2_h  = UArray2_height(uarray2);
-
-        int blk_h = 0;
-        int blk_w = 0;
-
-        for (int blk_row = 0; blk_row < uarray2_h; blk_row++) {
-                if (blk_row == uarray2_h - 1 && (height % blocksize) != 0) {
-                        blk_h = height % blocksize;
-                } else {
-                        blk_h = blocksize;
-                }
-
-                for (int blk_col = 0; blk_col < uarray2_w; blk_col++) {
-                        if (blk_col == uarray2_w - 1 &&
-                            (width % blocksize) != 0) {
-                                blk_w = width % blocksize;
-                        } else {
-                                blk_w = blocksize;
-                        }
-
-                        for (int y = 0; y < blk_h; y++) {
-                                for (int x = 0; x < blk_w; x++) {
-                                        int cell_col = blk_col * blocksize + x;
-                                        int cell_row = blk_row * blocksize + y;
-                                        apply(cell_col, cell_row, uarray2b,
-                                              UArray2b_at(uarray2b,
-                                              cell_col, cell_row), cl);
-                                }
-                        }
-                }
-        }
+/*
+ *      uarray2b.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Unboxed 2D array that is polymorphic in data storage
+ *      - Implements block-major mapping, with user-specified tile width and
+ *        height (square blocks of a blocksize are the usual case)
+ *      - All blocks live in one contiguous allocation (or in caller-provided
+ *        storage, e.g. a mapped file), tile after tile in block row-major
+ *        order; each block of the grid holds a pointer to its tile
+ *      - Tiles along the right and bottom edges are not padded: an edge
+ *        tile holds just the cells inside the array, row by row, so its
+ *        rows are only as long as the tile is wide
+ *      - A sparse array allocates each tile separately instead; a tile
+ *        whose pointer is NULL is uniform, and its one value is kept in a
+ *        per-block value array. The first at() on a uniform tile expands it,
+ *        publishing the new tile with compare-and-swap so that concurrent
+ *        expansions agree on one copy.
+ *      - A transpose/mirror of the whole array (UArray2b_transform) works
+ *        at two levels: the block grid is permuted and each tile is
+ *        transformed on its own, so only one or two tiles are in use at a
+ *        time. When the tiles line up after the transformation, each tile
+ *        is rewritten in its own storage through one scratch tile and its
+ *        block pointer moved, so no second array is allocated.
+ */
+
+#include "assert.h"
+#include "mem.h"
+#include "pool.h"
+#include "uarray2.h"
+#include "uarray2b.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define T UArray2b_T
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+
+/* Initialization Functions */
+void UArray2b_init(T uarray2b, int width, int height, int size,
+                   int tile_width, int tile_height, char *storage);
+void blocks_init(T uarray2b);
+void cell_init(int col, int row, UArray2_T uarray2, void *elem, void *cl);
+
+/* Sparse Tile Functions */
+char *expand_tile(T uarray2b, char **block, int blk_col, int blk_row);
+int   tile_is_uniform(T uarray2b, int blk_col, int blk_row);
+
+/* Transformation Functions */
+static void move_tiles(T source, T result, int transpose, int mirror_cols,
+                       int mirror_rows);
+static void copy_tiles(T source, T result, int transpose, int mirror_cols,
+                       int mirror_rows);
+static void copy_run  (char *dest, const char *source, int count,
+                       long step, int size);
+
+/* Cell budget of UArray2b_new_64K_block's tiles, if set (> 0) */
+static long default_cells = 0;
+
+/* Complete struct for UArray2b representation */
+struct T {
+        int width, height;
+        int size;
+        int tile_w, tile_h;     /* full tiles; edge tiles may be smaller */
+        int edge_w, edge_h;     /* columns of the last block column, rows
+                                   of the last block row                 */
+        UArray2_T blocks;       /* UArray2_T of char*, one per block,
+                                   each pointing at its tile in storage */
+        char *storage;          /* every tile, in block row-major order  */
+        int   owner;            /* 1 if storage was allocated here       */
+        int   sparse;           /* tiles allocated one by one; NULL tile
+                                   pointers mark uniform tiles           */
+        char *values;           /* sparse: each block's uniform value    */
+        void (*release)(void *storage, void *cl);
+        void *release_cl;
+};
+
+/*---------------------------------------------------------------
+ |             Constructors / Destructors                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       UArray2b_new
+ * [Purpose]:    Allocates memory for a 2D blocked array with user-specified
+ *               dimensions and blocksize
+ * [Parameters]: 4 ints (width, height, size of each data elem in bytes),
+ *               blocksize)
+ * [Return]:     Opaque representation of a UArray2b
+ */
+T UArray2b_new (int width, int height, int size, int blocksize)
+{
+        return UArray2b_new_tiled(width, height, size, blocksize, blocksize);
+}
+
+/* [Name]:       UArray2b_new_tiled
+ * [Purpose]:    Allocates memory for a 2D blocked array with user-specified
+ *               dimensions and tile_width x tile_height tiles
+ * [Parameters]: 5 ints (width, height, size of each data elem in bytes,
+ *               tile_width, tile_height)
+ * [Return]:     Opaque representation of a UArray2b
+ */
+T UArray2b_new_tiled(int width, int height, int size, int tile_width,
+                     int tile_height)
+{
+        T uarray2b;
+
+        NEW(uarray2b);
+        uarray2b->sparse = 0;
+        UArray2b_init(uarray2b, width, height, size, tile_width, tile_height,
+                      NULL);
+
+        return uarray2b;
+}
+
+/* [Name]:       UArray2b_new_64K_block
+ * [Purpose]:    Allocates memory for a 2D blocked array with user-specified
+ *               dimensions and tiles that can fit within a 64kb cache, if
+ *               possible, or of the cell budget set with
+ *               UArray2b_set_default_tile
+ * [Parameters]: 3 ints (width, height, size of each data elem in bytes)
+ * [Return]:     Opaque representation of a UArray2b
+ */
+T UArray2b_new_64K_block(int width, int height, int size)
+{
+        int tile_width, tile_height;
+
+        if (default_cells > 0) {
+                UArray2b_fit_tile(width, height, default_cells, &tile_width,
+                                  &tile_height);
+        } else {
+                UArray2b_tile_64K(width, height, size, &tile_width,
+                                  &tile_height);
+        }
+        return UArray2b_new_tiled(width, height, size, tile_width,
+                                  tile_height);
+}
+
+/* [Name]:       UArray2b_set_default_tile
+ * [Purpose]:    Sets the cell budget UArray2b_new_64K_block fits its tiles
+ *               to, so a caller can size the blocked methods' tiles (e.g.
+ *               to its cache) without replacing the methods suite; each
+ *               array's tile is fitted to its own shape, so a destination
+ *               with swapped sides gets the source's tile transposed
+ * [Parameters]: 1 long (cells; 0 restores the 64kb tiles)
+ * [Return]:     void
+ */
+void UArray2b_set_default_tile(long cells)
+{
+        default_cells = cells > 0 ? cells : 0;
+}
+
+/* [Name]:       UArray2b_new_sparse
+ * [Purpose]:    Creates a 2D blocked array whose tiles are allocated
+ *               individually on first access; until then every tile is
+ *               uniform with all-zero cells, and takes no tile memory
+ * [Parameters]: 5 ints (width, height, size of each data elem in bytes,
+ *               tile_width, tile_height)
+ * [Return]:     Opaque representation of a UArray2b
+ */
+T UArray2b_new_sparse(int width, int height, int size, int tile_width,
+                      int tile_height)
+{
+        T uarray2b;
+
+        NEW(uarray2b);
+        uarray2b->sparse = 1;
+        UArray2b_init(uarray2b, width, height, size, tile_width, tile_height,
+                      NULL);
+
+        return uarray2b;
+}
+
+/* [Name]:       UArray2b_wrap
+ * [Purpose]:    Creates a 2D blocked array whose tiles live in
+ *               caller-provided storage (e.g. a mapped file) laid out tile
+ *               after tile in block row-major order, edge tiles unpadded.
+ *               The storage is not copied.
+ * [Parameters]: 5 ints (width, height, size of each data elem in bytes,
+ *               tile_width, tile_height), 1 void* (storage), 1 release
+ *               function (called with storage and cl when the array is
+ *               freed; may be NULL), 1 void* (cl)
+ * [Return]:     Opaque representation of a UArray2b
+ */
+T UArray2b_wrap(int width, int height, int size, int tile_width,
+                int tile_height, void *storage,
+                void release(void *storage, void *cl), void *cl)
+{
+        T uarray2b;
+
+        assert(storage != NULL);
+
+        NEW(uarray2b);
+        uarray2b->sparse = 0;
+        UArray2b_init(uarray2b, width, height, size, tile_width, tile_height,
+                      storage);
+        uarray2b->release    = release;
+        uarray2b->release_cl = cl;
+
+        return uarray2b;
+}
+
+/* [Name]:       UArray2b_tile_64K
+ * [Purpose]:    Computes the tile UArray2b_new_64K_block would pick: the
+ *               largest whose cells fit within a 64kb cache
+ * [Parameters]: 3 ints (width, height, size of each data elem in bytes),
+ *               2 int* (tile_width, tile_height; set)
+ * [Return]:     void
+ */
+void UArray2b_tile_64K(int width, int height, int size, int *tile_width,
+                       int *tile_height)
+{
+        UArray2b_fit_tile(width, height, 64000 / size, tile_width,
+                          tile_height);
+}
+
+/* [Name]:       UArray2b_fit_tile
+ * [Purpose]:    Computes the largest tile of at most cells cells for a
+ *               width x height array. The tile is square when both sides
+ *               of the array are at least its side; otherwise it spans the
+ *               short side and runs along the long one, so a long, thin
+ *               array still gets full-sized tiles rather than tiny squares
+ * [Parameters]: 2 ints (width, height), 1 long (cells), 2 int*
+ *               (tile_width, tile_height; set)
+ * [Return]:     void
+ */
+void UArray2b_fit_tile(int width, int height, long cells, int *tile_width,
+                       int *tile_height)
+{
+        int side = cells < 1 ? 1 : (int)sqrt((double)cells);
+
+        if (side <= width && side <= height) {
+                *tile_width  = side;
+                *tile_height = side;
+        } else if (height < width) {
+                *tile_height = height;
+                *tile_width  = cells / height < width ? cells / height
+                                                      : width;
+        } else {
+                *tile_width  = width;
+                *tile_height = cells / width < height ? cells / width
+                                                      : height;
+        }
+        *tile_width  = *tile_width  < 1 ? 1 : *tile_width;
+        *tile_height = *tile_height < 1 ? 1 : *tile_height;
+}
+
+/* [Name]:       UArray2b_init
+ * [Purpose]:    Initializes the metadata in the UArray2b representation;
+ *               tile sides longer than the array are cut to fit it
+ * [Parameters]: 1 T (uarray2b), 5 ints (width, height, size of data element,
+ *               tile_width, tile_height), 1 char* (storage for the tiles,
+ *               or NULL to allocate it)
+ * [Return]:     void
+ */
+void UArray2b_init(T uarray2b, int width, int height, int size,
+                   int tile_width, int tile_height, char *storage)
+{
+        assert(width > 0 && height > 0 && size > 0);
+        assert(tile_width > 0 && tile_height > 0);
+
+        tile_width  = tile_width  < width  ? tile_width  : width;
+        tile_height = tile_height < height ? tile_height : height;
+
+        uarray2b->width      = width;
+        uarray2b->height     = height;
+        uarray2b->size       = size;
+        uarray2b->tile_w     = tile_width;
+        uarray2b->tile_h     = tile_height;
+        uarray2b->edge_w     = width  - (width  - 1) / tile_width  * tile_width;
+        uarray2b->edge_h     = height - (height - 1) / tile_height *
+                               tile_height;
+        uarray2b->storage    = storage;
+        uarray2b->owner      = storage == NULL && !uarray2b->sparse;
+        uarray2b->values     = NULL;
+        uarray2b->release    = NULL;
+        uarray2b->release_cl = NULL;
+
+        blocks_init(uarray2b);
+}
+
+/* [Name]:       blocks_init
+ * [Purpose]:    Allocates the tile storage (unless provided) and points each
+ *               block within the UArray2b at its tile
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     void
+ */
+void blocks_init(T uarray2b)
+{
+        int blocks_h = (int)ceil((double)uarray2b->height /
+                                 (double)uarray2b->tile_h);
+        int blocks_w = (int)ceil((double)uarray2b->width /
+                                 (double)uarray2b->tile_w);
+
+        if (uarray2b->sparse) {
+                uarray2b->values = CALLOC((long)blocks_w * blocks_h,
+                                          uarray2b->size);
+        } else if (uarray2b->storage == NULL) {
+                uarray2b->storage = Pool_calloc((long)uarray2b->width *
+                                                uarray2b->height,
+                                                uarray2b->size);
+        }
+
+        uarray2b->blocks = UArray2_new(blocks_w, blocks_h, sizeof(char *));
+        UArray2_map_row_major(uarray2b->blocks, cell_init, uarray2b);
+}
+
+/* [Name]:       cell_init
+ * [Purpose]:    Points each block within the UArray2b at its tile: a row
+ *               of blocks starts after every full row of blocks above it,
+ *               and a tile after the tiles to its left in the same row
+ * [Parameters]: 2 ints (col and row coordinates of the current block),
+ *               UArray2_T (uarray2 representation of all blocks),
+ *               2 void* (block at (col, row), closure)
+ * [Return]:     void
+ */
+void cell_init(int col, int row, UArray2_T uarray2, void *elem, void *cl)
+{
+        T uarray2b   = (T) cl;
+        char **block = (char **)elem;
+        int rows     = row == UArray2_height(uarray2) - 1 ? uarray2b->edge_h
+                                                         : uarray2b->tile_h;
+
+        if (uarray2b->sparse) {
+                *block = NULL;          /* uniform until first written */
+                return;
+        }
+        *block = uarray2b->storage + uarray2b->size *
+                 ((long)row * uarray2b->tile_h * uarray2b->width +
+                  (long)col * uarray2b->tile_w * rows);
+}
+
+/* [Name]:       UArray2b_free
+ * [Purpose]:    Frees the heap allocated memory of uarray2b, and hands
+ *               caller-provided storage back to its release function
+ * [Parameters]: 1 T* (uarray2b)
+ * [Return]:     void
+ */
+void UArray2b_free(T *uarray2b)
+{
+        assert(uarray2b != NULL && *uarray2b != NULL);
+
+        if ((*uarray2b)->sparse) {
+                UArray2_T blocks = (*uarray2b)->blocks;
+                for (int row = 0; row < UArray2_height(blocks); row++) {
+                        for (int col = 0; col < UArray2_width(blocks);
+                             col++) {
+                                char **block = UArray2_at(blocks, col, row);
+                                if (*block != NULL) {
+                                        FREE(*block);
+                                }
+                        }
+                }
+                FREE((*uarray2b)->values);
+        }
+        UArray2_free(&((*uarray2b)->blocks));
+        if ((*uarray2b)->owner) {
+                Pool_free((*uarray2b)->storage, (long)(*uarray2b)->width *
+                          (*uarray2b)->height * (*uarray2b)->size);
+        } else if ((*uarray2b)->release != NULL) {
+                (*uarray2b)->release((*uarray2b)->storage,
+                                     (*uarray2b)->release_cl);
+        }
+
+        FREE(*uarray2b);
+}
+
+/*---------------------------------------------------------------
+ |             UArray2b Metadata Functions                      |
+ *--------------------------------------------------------------*/
+/* [Name]:       UArray2b_width
+ * [Purpose]:    Returns width of uarray2b
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     Width of uarray2b
+ */
+int UArray2b_width(T uarray2b)
+{
+        assert(uarray2b != NULL);
+        return uarray2b->width;
+}
+
+/* [Name]:       UArray2b_height
+ * [Purpose]:    Returns height of uarray2b
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     Height of uarray2b
+ */
+int UArray2b_height (T uarray2b)
+{
+        assert(uarray2b != NULL);
+        return uarray2b->height;
+}
+
+/* [Name]:       UArray2b_size
+ * [Purpose]:    Returns the size of each data element of uarray2b
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     Size of each data element in uarray2b
+ */
+int UArray2b_size (T uarray2b)
+{
+        assert(uarray2b != NULL);
+        return uarray2b->size;
+}
+
+/* [Name]:       UArray2b_blocksize
+ * [Purpose]:    Returns blocksize of uarray2b (the shorter tile side, for
+ *               rectangular tiles)
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     Blocksize of uarray2b
+ */
+int UArray2b_blocksize(T uarray2b)
+{
+        assert(uarray2b != NULL);
+        return uarray2b->tile_w < uarray2b->tile_h ? uarray2b->tile_w
+                                                   : uarray2b->tile_h;
+}
+
+/* [Name]:       UArray2b_tile_width
+ * [Purpose]:    Returns the width of a full tile of uarray2b
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     Tile width, in cells
+ */
+int UArray2b_tile_width(T uarray2b)
+{
+        assert(uarray2b != NULL);
+        return uarray2b->tile_w;
+}
+
+/* [Name]:       UArray2b_tile_height
+ * [Purpose]:    Returns the height of a full tile of uarray2b
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     Tile height, in cells
+ */
+int UArray2b_tile_height(T uarray2b)
+{
+        assert(uarray2b != NULL);
+        return uarray2b->tile_h;
+}
+
+/* [Name]:       UArray2b_blocks_width
+ * [Purpose]:    Returns the number of blocks across uarray2b
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     Width of the block grid
+ */
+int UArray2b_blocks_width(T uarray2b)
+{
+        assert(uarray2b != NULL);
+        return UArray2_width(uarray2b->blocks);
+}
+
+/* [Name]:       UArray2b_blocks_height
+ * [Purpose]:    Returns the number of blocks down uarray2b
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     Height of the block grid
+ */
+int UArray2b_blocks_height(T uarray2b)
+{
+        assert(uarray2b != NULL);
+        return UArray2_height(uarray2b->blocks);
+}
+
+/* [Name]:       UArray2b_tile_bytes
+ * [Purpose]:    Returns the number of bytes in one full tile (edge tiles
+ *               hold fewer)
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     Bytes per full tile
+ */
+long UArray2b_tile_bytes(T uarray2b)
+{
+        assert(uarray2b != NULL);
+        return (long)uarray2b->tile_w * uarray2b->tile_h * uarray2b->size;
+}
+
+/* [Name]:       UArray2b_block_shape
+ * [Purpose]:    Returns the columns and rows of cells in one block; the
+ *               tile's rows are that many cells long
+ * [Parameters]: 1 T (uarray2b), 2 ints (block column and row), 2 int*
+ *               (columns, rows; set)
+ * [Return]:     void
+ */
+void UArray2b_block_shape(T uarray2b, int blk_col, int blk_row, int *columns,
+                          int *rows)
+{
+        assert(uarray2b != NULL);
+        *columns = blk_col == UArray2_width(uarray2b->blocks) - 1
+                   ? uarray2b->edge_w : uarray2b->tile_w;
+        *rows    = blk_row == UArray2_height(uarray2b->blocks) - 1
+                   ? uarray2b->edge_h : uarray2b->tile_h;
+}
+
+/*---------------------------------------------------------------
+ |                      Access Functions                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       UArray2b_at
+ * [Purpose]:    Returns the element at the given (col, row)
+ * [Parameters]: 1 T (uarray2b), 2 ints (col and row)
+ * [Return]:     void* pointing to element at given index
+ */
+void *UArray2b_at(T uarray2b, int col, int row)
+{
+        assert(uarray2b != NULL);
+        assert(col < uarray2b->width && row < uarray2b->height);
+
+        UArray2_T blocks = uarray2b->blocks;
+        int blk_col = col / uarray2b->tile_w;
+        int blk_row = row / uarray2b->tile_h;
+        int line    = blk_col == UArray2_width(blocks) - 1 ? uarray2b->edge_w
+                                                          : uarray2b->tile_w;
+        char **curr_block = UArray2_at(blocks, blk_col, blk_row);
+        char *tile = __atomic_load_n(curr_block, __ATOMIC_ACQUIRE);
+        if (tile == NULL) {
+                tile = expand_tile(uarray2b, curr_block, blk_col, blk_row);
+        }
+        return tile + (long)uarray2b->size *
+               ((long)line * (row - blk_row * uarray2b->tile_h) +
+                (col - blk_col * uarray2b->tile_w));
+}
+
+/* [Name]:       UArray2b_get
+ * [Purpose]:    Returns the element at the given (col, row) for reading; a
+ *               uniform tile answers with its value and stays uniform
+ * [Parameters]: 1 T (uarray2b), 2 ints (col and row)
+ * [Return]:     const void* pointing to the element (or the tile's value)
+ */
+const void *UArray2b_get(T uarray2b, int col, int row)
+{
+        assert(uarray2b != NULL);
+        assert(col < uarray2b->width && row < uarray2b->height);
+
+        int blk_col = col / uarray2b->tile_w;
+        int blk_row = row / uarray2b->tile_h;
+        int line    = blk_col == UArray2_width(uarray2b->blocks) - 1
+                      ? uarray2b->edge_w : uarray2b->tile_w;
+        char *tile = __atomic_load_n((char **)UArray2_at(uarray2b->blocks,
+                                                         blk_col, blk_row),
+                                     __ATOMIC_ACQUIRE);
+        if (tile == NULL) {
+                long index = (long)blk_row *
+                             UArray2_width(uarray2b->blocks) + blk_col;
+                return uarray2b->values + index * uarray2b->size;
+        }
+        return tile + (long)uarray2b->size *
+               ((long)line * (row - blk_row * uarray2b->tile_h) +
+                (col - blk_col * uarray2b->tile_w));
+}
+
+/* [Name]:       UArray2b_block
+ * [Purpose]:    Returns the tile of the block at (blk_col, blk_row); cells
+ *               are stored row by row, the block's columns cells per row
+ * [Parameters]: 1 T (uarray2b), 2 ints (block column and row)
+ * [Return]:     void* pointing to the first cell of the tile
+ */
+void *UArray2b_block(T uarray2b, int blk_col, int blk_row)
+{
+        assert(uarray2b != NULL);
+        char **block = UArray2_at(uarray2b->blocks, blk_col, blk_row);
+        char  *tile  = __atomic_load_n(block, __ATOMIC_ACQUIRE);
+        return tile != NULL ? tile
+                            : expand_tile(uarray2b, block, blk_col, blk_row);
+}
+
+/*---------------------------------------------------------------
+ |                    Sparse Tile Functions                     |
+ *--------------------------------------------------------------*/
+/* [Name]:       UArray2b_uniform
+ * [Purpose]:    Tells whether a tile is uniform
+ * [Parameters]: 1 T (uarray2b), 2 ints (block column and row)
+ * [Return]:     Pointer to the tile's value if it is uniform, else NULL
+ */
+const void *UArray2b_uniform(T uarray2b, int blk_col, int blk_row)
+{
+        assert(uarray2b != NULL);
+
+        if (!uarray2b->sparse ||
+            __atomic_load_n((char **)UArray2_at(uarray2b->blocks, blk_col,
+                                                blk_row),
+                            __ATOMIC_ACQUIRE) != NULL) {
+                return NULL;
+        }
+        long index = (long)blk_row * UArray2_width(uarray2b->blocks) +
+                     blk_col;
+        return uarray2b->values + index * uarray2b->size;
+}
+
+/* [Name]:       UArray2b_set_uniform
+ * [Purpose]:    Makes a tile of a sparse array uniform with the given
+ *               value, freeing its cells if it had any
+ * [Parameters]: 1 T (uarray2b), 2 ints (block column and row),
+ *               1 const void* (value, size bytes)
+ * [Return]:     void
+ */
+void UArray2b_set_uniform(T uarray2b, int blk_col, int blk_row,
+                          const void *value)
+{
+        assert(uarray2b != NULL && uarray2b->sparse && value != NULL);
+
+        char **block = UArray2_at(uarray2b->blocks, blk_col, blk_row);
+        long   index = (long)blk_row * UArray2_width(uarray2b->blocks) +
+                       blk_col;
+
+        memcpy(uarray2b->values + index * uarray2b->size, value,
+               uarray2b->size);
+        if (*block != NULL) {
+                FREE(*block);
+                *block = NULL;
+        }
+}
+
+/* [Name]:       UArray2b_compress
+ * [Purpose]:    Makes every tile of a sparse array whose cells inside the
+ *               array are all equal uniform, releasing its memory
+ * [Parameters]: 1 T (uarray2b)
+ * [Return]:     Number of uniform tiles afterwards
+ */
+long UArray2b_compress(T uarray2b)
+{
+        long uniform = 0;
+
+        assert(uarray2b != NULL && uarray2b->sparse);
+
+        for (int row = 0; row < UArray2_height(uarray2b->blocks); row++) {
+                uniform += UArray2b_compress_row(uarray2b, row);
+        }
+        return uniform;
+}
+
+/* [Name]:       UArray2b_compress_row
+ * [Purpose]:    UArray2b_compress for one row of blocks, so a decoder can
+ *               fold each block row as soon as it is filled
+ * [Parameters]: 1 T (uarray2b), 1 int (blk_row)
+ * [Return]:     Number of uniform tiles in the block row afterwards
+ */
+long UArray2b_compress_row(T uarray2b, int blk_row)
+{
+        long uniform = 0;
+
+        assert(uarray2b != NULL && uarray2b->sparse);
+        assert(blk_row >= 0 && blk_row < UArray2_height(uarray2b->blocks));
+
+        for (int col = 0; col < UArray2_width(uarray2b->blocks); col++) {
+                if (UArray2b_uniform(uarray2b, col, blk_row) != NULL) {
+                        uniform++;
+                } else if (tile_is_uniform(uarray2b, col, blk_row)) {
+                        UArray2b_set_uniform(uarray2b, col, blk_row,
+                                UArray2b_block(uarray2b, col, blk_row));
+                        uniform++;
+                }
+        }
+        return uniform;
+}
+
+/* [Name]:       expand_tile
+ * [Purpose]:    Gives a uniform tile its own cells, all set to its value,
+ *               and publishes them with compare-and-swap; if another
+ *               thread expanded the tile first, its copy is used instead
+ * [Parameters]: 1 T (uarray2b), 1 char** (block; its tile pointer),
+ *               2 ints (block column and row)
+ * [Return]:     The tile's cells
+ */
+char *expand_tile(T uarray2b, char **block, int blk_col, int blk_row)
+{
+        int   cols, rows;
+        long  cells;
+        long  index = (long)blk_row * UArray2_width(uarray2b->blocks) +
+                      blk_col;
+        char *value = uarray2b->values + index * uarray2b->size;
+        char *tile;
+        char *expected = NULL;
+
+        assert(uarray2b->sparse);
+
+        UArray2b_block_shape(uarray2b, blk_col, blk_row, &cols, &rows);
+        cells = (long)cols * rows;
+        tile  = ALLOC(cells * uarray2b->size);
+        for (long i = 0; i < cells; i++) {
+                memcpy(tile + i * uarray2b->size, value, uarray2b->size);
+        }
+        if (!__atomic_compare_exchange_n(block, &expected, tile, 0,
+                                         __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE)) {
+                FREE(tile);
+                tile = expected;
+        }
+        return tile;
+}
+
+/* [Name]:       tile_is_uniform
+ * [Purpose]:    Checks whether the cells of a tile are all equal
+ * [Parameters]: 1 T (uarray2b), 2 ints (block column and row)
+ * [Return]:     1 if uniform, 0 otherwise
+ */
+int tile_is_uniform(T uarray2b, int blk_col, int blk_row)
+{
+        int   size = uarray2b->size;
+        int   cols, rows;
+        char *tile = UArray2b_block(uarray2b, blk_col, blk_row);
+
+        UArray2b_block_shape(uarray2b, blk_col, blk_row, &cols, &rows);
+        for (long i = 1; i < (long)cols * rows; i++) {
+                if (memcmp(tile + i * size, tile, size) != 0) {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/*---------------------------------------------------------------
+ |                   Transformation Functions                   |
+ *--------------------------------------------------------------*/
+/* [Name]:       UArray2b_transform
+ * [Purpose]:    Replaces the array by itself transposed (if transpose),
+ *               then mirrored left to right (mirror_cols) and/or top to
+ *               bottom (mirror_rows); these make up every rotation and
+ *               flip. The result's tiles are the source's, transposed
+ *               with it. If every mirrored axis holds whole tiles, the
+ *               tiles keep their storage and the block grid is permuted;
+ *               otherwise a new array is filled a tile at a time.
+ * [Parameters]: 1 T* (uarray2b; not sparse, replaced), 3 ints (transpose,
+ *               mirror_cols, mirror_rows; nonzero applies)
+ * [Return]:     void
+ */
+void UArray2b_transform(T *uarray2b, int transpose, int mirror_cols,
+                        int mirror_rows)
+{
+        T source, result;
+
+        assert(uarray2b != NULL && *uarray2b != NULL);
+        assert(!(*uarray2b)->sparse);
+
+        source = *uarray2b;
+        if (!transpose && !mirror_cols && !mirror_rows) {
+                return;
+        }
+
+        int width  = transpose ? source->height : source->width;
+        int height = transpose ? source->width  : source->height;
+        int tile_w = transpose ? source->tile_h : source->tile_w;
+        int tile_h = transpose ? source->tile_w : source->tile_h;
+
+        NEW(result);
+        result->sparse = 0;
+        if (UArray2b_moves_in_place(source->width, source->height,
+                                    source->tile_w, source->tile_h,
+                                    transpose, mirror_cols, mirror_rows)) {
+                /* the result takes over the source's storage */
+                UArray2b_init(result, width, height, source->size, tile_w,
+                              tile_h, source->storage);
+                result->owner      = source->owner;
+                result->release    = source->release;
+                result->release_cl = source->release_cl;
+                source->owner      = 0;
+                source->release    = NULL;
+                move_tiles(source, result, transpose, mirror_cols,
+                           mirror_rows);
+        } else {
+                UArray2b_init(result, width, height, source->size, tile_w,
+                              tile_h, NULL);
+                copy_tiles(source, result, transpose, mirror_cols,
+                           mirror_rows);
+        }
+
+        UArray2b_free(&source);
+        *uarray2b = result;
+}
+
+/* [Name]:       UArray2b_moves_in_place
+ * [Purpose]:    Says whether UArray2b_transform can keep the tiles in
+ *               their storage: every mirrored axis of the result must hold
+ *               whole tiles, or the edge tiles would land out of place.
+ *               Tile sides longer than the array count as cut to fit it.
+ * [Parameters]: 4 ints (source width, height, tile_width, tile_height),
+ *               3 ints (transpose, mirror_cols, mirror_rows)
+ * [Return]:     1 if the tiles are moved in place, 0 if a second array is
+ *               filled
+ */
+int UArray2b_moves_in_place(int width, int height, int tile_width,
+                            int tile_height, int transpose, int mirror_cols,
+                            int mirror_rows)
+{
+        int result_w = transpose ? height      : width;
+        int result_h = transpose ? width       : height;
+        int tile_w   = transpose ? tile_height : tile_width;
+        int tile_h   = transpose ? tile_width  : tile_height;
+
+        assert(tile_w > 0 && tile_h > 0);
+        tile_w = tile_w < result_w ? tile_w : result_w;  /* cut to fit */
+        tile_h = tile_h < result_h ? tile_h : result_h;
+        return (!mirror_cols || result_w % tile_w == 0) &&
+               (!mirror_rows || result_h % tile_h == 0);
+}
+
+/* [Name]:       move_tiles
+ * [Purpose]:    Transforms each tile within its own storage (copied to a
+ *               scratch tile first, then written back transformed) and
+ *               points the result's block at it; every block of the result
+ *               is the image of exactly one source block
+ * [Parameters]: 2 T (source, result; result already shares the storage),
+ *               3 ints (transpose, mirror_cols, mirror_rows)
+ * [Return]:     void
+ */
+static void move_tiles(T source, T result, int transpose, int mirror_cols,
+                       int mirror_rows)
+{
+        int   size    = source->size;
+        int   grid_w  = UArray2_width(result->blocks);
+        int   grid_h  = UArray2_height(result->blocks);
+        char *scratch = ALLOC((long)source->tile_w * source->tile_h * size);
+
+        for (int blk_row = 0; blk_row < UArray2_height(source->blocks);
+             blk_row++) {
+                for (int blk_col = 0; blk_col < UArray2_width(source->blocks);
+                     blk_col++) {
+                        int   cols, rows;
+                        char *tile = *(char **)UArray2_at(source->blocks,
+                                                          blk_col, blk_row);
+                        UArray2b_block_shape(source, blk_col, blk_row, &cols,
+                                             &rows);
+                        memcpy(scratch, tile, (long)cols * rows * size);
+
+                        /* result cell (x, y) of this tile reads scratch
+                         * at u, v: x and y mirrored, then swapped */
+                        int  dest_cols = transpose ? rows : cols;
+                        int  dest_rows = transpose ? cols : rows;
+                        long step = (transpose ? cols : 1) *
+                                    (mirror_cols ? -1L : 1L) * size;
+                        for (int y = 0; y < dest_rows; y++) {
+                                int  u = mirror_cols ? dest_cols - 1 : 0;
+                                int  v = mirror_rows ? dest_rows - 1 - y : y;
+                                long first = transpose
+                                             ? (long)u * cols + v
+                                             : (long)v * cols + u;
+                                copy_run(tile + (long)y * dest_cols * size,
+                                         scratch + first * size, dest_cols,
+                                         step, size);
+                        }
+
+                        int a = transpose ? blk_row : blk_col;
+                        int b = transpose ? blk_col : blk_row;
+                        *(char **)UArray2_at(result->blocks,
+                                             mirror_cols ? grid_w - 1 - a : a,
+                                             mirror_rows ? grid_h - 1 - b : b)
+                                = tile;
+                }
+        }
+        FREE(scratch);
+}
+
+/* [Name]:       copy_tiles
+ * [Purpose]:    Fills each tile of a new result in turn. Along a row of a
+ *               result tile the source cells form a run within a row or
+ *               column of source tiles; the run is copied a source tile at
+ *               a time, so each result tile draws on at most four source
+ *               tiles
+ * [Parameters]: 2 T (source, result), 3 ints (transpose, mirror_cols,
+ *               mirror_rows)
+ * [Return]:     void
+ */
+static void copy_tiles(T source, T result, int transpose, int mirror_cols,
+                       int mirror_rows)
+{
+        int size = source->size;
+        int dir  = mirror_cols ? -1 : 1;   /* source steps per result col */
+
+        for (int blk_row = 0; blk_row < UArray2_height(result->blocks);
+             blk_row++) {
+                for (int blk_col = 0; blk_col < UArray2_width(result->blocks);
+                     blk_col++) {
+                        int   dest_cols, dest_rows;
+                        char *dest = UArray2b_block(result, blk_col, blk_row);
+                        UArray2b_block_shape(result, blk_col, blk_row,
+                                             &dest_cols, &dest_rows);
+                        for (int y = 0; y < dest_rows; y++) {
+                                int row = blk_row * result->tile_h + y;
+                                int v   = mirror_rows ? result->height - 1 -
+                                                        row : row;
+                                for (int x = 0; x < dest_cols; ) {
+                                        int col = blk_col * result->tile_w + x;
+                                        int u   = mirror_cols
+                                                  ? result->width - 1 - col
+                                                  : col;
+                                        int sc  = transpose ? v : u;
+                                        int sr  = transpose ? u : v;
+                                        int bc  = sc / source->tile_w;
+                                        int br  = sr / source->tile_h;
+                                        int cols, rows;
+                                        UArray2b_block_shape(source, bc, br,
+                                                             &cols, &rows);
+                                        int lc  = sc - bc * source->tile_w;
+                                        int lr  = sr - br * source->tile_h;
+                                        int along  = transpose ? lr : lc;
+                                        int extent = transpose ? rows : cols;
+                                        int run    = dir > 0 ? extent - along
+                                                             : along + 1;
+                                        if (run > dest_cols - x) {
+                                                run = dest_cols - x;
+                                        }
+                                        char *tile = *(char **)UArray2_at(
+                                                source->blocks, bc, br);
+                                        copy_run(dest + ((long)y * dest_cols +
+                                                         x) * size,
+                                                 tile + ((long)lr * cols +
+                                                         lc) * size,
+                                                 run, (transpose ? cols : 1) *
+                                                      (long)dir * size, size);
+                                        x += run;
+                                }
+                        }
+                }
+        }
+}
+
+/* [Name]:       copy_run
+ * [Purpose]:    Copies count cells to consecutive cells of dest from
+ *               source cells step bytes apart; 4- and 12-byte cells (PAM
+ *               and ppm pixels) are copied as fixed-size words
+ * [Parameters]: 1 char* (dest), 1 const char* (source), 1 int (count),
+ *               1 long (step, bytes), 1 int (size)
+ * [Return]:     void
+ */
+static void copy_run(char *dest, const char *source, int count, long step,
+                     int size)
+{
+        if (size == 4) {
+                for (int i = 0; i < count; i++, source += step) {
+                        ((uint32_t *)dest)[i] = *(const uint32_t *)source;
+                }
+        } else if (size == 12) {
+                for (int i = 0; i < count; i++, dest += 12, source += step) {
+                        memcpy(dest, source, 12);
+                }
+        } else {
+                for (int i = 0; i < count; i++, dest += size,
+                     source += step) {
+                        memcpy(dest, source, size);
+                }
+        }
+}
+
+/* [Name]:       UArray2b_map
+ * [Purpose]:    Map function for UArray2b that does block-major mapping
+ * [Parameters]: 1 T (uarray2b), 1 apply function, 1 void* (closure)
+ * [Return]:     void
+ */
+void UArray2b_map(T uarray2b, void apply(int col, int row, T uarray2b,
+                                        void *elem, void *cl), void *cl)
+{
+        UArray2_T uarray2 = uarray2b->blocks;
+        int uarray2_w  = UArray2_width(uarray2);
+        int uarray2_h  = UArray2_height(uarray2);
+
+        int blk_h = 0;
+        int blk_w = 0;
+
+        for (int blk_row = 0; blk_row < uarray2_h; blk_row++) {
+                for (int blk_col = 0; blk_col < uarray2_w; blk_col++) {
+                        UArray2b_block_shape(uarray2b, blk_col, blk_row,
+                                             &blk_w, &blk_h);
+
+                        for (int y = 0; y < blk_h; y++) {
+                                for (int x = 0; x < blk_w; x++) {
+                                        int cell_col = blk_col *
+                                                       uarray2b->tile_w + x;
+                                        int cell_row = blk_row *
+                                                       uarray2b->tile_h + y;
+                                        apply(cell_col, cell_row, uarray2b,
+                                              UArray2b_at(uarray2b,
+                                              cell_col, cell_row), cl);
+                                }
+                        }
+                }
+        }
 }
\ No newline at end of file
@@ -0,0 +1,109 @@
+#ifndef UARRAY2B_INCLUDED
+#define UARRAY2B_INCLUDED
+
+#define T UArray2b_T
+typedef struct T *T;
+
+extern T    UArray2b_new (int width, int height, int size, int blocksize);
+  /* new blocked 2d array: blocksize = square root of # of cells in block */
+extern T    UArray2b_new_tiled(int width, int height, int size,
+                               int tile_width, int tile_height);
+  /* new blocked 2d array of tile_width x tile_height tiles. Tile sides
+     longer than the array are cut to fit it, and the tiles along the
+     right and bottom edges hold only the cells inside the array */
+extern T    UArray2b_new_64K_block(int width, int height, int size);
+  /* new blocked 2d array: tiles as large as possible provided a tile
+     occupies at most 64KB (if possible), or holds at most the cells set
+     by UArray2b_set_default_tile */
+extern void UArray2b_set_default_tile(long cells);
+  /* cell budget UArray2b_new_64K_block fits its tiles to from now on
+     (and so the blocked methods' new); 0 restores 64KB tiles */
+extern T    UArray2b_wrap(int width, int height, int size, int tile_width,
+                          int tile_height, void *storage,
+                          void release(void *storage, void *cl), void *cl);
+  /* new blocked 2d array over caller-provided storage holding every tile
+     in block row-major order, laid out as UArray2b_new_tiled lays them
+     out (width * height cells in all); release, if not NULL, is called
+     with storage and cl when the array is freed */
+extern void UArray2b_fit_tile(int width, int height, long cells,
+                              int *tile_width, int *tile_height);
+  /* the largest tile of at most cells cells for a width x height array:
+     square if the array allows, else as long as the short side of the
+     array and stretched along the long side */
+extern void UArray2b_tile_64K(int width, int height, int size,
+                              int *tile_width, int *tile_height);
+  /* the tile UArray2b_new_64K_block would choose */
+extern T    UArray2b_new_sparse(int width, int height, int size,
+                                int tile_width, int tile_height);
+  /* new blocked 2d array whose tiles are allocated one by one, and only
+     when needed: a tile may instead be "uniform", one value standing for
+     every cell. All tiles start uniform (zero). */
+
+extern void  UArray2b_free     (T *array2b);
+
+extern int   UArray2b_width    (T  array2b);
+extern int   UArray2b_height   (T  array2b);
+extern int   UArray2b_size     (T  array2b);
+extern int   UArray2b_blocksize(T  array2b);
+  /* the shorter side of a tile */
+extern int   UArray2b_tile_width (T array2b);
+extern int   UArray2b_tile_height(T array2b);
+
+extern int   UArray2b_blocks_width (T array2b);
+extern int   UArray2b_blocks_height(T array2b);
+extern long  UArray2b_tile_bytes   (T array2b);
+  /* shape of the block grid, and bytes per full (not edge) tile */
+extern void  UArray2b_block_shape  (T array2b, int blk_col, int blk_row,
+                                    int *columns, int *rows);
+  /* the cells of the given block: full tiles are tile_width x
+     tile_height, edge tiles only as wide or tall as the array allows */
+
+extern void *UArray2b_at(T array2b, int column, int row);
+  /* return a pointer to the cell in the given column and row.
+     index out of range is a checked run-time error
+   */
+extern void *UArray2b_block(T array2b, int blk_col, int blk_row);
+  /* return a pointer to the tile of the given block; cells are stored
+     row by row, as many cells per row as UArray2b_block_shape's columns */
+
+extern const void *UArray2b_get(T array2b, int column, int row);
+  /* like UArray2b_at, but read only: a uniform tile is not expanded */
+extern const void *UArray2b_uniform(T array2b, int blk_col, int blk_row);
+  /* the value of a uniform tile, or NULL if the tile holds cells */
+extern void  UArray2b_set_uniform(T array2b, int blk_col, int blk_row,
+                                  const void *value);
+  /* make a tile of a sparse array uniform, freeing its cells; not safe
+     against concurrent access to the same tile */
+extern long  UArray2b_compress(T array2b);
+  /* make every tile of a sparse array whose cells (inside the array) are
+     all equal uniform; returns the number of uniform tiles */
+extern long  UArray2b_compress_row(T array2b, int blk_row);
+  /* UArray2b_compress for one row of blocks; safe while other threads
+     write other block rows */
+
+/* UArray2b_at and UArray2b_block expand a uniform tile (allocate it and
+   fill it with its value) first, since the caller may write through the
+   pointer; concurrent expansions of one tile agree on a single copy */
+
+extern void  UArray2b_transform(T *array2b, int transpose,
+                               int mirror_cols, int mirror_rows);
+  /* replace a (non-sparse) array by itself transposed, then mirrored
+     left to right and/or top to bottom. Tiles are transposed with the
+     array; where the tiles line up afterwards they are rewritten in
+     place and only the block grid is rebuilt */
+extern int   UArray2b_moves_in_place(int width, int height, int tile_width,
+                                     int tile_height, int transpose,
+                                     int mirror_cols, int mirror_rows);
+  /* whether UArray2b_transform rewrites the tiles of a width x height
+     array of tile_width x tile_height tiles in their own storage (1), or
+     fills a second array (0) */
+
+extern void  UArray2b_map(T array2b, 
+    void apply(int col, int row, T array2b, void *elem, void *cl), void *cl);
+      /* visits every cell in one block before moving to another block */
+
+/* it is a checked run-time error to pass a NULL T
+   to any function in this interface */
+
+#undef T
+#endif
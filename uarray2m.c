@@ -0,0 +1,408 @@
+/*
+ *      uarray2m.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Unboxed 2D array that is polymorphic in data storage, stored in
+ *        Morton (Z) order: nearby cells are nearby in memory at every
+ *        scale, so no blocksize has to be picked for any one cache
+ *      - The array is covered by a row-major grid of side x side squares
+ *        (side a power of two); a cell's index within its square is its
+ *        column and row with their bits interleaved (column in the even
+ *        bits, row in the odd bits)
+ *      - Interleaving uses the BMI2 pdep/pext instructions when the
+ *        processor has them (checked once at startup, so the default
+ *        build uses them too), and shifts and masks otherwise
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "assert.h"
+#include "mem.h"
+#include "pool.h"
+#include "uarray2m.h"
+
+/* pdep/pext are compiled in when the build targets them everywhere, or
+ * compiled for BMI2 alone and picked at run time on other x86-64 builds */
+#if defined(__BMI2__)
+#define BMI2_ALWAYS
+#elif defined(__x86_64__) && defined(__GNUC__)
+#define BMI2_DISPATCH
+#endif
+
+#if defined(BMI2_ALWAYS) || defined(BMI2_DISPATCH)
+#include <immintrin.h>
+#endif
+
+#define T UArray2m_T
+
+#define EVEN_BITS 0x5555555555555555ull        /* column bits of an index */
+#define ODD_BITS  0xaaaaaaaaaaaaaaaaull        /* row bits of an index    */
+
+/* Complete struct for UArray2m representation */
+struct T {
+        int   width, height;
+        int   size;
+        int   bits;             /* side of the squares is 1 << bits      */
+        int   squares_w, squares_h;
+        char *storage;          /* every square, in row-major order      */
+};
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static int      square_bits(int width, int height);
+static uint64_t interleave (uint32_t col, uint32_t row);
+static uint32_t even_bits  (uint64_t index);
+static void     hilbert_cell(uint64_t d, int bits, int *x, int *y);
+
+#if defined(BMI2_DISPATCH)
+static int      has_bmi2;       /* set once, before main */
+
+static void     detect_bmi2    (void) __attribute__((constructor));
+static uint64_t interleave_bmi2(uint32_t col, uint32_t row)
+                __attribute__((target("bmi2")));
+static uint32_t even_bits_bmi2 (uint64_t index)
+                __attribute__((target("bmi2")));
+#endif
+
+/*---------------------------------------------------------------
+ |             Constructors / Destructors                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       UArray2m_new
+ * [Purpose]:    Allocates memory for a Morton-ordered 2D array with
+ *               user-specified dimensions
+ * [Parameters]: 3 ints (width, height, size of each data elem in bytes)
+ * [Return]:     Opaque representation of a UArray2m
+ */
+T UArray2m_new(int width, int height, int size)
+{
+        T uarray2m;
+
+        assert(width > 0 && height > 0 && size > 0);
+
+        NEW(uarray2m);
+        uarray2m->width     = width;
+        uarray2m->height    = height;
+        uarray2m->size      = size;
+        uarray2m->bits      = square_bits(width, height);
+        uarray2m->squares_w = ((width  - 1) >> uarray2m->bits) + 1;
+        uarray2m->squares_h = ((height - 1) >> uarray2m->bits) + 1;
+        uarray2m->storage   = Pool_calloc(((long)uarray2m->squares_w *
+                                           uarray2m->squares_h) <<
+                                          (2 * uarray2m->bits), size);
+
+        return uarray2m;
+}
+
+/* [Name]:       square_bits
+ * [Purpose]:    Picks the side of the squares: the largest power of two no
+ *               longer than needed to cover the short side of the array,
+ *               whose padding past the edges stays within a quarter of
+ *               the array's cells (a side of 1 never pads)
+ * [Parameters]: 2 ints (width, height)
+ * [Return]:     log2 of the side
+ */
+static int square_bits(int width, int height)
+{
+        long cells = (long)width * height;
+        int  short_side = width < height ? width : height;
+        int  bits = 0;
+
+        while ((1L << bits) < short_side) {
+                bits++;
+        }
+        for (; bits > 0; bits--) {
+                long side   = 1L << bits;
+                long padded = ((width  + side - 1) / side) *
+                              ((height + side - 1) / side) * side * side;
+                if (padded <= cells + cells / 4) {
+                        break;
+                }
+        }
+        return bits;
+}
+
+/* [Name]:       UArray2m_free
+ * [Purpose]:    Frees the heap allocated memory of uarray2m
+ * [Parameters]: 1 T* (uarray2m)
+ * [Return]:     void
+ */
+void UArray2m_free(T *uarray2m)
+{
+        assert(uarray2m != NULL && *uarray2m != NULL);
+
+        Pool_free((*uarray2m)->storage,
+                  (((long)(*uarray2m)->squares_w * (*uarray2m)->squares_h) <<
+                   (2 * (*uarray2m)->bits)) * (*uarray2m)->size);
+        FREE(*uarray2m);
+}
+
+/*---------------------------------------------------------------
+ |             UArray2m Metadata Functions                      |
+ *--------------------------------------------------------------*/
+/* [Name]:       UArray2m_width
+ * [Purpose]:    Returns width of uarray2m
+ * [Parameters]: 1 T (uarray2m)
+ * [Return]:     Width of uarray2m
+ */
+int UArray2m_width(T uarray2m)
+{
+        assert(uarray2m != NULL);
+        return uarray2m->width;
+}
+
+/* [Name]:       UArray2m_height
+ * [Purpose]:    Returns height of uarray2m
+ * [Parameters]: 1 T (uarray2m)
+ * [Return]:     Height of uarray2m
+ */
+int UArray2m_height(T uarray2m)
+{
+        assert(uarray2m != NULL);
+        return uarray2m->height;
+}
+
+/* [Name]:       UArray2m_size
+ * [Purpose]:    Returns the size of each data element of uarray2m
+ * [Parameters]: 1 T (uarray2m)
+ * [Return]:     Size of each data element in uarray2m
+ */
+int UArray2m_size(T uarray2m)
+{
+        assert(uarray2m != NULL);
+        return uarray2m->size;
+}
+
+/* [Name]:       UArray2m_side
+ * [Purpose]:    Returns the side of the Morton squares of uarray2m
+ * [Parameters]: 1 T (uarray2m)
+ * [Return]:     Side, a power of two
+ */
+int UArray2m_side(T uarray2m)
+{
+        assert(uarray2m != NULL);
+        return 1 << uarray2m->bits;
+}
+
+/*---------------------------------------------------------------
+ |                      Access Functions                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       UArray2m_at
+ * [Purpose]:    Returns the element at the given (col, row): its square's
+ *               offset plus the interleaved bits of its position within
+ *               the square
+ * [Parameters]: 1 T (uarray2m), 2 ints (col and row)
+ * [Return]:     void* pointing to element at given index
+ */
+void *UArray2m_at(T uarray2m, int col, int row)
+{
+        assert(uarray2m != NULL);
+        assert(col >= 0 && col < uarray2m->width);
+        assert(row >= 0 && row < uarray2m->height);
+
+        int      bits   = uarray2m->bits;
+        uint32_t mask   = (1u << bits) - 1;
+        uint64_t square = (uint64_t)(row >> bits) * uarray2m->squares_w +
+                          (col >> bits);
+        uint64_t index  = square << (2 * bits) | interleave(col & mask,
+                                                            row & mask);
+
+        return uarray2m->storage + index * uarray2m->size;
+}
+
+/* [Name]:       UArray2m_map_morton
+ * [Purpose]:    Map function for UArray2m that visits the cells in storage
+ *               order: square by square, and within a square along the Z
+ *               curve, skipping the padding past the array's edges
+ * [Parameters]: 1 T (uarray2m), 1 apply function, 1 void* (closure)
+ * [Return]:     void
+ */
+void UArray2m_map_morton(T uarray2m, void apply(int col, int row,
+                                                T uarray2m, void *elem,
+                                                void *cl), void *cl)
+{
+        assert(uarray2m != NULL);
+
+        int      bits  = uarray2m->bits;
+        uint64_t cells = 1ull << (2 * bits);
+        char    *elem  = uarray2m->storage;
+
+        for (int sq_row = 0; sq_row < uarray2m->squares_h; sq_row++) {
+                for (int sq_col = 0; sq_col < uarray2m->squares_w;
+                     sq_col++) {
+                        int col0 = sq_col << bits;
+                        int row0 = sq_row << bits;
+                        for (uint64_t i = 0; i < cells; i++) {
+                                int col = col0 + even_bits(i);
+                                int row = row0 + even_bits(i >> 1);
+                                if (col < uarray2m->width &&
+                                    row < uarray2m->height) {
+                                        apply(col, row, uarray2m, elem, cl);
+                                }
+                                elem += uarray2m->size;
+                        }
+                }
+        }
+}
+
+/* [Name]:       UArray2m_map_hilbert
+ * [Purpose]:    Map function for UArray2m that visits each square along a
+ *               Hilbert curve, squares in row-major order; each curve ends
+ *               next to where the one in the square to its right begins
+ * [Parameters]: 1 T (uarray2m), 1 apply function, 1 void* (closure)
+ * [Return]:     void
+ */
+void UArray2m_map_hilbert(T uarray2m, void apply(int col, int row,
+                                                 T uarray2m, void *elem,
+                                                 void *cl), void *cl)
+{
+        assert(uarray2m != NULL);
+
+        int      bits  = uarray2m->bits;
+        uint64_t cells = 1ull << (2 * bits);
+
+        for (int sq_row = 0; sq_row < uarray2m->squares_h; sq_row++) {
+                for (int sq_col = 0; sq_col < uarray2m->squares_w;
+                     sq_col++) {
+                        int col0 = sq_col << bits;
+                        int row0 = sq_row << bits;
+                        for (uint64_t d = 0; d < cells; d++) {
+                                int x, y;
+                                hilbert_cell(d, bits, &x, &y);
+                                if (col0 + x < uarray2m->width &&
+                                    row0 + y < uarray2m->height) {
+                                        apply(col0 + x, row0 + y, uarray2m,
+                                              UArray2m_at(uarray2m,
+                                                          col0 + x,
+                                                          row0 + y), cl);
+                                }
+                        }
+                }
+        }
+}
+
+/*---------------------------------------------------------------
+ |                      Curve Helpers                           |
+ *--------------------------------------------------------------*/
+/* [Name]:       interleave
+ * [Purpose]:    Spreads col over the even bits and row over the odd bits
+ *               of a Morton index
+ * [Parameters]: 2 uint32_ts (col, row; within a square)
+ * [Return]:     Morton index
+ */
+static uint64_t interleave(uint32_t col, uint32_t row)
+{
+#if defined(BMI2_ALWAYS)
+        return _pdep_u64(col, EVEN_BITS) | _pdep_u64(row, ODD_BITS);
+#else
+#if defined(BMI2_DISPATCH)
+        if (has_bmi2) {
+                return interleave_bmi2(col, row);
+        }
+#endif
+        uint64_t x = col, y = row;
+
+        x = (x | x << 16) & 0x0000ffff0000ffffull;
+        x = (x | x << 8)  & 0x00ff00ff00ff00ffull;
+        x = (x | x << 4)  & 0x0f0f0f0f0f0f0f0full;
+        x = (x | x << 2)  & 0x3333333333333333ull;
+        x = (x | x << 1)  & EVEN_BITS;
+        y = (y | y << 16) & 0x0000ffff0000ffffull;
+        y = (y | y << 8)  & 0x00ff00ff00ff00ffull;
+        y = (y | y << 4)  & 0x0f0f0f0f0f0f0f0full;
+        y = (y | y << 2)  & 0x3333333333333333ull;
+        y = (y | y << 1)  & EVEN_BITS;
+        return x | y << 1;
+#endif
+}
+
+/* [Name]:       even_bits
+ * [Purpose]:    Gathers the even bits of a Morton index (the column; shift
+ *               the index right by one first for the row)
+ * [Parameters]: 1 uint64_t (index)
+ * [Return]:     The gathered bits
+ */
+static uint32_t even_bits(uint64_t index)
+{
+#if defined(BMI2_ALWAYS)
+        return _pext_u64(index, EVEN_BITS);
+#else
+#if defined(BMI2_DISPATCH)
+        if (has_bmi2) {
+                return even_bits_bmi2(index);
+        }
+#endif
+        uint64_t x = index & EVEN_BITS;
+
+        x = (x | x >> 1)  & 0x3333333333333333ull;
+        x = (x | x >> 2)  & 0x0f0f0f0f0f0f0f0full;
+        x = (x | x >> 4)  & 0x00ff00ff00ff00ffull;
+        x = (x | x >> 8)  & 0x0000ffff0000ffffull;
+        x = (x | x >> 16) & 0x00000000ffffffffull;
+        return x;
+#endif
+}
+
+#if defined(BMI2_DISPATCH)
+/* [Name]:       detect_bmi2
+ * [Purpose]:    Records whether the processor has BMI2; runs once before
+ *               main, so the flag is never written while arrays are in use
+ * [Parameters]: None
+ * [Return]:     void
+ */
+static void detect_bmi2(void)
+{
+        __builtin_cpu_init();
+        has_bmi2 = __builtin_cpu_supports("bmi2");
+}
+
+/* [Name]:       interleave_bmi2
+ * [Purpose]:    interleave with pdep; only called when has_bmi2 is set
+ * [Parameters]: 2 uint32_ts (col, row; within a square)
+ * [Return]:     Morton index
+ */
+static uint64_t interleave_bmi2(uint32_t col, uint32_t row)
+{
+        return _pdep_u64(col, EVEN_BITS) | _pdep_u64(row, ODD_BITS);
+}
+
+/* [Name]:       even_bits_bmi2
+ * [Purpose]:    even_bits with pext; only called when has_bmi2 is set
+ * [Parameters]: 1 uint64_t (index)
+ * [Return]:     The gathered bits
+ */
+static uint32_t even_bits_bmi2(uint64_t index)
+{
+        return _pext_u64(index, EVEN_BITS);
+}
+#endif
+
+/* [Name]:       hilbert_cell
+ * [Purpose]:    Finds the d-th cell along the Hilbert curve through a
+ *               square of side 1 << bits, which starts at the top left
+ *               corner and ends at the top right one
+ * [Parameters]: 1 uint64_t (d), 1 int (bits), 2 int* (x, y; set)
+ * [Return]:     void
+ */
+static void hilbert_cell(uint64_t d, int bits, int *x, int *y)
+{
+        *x = 0;
+        *y = 0;
+        for (int s = 1; s < 1 << bits; s *= 2) {
+                int rx = 1 & (d >> 1);
+                int ry = 1 & (d ^ rx);
+                if (ry == 0) {
+                        if (rx == 1) {
+                                *x = s - 1 - *x;
+                                *y = s - 1 - *y;
+                        }
+                        int swap = *x;
+                        *x = *y;
+                        *y = swap;
+                }
+                *x += s * rx;
+                *y += s * ry;
+                d >>= 2;
+        }
+}
@@ -0,0 +1,37 @@
+#ifndef UARRAY2M_INCLUDED
+#define UARRAY2M_INCLUDED
+
+#define T UArray2m_T
+typedef struct T *T;
+
+extern T     UArray2m_new   (int width, int height, int size);
+  /* new 2d array stored in Morton (Z) order: the array is covered by a
+     row-major grid of power-of-two squares, and the cells of each square
+     are stored with the bits of their column and row interleaved. The
+     squares are as large as possible while padding past the array's
+     edges stays within a quarter of its cells */
+extern void  UArray2m_free  (T *array2m);
+
+extern int   UArray2m_width (T array2m);
+extern int   UArray2m_height(T array2m);
+extern int   UArray2m_size  (T array2m);
+extern int   UArray2m_side  (T array2m);
+  /* side of the Morton squares */
+
+extern void *UArray2m_at(T array2m, int column, int row);
+  /* return a pointer to the cell in the given column and row.
+     index out of range is a checked run-time error */
+
+extern void  UArray2m_map_morton (T array2m,
+    void apply(int col, int row, T array2m, void *elem, void *cl), void *cl);
+  /* visits every cell in storage (Z) order, square by square */
+extern void  UArray2m_map_hilbert(T array2m,
+    void apply(int col, int row, T array2m, void *elem, void *cl), void *cl);
+  /* visits every cell along a Hilbert curve through each square, square
+     by square; consecutive cells are always neighbours within a square */
+
+/* it is a checked run-time error to pass a NULL T
+   to any function in this interface */
+
+#undef T
+#endif
@@ -0,0 +1,367 @@
+/*
+ *      uring.c
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - The submission and completion rings are mapped from the ring fd;
+ *        the head/tail indices shared with the kernel are read with acquire
+ *        and published with release ordering
+ *      - Requests are only queued by Uring_read/Uring_write; Uring_wait
+ *        submits everything queued and waits for a completion in the same
+ *        io_uring_enter call, so a batch of requests costs one system call
+ *      - Buffers are registered (READ_FIXED/WRITE_FIXED, no per-request
+ *        page pinning) when the memlock limit allows it, and used as plain
+ *        READ/WRITE buffers otherwise
+ *      - Not thread safe: one ring per thread
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "mem.h"
+#include "uring.h"
+
+#define T Uring_T
+
+/* Buffers are aligned for O_DIRECT-friendly transfers */
+#define BUFFER_ALIGN 4096
+
+/* One buffer and the request currently using it */
+typedef struct request {
+        unsigned char *buffer;
+        int            opcode;          /* IORING_OP_*, or -1 when idle */
+        int            fd;
+        long           length, done;    /* bytes requested / completed */
+        long           offset;
+} request;
+
+struct T {
+        int       ring_fd;
+        int       depth;
+        int       fixed;                /* buffers are registered */
+        int       queued;               /* SQEs not yet submitted */
+        int       in_flight;
+
+        void     *sq_ptr, *cq_ptr;
+        size_t    sq_size, cq_size;
+        struct io_uring_sqe *sqes;
+        size_t    sqes_size;
+        unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+        struct io_uring_cqe *cqes;
+
+        request  *requests;
+};
+
+/*---------------------------------------------------------------
+ |             Private Helpers, No Client Access                |
+ *--------------------------------------------------------------*/
+static int  map_rings (T ring, struct io_uring_params *params);
+static void queue_sqe (T ring, int slot);
+static void submit    (T ring, int opcode, int slot, int fd, long length,
+                       long offset);
+
+/*---------------------------------------------------------------
+ |             Constructors / Destructors                       |
+ *--------------------------------------------------------------*/
+/* [Name]:       Uring_new
+ * [Purpose]:    Sets up a ring with depth buffers of buffer_bytes each
+ * [Parameters]: 1 int (depth, at least 1), 1 long (buffer_bytes)
+ * [Return]:     The ring, or NULL if io_uring cannot be used here
+ */
+T Uring_new(int depth, long buffer_bytes)
+{
+        struct io_uring_params params;
+        T ring;
+
+        assert(depth > 0 && buffer_bytes > 0);
+
+        memset(&params, 0, sizeof(params));
+        int fd = syscall(__NR_io_uring_setup, depth, &params);
+        if (fd < 0) {
+                return NULL;
+        }
+
+        NEW(ring);
+        memset(ring, 0, sizeof(*ring));
+        ring->ring_fd = fd;
+        ring->depth   = depth;
+        if (map_rings(ring, &params) != 0) {
+                close(fd);
+                FREE(ring);
+                return NULL;
+        }
+
+        struct iovec iovecs[depth];
+        ring->requests = CALLOC(depth, sizeof(request));
+        for (int i = 0; i < depth; i++) {
+                if (posix_memalign((void **)&ring->requests[i].buffer,
+                                   BUFFER_ALIGN, buffer_bytes) != 0) {
+                        ring->depth = i;
+                        Uring_free(&ring);
+                        return NULL;
+                }
+                ring->requests[i].opcode = -1;
+                iovecs[i].iov_base = ring->requests[i].buffer;
+                iovecs[i].iov_len  = buffer_bytes;
+        }
+
+        /* registration pins the buffers; RLIMIT_MEMLOCK may refuse it */
+        ring->fixed = syscall(__NR_io_uring_register, fd,
+                              IORING_REGISTER_BUFFERS, iovecs, depth) == 0;
+        return ring;
+}
+
+/* [Name]:       Uring_free
+ * [Purpose]:    Waits for any request still in flight, then releases the
+ *               ring and its buffers
+ * [Parameters]: 1 T* (ring)
+ * [Return]:     void
+ */
+void Uring_free(T *ring)
+{
+        int slot;
+
+        assert(ring != NULL && *ring != NULL);
+
+        while (Uring_wait(*ring, &slot) != 0) {
+                /* the kernel may still write into the buffers */
+        }
+        for (int i = 0; i < (*ring)->depth; i++) {
+                free((*ring)->requests[i].buffer);
+        }
+        FREE((*ring)->requests);
+        munmap((*ring)->sqes, (*ring)->sqes_size);
+        if ((*ring)->cq_ptr != (*ring)->sq_ptr) {
+                munmap((*ring)->cq_ptr, (*ring)->cq_size);
+        }
+        munmap((*ring)->sq_ptr, (*ring)->sq_size);
+        close((*ring)->ring_fd);
+        FREE(*ring);
+}
+
+/*---------------------------------------------------------------
+ |                        Ring Functions                        |
+ *--------------------------------------------------------------*/
+/* [Name]:       Uring_depth
+ * [Purpose]:    Returns the number of buffers (and in-flight requests)
+ * [Parameters]: 1 T (ring)
+ * [Return]:     The ring's depth
+ */
+int Uring_depth(T ring)
+{
+        assert(ring != NULL);
+        return ring->depth;
+}
+
+/* [Name]:       Uring_buffer
+ * [Purpose]:    Returns the buffer of a slot; it must not be touched while
+ *               a request on the slot is in flight
+ * [Parameters]: 1 T (ring), 1 int (slot)
+ * [Return]:     The slot's buffer
+ */
+unsigned char *Uring_buffer(T ring, int slot)
+{
+        assert(ring != NULL && slot >= 0 && slot < ring->depth);
+        return ring->requests[slot].buffer;
+}
+
+/* [Name]:       Uring_read
+ * [Purpose]:    Queues a read of length bytes at offset into a slot's
+ *               buffer; it is submitted by the next Uring_wait
+ * [Parameters]: 1 T (ring), 2 ints (slot, idle; fd), 2 longs (length,
+ *               offset)
+ * [Return]:     void
+ */
+void Uring_read(T ring, int slot, int fd, long length, long offset)
+{
+        submit(ring, ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ,
+               slot, fd, length, offset);
+}
+
+/* [Name]:       Uring_write
+ * [Purpose]:    Queues a write of length bytes from a slot's buffer at
+ *               offset; it is submitted by the next Uring_wait
+ * [Parameters]: 1 T (ring), 2 ints (slot, idle; fd), 2 longs (length,
+ *               offset)
+ * [Return]:     void
+ */
+void Uring_write(T ring, int slot, int fd, long length, long offset)
+{
+        submit(ring, ring->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+               slot, fd, length, offset);
+}
+
+/* [Name]:       Uring_wait
+ * [Purpose]:    Submits the queued requests and waits until one request
+ *               has completed in full (short transfers are continued
+ *               transparently)
+ * [Parameters]: 1 T (ring), 1 int* (slot; set to the completed slot)
+ * [Return]:     1 on a completed request, -1 on a failed one (its slot is
+ *               idle again either way), 0 if nothing was in flight
+ */
+int Uring_wait(T ring, int *slot)
+{
+        assert(ring != NULL && slot != NULL);
+
+        while (ring->in_flight > 0) {
+                unsigned head = *ring->cq_head;
+                if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+                        int n = syscall(__NR_io_uring_enter, ring->ring_fd,
+                                        ring->queued, 1,
+                                        IORING_ENTER_GETEVENTS, NULL, 0);
+                        if (n < 0 && errno != EINTR && errno != EAGAIN &&
+                            errno != EBUSY) {
+                                /* the ring itself is broken; requests the
+                                 * kernel never took are lost */
+                                ring->in_flight = 0;
+                                return -1;
+                        }
+                        if (n > 0) {
+                                ring->queued -= n < ring->queued
+                                                ? n : ring->queued;
+                        }
+                        continue;
+                }
+
+                struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+                int      id  = cqe->user_data;
+                int      res = cqe->res;
+                request *r   = &ring->requests[id];
+                __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+                ring->in_flight--;
+
+                if (res == -EINTR || res == -EAGAIN ||
+                    (res > 0 && r->done + res < r->length)) {
+                        r->done += res > 0 ? res : 0;
+                        queue_sqe(ring, id);
+                        continue;
+                }
+                r->opcode = -1;
+                *slot     = id;
+                return res > 0 ? 1 : -1;
+        }
+        return 0;
+}
+
+/*---------------------------------------------------------------
+ |                        Ring Helpers                          |
+ *--------------------------------------------------------------*/
+/* [Name]:       map_rings
+ * [Purpose]:    Maps the submission queue, completion queue and SQE array
+ *               of a fresh ring and records the shared index pointers
+ * [Parameters]: 1 T (ring), 1 struct io_uring_params* (params)
+ * [Return]:     0 on success, -1 if a mapping failed
+ */
+static int map_rings(T ring, struct io_uring_params *params)
+{
+        int fd = ring->ring_fd;
+
+        ring->sq_size = params->sq_off.array +
+                        params->sq_entries * sizeof(unsigned);
+        ring->cq_size = params->cq_off.cqes +
+                        params->cq_entries * sizeof(struct io_uring_cqe);
+        if (params->features & IORING_FEAT_SINGLE_MMAP) {
+                ring->sq_size = ring->sq_size > ring->cq_size
+                                ? ring->sq_size : ring->cq_size;
+                ring->cq_size = ring->sq_size;
+        }
+
+        ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd,
+                            IORING_OFF_SQ_RING);
+        if (ring->sq_ptr == MAP_FAILED) {
+                return -1;
+        }
+        if (params->features & IORING_FEAT_SINGLE_MMAP) {
+                ring->cq_ptr = ring->sq_ptr;
+        } else {
+                ring->cq_ptr = mmap(NULL, ring->cq_size,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, fd,
+                                    IORING_OFF_CQ_RING);
+                if (ring->cq_ptr == MAP_FAILED) {
+                        munmap(ring->sq_ptr, ring->sq_size);
+                        return -1;
+                }
+        }
+        ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+        ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (ring->sqes == MAP_FAILED) {
+                if (ring->cq_ptr != ring->sq_ptr) {
+                        munmap(ring->cq_ptr, ring->cq_size);
+                }
+                munmap(ring->sq_ptr, ring->sq_size);
+                return -1;
+        }
+
+        char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+        ring->sq_head  = (unsigned *)(sq + params->sq_off.head);
+        ring->sq_tail  = (unsigned *)(sq + params->sq_off.tail);
+        ring->sq_mask  = (unsigned *)(sq + params->sq_off.ring_mask);
+        ring->sq_array = (unsigned *)(sq + params->sq_off.array);
+        ring->cq_head  = (unsigned *)(cq + params->cq_off.head);
+        ring->cq_tail  = (unsigned *)(cq + params->cq_off.tail);
+        ring->cq_mask  = (unsigned *)(cq + params->cq_off.ring_mask);
+        ring->cqes     = (struct io_uring_cqe *)(cq + params->cq_off.cqes);
+        return 0;
+}
+
+/* [Name]:       submit
+ * [Purpose]:    Records a request on an idle slot and queues its SQE
+ * [Parameters]: 1 T (ring), 3 ints (opcode, slot, fd), 2 longs (length,
+ *               offset)
+ * [Return]:     void
+ */
+static void submit(T ring, int opcode, int slot, int fd, long length,
+                   long offset)
+{
+        assert(ring != NULL && slot >= 0 && slot < ring->depth);
+        assert(ring->requests[slot].opcode == -1 && length > 0);
+
+        request *r = &ring->requests[slot];
+        r->opcode = opcode;
+        r->fd     = fd;
+        r->length = length;
+        r->done   = 0;
+        r->offset = offset;
+        queue_sqe(ring, slot);
+}
+
+/* [Name]:       queue_sqe
+ * [Purpose]:    Fills the next SQE with the remaining part of a slot's
+ *               request and publishes it to the kernel (at most depth
+ *               requests exist, so the queue never overflows)
+ * [Parameters]: 1 T (ring), 1 int (slot)
+ * [Return]:     void
+ */
+static void queue_sqe(T ring, int slot)
+{
+        request *r    = &ring->requests[slot];
+        unsigned tail = *ring->sq_tail;
+        unsigned idx  = tail & *ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode    = r->opcode;
+        sqe->fd        = r->fd;
+        sqe->addr      = (unsigned long)(r->buffer + r->done);
+        sqe->len       = r->length - r->done;
+        sqe->off       = r->offset + r->done;
+        sqe->buf_index = slot;
+        sqe->user_data = slot;
+
+        ring->sq_array[idx] = idx;
+        __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ring->queued++;
+        ring->in_flight++;
+}
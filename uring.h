@@ -0,0 +1,32 @@
+/*
+ *      uring.h
+ *      by Jia Wen Goh (jgoh01) & Sean Ong (song02), 10/6/2017
+ *
+ *      - Minimal io_uring queue for positional file I/O, driven with the
+ *        raw system calls (no liburing needed)
+ *      - A ring owns 'depth' page-aligned buffers, registered with the
+ *        kernel when allowed, and keeps up to 'depth' reads/writes in
+ *        flight, one per buffer; short transfers are resubmitted
+ *        internally, so a completion always covers the whole request
+ *      - Uring_new returns NULL when io_uring is unavailable (old kernel,
+ *        seccomp filter, ...), and callers fall back to pread/pwrite
+ */
+
+#ifndef URING_INCLUDED
+#define URING_INCLUDED
+
+#define T Uring_T
+typedef struct T *T;
+
+extern T              Uring_new   (int depth, long buffer_bytes);
+extern void           Uring_free  (T *ring);
+extern int            Uring_depth (T ring);
+extern unsigned char *Uring_buffer(T ring, int slot);
+extern void           Uring_read  (T ring, int slot, int fd, long length,
+                                   long offset);
+extern void           Uring_write (T ring, int slot, int fd, long length,
+                                   long offset);
+extern int            Uring_wait  (T ring, int *slot);
+
+#undef T
+#endif